@@ -747,14 +747,14 @@ common_params_context common_params_parser_init(common_params & params, llama_ex
         [](common_params & params, const std::string & value) {
             params.lookup_cache_static = value;
         }
-    ).set_examples({LLAMA_EXAMPLE_LOOKUP}));
+    ).set_examples({LLAMA_EXAMPLE_LOOKUP, LLAMA_EXAMPLE_SERVER}));
     add_opt(common_arg(
         {"-lcd", "--lookup-cache-dynamic"}, "FNAME",
         "path to dynamic lookup cache to use for lookup decoding (updated by generation)",
         [](common_params & params, const std::string & value) {
             params.lookup_cache_dynamic = value;
         }
-    ).set_examples({LLAMA_EXAMPLE_LOOKUP}));
+    ).set_examples({LLAMA_EXAMPLE_LOOKUP, LLAMA_EXAMPLE_SERVER}));
     add_opt(common_arg(
         {"-c", "--ctx-size"}, "N",
         string_format("size of the prompt context (default: %d, 0 = loaded from model)", params.n_ctx),
@@ -1869,6 +1869,23 @@ common_params_context common_params_parser_init(common_params & params, llama_ex
             params.chunk_separator = value;
         }
     ).set_examples({LLAMA_EXAMPLE_RETRIEVAL}));
+    add_opt(common_arg(
+        {"--index-file"}, "FNAME",
+        "file to save the index of the embedded chunks to, it is loaded instead if it matches the model and the chunks",
+        [](common_params & params, const std::string & value) {
+            params.index_file = value;
+        }
+    ).set_examples({LLAMA_EXAMPLE_RETRIEVAL}));
+    add_opt(common_arg(
+        {"--index-type"}, "{auto,flat,hnsw}",
+        string_format("index of the embedded chunks: exact search (flat) or approximate search for large corpora (hnsw) (default: %s)", params.index_type.c_str()),
+        [](common_params & params, const std::string & value) {
+            if (value != "auto" && value != "flat" && value != "hnsw") {
+                throw std::invalid_argument("invalid value");
+            }
+            params.index_type = value;
+        }
+    ).set_examples({LLAMA_EXAMPLE_RETRIEVAL}));
     add_opt(common_arg(
         {"--junk"}, "N",
         string_format("number of times to repeat the junk text (default: %d)", params.n_junk),
@@ -1962,7 +1979,7 @@ common_params_context common_params_parser_init(common_params & params, llama_ex
         [](common_params & params, int value) {
             params.embd_normalize = value;
         }
-    ).set_examples({LLAMA_EXAMPLE_EMBEDDING}));
+    ).set_examples({LLAMA_EXAMPLE_EMBEDDING, LLAMA_EXAMPLE_RETRIEVAL, LLAMA_EXAMPLE_SERVER}));
     add_opt(common_arg(
         {"--embd-output-format"}, "FORMAT",
         "empty = default, \"array\" = [[],[]...], \"json\" = openai style, \"json+\" = same \"json\" + cosine similarity matrix",
@@ -2107,6 +2124,13 @@ common_params_context common_params_parser_init(common_params & params, llama_ex
             params.endpoint_slots = false;
         }
     ).set_examples({LLAMA_EXAMPLE_SERVER}).set_env("LLAMA_ARG_NO_ENDPOINT_SLOTS"));
+    add_opt(common_arg(
+        {"--no-tokenize-cache"},
+        string_format("disable the cache of the tokenization of prompt segments (default: %s)", params.tokenize_cache ? "enabled" : "disabled"),
+        [](common_params & params) {
+            params.tokenize_cache = false;
+        }
+    ).set_examples({LLAMA_EXAMPLE_SERVER}).set_env("LLAMA_ARG_NO_TOKENIZE_CACHE"));
     add_opt(common_arg(
         {"--slot-save-path"}, "PATH",
         "path to save slot kv cache (default: disabled)",
@@ -2409,6 +2433,67 @@ common_params_context common_params_parser_init(common_params & params, llama_ex
             params.speculative.n_min = value;
         }
     ).set_examples({LLAMA_EXAMPLE_SPECULATIVE, LLAMA_EXAMPLE_LOOKUP, LLAMA_EXAMPLE_SERVER}).set_env("LLAMA_ARG_DRAFT_MIN"));
+    add_opt(common_arg(
+        {"--draft-lookup"},
+        string_format("without a draft model, draft from the n-grams of the prompt and the generated text (default: %s)", params.speculative.lookup ? "enabled" : "disabled"),
+        [](common_params & params) {
+            params.speculative.lookup = true;
+        }
+    ).set_examples({LLAMA_EXAMPLE_SERVER}).set_env("LLAMA_ARG_DRAFT_LOOKUP"));
+    add_opt(common_arg(
+        {"--draft-lookahead"},
+        string_format("without a draft model, use lookahead (Jacobi) decoding (default: %s)", params.speculative.lookahead ? "enabled" : "disabled"),
+        [](common_params & params) {
+            params.speculative.lookahead = true;
+        }
+    ).set_examples({LLAMA_EXAMPLE_SERVER}).set_env("LLAMA_ARG_DRAFT_LOOKAHEAD"));
+    add_opt(common_arg(
+        {"--lookahead-window"}, "W",
+        string_format("lookahead decoding: number of tokens that are guessed in parallel (default: %d)", params.speculative.lookahead_w),
+        [](common_params & params, int value) {
+            if (value < 1) {
+                throw std::invalid_argument("invalid value");
+            }
+            params.speculative.lookahead_w = value;
+        }
+    ).set_examples({LLAMA_EXAMPLE_LOOKAHEAD, LLAMA_EXAMPLE_SERVER}).set_env("LLAMA_ARG_LOOKAHEAD_WINDOW"));
+    add_opt(common_arg(
+        {"--lookahead-ngram"}, "N",
+        string_format("lookahead decoding: size of the n-grams collected from the guesses, >= 3 (default: %d)", params.speculative.lookahead_n),
+        [](common_params & params, int value) {
+            if (value < 3) {
+                throw std::invalid_argument("invalid value");
+            }
+            params.speculative.lookahead_n = value;
+        }
+    ).set_examples({LLAMA_EXAMPLE_LOOKAHEAD, LLAMA_EXAMPLE_SERVER}).set_env("LLAMA_ARG_LOOKAHEAD_NGRAM"));
+    add_opt(common_arg(
+        {"--lookahead-verify"}, "G",
+        string_format("lookahead decoding: max number of n-grams verified with each token (default: %d)", params.speculative.lookahead_g),
+        [](common_params & params, int value) {
+            if (value < 1) {
+                throw std::invalid_argument("invalid value");
+            }
+            params.speculative.lookahead_g = value;
+        }
+    ).set_examples({LLAMA_EXAMPLE_LOOKAHEAD, LLAMA_EXAMPLE_SERVER}).set_env("LLAMA_ARG_LOOKAHEAD_VERIFY"));
+    add_opt(common_arg(
+        {"--draft-adaptive"},
+        string_format("adapt the draft length to the measured acceptance rate and costs, and skip speculation when it does not pay off (default: %s)", params.speculative.adaptive ? "enabled" : "disabled"),
+        [](common_params & params) {
+            params.speculative.adaptive = true;
+        }
+    ).set_examples({LLAMA_EXAMPLE_SERVER}).set_env("LLAMA_ARG_DRAFT_ADAPTIVE"));
+    add_opt(common_arg(
+        {"--draft-branch"}, "N",
+        string_format("maximum number of candidates drafted after each token, > 1 drafts a tree of tokens (default: %d)", params.speculative.n_branch),
+        [](common_params & params, int value) {
+            if (value < 1) {
+                throw std::invalid_argument("invalid value");
+            }
+            params.speculative.n_branch = value;
+        }
+    ).set_examples({LLAMA_EXAMPLE_SPECULATIVE}).set_env("LLAMA_ARG_DRAFT_BRANCH"));
     add_opt(common_arg(
         {"--draft-p-split"}, "P",
         string_format("speculative decoding split probability (default: %.1f)", (double)params.speculative.p_split),
@@ -2416,6 +2501,37 @@ common_params_context common_params_parser_init(common_params & params, llama_ex
             params.speculative.p_split = std::stof(value);
         }
     ).set_examples({LLAMA_EXAMPLE_SPECULATIVE}).set_env("LLAMA_ARG_DRAFT_P_SPLIT"));
+    add_opt(common_arg(
+        {"--draft-layers"}, "N",
+        string_format("self-speculative decoding without a draft model: draft with the first N layers of the model (default: %d, 0 = disabled)", params.speculative.n_layer),
+        [](common_params & params, int value) {
+            if (value < 0) {
+                throw std::invalid_argument("invalid value");
+            }
+            params.speculative.n_layer = value;
+        }
+    ).set_examples({LLAMA_EXAMPLE_SPECULATIVE, LLAMA_EXAMPLE_SERVER}).set_env("LLAMA_ARG_DRAFT_LAYERS"));
+    add_opt(common_arg(
+        {"--draft-skip-layers"}, "i,j-k,...",
+        "self-speculative decoding without a draft model: draft with the model, skipping the listed layers and ranges of layers",
+        [](common_params & params, const std::string & value) {
+            params.speculative.layer_skip.clear();
+            for (const auto & item : string_split<std::string>(value, ',')) {
+                const auto range = string_split<std::string>(item, '-');
+                if (range.size() < 1 || range.size() > 2) {
+                    throw std::invalid_argument("invalid layer range: " + item);
+                }
+                const int32_t il0 = std::stoi(range.front());
+                const int32_t il1 = std::stoi(range.back());
+                if (il0 < 0 || il1 < il0) {
+                    throw std::invalid_argument("invalid layer range: " + item);
+                }
+                for (int32_t il = il0; il <= il1; ++il) {
+                    params.speculative.layer_skip.push_back(il);
+                }
+            }
+        }
+    ).set_examples({LLAMA_EXAMPLE_SPECULATIVE, LLAMA_EXAMPLE_SERVER}).set_env("LLAMA_ARG_DRAFT_SKIP_LAYERS"));
     add_opt(common_arg(
         {"--draft-p-min"}, "P",
         string_format("minimum speculative decoding probability (greedy) (default: %.1f)", (double)params.speculative.p_min),
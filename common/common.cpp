@@ -948,6 +948,9 @@ struct common_init_result common_init_from_params(common_params & params) {
 
     auto cparams = common_context_params_to_llama(params);
 
+    // long prompts are tokenized with the batch threads - the model is owned by this context, so this does not affect others
+    llama_model_set_n_threads_tokenize(model, cparams.n_threads_batch);
+
     llama_context * lctx = llama_init_from_model(model, cparams);
     if (lctx == NULL) {
         LOG_ERR("%s: failed to create context with model '%s'\n", __func__, params.model.c_str());
@@ -1136,6 +1139,7 @@ struct llama_context_params common_context_params_to_llama(const common_params &
     cparams.offload_kqv       = !params.no_kv_offload;
     cparams.flash_attn        = params.flash_attn;
     cparams.no_perf           = params.no_perf;
+    cparams.embd_norm         = params.embd_normalize == 2;
 
     if (params.reranking) {
         cparams.embeddings    = true;
@@ -1888,6 +1892,31 @@ void common_embd_normalize(const float * inp, float * out, int n, int embd_norm)
     }
 }
 
+void common_embd_quantize_i8(const float * inp, int8_t * out, int n) {
+    float amax = 0.0f;
+    for (int i = 0; i < n; i++) {
+        amax = std::max(amax, std::abs(inp[i]));
+    }
+
+    const float scale = amax > 0.0f ? 127.0f/amax : 0.0f;
+
+    for (int i = 0; i < n; i++) {
+        out[i] = (int8_t) std::lround(inp[i]*scale);
+    }
+}
+
+void common_embd_quantize_bin(const float * inp, uint8_t * out, int n) {
+    for (int i = 0; i < (n + 7)/8; i++) {
+        out[i] = 0;
+    }
+
+    for (int i = 0; i < n; i++) {
+        if (inp[i] > 0.0f) {
+            out[i/8] |= 0x80 >> (i%8);
+        }
+    }
+}
+
 float common_embd_similarity_cos(const float * embd1, const float * embd2, int n){
     double sum  = 0.0;
     double sum1 = 0.0;
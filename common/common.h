@@ -78,6 +78,7 @@ enum llama_example {
     LLAMA_EXAMPLE_EXPORT_LORA,
     LLAMA_EXAMPLE_LLAVA,
     LLAMA_EXAMPLE_LOOKUP,
+    LLAMA_EXAMPLE_LOOKAHEAD,
     LLAMA_EXAMPLE_PARALLEL,
     LLAMA_EXAMPLE_TTS,
 
@@ -190,10 +191,22 @@ struct common_params_speculative {
     int32_t n_ctx        =     0; // draft context size
     int32_t n_max        =    16; // maximum number of tokens to draft during speculative decoding
     int32_t n_min        =     0; // minimum number of draft tokens to use for speculative decoding
+    int32_t n_branch     =     1; // maximum number of candidates drafted after each token (> 1 - tree speculation)
     int32_t n_gpu_layers =    -1; // number of layers to store in VRAM for the draft model (-1 - use default)
     float   p_split      =  0.1f; // speculative decoding split probability
     float   p_min        = 0.75f; // minimum speculative decoding probability (greedy)
 
+    bool lookup = false; // draft from the n-grams of the prompt and the generated text when there is no draft model
+    bool adaptive = false; // pick the draft length from the measured acceptance rate and costs, up to n_max
+
+    bool    lookahead   = false; // lookahead (Jacobi) decoding when there is no draft model
+    int32_t lookahead_w = 15;    // lookahead decoding: size of the window of guesses
+    int32_t lookahead_n = 5;     // lookahead decoding: size of the n-grams
+    int32_t lookahead_g = 15;    // lookahead decoding: max number of verified n-grams
+
+    int32_t              n_layer = 0; // self-speculation: draft with the first n_layer layers of the target model (0 = disabled)
+    std::vector<int32_t> layer_skip;  // self-speculation: layers of the target model to skip when drafting
+
     struct cpu_params cpuparams;
     struct cpu_params cpuparams_batch;
 
@@ -382,6 +395,8 @@ struct common_params {
     bool endpoint_props   = false; // only control POST requests, not GET
     bool endpoint_metrics = false;
 
+    bool tokenize_cache = true; // cache the tokenization of prompt segments
+
     bool log_json = false;
 
     std::string slot_save_path;
@@ -402,6 +417,9 @@ struct common_params {
 
     std::string chunk_separator = "\n"; // chunk separator for context embedding
 
+    std::string index_file = "";     // file to save/load the index of the chunk embeddings
+    std::string index_type = "auto"; // type of the index of the chunk embeddings (auto, flat, hnsw)
+
     // passkey params
     int32_t n_junk = 250; // number of times to repeat the junk text
     int32_t i_pos  = -1;  // position of the passkey in the junk text
@@ -651,6 +669,12 @@ void common_embd_normalize(const float * inp, float * out, int n, int embd_norm)
 
 float common_embd_similarity_cos(const float * embd1, const float * embd2, int n);
 
+// quantize an embedding for storage and transfer, the cosine similarity is approximately preserved
+//   int8:   scaled by the max absolute value to [-127, 127]
+//   binary: the sign bits, 8 per byte, the first dimension in the most significant bit (n/8 bytes, rounded up)
+void common_embd_quantize_i8 (const float * inp, int8_t  * out, int n);
+void common_embd_quantize_bin(const float * inp, uint8_t * out, int n);
+
 //
 // Control vector utils
 //
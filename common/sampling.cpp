@@ -420,6 +420,40 @@ std::vector<llama_token> common_sampler_sample_and_accept_n(struct common_sample
     return common_sampler_sample_and_accept_n(gsmpl, ctx, idxs, draft, grammar_first);
 }
 
+std::vector<llama_token> common_sampler_sample_and_accept_tree(struct common_sampler * gsmpl, struct llama_context * ctx, const std::vector<int> & parents, const llama_tokens & draft, std::vector<int> & path, bool grammar_first) {
+    GGML_ASSERT(parents.size() == draft.size() && "parents.size() must be draft.size()");
+
+    std::vector<llama_token> result;
+
+    path.clear();
+
+    int cur = -1;
+    while (true) {
+        const llama_token id = common_sampler_sample(gsmpl, ctx, cur + 1, grammar_first);
+
+        common_sampler_accept(gsmpl, id, true);
+
+        result.push_back(id);
+
+        int next = -1;
+        for (size_t i = cur + 1; i < draft.size(); ++i) {
+            if (parents[i] == cur && draft[i] == id) {
+                next = i;
+                break;
+            }
+        }
+
+        if (next == -1) {
+            break;
+        }
+
+        path.push_back(next);
+        cur = next;
+    }
+
+    return result;
+}
+
 uint32_t common_sampler_get_seed(const struct common_sampler * gsmpl) {
     return llama_sampler_get_seed(gsmpl->chain);
 }
@@ -81,6 +81,16 @@ std::vector<llama_token> common_sampler_sample_and_accept_n(struct common_sample
 // assume idxs == [ 0, 1, 2, ..., draft.size() ]
 std::vector<llama_token> common_sampler_sample_and_accept_n(struct common_sampler * gsmpl, struct llama_context * ctx, const llama_tokens & draft, bool grammar_first = false);
 
+// same as common_sampler_sample_and_accept_n, but the draft is a tree of tokens given by their parents (-1 for the roots)
+// the logits of the last accepted token are at index 0 and the logits of the draft node i are at index i + 1
+// at each step, the sampled token is accepted if it is one of the children of the current node
+//
+// path receives the accepted draft nodes
+//
+// returns at least 1 token, up to the depth of the tree + 1
+//
+std::vector<llama_token> common_sampler_sample_and_accept_tree(struct common_sampler * gsmpl, struct llama_context * ctx, const std::vector<int> & parents, const llama_tokens & draft, std::vector<int> & path, bool grammar_first = false);
+
 uint32_t common_sampler_get_seed(const struct common_sampler * gsmpl);
 
 // helpers
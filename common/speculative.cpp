@@ -6,6 +6,7 @@
 
 #include <cstring>
 #include <algorithm>
+#include <memory>
 
 #define SPEC_VOCAB_MAX_SIZE_DIFFERENCE  128
 #define SPEC_VOCAB_CHECK_START_TOKEN_ID 5
@@ -15,16 +16,32 @@ struct common_speculative {
     struct common_sampler * smpl;
 
     llama_batch batch;
-    llama_tokens prompt;
+    llama_tokens prompt; // the tokens of seq_id in the draft context
+
+    llama_seq_id seq_id;
+    int32_t      n_ctx;
+
+    // self-speculation: the layers of the target model that are skipped when drafting
+    std::vector<bool> layer_skip;
 };
 
 struct common_speculative * common_speculative_init(
         struct llama_context * ctx_dft) {
+    return common_speculative_init_seq(ctx_dft, 0, llama_n_ctx(ctx_dft));
+}
+
+struct common_speculative * common_speculative_init_seq(
+        struct llama_context * ctx_dft,
+        llama_seq_id seq_id,
+        int32_t n_ctx) {
     auto * result = new common_speculative {
-        /* .ctx    = */ ctx_dft,
-        /* .smpl   = */ nullptr,
-        /* .batch  = */ llama_batch_init(llama_n_batch(ctx_dft), 0, 1),
-        /* .prompt = */ {},
+        /* .ctx        = */ ctx_dft,
+        /* .smpl       = */ nullptr,
+        /* .batch      = */ llama_batch_init(llama_n_batch(ctx_dft), 0, 1),
+        /* .prompt     = */ {},
+        /* .seq_id     = */ seq_id,
+        /* .n_ctx      = */ n_ctx,
+        /* .layer_skip = */ {},
     };
 
     // TODO: optimize or pass from outside?
@@ -62,6 +79,49 @@ struct common_speculative * common_speculative_init(
     return result;
 }
 
+struct common_speculative * common_speculative_init_self(
+        struct llama_context * ctx_tgt,
+        llama_seq_id seq_id,
+        const std::vector<bool> & layer_skip) {
+    if (layer_skip.size() != (size_t) llama_model_n_layer(llama_get_model(ctx_tgt)) ||
+        std::find(layer_skip.begin(), layer_skip.end(), false) == layer_skip.end()) {
+        LOG_ERR("%s: invalid set of layers to skip\n", __func__);
+        return nullptr;
+    }
+
+    if (!llama_model_can_skip_layers(llama_get_model(ctx_tgt))) {
+        LOG_ERR("%s: the model does not support skipping layers\n", __func__);
+        return nullptr;
+    }
+
+    auto * result = common_speculative_init_seq(ctx_tgt, seq_id, llama_n_ctx(ctx_tgt));
+
+    result->layer_skip = layer_skip;
+
+    return result;
+}
+
+std::vector<bool> common_speculative_layer_skip(
+        const struct llama_model * model,
+        int32_t n_layer_draft,
+        const std::vector<int32_t> & skip) {
+    const int32_t n_layer = llama_model_n_layer(model);
+
+    std::vector<bool> result(n_layer, false);
+
+    for (int32_t il = std::max(0, n_layer_draft); n_layer_draft > 0 && il < n_layer; ++il) {
+        result[il] = true;
+    }
+
+    for (const int32_t il : skip) {
+        if (il >= 0 && il < n_layer) {
+            result[il] = true;
+        }
+    }
+
+    return result;
+}
+
 void common_speculative_free(struct common_speculative * spec) {
     if (spec == nullptr) {
         return;
@@ -134,20 +194,30 @@ bool common_speculative_are_compatible(
     return true;
 }
 
-llama_tokens common_speculative_gen_draft(
+// only very high-confidence draft tokens are evaluated to draft the tokens after them
+// a token with p < p_min is still the last token of its draft (or branch)
+static bool common_speculative_can_expand(const struct common_speculative_params & params, float p) {
+    return p >= params.p_min;
+}
+
+// add the new tokens of the prompt and id_last to the batch, id_last is the last token of the batch and has logits
+// returns false if the draft of a previous call continues id_last - in that case it is returned in result instead
+static bool common_speculative_add_prompt(
         struct common_speculative * spec,
         struct common_speculative_params params,
         const llama_tokens & prompt_tgt,
-        llama_token id_last) {
-    auto & batch  = spec->batch;
+        llama_token id_last,
+        llama_batch & batch,
+        llama_tokens & result) {
     auto & ctx    = spec->ctx;
-    auto & smpl   = spec->smpl;
     auto & prompt = spec->prompt;
 
+    const llama_seq_id seq_id = spec->seq_id;
+
     int reuse_i = 0;
     int reuse_n = 0;
 
-    const int n_ctx = llama_n_ctx(ctx) - params.n_draft;
+    const int n_ctx = spec->n_ctx - params.n_draft;
 
     const int i_start = std::max<int>(0, (int) prompt_tgt.size() - n_ctx);
 
@@ -169,11 +239,8 @@ llama_tokens common_speculative_gen_draft(
 
     LOG_DBG("%s: reuse_i = %d, reuse_n = %d, prompt = %d\n", __func__, reuse_i, reuse_n, (int) prompt.size());
 
-    llama_tokens result;
-    result.reserve(params.n_draft);
-
     if (reuse_n == 0) {
-        llama_kv_self_clear(ctx);
+        llama_kv_self_seq_rm(ctx, seq_id, -1, -1);
 
         prompt.clear();
     } else {
@@ -188,91 +255,708 @@ llama_tokens common_speculative_gen_draft(
                 }
             }
 
-            return result;
+            return false;
         }
 
         if (reuse_i > 0) {
-            llama_kv_self_seq_rm (ctx, 0, 0, reuse_i);
-            llama_kv_self_seq_add(ctx, 0, reuse_i, -1, -reuse_i);
+            llama_kv_self_seq_rm (ctx, seq_id, 0, reuse_i);
+            llama_kv_self_seq_add(ctx, seq_id, reuse_i, -1, -reuse_i);
 
             prompt.erase(prompt.begin(), prompt.begin() + reuse_i);
         }
 
         if (reuse_n < (int) prompt.size()) {
-            llama_kv_self_seq_rm (ctx, 0, reuse_n, -1);
+            llama_kv_self_seq_rm (ctx, seq_id, reuse_n, -1);
 
             prompt.erase(prompt.begin() + reuse_n, prompt.end());
         }
     }
 
-    // prepare a batch to evaluate any new tokens in the prompt
-    common_batch_clear(batch);
-
+    // evaluate any new tokens in the prompt - we should rarely have many of them during normal decoding
     for (size_t i = i_start + reuse_n; i < prompt_tgt.size(); ++i) {
         //LOG_DBG("i = %d, i_start = %d, reuse_n = %d, i - i_start = %d, id = %6d\n", i, i_start, reuse_n, i - i_start, prompt_tgt[i]);
-        common_batch_add(batch, prompt_tgt[i], i - i_start, { 0 }, false);
+        common_batch_add(batch, prompt_tgt[i], i - i_start, { seq_id }, false);
 
         prompt.push_back(prompt_tgt[i]);
     }
 
-    // we should rarely end-up here during normal decoding
-    if (batch.n_tokens > 0) {
-        //LOG_DBG("%s: draft prompt batch: %s\n", __func__, string_from(ctx, batch).c_str());
+    const llama_pos n_past = prompt.size();
 
-        llama_decode(ctx, batch);
+    LOG_DBG("%s: seq_id = %d, n_past = %d\n", __func__, seq_id, n_past);
+
+    common_batch_add(batch, id_last, n_past, { seq_id }, true);
+
+    prompt.push_back(id_last);
+
+    //LOG_DBG("%s: draft prompt: %s\n", __func__, string_from(ctx, prompt).c_str());
+
+    return true;
+}
+
+// evaluate the new tokens of the prompt and id_last with the draft model, the logits of id_last are at index batch.n_tokens - 1
+static bool common_speculative_eval_prompt(
+        struct common_speculative * spec,
+        struct common_speculative_params params,
+        const llama_tokens & prompt_tgt,
+        llama_token id_last,
+        llama_tokens & result) {
+    common_batch_clear(spec->batch);
+
+    if (!common_speculative_add_prompt(spec, params, prompt_tgt, id_last, spec->batch, result)) {
+        return false;
     }
 
-    const llama_pos n_past = prompt.size();
+    llama_decode(spec->ctx, spec->batch);
 
-    LOG_DBG("%s: n_past = %d\n", __func__, n_past);
+    return true;
+}
+
+llama_tokens common_speculative_gen_draft(
+        struct common_speculative * spec,
+        struct common_speculative_params params,
+        const llama_tokens & prompt_tgt,
+        llama_token id_last) {
+    return common_speculative_gen_drafts({ spec }, { params }, { &prompt_tgt }, { id_last })[0];
+}
+
+std::vector<llama_tokens> common_speculative_gen_drafts(
+        const std::vector<struct common_speculative *>      & specs,
+        const std::vector<struct common_speculative_params> & params,
+        const std::vector<const llama_tokens *>             & prompts_tgt,
+        const llama_tokens                                  & ids_last) {
+    const int n_spec = specs.size();
+
+    std::vector<llama_tokens> result(n_spec);
+
+    if (n_spec == 0) {
+        return result;
+    }
+
+    GGML_ASSERT((int) params.size() == n_spec && (int) prompts_tgt.size() == n_spec && (int) ids_last.size() == n_spec);
+
+    auto & batch = specs[0]->batch;
+    auto & ctx   = specs[0]->ctx;
+
+    // index of the logits of each speculator in the batch, -1 when its draft is complete
+    std::vector<int>       i_batch(n_spec, -1);
+    std::vector<llama_pos> n_past (n_spec, 0);
+
+    // self-speculation: the prompts are already in the KV cache of the target context
+    const bool self = !specs[0]->layer_skip.empty();
 
     common_batch_clear(batch);
-    common_batch_add  (batch, id_last, n_past, { 0 }, true);
 
-    prompt.push_back(id_last);
+    for (int s = 0; s < n_spec; ++s) {
+        GGML_ASSERT(specs[s]->ctx == ctx);
+        GGML_ASSERT(specs[s]->layer_skip == specs[0]->layer_skip);
 
-    //LOG_DBG("%s: draft prompt: %s\n", __func__, string_from(ctx, prompt).c_str());
+        result[s].reserve(params[s].n_draft);
 
-    llama_decode(ctx, batch);
+        if (self) {
+            n_past[s] = prompts_tgt[s]->size();
 
-    common_sampler_reset(smpl);
+            common_batch_add(batch, ids_last[s], n_past[s], { specs[s]->seq_id }, true);
+        } else {
+            if (!common_speculative_add_prompt(specs[s], params[s], *prompts_tgt[s], ids_last[s], batch, result[s])) {
+                continue;
+            }
+
+            n_past[s] = specs[s]->prompt.size() - 1;
+        }
+
+        i_batch[s] = batch.n_tokens - 1;
+
+        common_sampler_reset(specs[s]->smpl);
+    }
+
+    if (self) {
+        const auto & skip = specs[0]->layer_skip;
+
+        // note: std::vector<bool> has no data()
+        std::unique_ptr<bool[]> skip_arr(new bool[skip.size()]);
+        std::copy(skip.begin(), skip.end(), skip_arr.get());
+
+        llama_set_layer_skip(ctx, skip_arr.get(), skip.size());
+    }
+
+    // sample the drafts from the draft model, one token of each draft per decode
+    for (int i = 0; batch.n_tokens > 0; ++i) {
+        llama_decode(ctx, batch);
 
-    // sample n_draft tokens from the draft model
-    for (int i = 0; i < params.n_draft; ++i) {
         common_batch_clear(batch);
 
-        common_sampler_sample(smpl, ctx, 0, true);
+        for (int s = 0; s < n_spec; ++s) {
+            if (i_batch[s] < 0) {
+                continue;
+            }
+
+            auto & spec = specs[s];
+
+            common_sampler_sample(spec->smpl, ctx, i_batch[s], true);
+
+            i_batch[s] = -1;
+
+            const auto * cur_p = common_sampler_get_candidates(spec->smpl);
+
+            for (int k = 0; k < std::min(3, (int) cur_p->size); ++k) {
+                LOG_DBG(" - draft candidate %3d, seq %3d, pos %3d: %6d (%8.3f) '%s'\n",
+                        k, spec->seq_id, i, cur_p->data[k].id, cur_p->data[k].p, common_token_to_piece(ctx, cur_p->data[k].id).c_str());
+            }
+
+            const llama_token id = cur_p->data[0].id;
+
+            common_sampler_accept(spec->smpl, id, true);
+
+            result[s].push_back(id);
+
+            if (params[s].n_draft <= (int) result[s].size()) {
+                continue;
+            }
+
+            if (!common_speculative_can_expand(params[s], cur_p->data[0].p)) {
+                continue;
+            }
+
+            i_batch[s] = batch.n_tokens;
 
-        const auto * cur_p = common_sampler_get_candidates(smpl);
+            // evaluate the drafted token on the draft model
+            common_batch_add(batch, id, n_past[s] + i + 1, { spec->seq_id }, true);
 
-        for (int k = 0; k < std::min(3, (int) cur_p->size); ++k) {
-            LOG_DBG(" - draft candidate %3d, pos %3d: %6d (%8.3f) '%s'\n",
-                    k, i, cur_p->data[k].id, cur_p->data[k].p, common_token_to_piece(ctx, cur_p->data[k].id).c_str());
+            if (!self) {
+                spec->prompt.push_back(id);
+            }
         }
+    }
 
-        // add drafted token for each sequence
-        const llama_token id = cur_p->data[0].id;
+    if (self) {
+        llama_set_layer_skip(ctx, nullptr, 0);
 
-        common_sampler_accept(smpl, id, true);
+        // the KV cache of the skipped layers is missing for the drafted tokens - they are evaluated again for verification
+        for (int s = 0; s < n_spec; ++s) {
+            llama_kv_self_seq_rm(ctx, specs[s]->seq_id, n_past[s], -1);
+        }
+    }
 
-        result.push_back(id);
+    return result;
+}
 
-        if (params.n_draft <= (int) result.size()) {
-            break;
+common_speculative_tree common_speculative_gen_draft_tree(
+        struct common_speculative * spec,
+        struct common_speculative_params params,
+        const llama_tokens & prompt_tgt,
+        llama_token id_last) {
+    auto & batch  = spec->batch;
+    auto & ctx    = spec->ctx;
+    auto & smpl   = spec->smpl;
+    auto & prompt = spec->prompt;
+
+    GGML_ASSERT(spec->layer_skip.empty() && "tree drafts are not supported with self-speculation");
+
+    common_speculative_tree result;
+
+    {
+        llama_tokens draft;
+        if (!common_speculative_eval_prompt(spec, params, prompt_tgt, id_last, draft)) {
+            for (size_t i = 0; i < draft.size(); ++i) {
+                result.add(draft[i], (int) i - 1);
+            }
+            return result;
         }
+    }
 
-        // only collect very high-confidence draft tokens
-        if (cur_p->data[0].p < params.p_min) {
-            break;
+    const llama_pos n_past = prompt.size() - 1;
+
+    // a drafted node that is evaluated with the draft model to expand it
+    struct leaf {
+        int node;
+        int i_batch;
+        llama_seq_id seq_id;
+    };
+
+    // the first child of a node stays in the sequence of its parent, so the greedy path remains in seq 0
+    std::vector<leaf> leaves = { { -1, batch.n_tokens - 1, 0 } };
+    std::vector<leaf> leaves_next;
+
+    llama_seq_id n_seq = 1;
+
+    common_sampler_reset(smpl);
+
+    for (int depth = 0; !leaves.empty() && (int) result.size() < params.n_draft; ++depth) {
+        common_batch_clear(batch);
+        leaves_next.clear();
+
+        for (const auto & cur : leaves) {
+            common_sampler_sample(smpl, ctx, cur.i_batch, true);
+
+            const auto * cur_p = common_sampler_get_candidates(smpl);
+
+            for (int k = 0; k < std::min(params.n_branch, (int) cur_p->size); ++k) {
+                const llama_token id = cur_p->data[k].id;
+                const float       p  = cur_p->data[k].p;
+
+                if ((int) result.size() >= params.n_draft) {
+                    break;
+                }
+
+                // the alternatives to the most probable token must be likely enough to be worth a branch
+                if (k > 0 && p < params.p_split) {
+                    break;
+                }
+
+                LOG_DBG(" - draft candidate %3d, depth %3d, parent %3d: %6d (%8.3f) '%s'\n",
+                        k, depth, cur.node, id, p, common_token_to_piece(ctx, id).c_str());
+
+                const int node = result.add(id, cur.node);
+
+                if (!common_speculative_can_expand(params, p)) {
+                    continue;
+                }
+
+                llama_seq_id seq_id = cur.seq_id;
+                if (k > 0) {
+                    seq_id = n_seq++;
+                    llama_kv_self_seq_cp(ctx, cur.seq_id, seq_id, -1, -1);
+                }
+
+                leaves_next.push_back({ node, batch.n_tokens, seq_id });
+
+                common_batch_add(batch, id, n_past + depth + 1, { seq_id }, true);
+            }
         }
 
-        common_batch_add(batch, id, n_past + i + 1, { 0 }, true);
+        if ((int) result.size() >= params.n_draft || batch.n_tokens == 0) {
+            break;
+        }
 
-        // evaluate the drafted tokens on the draft model
+        // evaluate the next level of the tree on the draft model
         llama_decode(ctx, batch);
 
-        prompt.push_back(id);
+        for (const auto & cur : leaves_next) {
+            if (cur.seq_id == 0) {
+                prompt.push_back(result.tokens[cur.node]);
+            }
+        }
+
+        leaves.swap(leaves_next);
+    }
+
+    // drop the branches from the draft context
+    for (llama_seq_id s = 1; s < n_seq; ++s) {
+        llama_kv_self_seq_rm(ctx, s, -1, -1);
     }
 
     return result;
 }
+
+// the sequences of each node of the tree: one per leaf below the node
+static std::vector<std::vector<llama_seq_id>> common_speculative_tree_seqs(
+        const common_speculative_tree & tree,
+        llama_seq_id seq_id,
+        llama_seq_id seq_id_tmp) {
+    std::vector<bool> is_leaf(tree.size(), true);
+    for (size_t i = 0; i < tree.size(); ++i) {
+        if (tree.parents[i] >= 0) {
+            is_leaf[tree.parents[i]] = false;
+        }
+    }
+
+    std::vector<std::vector<llama_seq_id>> result(tree.size());
+
+    int n_leaves = 0;
+    for (size_t i = 0; i < tree.size(); ++i) {
+        if (!is_leaf[i]) {
+            continue;
+        }
+
+        const llama_seq_id s = n_leaves == 0 ? seq_id : seq_id_tmp + n_leaves - 1;
+        n_leaves++;
+
+        for (int j = i; j >= 0; j = tree.parents[j]) {
+            result[j].push_back(s);
+        }
+    }
+
+    return result;
+}
+
+void common_speculative_tree_add(
+        struct llama_context * ctx,
+        llama_batch & batch,
+        const common_speculative_tree & tree,
+        llama_token id_last,
+        llama_pos n_past,
+        llama_seq_id seq_id,
+        llama_seq_id seq_id_tmp) {
+    const auto seqs = common_speculative_tree_seqs(tree, seq_id, seq_id_tmp);
+
+    // all paths share id_last and the history of seq_id
+    std::vector<llama_seq_id> seqs_last = { seq_id };
+    for (size_t i = 0; i < tree.size(); ++i) {
+        if (tree.parents[i] == -1) {
+            for (const llama_seq_id s : seqs[i]) {
+                if (s != seq_id) {
+                    seqs_last.push_back(s);
+                    llama_kv_self_seq_cp(ctx, seq_id, s, -1, -1);
+                }
+            }
+        }
+    }
+
+    common_batch_add(batch, id_last, n_past, seqs_last, true);
+
+    // the mask of a token is determined by its first sequence, which is a leaf below it - so each node attends
+    // exactly to its ancestors, because only they share that sequence
+    std::vector<int> depth(tree.size());
+    for (size_t i = 0; i < tree.size(); ++i) {
+        depth[i] = tree.parents[i] == -1 ? 0 : depth[tree.parents[i]] + 1;
+
+        common_batch_add(batch, tree.tokens[i], n_past + 1 + depth[i], seqs[i], true);
+    }
+}
+
+void common_speculative_tree_accept(
+        struct llama_context * ctx,
+        const common_speculative_tree & tree,
+        const std::vector<int> & path,
+        llama_pos n_past,
+        llama_seq_id seq_id,
+        llama_seq_id seq_id_tmp) {
+    const auto seqs = common_speculative_tree_seqs(tree, seq_id, seq_id_tmp);
+
+    const llama_pos p0 = n_past + 1;
+    const llama_pos p1 = p0 + path.size();
+
+    // the first sequence of the last accepted node contains exactly the accepted path
+    const llama_seq_id seq_path = path.empty() ? seq_id : seqs[path.back()][0];
+
+    if (seq_path == seq_id) {
+        llama_kv_self_seq_rm(ctx, seq_id, p1, -1);
+    } else {
+        llama_kv_self_seq_rm(ctx, seq_id, p0, -1);
+        llama_kv_self_seq_cp(ctx, seq_path, seq_id, p0, p1);
+    }
+
+    llama_seq_id seq_max = seq_id_tmp - 1;
+    for (const auto & s : seqs) {
+        for (const llama_seq_id cur : s) {
+            if (cur != seq_id) {
+                seq_max = std::max(seq_max, cur);
+            }
+        }
+    }
+
+    for (llama_seq_id s = seq_id_tmp; s <= seq_max; ++s) {
+        llama_kv_self_seq_rm(ctx, s, -1, -1);
+    }
+}
+
+//
+// adaptive draft length
+//
+
+void common_speculative_cost::add(int n, double t_us) {
+    sw  = decay*sw  + 1.0;
+    sn  = decay*sn  + n;
+    st  = decay*st  + t_us;
+    snn = decay*snn + (double) n*n;
+    snt = decay*snt + n*t_us;
+}
+
+double common_speculative_cost::eval(int n) const {
+    if (empty()) {
+        return -1.0;
+    }
+
+    // with too little spread in the measured sizes, assume a constant cost
+    double b = 0.0;
+
+    const double var = sw*snn - sn*sn;
+    if (var > 1e-3*sw*sw) {
+        b = std::max(0.0, (sw*snt - sn*st)/var);
+    }
+
+    const double a = std::max(0.0, (st - b*sn)/sw);
+
+    return a + b*n;
+}
+
+void common_speculative_adaptive::reset_accept() {
+    n_accept   = 1.0;
+    n_trial    = 2.0;
+    n_skip     = 0;
+    skip_draft = true;
+}
+
+void common_speculative_adaptive::add_draft(int n_draft, int64_t t_us) {
+    if (skip_draft) {
+        skip_draft = false;
+        return;
+    }
+
+    if (n_draft > 0) {
+        cost_draft.add(n_draft, t_us);
+    }
+}
+
+void common_speculative_adaptive::add_accept(int n_draft, int n_accepted) {
+    // the drafted tokens are compared until the first rejection
+    n_accept = decay*n_accept + n_accepted;
+    n_trial  = decay*n_trial  + n_accepted + (n_accepted < n_draft ? 1 : 0);
+}
+
+void common_speculative_adaptive::add_verify(int n_draft, int n_accepted, int64_t t_us) {
+    add_accept(n_draft, n_accepted);
+    add_target(n_draft + 1, t_us);
+}
+
+void common_speculative_adaptive::add_target(int n_tokens, int64_t t_us) {
+    cost_target.add(n_tokens, t_us);
+}
+
+double common_speculative_adaptive::p_accept() const {
+    return n_accept/n_trial;
+}
+
+int common_speculative_adaptive::get_n_draft(int n_min, int n_max, int n_batch) {
+    if (n_max <= 0 || n_max < n_min) {
+        return 0;
+    }
+
+    // nothing measured yet - use the longest draft
+    if (cost_draft.empty() || cost_target.empty()) {
+        return n_max;
+    }
+
+    const double p = p_accept();
+
+    // with a per-token acceptance rate p, a draft of k tokens yields 1 + p + ... + p^k tokens on average
+    // when it is added to a batch, the batch yields the first of them anyway
+    int    best_n    = 0;
+    double best_rate = 0.0;
+
+    double n_exp = n_batch > 0 ? 0.0 : 1.0;
+    double p_k   = 1.0;
+
+    for (int k = 1; k <= n_max; ++k) {
+        p_k   *= p;
+        n_exp += p_k;
+
+        if (k < n_min) {
+            continue;
+        }
+
+        const double t_verify = n_batch > 0 ? cost_target.eval(n_batch + k) - cost_target.eval(n_batch) : cost_target.eval(k + 1);
+
+        // note: the costs can be close to 0, e.g. for drafts from a lookup and a batch that is not compute bound
+        const double rate = n_exp/std::max(1.0, cost_draft.eval(k) + t_verify);
+        if (rate > best_rate) {
+            best_n    = k;
+            best_rate = rate;
+        }
+    }
+
+    // the cost per token without speculation
+    const double t_base_us = n_batch > 0 ? cost_target.eval(n_batch)/n_batch : cost_target.eval(1);
+
+    LOG_DBG("%s: p_accept = %.3f, t_draft(1) = %.1f us, t_base = %.1f us, n_batch = %d, best n_draft = %d (%.1f t/s)\n",
+            __func__, p, cost_draft.eval(1), t_base_us, n_batch, best_n, 1e6*best_rate);
+
+    if (best_rate*t_base_us > 1.0) {
+        n_skip = 0;
+        return best_n;
+    }
+
+    // speculation is slower than generating without it - draft only occasionally to keep the estimates current
+    // the next draft catches up with the skipped tokens, which is not representative of its cost
+    skip_draft = true;
+
+    if (++n_skip >= n_probe) {
+        n_skip = 0;
+        return best_n;
+    }
+
+    return 0;
+}
+
+//
+// lookahead decoding
+//
+
+struct common_lookahead * common_lookahead_init(const struct llama_vocab * vocab, int32_t W, int32_t N, int32_t G) {
+    GGML_ASSERT(W > 0 && N >= 3 && G > 0);
+
+    const int32_t n_vocab = llama_vocab_n_tokens(vocab);
+
+    auto * result = new common_lookahead {
+        /* .W        = */ W,
+        /* .N        = */ N,
+        /* .G        = */ G,
+        /* .pool     = */ {},
+        /* .tokens_j = */ std::vector<llama_tokens>(N - 1, llama_tokens(W)),
+    };
+
+    // initialize the guesses with a sequence of increasing token ids
+    for (int j = 0; j < N - 1; j++) {
+        for (int i = 0; i < W; i++) {
+            result->tokens_j[j][i] = (100 + i) % n_vocab;
+        }
+    }
+
+    return result;
+}
+
+void common_lookahead_free(struct common_lookahead * la) {
+    delete la;
+}
+
+common_speculative_tree common_lookahead_gen_draft(
+        const struct common_lookahead * la,
+        llama_token id_last,
+        int n_draft) {
+    common_speculative_tree result;
+
+    const auto it = la->pool.find(id_last);
+    if (it == la->pool.end()) {
+        return result;
+    }
+
+    const auto & ngrams = it->second.tokens;
+
+    // the node of each n-gram at the current depth, -1 when the n-gram did not fit in the draft
+    std::vector<int> node(ngrams.size(), -1);
+
+    // the n-grams with a common prefix share its nodes - adding the nodes depth by depth keeps them in breadth-first order
+    for (int d = 0; d < la->N - 1; ++d) {
+        const int n_prev = result.size();
+
+        for (size_t g = 0; g < ngrams.size(); ++g) {
+            if (d > 0 && node[g] < 0) {
+                continue;
+            }
+
+            const int parent = d == 0 ? -1 : node[g];
+            const llama_token id = ngrams[g][d];
+
+            node[g] = -1;
+
+            for (int k = n_prev; k < (int) result.size(); ++k) {
+                if (result.parents[k] == parent && result.tokens[k] == id) {
+                    node[g] = k;
+                    break;
+                }
+            }
+
+            if (node[g] < 0 && (int) result.size() < n_draft) {
+                node[g] = result.add(id, parent);
+            }
+        }
+    }
+
+    return result;
+}
+
+int common_lookahead_add(
+        struct llama_context * ctx,
+        struct common_lookahead * la,
+        llama_batch & batch,
+        int i_last,
+        llama_pos n_past,
+        llama_seq_id seq_id,
+        llama_seq_id seq_id_tmp) {
+    const int W = la->W;
+    const int N = la->N;
+
+    // id_last is the first guess of the first level of each column
+    for (int i = 0; i < W; ++i) {
+        llama_kv_self_seq_cp(ctx, seq_id, seq_id_tmp + i, -1, -1);
+
+        batch.seq_id[i_last][batch.n_seq_id[i_last]++] = seq_id_tmp + i;
+    }
+
+    // the guesses of the first level are seen by the columns that follow them
+    std::vector<llama_seq_id> seqs;
+
+    for (int i = 1; i < W; ++i) {
+        seqs.clear();
+        for (int k = i; k < W; ++k) {
+            seqs.push_back(seq_id_tmp + k);
+        }
+
+        common_batch_add(batch, la->tokens_j[0][i], n_past + i, seqs, false);
+    }
+
+    // the other levels are only seen by their own column
+    for (int j = 1; j < N - 1; ++j) {
+        for (int i = 0; i < W; ++i) {
+            common_batch_add(batch, la->tokens_j[j][i], n_past + j + i, { seq_id_tmp + i }, j == N - 2);
+        }
+    }
+
+    return batch.n_tokens - W;
+}
+
+void common_lookahead_accept(
+        struct llama_context * ctx,
+        struct common_lookahead * la,
+        int i_guess,
+        int n_accepted,
+        llama_seq_id seq_id_tmp) {
+    const int W = la->W;
+    const int N = la->N;
+    const int G = la->G;
+
+    const int n_vocab = llama_vocab_n_tokens(llama_model_get_vocab(llama_get_model(ctx)));
+
+    auto & tokens_j = la->tokens_j;
+
+    for (int v = 0; v <= n_accepted; ++v) {
+        const llama_tokens tokens_j_prev = tokens_j[0];
+
+        for (int j = 0; j < N - 2; j++) {
+            tokens_j[j] = tokens_j[j + 1];
+        }
+
+        if (v > 0 || i_guess < 0) {
+            // init from the previous level
+            tokens_j[N - 2] = tokens_j[0];
+
+            continue;
+        }
+
+        // the new guesses of the last level are the greedy predictions of the window
+        for (int i = 0; i < W; i++) {
+            const float * logits = llama_get_logits_ith(ctx, i_guess + i);
+
+            tokens_j[N - 2][i] = std::max_element(logits, logits + n_vocab) - logits;
+        }
+
+        // collect the n-grams of the columns, the first token of the n-gram is the key in the pool
+        // ref: https://github.com/hao-ai-lab/LookaheadDecoding/issues/14#issuecomment-1826198518
+        llama_tokens ngram(N - 1);
+
+        for (int f = 0; f < W; ++f) {
+            for (int j = 0; j < N - 1; ++j) {
+                ngram[j] = tokens_j[j][f];
+            }
+
+            auto & ngrams = la->pool[tokens_j_prev[f]];
+
+            // filter-out repeating n-grams
+            if (std::find(ngrams.tokens.begin(), ngrams.tokens.end(), ngram) != ngrams.tokens.end()) {
+                continue;
+            }
+
+            if ((int) ngrams.tokens.size() < G) {
+                ngrams.tokens.push_back(ngram);
+            } else {
+                ngrams.tokens[ngrams.head] = ngram;
+            }
+
+            ngrams.head = (ngrams.head + 1) % G;
+        }
+    }
+
+    for (int i = 0; i < W; ++i) {
+        llama_kv_self_seq_rm(ctx, seq_id_tmp + i, -1, -1);
+    }
+}
@@ -3,17 +3,127 @@
 #include "llama.h"
 #include "common.h"
 
+#include <unordered_map>
+
 struct common_speculative;
 
 struct common_speculative_params {
-    int n_draft = 16;  // max drafted tokens
-    int n_reuse = 256;
+    int n_draft  = 16;  // max drafted tokens
+    int n_reuse  = 256;
+    int n_branch = 1;   // max candidates drafted after each token (tree drafts only)
+
+    float p_min   = 0.75f; // min probability required to accept a token in the draft
+    float p_split = 0.1f;  // min probability of the alternative candidates (tree drafts only)
+};
+
+// a tree of drafted tokens
+// the nodes are stored in breadth-first order, the parent of a node always comes before it
+// the roots (parent == -1) are the candidates for the token that follows id_last
+struct common_speculative_tree {
+    llama_tokens     tokens;
+    std::vector<int> parents;
+
+    int add(llama_token token, int parent) {
+        tokens.push_back(token);
+        parents.push_back(parent);
+        return (int) tokens.size() - 1;
+    }
+
+    size_t size() const {
+        return tokens.size();
+    }
+
+    bool empty() const {
+        return tokens.empty();
+    }
+
+    void clear() {
+        tokens.clear();
+        parents.clear();
+    }
+};
+
+// least squares fit of the cost of processing n tokens as a + b*n, with exponentially decaying weights
+struct common_speculative_cost {
+    double decay = 0.95;
+
+    double sw  = 0.0;
+    double sn  = 0.0;
+    double st  = 0.0;
+    double snn = 0.0;
+    double snt = 0.0;
+
+    void add(int n, double t_us);
+
+    bool empty() const {
+        return sw <= 0.0;
+    }
+
+    // estimated cost of n tokens, < 0 if nothing has been measured
+    double eval(int n) const;
+};
+
+// online choice of the draft length that maximizes the expected number of generated tokens per second
+// tracks the per-token acceptance rate of the drafts as an EWMA, and the costs of drafting and of evaluating
+// tokens with the target model
+struct common_speculative_adaptive {
+    double decay   = 0.9; // weight of the history of the acceptance rate
+    int    n_probe = 16;  // when speculation does not pay off, still draft once every n_probe calls to re-measure
+
+    // acceptance: weighted number of accepted tokens and of tokens compared with the target
+    // the prior corresponds to an acceptance rate of 0.5
+    double n_accept = 1.0;
+    double n_trial  = 2.0;
+
+    common_speculative_cost cost_draft;
+    common_speculative_cost cost_target;
+
+    int  n_skip     = 0;    // calls since the last draft
+    bool skip_draft = true; // the next draft also evaluates the prompt or skipped tokens - not a measurement
+
+    // start a new task: forget the acceptance rate, keep the measured costs
+    void reset_accept();
+
+    // a draft of n_draft tokens took t_us to generate
+    void add_draft(int n_draft, int64_t t_us);
+
+    // n_accepted of the n_draft drafted tokens were accepted
+    void add_accept(int n_draft, int n_accepted);
+
+    // n_accepted of the n_draft drafted tokens were accepted, the verification batch took t_us
+    void add_verify(int n_draft, int n_accepted, int64_t t_us);
+
+    // the target model evaluated n_tokens in t_us
+    void add_target(int n_tokens, int64_t t_us);
 
-    float p_min = 0.75f; // min probability required to accept a token in the draft
+    double p_accept() const;
+
+    // the draft length in [n_min, n_max] with the best expected rate, or 0 if the rate is not better than without speculation
+    // n_batch > 0: the draft is verified together with n_batch other tokens, which are processed at the rate of that batch
+    // n_batch = 0: the draft is verified in a batch of its own, compared with generating one token at a time
+    int get_n_draft(int n_min, int n_max, int n_batch = 0);
 };
 
 struct common_speculative * common_speculative_init(struct llama_context * ctx_dft);
 
+// a speculator that uses only the sequence seq_id and up to n_ctx cells of the draft context
+// several speculators can share a draft context and draft together with common_speculative_gen_drafts
+struct common_speculative * common_speculative_init_seq(struct llama_context * ctx_dft, llama_seq_id seq_id, int32_t n_ctx);
+
+// self-speculation: draft with the target context itself, skipping the layers in layer_skip
+// the KV cache of seq_id must contain the prompt passed to the draft functions, the drafted tokens are removed from it
+// requires llama_model_can_skip_layers()
+struct common_speculative * common_speculative_init_self(
+        struct llama_context * ctx_tgt,
+        llama_seq_id seq_id,
+        const std::vector<bool> & layer_skip);
+
+// the layers to skip for self-speculation: the layers from n_layer_draft on (if > 0) and the layers in skip
+std::vector<bool> common_speculative_layer_skip(
+        const struct llama_model * model,
+        int32_t n_layer_draft,
+        const std::vector<int32_t> & skip);
+
 void common_speculative_free(struct common_speculative * spec);
 
 bool common_speculative_are_compatible(
@@ -21,8 +131,108 @@ bool common_speculative_are_compatible(
         const struct llama_context * ctx_dft);
 
 // sample up to n_draft tokens and add them to the batch using the draft model
+// the draft stops after the first token with p < p_min, which is included in the draft
 llama_tokens common_speculative_gen_draft(
                struct common_speculative * spec,
         struct common_speculative_params   params,
                       const llama_tokens & prompt,
                              llama_token   id_last);
+
+// same as common_speculative_gen_draft for several speculators that share the same draft context
+// the drafts are generated together, with a single llama_decode of the draft context per drafted token
+std::vector<llama_tokens> common_speculative_gen_drafts(
+        const std::vector<struct common_speculative *>      & specs,
+        const std::vector<struct common_speculative_params> & params,
+        const std::vector<const llama_tokens *>             & prompts_tgt,
+        const llama_tokens                                  & ids_last);
+
+// draft a tree of up to n_draft tokens: each token is followed by up to n_branch candidates with probability >= p_split
+// the branches are evaluated in the temporary sequences 1, 2, ... of the draft context - the speculator needs a draft context of its own
+// a node with p < p_min is not expanded, it is the last token of its branch - as in common_speculative_gen_draft, so
+// with n_branch == 1 the tree is a chain of the same tokens as the linear draft
+common_speculative_tree common_speculative_gen_draft_tree(
+               struct common_speculative * spec,
+        struct common_speculative_params   params,
+                      const llama_tokens & prompt,
+                             llama_token   id_last);
+
+// add id_last at position n_past followed by the tree to the batch, all with logits - node i is at batch index i + 1
+// each path of the tree is evaluated in its own sequence, which results in a tree attention mask:
+// the main path stays in seq_id and the others use the sequences [seq_id_tmp, seq_id_tmp + n_leaves - 1)
+void common_speculative_tree_add(
+                  struct llama_context * ctx,
+                           llama_batch & batch,
+        const common_speculative_tree  & tree,
+                           llama_token   id_last,
+                             llama_pos   n_past,
+                          llama_seq_id   seq_id,
+                          llama_seq_id   seq_id_tmp);
+
+// keep the accepted nodes of the tree in seq_id and remove the rejected branches from the KV cache
+// path are the accepted nodes, as returned by common_sampler_sample_and_accept_tree
+void common_speculative_tree_accept(
+                  struct llama_context * ctx,
+        const common_speculative_tree  & tree,
+                 const std::vector<int> & path,
+                             llama_pos   n_past,
+                          llama_seq_id   seq_id,
+                          llama_seq_id   seq_id_tmp);
+
+//
+// lookahead (Jacobi) decoding
+// ref: https://lmsys.org/blog/2023-11-21-lookahead-decoding/
+//
+// with each decode, a window of W guesses is refined for the next N - 1 positions, and the n-grams that show up in the
+// guesses are collected - the n-grams that follow the last token are then verified as a tree of drafts
+//
+
+struct common_lookahead {
+    int32_t W; // lookahead window
+    int32_t N; // n-gram size
+    int32_t G; // max verification n-grams
+
+    // for each token, a ring-buffer of capacity G of the n-grams of size N - 1 that followed it
+    struct ngrams {
+        int32_t head = 0;
+
+        std::vector<llama_tokens> tokens;
+    };
+
+    std::unordered_map<llama_token, ngrams> pool;
+
+    // the guesses of the past N - 1 Jacobi iterations, [N - 1][W]
+    std::vector<llama_tokens> tokens_j;
+};
+
+// N must be >= 3
+struct common_lookahead * common_lookahead_init(const struct llama_vocab * vocab, int32_t W, int32_t N, int32_t G);
+
+void common_lookahead_free(struct common_lookahead * la);
+
+// the tree of the collected n-grams that follow id_last, with at most n_draft tokens
+common_speculative_tree common_lookahead_gen_draft(
+        const struct common_lookahead * la,
+                          llama_token   id_last,
+                                  int   n_draft);
+
+// add the window of guesses to the batch, after id_last at index i_last of the batch and position n_past
+// each column of the window is evaluated in its own sequence [seq_id_tmp, seq_id_tmp + W), with the history of seq_id
+// the batch needs room for the sequences of common_speculative_tree_add and W more for id_last
+// returns the batch index of the first guess of the last level
+int common_lookahead_add(
+        struct llama_context * ctx,
+        struct common_lookahead * la,
+                   llama_batch & batch,
+                           int   i_last,
+                     llama_pos   n_past,
+                  llama_seq_id   seq_id,
+                  llama_seq_id   seq_id_tmp);
+
+// update the guesses with the output at i_guess (-1 if the window was not evaluated) and collect their n-grams
+// the window is shifted once for each of the n_accepted + 1 new tokens and removed from the KV cache
+void common_lookahead_accept(
+        struct llama_context * ctx,
+        struct common_lookahead * la,
+                           int   i_guess,
+                           int   n_accepted,
+                  llama_seq_id   seq_id_tmp);
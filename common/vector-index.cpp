@@ -0,0 +1,903 @@
+#include "vector-index.h"
+#include "log.h"
+
+#include "ggml.h"
+#include "ggml-alloc.h"
+#include "ggml-backend.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <queue>
+#include <random>
+#include <thread>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define VINDEX_MAGIC     "ggvi"
+#define VINDEX_VERSION   1
+#define VINDEX_ALIGNMENT 64
+
+// limit the size of the score matrix of the flat search
+#define VINDEX_FLAT_MAX_SCORES (64*1024*1024)
+
+// on-disk header, each section that follows it starts at a multiple of VINDEX_ALIGNMENT:
+//   vectors  - float   [n_vec][n_embd]
+//   levels   - int32_t [n_vec]                 (HNSW only)
+//   offs_up  - int64_t [n_vec]                 (HNSW only)
+//   links0   - int32_t [n_vec][1 + M0]         (HNSW only)
+//   links_up - int32_t [n_links_up]            (HNSW only)
+struct vindex_header {
+    char     magic[4];
+    uint32_t version;
+    uint32_t type;
+    int32_t  n_embd;
+    int64_t  n_vec;
+    int32_t  M;
+    int32_t  M0;
+    int32_t  entry;
+    int32_t  max_level;
+    int64_t  n_links_up;
+    uint64_t tag;
+};
+
+static size_t vindex_pad(size_t n) {
+    return (n + VINDEX_ALIGNMENT - 1) / VINDEX_ALIGNMENT * VINDEX_ALIGNMENT;
+}
+
+static float vindex_dot(const float * a, const float * b, int32_t n) {
+    // independent accumulators, so that the loop can be vectorized
+    float s[8] = { 0.0f };
+
+    int32_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        for (int j = 0; j < 8; ++j) {
+            s[j] += a[i + j]*b[i + j];
+        }
+    }
+
+    float sum = ((s[0] + s[1]) + (s[2] + s[3])) + ((s[4] + s[5]) + (s[6] + s[7]));
+    for (; i < n; ++i) {
+        sum += a[i]*b[i];
+    }
+
+    return sum;
+}
+
+// (score, id)
+using vindex_cand = std::pair<float, int32_t>;
+
+// set of the nodes visited by a search, cleared in O(1) by changing the tag
+struct vindex_visited {
+    std::vector<uint32_t> tags;
+
+    uint32_t cur = 0;
+
+    void reset(int64_t n) {
+        if ((int64_t) tags.size() != n) {
+            tags.assign(n, 0);
+            cur = 0;
+        }
+
+        if (++cur == 0) {
+            std::fill(tags.begin(), tags.end(), 0);
+            cur = 1;
+        }
+    }
+
+    // returns false if the node was already visited
+    bool visit(int32_t id) {
+        if (tags[id] == cur) {
+            return false;
+        }
+        tags[id] = cur;
+        return true;
+    }
+};
+
+struct common_vindex {
+    common_vindex_params params;
+
+    int64_t n_vec  = 0;
+    int32_t n_embd = 0;
+
+    // the vectors are stored in a tensor of the CPU backend [n_embd, n_vec]
+    ggml_backend_t        backend = nullptr;
+    ggml_backend_buffer_t buf     = nullptr;
+    ggml_context        * ctx     = nullptr;
+    ggml_tensor         * vecs    = nullptr;
+
+    const float * data = nullptr;
+
+    // HNSW graph
+    // the links of a node on a layer are stored as the number of links followed by the ids of the nodes
+    int32_t M0        = 0;
+    int32_t entry     = -1;
+    int32_t max_level = -1;
+    int64_t n_links_up = 0;
+
+    const int32_t * levels   = nullptr;
+    const int64_t * offs_up  = nullptr; // offset of the links on layer 1 in links_up
+    const int32_t * links0   = nullptr;
+    const int32_t * links_up = nullptr;
+
+    // storage of the graph when it is built in memory
+    std::vector<int32_t> levels_buf;
+    std::vector<int64_t> offs_up_buf;
+    std::vector<int32_t> links0_buf;
+    std::vector<int32_t> links_up_buf;
+
+    // locks of the nodes, only while the graph is being built
+    mutable std::vector<std::mutex> node_mtx;
+    std::mutex                      entry_mtx;
+
+    // memory-mapped file
+    void * mapping      = nullptr;
+    size_t mapping_size = 0;
+
+    std::vector<uint8_t> file_buf;
+
+    // search buffers, one per thread
+    std::vector<vindex_visited> visited;
+
+    ~common_vindex() {
+        ggml_backend_buffer_free(buf);
+        ggml_free(ctx);
+        ggml_backend_free(backend);
+#ifndef _WIN32
+        if (mapping) {
+            munmap(mapping, mapping_size);
+        }
+#endif
+    }
+
+    const float * vec(int32_t id) const {
+        return data + (int64_t) id*n_embd;
+    }
+
+    int64_t links_offset(int32_t id, int level) const {
+        return level == 0 ? (int64_t) id*(1 + M0) : offs_up[id] + (int64_t) (level - 1)*(1 + params.M);
+    }
+
+    const int32_t * get_links(int32_t id, int level) const {
+        return (level == 0 ? links0 : links_up) + links_offset(id, level);
+    }
+
+    int32_t * get_links_mut(int32_t id, int level) {
+        return (level == 0 ? links0_buf.data() : links_up_buf.data()) + links_offset(id, level);
+    }
+
+    // check that the links of a loaded graph stay within the index, so that a corrupted file cannot be used to read out of bounds
+    bool check_graph() const {
+        if (entry < 0 || entry >= n_vec || max_level < 0 || levels[entry] != max_level) {
+            return false;
+        }
+
+        for (int32_t id = 0; id < n_vec; ++id) {
+            const int level = levels[id];
+
+            if (level < 0 || level > max_level) {
+                return false;
+            }
+
+            if (level > 0 && (offs_up[id] < 0 || offs_up[id] > n_links_up - (int64_t) level*(1 + params.M))) {
+                return false;
+            }
+
+            for (int l = 0; l <= level; ++l) {
+                const int32_t * links = get_links(id, l);
+
+                if (links[0] < 0 || links[0] > (l == 0 ? M0 : params.M)) {
+                    return false;
+                }
+
+                for (int32_t i = 1; i <= links[0]; ++i) {
+                    if (links[i] < 0 || links[i] >= n_vec) {
+                        return false;
+                    }
+                }
+            }
+        }
+
+        return true;
+    }
+
+    // copy the links of a node, it is locked while the graph is being built
+    int32_t read_links(int32_t id, int level, int32_t * dst) const {
+        std::unique_lock<std::mutex> lock;
+        if (!node_mtx.empty()) {
+            lock = std::unique_lock<std::mutex>(node_mtx[id]);
+        }
+
+        const int32_t * links = get_links(id, level);
+        std::copy(links + 1, links + 1 + links[0], dst);
+
+        return links[0];
+    }
+
+    // move to the neighbor with the best score until there is none
+    void search_greedy(const float * q, int32_t & ep, float & ep_score, int level) const {
+        std::vector<int32_t> nbrs(M0);
+
+        bool changed = true;
+        while (changed) {
+            changed = false;
+
+            const int32_t n = read_links(ep, level, nbrs.data());
+            for (int32_t i = 0; i < n; ++i) {
+                const float score = vindex_dot(q, vec(nbrs[i]), n_embd);
+                if (score > ep_score) {
+                    ep_score = score;
+                    ep       = nbrs[i];
+                    changed  = true;
+                }
+            }
+        }
+    }
+
+    // beam search on a layer, res is sorted by decreasing score
+    void search_layer(const float * q, int32_t ep, float ep_score, int32_t ef, int level, vindex_visited & vis, std::vector<vindex_cand> & res) const {
+        // the candidates to expand, best first
+        std::priority_queue<vindex_cand> cand;
+
+        // the best ef nodes found so far, worst first
+        std::priority_queue<vindex_cand, std::vector<vindex_cand>, std::greater<vindex_cand>> top;
+
+        std::vector<int32_t> nbrs(M0);
+
+        vis.reset(n_vec);
+        vis.visit(ep);
+
+        cand.push({ ep_score, ep });
+        top .push({ ep_score, ep });
+
+        while (!cand.empty()) {
+            const vindex_cand cur = cand.top();
+            if (cur.first < top.top().first && (int32_t) top.size() >= ef) {
+                break;
+            }
+            cand.pop();
+
+            const int32_t n = read_links(cur.second, level, nbrs.data());
+            for (int32_t i = 0; i < n; ++i) {
+                const int32_t id = nbrs[i];
+                if (!vis.visit(id)) {
+                    continue;
+                }
+
+                const float score = vindex_dot(q, vec(id), n_embd);
+                if ((int32_t) top.size() < ef || score > top.top().first) {
+                    cand.push({ score, id });
+                    top .push({ score, id });
+                    if ((int32_t) top.size() > ef) {
+                        top.pop();
+                    }
+                }
+            }
+        }
+
+        res.resize(top.size());
+        for (int i = (int) res.size() - 1; i >= 0; --i) {
+            res[i] = top.top();
+            top.pop();
+        }
+    }
+
+    // keep at most m candidates (sorted by decreasing score), skipping the ones that are closer to an already selected
+    // candidate than to the base node - this keeps links in all directions instead of only to the nearest cluster
+    void select_links(std::vector<vindex_cand> & cands, int32_t m) const {
+        if ((int32_t) cands.size() <= m) {
+            return;
+        }
+
+        std::vector<vindex_cand> res;
+        res.reserve(m);
+
+        for (const auto & c : cands) {
+            if ((int32_t) res.size() >= m) {
+                break;
+            }
+
+            bool keep = true;
+            for (const auto & r : res) {
+                if (vindex_dot(vec(c.second), vec(r.second), n_embd) > c.first) {
+                    keep = false;
+                    break;
+                }
+            }
+
+            if (keep) {
+                res.push_back(c);
+            }
+        }
+
+        cands = std::move(res);
+    }
+
+    void insert(int32_t id, vindex_visited & vis) {
+        const int     level = levels[id];
+        const float * q     = vec(id);
+
+        // nodes that go above the current top layer become the entry point, the other insertions wait for them
+        std::unique_lock<std::mutex> lock_entry(entry_mtx);
+
+        int32_t   ep      = entry;
+        const int ep_level = max_level;
+
+        if (ep < 0) {
+            entry     = id;
+            max_level = level;
+            return;
+        }
+
+        if (level <= ep_level) {
+            lock_entry.unlock();
+        }
+
+        float ep_score = vindex_dot(q, vec(ep), n_embd);
+
+        for (int l = ep_level; l > level; --l) {
+            search_greedy(q, ep, ep_score, l);
+        }
+
+        std::vector<vindex_cand> cands;
+        std::vector<vindex_cand> cands_nbr;
+
+        for (int l = std::min(level, ep_level); l >= 0; --l) {
+            search_layer(q, ep, ep_score, params.ef_construction, l, vis, cands);
+
+            ep       = cands[0].second;
+            ep_score = cands[0].first;
+
+            cands.erase(std::remove_if(cands.begin(), cands.end(), [id](const vindex_cand & c) { return c.second == id; }), cands.end());
+
+            select_links(cands, params.M);
+
+            {
+                std::lock_guard<std::mutex> lock(node_mtx[id]);
+
+                int32_t * links = get_links_mut(id, l);
+
+                links[0] = cands.size();
+                for (size_t i = 0; i < cands.size(); ++i) {
+                    links[1 + i] = cands[i].second;
+                }
+            }
+
+            const int32_t m_max = l == 0 ? M0 : params.M;
+
+            for (const auto & c : cands) {
+                std::lock_guard<std::mutex> lock(node_mtx[c.second]);
+
+                int32_t * links = get_links_mut(c.second, l);
+
+                if (links[0] < m_max) {
+                    links[1 + links[0]++] = id;
+                    continue;
+                }
+
+                // the neighbor is full - select its links again among the old ones and the new node
+                cands_nbr.clear();
+                cands_nbr.push_back({ c.first, id });
+                for (int32_t i = 0; i < links[0]; ++i) {
+                    cands_nbr.push_back({ vindex_dot(vec(c.second), vec(links[1 + i]), n_embd), links[1 + i] });
+                }
+
+                std::sort(cands_nbr.begin(), cands_nbr.end(), std::greater<vindex_cand>());
+
+                select_links(cands_nbr, m_max);
+
+                links[0] = cands_nbr.size();
+                for (size_t i = 0; i < cands_nbr.size(); ++i) {
+                    links[1 + i] = cands_nbr[i].second;
+                }
+            }
+        }
+
+        if (level > ep_level) {
+            entry     = id;
+            max_level = level;
+        }
+    }
+
+    void build() {
+        M0 = 2*params.M;
+
+        levels_buf .resize(n_vec);
+        offs_up_buf.resize(n_vec);
+
+        // the layer of each node is drawn from an exponential distribution, so that each layer has ~1/M of the nodes below it
+        {
+            std::mt19937 rng(params.seed);
+            std::uniform_real_distribution<double> dist(0.0, 1.0);
+
+            const double mult = 1.0/std::log((double) std::max(2, params.M));
+
+            n_links_up = 0;
+            for (int64_t i = 0; i < n_vec; ++i) {
+                const int level = std::min(16, (int) (-std::log(1.0 - dist(rng))*mult));
+
+                levels_buf [i] = level;
+                offs_up_buf[i] = n_links_up;
+
+                n_links_up += (int64_t) level*(1 + params.M);
+            }
+        }
+
+        links0_buf  .assign(n_vec*(1 + M0), 0);
+        links_up_buf.assign(n_links_up, 0);
+
+        levels   = levels_buf.data();
+        offs_up  = offs_up_buf.data();
+        links0   = links0_buf.data();
+        links_up = links_up_buf.data();
+
+        node_mtx = std::vector<std::mutex>(n_vec);
+
+        const int n_threads = std::max(1, params.n_threads);
+
+        visited.resize(n_threads);
+
+        // the first node is the initial entry point
+        insert(0, visited[0]);
+
+        std::atomic<int64_t> next { 1 };
+
+        auto worker = [&](int ith) {
+            for (int64_t i = next++; i < n_vec; i = next++) {
+                insert(i, visited[ith]);
+            }
+        };
+
+        std::vector<std::thread> threads;
+        for (int i = 1; i < n_threads; ++i) {
+            threads.emplace_back(worker, i);
+        }
+        worker(0);
+
+        for (auto & t : threads) {
+            t.join();
+        }
+
+        std::vector<std::mutex>().swap(node_mtx);
+    }
+
+    bool init_backend() {
+        ggml_backend_dev_t dev = ggml_backend_dev_by_type(GGML_BACKEND_DEVICE_TYPE_CPU);
+        if (!dev) {
+            LOG_ERR("%s: no CPU backend found\n", __func__);
+            return false;
+        }
+
+        backend = ggml_backend_dev_init(dev, nullptr);
+        if (!backend) {
+            LOG_ERR("%s: failed to initialize the CPU backend\n", __func__);
+            return false;
+        }
+
+        ggml_backend_reg_t reg = ggml_backend_dev_backend_reg(dev);
+
+        auto * set_n_threads_fn = (ggml_backend_set_n_threads_t) ggml_backend_reg_get_proc_address(reg, "ggml_backend_set_n_threads");
+        if (set_n_threads_fn) {
+            set_n_threads_fn(backend, params.n_threads);
+        }
+
+        ggml_init_params iparams = {
+            /*.mem_size   =*/ ggml_tensor_overhead(),
+            /*.mem_buffer =*/ NULL,
+            /*.no_alloc   =*/ true,
+        };
+
+        ctx  = ggml_init(iparams);
+        vecs = ggml_new_tensor_2d(ctx, GGML_TYPE_F32, n_embd, n_vec);
+
+        ggml_set_name(vecs, "vindex_vecs");
+
+        return true;
+    }
+
+    // use the vectors in place if possible, otherwise copy them to a buffer of the backend
+    bool init_vecs(const float * src, bool in_place) {
+        const size_t size = ggml_nbytes(vecs);
+
+        ggml_backend_dev_t dev = ggml_backend_get_device(backend);
+
+        ggml_backend_dev_props props;
+        ggml_backend_dev_get_props(dev, &props);
+
+        if (in_place && props.caps.buffer_from_host_ptr) {
+            // the backend only reads the vectors
+            void * ptr = const_cast<float *>(src);
+
+            buf = ggml_backend_dev_buffer_from_host_ptr(dev, ptr, size, size);
+            if (buf && ggml_backend_tensor_alloc(buf, vecs, ptr) == GGML_STATUS_SUCCESS) {
+                data = src;
+                return true;
+            }
+
+            ggml_backend_buffer_free(buf);
+        }
+
+        buf = ggml_backend_alloc_ctx_tensors(ctx, backend);
+        if (!buf) {
+            LOG_ERR("%s: failed to allocate %.2f MiB for the vectors\n", __func__, size/1024.0/1024.0);
+            return false;
+        }
+
+        ggml_backend_tensor_set(vecs, src, 0, size);
+
+        data = (const float *) vecs->data;
+
+        return true;
+    }
+
+    void search_flat(const float * queries, int32_t n_queries, int32_t k, std::vector<std::vector<common_vindex_match>> & res) const {
+        const int32_t n_chunk = std::max<int64_t>(1, std::min<int64_t>(n_queries, VINDEX_FLAT_MAX_SCORES/n_vec));
+
+        std::vector<float> scores;
+
+        for (int32_t i0 = 0; i0 < n_queries; i0 += n_chunk) {
+            const int32_t n_q = std::min(n_chunk, n_queries - i0);
+
+            ggml_init_params iparams = {
+                /*.mem_size   =*/ ggml_tensor_overhead()*2 + ggml_graph_overhead_custom(8, false),
+                /*.mem_buffer =*/ NULL,
+                /*.no_alloc   =*/ true,
+            };
+
+            ggml_context * ctx0 = ggml_init(iparams);
+
+            ggml_tensor * q = ggml_new_tensor_2d(ctx0, GGML_TYPE_F32, n_embd, n_q);
+            ggml_tensor * s = ggml_mul_mat(ctx0, vecs, q); // [n_vec, n_q]
+
+            ggml_cgraph * gf = ggml_new_graph_custom(ctx0, 8, false);
+            ggml_build_forward_expand(gf, s);
+
+            ggml_backend_buffer_t buf0 = ggml_backend_alloc_ctx_tensors(ctx0, backend);
+            if (!buf0) {
+                LOG_ERR("%s: failed to allocate the scores\n", __func__);
+                ggml_free(ctx0);
+                return;
+            }
+
+            ggml_backend_tensor_set(q, queries + (int64_t) i0*n_embd, 0, ggml_nbytes(q));
+            ggml_backend_graph_compute(backend, gf);
+
+            scores.resize(ggml_nelements(s));
+            ggml_backend_tensor_get(s, scores.data(), 0, ggml_nbytes(s));
+
+            ggml_backend_buffer_free(buf0);
+            ggml_free(ctx0);
+
+            // top-k with a min-heap of the best scores
+            std::vector<vindex_cand> top;
+            top.reserve(k + 1);
+
+            for (int32_t j = 0; j < n_q; ++j) {
+                const float * sj = scores.data() + (int64_t) j*n_vec;
+
+                top.clear();
+                for (int64_t i = 0; i < n_vec; ++i) {
+                    if ((int32_t) top.size() < k) {
+                        top.push_back({ sj[i], (int32_t) i });
+                        std::push_heap(top.begin(), top.end(), std::greater<vindex_cand>());
+                    } else if (sj[i] > top.front().first) {
+                        std::pop_heap(top.begin(), top.end(), std::greater<vindex_cand>());
+                        top.back() = { sj[i], (int32_t) i };
+                        std::push_heap(top.begin(), top.end(), std::greater<vindex_cand>());
+                    }
+                }
+
+                std::sort_heap(top.begin(), top.end(), std::greater<vindex_cand>());
+
+                auto & cur = res[i0 + j];
+                cur.resize(top.size());
+                for (size_t i = 0; i < top.size(); ++i) {
+                    cur[i] = { top[i].second, top[i].first };
+                }
+            }
+        }
+    }
+
+    void search_hnsw(const float * queries, int32_t n_queries, int32_t k, std::vector<std::vector<common_vindex_match>> & res) {
+        const int32_t ef = std::max(params.ef_search, k);
+
+        const int n_threads = std::max(1, std::min(params.n_threads, n_queries));
+
+        if ((int) visited.size() < n_threads) {
+            visited.resize(n_threads);
+        }
+
+        std::atomic<int32_t> next { 0 };
+
+        auto worker = [&](int ith) {
+            std::vector<vindex_cand> cands;
+
+            for (int32_t j = next++; j < n_queries; j = next++) {
+                const float * q = queries + (int64_t) j*n_embd;
+
+                int32_t ep       = entry;
+                float   ep_score = vindex_dot(q, vec(ep), n_embd);
+
+                for (int l = max_level; l > 0; --l) {
+                    search_greedy(q, ep, ep_score, l);
+                }
+
+                search_layer(q, ep, ep_score, ef, 0, visited[ith], cands);
+
+                auto & cur = res[j];
+                cur.resize(std::min<size_t>(k, cands.size()));
+                for (size_t i = 0; i < cur.size(); ++i) {
+                    cur[i] = { cands[i].second, cands[i].first };
+                }
+            }
+        };
+
+        std::vector<std::thread> threads;
+        for (int i = 1; i < n_threads; ++i) {
+            threads.emplace_back(worker, i);
+        }
+        worker(0);
+
+        for (auto & t : threads) {
+            t.join();
+        }
+    }
+};
+
+common_vindex * common_vindex_init(const float * data, int64_t n_vec, int32_t n_embd, const common_vindex_params & params) {
+    if (n_vec <= 0 || n_embd <= 0 || n_vec > INT32_MAX) {
+        LOG_ERR("%s: invalid number of vectors (%lld) or size (%d)\n", __func__, (long long) n_vec, n_embd);
+        return nullptr;
+    }
+
+    auto * res = new common_vindex();
+
+    res->params = params;
+    res->n_vec  = n_vec;
+    res->n_embd = n_embd;
+
+    if (!res->init_backend() || !res->init_vecs(data, false)) {
+        delete res;
+        return nullptr;
+    }
+
+    if (params.type == COMMON_VINDEX_TYPE_HNSW) {
+        const int64_t t_start_us = ggml_time_us();
+
+        res->build();
+
+        LOG_INF("%s: built HNSW index of %lld vectors in %.2f s, M = %d, ef_construction = %d, layers = %d\n", __func__,
+                (long long) n_vec, (ggml_time_us() - t_start_us)/1e6, params.M, params.ef_construction, res->max_level + 1);
+    }
+
+    return res;
+}
+
+common_vindex * common_vindex_load(const std::string & fname, const common_vindex_params & params) {
+    const uint8_t * base = nullptr;
+    size_t          size = 0;
+
+    auto * res = new common_vindex();
+
+#ifndef _WIN32
+    {
+        const int fd = open(fname.c_str(), O_RDONLY);
+        if (fd < 0) {
+            delete res;
+            return nullptr;
+        }
+
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            void * addr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+            if (addr != MAP_FAILED) {
+                res->mapping      = addr;
+                res->mapping_size = st.st_size;
+            }
+        }
+        close(fd);
+
+        if (!res->mapping) {
+            LOG_ERR("%s: failed to map '%s'\n", __func__, fname.c_str());
+            delete res;
+            return nullptr;
+        }
+
+        base = (const uint8_t *) res->mapping;
+        size = res->mapping_size;
+    }
+#else
+    {
+        std::ifstream f(fname, std::ios::binary);
+        if (!f) {
+            delete res;
+            return nullptr;
+        }
+
+        res->file_buf.assign(std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>());
+
+        base = res->file_buf.data();
+        size = res->file_buf.size();
+    }
+#endif
+
+    vindex_header hdr;
+    if (size < sizeof(hdr)) {
+        LOG_ERR("%s: '%s' is too small\n", __func__, fname.c_str());
+        delete res;
+        return nullptr;
+    }
+
+    memcpy(&hdr, base, sizeof(hdr));
+
+    if (memcmp(hdr.magic, VINDEX_MAGIC, 4) != 0 || hdr.version != VINDEX_VERSION) {
+        LOG_ERR("%s: '%s' is not a vector index or has an unsupported version\n", __func__, fname.c_str());
+        delete res;
+        return nullptr;
+    }
+
+    const bool is_hnsw = hdr.type == COMMON_VINDEX_TYPE_HNSW;
+
+    // the links of all the layers are read into buffers of M0 elements, so M0 must not be less than M
+    if (hdr.n_vec <= 0 || hdr.n_vec > INT32_MAX || hdr.n_embd <= 0 || hdr.type > COMMON_VINDEX_TYPE_HNSW ||
+        (is_hnsw && (hdr.M <= 0 || hdr.M0 < hdr.M || hdr.n_links_up < 0))) {
+        LOG_ERR("%s: '%s' is corrupted\n", __func__, fname.c_str());
+        delete res;
+        return nullptr;
+    }
+
+    // the sections must fit in the file - this also keeps the offsets below from overflowing
+    const uint64_t n_elem_max = size/sizeof(int32_t);
+
+    if ((uint64_t) hdr.n_vec*hdr.n_embd > n_elem_max ||
+        (is_hnsw && ((uint64_t) hdr.n_vec*(1 + (uint64_t) hdr.M0) > n_elem_max || (uint64_t) hdr.n_links_up > n_elem_max))) {
+        LOG_ERR("%s: '%s' is truncated\n", __func__, fname.c_str());
+        delete res;
+        return nullptr;
+    }
+
+    const size_t off_vecs     = vindex_pad(sizeof(hdr));
+    const size_t off_levels   = off_vecs    + vindex_pad(sizeof(float)  *hdr.n_vec*hdr.n_embd);
+    const size_t off_offs_up  = off_levels  + vindex_pad(sizeof(int32_t)*hdr.n_vec);
+    const size_t off_links0   = off_offs_up + vindex_pad(sizeof(int64_t)*hdr.n_vec);
+    const size_t off_links_up = off_links0  + vindex_pad(sizeof(int32_t)*hdr.n_vec*(1 + hdr.M0));
+    const size_t size_exp     = is_hnsw ? off_links_up + sizeof(int32_t)*hdr.n_links_up : off_levels;
+
+    if (size < size_exp) {
+        LOG_ERR("%s: '%s' is truncated\n", __func__, fname.c_str());
+        delete res;
+        return nullptr;
+    }
+
+    res->params           = params;
+    res->params.type      = (common_vindex_type) hdr.type;
+    res->params.M         = hdr.M;
+    res->params.tag       = hdr.tag;
+
+    res->n_vec  = hdr.n_vec;
+    res->n_embd = hdr.n_embd;
+
+    if (!res->init_backend() || !res->init_vecs((const float *) (base + off_vecs), res->mapping != nullptr)) {
+        delete res;
+        return nullptr;
+    }
+
+    if (is_hnsw) {
+        res->M0         = hdr.M0;
+        res->entry      = hdr.entry;
+        res->max_level  = hdr.max_level;
+        res->n_links_up = hdr.n_links_up;
+
+        res->levels   = (const int32_t *) (base + off_levels);
+        res->offs_up  = (const int64_t *) (base + off_offs_up);
+        res->links0   = (const int32_t *) (base + off_links0);
+        res->links_up = (const int32_t *) (base + off_links_up);
+
+        if (!res->check_graph()) {
+            LOG_ERR("%s: '%s' has an invalid HNSW graph\n", __func__, fname.c_str());
+            delete res;
+            return nullptr;
+        }
+    }
+
+    return res;
+}
+
+bool common_vindex_save(const common_vindex * vindex, const std::string & fname) {
+    std::ofstream f(fname, std::ios::binary);
+    if (!f) {
+        LOG_ERR("%s: failed to open '%s' for writing\n", __func__, fname.c_str());
+        return false;
+    }
+
+    const bool is_hnsw = vindex->params.type == COMMON_VINDEX_TYPE_HNSW;
+
+    vindex_header hdr;
+    memset(&hdr, 0, sizeof(hdr));
+
+    memcpy(hdr.magic, VINDEX_MAGIC, 4);
+    hdr.version    = VINDEX_VERSION;
+    hdr.type       = vindex->params.type;
+    hdr.n_embd     = vindex->n_embd;
+    hdr.n_vec      = vindex->n_vec;
+    hdr.M          = vindex->params.M;
+    hdr.M0         = vindex->M0;
+    hdr.entry      = vindex->entry;
+    hdr.max_level  = vindex->max_level;
+    hdr.n_links_up = vindex->n_links_up;
+    hdr.tag        = vindex->params.tag;
+
+    const char zeros[VINDEX_ALIGNMENT] = { 0 };
+
+    auto write = [&](const void * src, size_t n) {
+        f.write((const char *) src, n);
+        f.write(zeros, vindex_pad(n) - n);
+    };
+
+    write(&hdr, sizeof(hdr));
+    write(vindex->data, sizeof(float)*vindex->n_vec*vindex->n_embd);
+
+    if (is_hnsw) {
+        write(vindex->levels,   sizeof(int32_t)*vindex->n_vec);
+        write(vindex->offs_up,  sizeof(int64_t)*vindex->n_vec);
+        write(vindex->links0,   sizeof(int32_t)*vindex->n_vec*(1 + vindex->M0));
+        write(vindex->links_up, sizeof(int32_t)*vindex->n_links_up);
+    }
+
+    if (!f) {
+        LOG_ERR("%s: failed to write '%s'\n", __func__, fname.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+void common_vindex_free(common_vindex * vindex) {
+    delete vindex;
+}
+
+int64_t common_vindex_n_vec(const common_vindex * vindex) {
+    return vindex->n_vec;
+}
+
+int32_t common_vindex_n_embd(const common_vindex * vindex) {
+    return vindex->n_embd;
+}
+
+const common_vindex_params & common_vindex_get_params(const common_vindex * vindex) {
+    return vindex->params;
+}
+
+void common_vindex_set_ef_search(common_vindex * vindex, int32_t ef_search) {
+    vindex->params.ef_search = ef_search;
+}
+
+std::vector<std::vector<common_vindex_match>> common_vindex_search(
+        common_vindex * vindex,
+          const float * queries,
+              int32_t   n_queries,
+              int32_t   k) {
+    std::vector<std::vector<common_vindex_match>> res(n_queries);
+
+    k = std::min<int64_t>(k, vindex->n_vec);
+    if (k <= 0 || n_queries <= 0) {
+        return res;
+    }
+
+    if (vindex->params.type == COMMON_VINDEX_TYPE_HNSW) {
+        vindex->search_hnsw(queries, n_queries, k, res);
+    } else {
+        vindex->search_flat(queries, n_queries, k, res);
+    }
+
+    return res;
+}
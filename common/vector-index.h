@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// In-process index of embedding vectors for retrieval
+//
+// the vectors are compared by inner product - normalize them to search by cosine similarity
+//
+//   - FLAT: exact search, the scores are computed as a matrix multiplication with the CPU backend
+//   - HNSW: approximate search in a Hierarchical Navigable Small World graph (https://arxiv.org/abs/1603.09320)
+//           the cost of a query grows with the log of the number of vectors, use it for large corpora
+//
+// the index can be saved to a file, which is memory-mapped when loaded
+
+enum common_vindex_type {
+    COMMON_VINDEX_TYPE_FLAT = 0,
+    COMMON_VINDEX_TYPE_HNSW = 1,
+};
+
+struct common_vindex_params {
+    common_vindex_type type = COMMON_VINDEX_TYPE_FLAT;
+
+    int32_t n_threads = 4;
+
+    // HNSW
+    int32_t  M               = 16;  // max number of links of a node on the upper layers (2*M on the bottom layer)
+    int32_t  ef_construction = 128; // number of candidates considered when linking a new node
+    int32_t  ef_search       = 64;  // number of candidates considered when searching (at least k)
+    uint32_t seed            = 0;   // RNG seed for the layers of the nodes
+
+    uint64_t tag = 0; // user value stored with the index, e.g. a hash of the data the vectors were computed from
+};
+
+struct common_vindex_match {
+    int64_t id;
+    float   score;
+};
+
+struct common_vindex;
+
+// build an index of n_vec vectors with n_embd elements each, the data is copied
+common_vindex * common_vindex_init(const float * data, int64_t n_vec, int32_t n_embd, const common_vindex_params & params);
+
+// load an index saved with common_vindex_save()
+// only n_threads and ef_search are used from the params, the rest is read from the file
+common_vindex * common_vindex_load(const std::string & fname, const common_vindex_params & params);
+
+bool common_vindex_save(const common_vindex * vindex, const std::string & fname);
+
+void common_vindex_free(common_vindex * vindex);
+
+int64_t common_vindex_n_vec (const common_vindex * vindex);
+int32_t common_vindex_n_embd(const common_vindex * vindex);
+
+const common_vindex_params & common_vindex_get_params(const common_vindex * vindex);
+
+void common_vindex_set_ef_search(common_vindex * vindex, int32_t ef_search);
+
+// find the k vectors with the highest inner product with each of the n_queries queries
+// the matches of each query are sorted by decreasing score
+// the search buffers are owned by the index, so it must not be searched from multiple threads at the same time
+std::vector<std::vector<common_vindex_match>> common_vindex_search(
+        common_vindex * vindex,
+          const float * queries,
+              int32_t   n_queries,
+              int32_t   k);
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <list>
+#include <vector>
+
+// LRU cache of image embeddings, most recently used first
+//
+// the entries are found by a hash of the image, and the size and the pixels of the image are compared to rule out
+// collisions - so the pixels are kept with the embedding, and they count towards the size of the cache
+struct clip_embd_cache {
+    struct entry {
+        uint64_t hash;
+        int      nx;
+        int      ny;
+        int      n_pos;
+
+        std::vector<uint8_t> pixels;
+        std::vector<float>   embd;
+
+        size_t size() const {
+            return pixels.size() + embd.size()*sizeof(float);
+        }
+    };
+
+    std::list<entry> entries;
+
+    size_t size     = 0;
+    size_t max_size = 256u*1024*1024;
+
+    // FNV-1a over the size and the pixels
+    static uint64_t hash(int nx, int ny, const uint8_t * data, size_t n) {
+        uint64_t hash = 0xcbf29ce484222325ULL;
+        auto add = [&](uint64_t v) {
+            hash ^= v;
+            hash *= 0x100000001b3ULL;
+        };
+
+        add(nx);
+        add(ny);
+
+        size_t i = 0;
+        for (; i + 8 <= n; i += 8) {
+            uint64_t v;
+            memcpy(&v, data + i, sizeof(v));
+            add(v);
+        }
+        for (; i < n; i++) {
+            add(data[i]);
+        }
+
+        return hash;
+    }
+
+    void set_max_size(size_t max_size_new) {
+        max_size = max_size_new;
+
+        evict(0);
+    }
+
+    // the entry of the image, which becomes the most recently used, or nullptr
+    const entry * get(int nx, int ny, const uint8_t * data, size_t n) {
+        auto it = find(hash(nx, ny, data, n), nx, ny, data, n);
+        if (it == entries.end()) {
+            return nullptr;
+        }
+
+        entries.splice(entries.begin(), entries, it);
+
+        return &entries.front();
+    }
+
+    void put(int nx, int ny, const uint8_t * data, size_t n, const float * embd, size_t n_embd, int n_pos) {
+        const size_t size_new = n + n_embd*sizeof(float);
+
+        if (size_new > max_size) {
+            return;
+        }
+
+        const uint64_t h = hash(nx, ny, data, n);
+
+        auto it = find(h, nx, ny, data, n);
+        if (it != entries.end()) {
+            size -= it->size();
+            entries.erase(it);
+        }
+
+        evict(size_new);
+
+        entries.push_front({ h, nx, ny, n_pos, std::vector<uint8_t>(data, data + n), std::vector<float>(embd, embd + n_embd) });
+        size += size_new;
+    }
+
+private:
+    std::list<entry>::iterator find(uint64_t h, int nx, int ny, const uint8_t * data, size_t n) {
+        for (auto it = entries.begin(); it != entries.end(); ++it) {
+            if (it->hash == h && it->nx == nx && it->ny == ny && it->pixels.size() == n && memcmp(it->pixels.data(), data, n) == 0) {
+                return it;
+            }
+        }
+
+        return entries.end();
+    }
+
+    // evict the least recently used entries until size_new more bytes fit in the cache
+    void evict(size_t size_new) {
+        while (!entries.empty() && size + size_new > max_size) {
+            size -= entries.back().size();
+            entries.pop_back();
+        }
+    }
+};
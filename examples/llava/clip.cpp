@@ -3,6 +3,7 @@
 // I'll gradually clean and extend it
 // Note: Even when using identical normalized image inputs (see normalize_image_u8_to_f32()) we have a significant difference in resulting embeddings compared to pytorch
 #include "clip.h"
+#include "clip-embd-cache.h"
 #include "ggml.h"
 #include "ggml-cpp.h"
 #include "ggml-cpu.h"
@@ -21,6 +22,7 @@
 #include <map>
 #include <regex>
 #include <stdexcept>
+#include <thread>
 #include <unordered_set>
 #include <vector>
 #include <sstream>
@@ -605,6 +607,11 @@ struct clip_ctx {
 
     struct clip_image_size * load_image_size = nullptr;
 
+    clip_embd_cache embd_cache;
+
+    // threads of the image preprocessing
+    int n_threads = GGML_DEFAULT_N_THREADS;
+
     clip_ctx(clip_context_params & ctx_params) {
         backend_cpu = ggml_backend_init_by_type(GGML_BACKEND_DEVICE_TYPE_CPU, nullptr);
         backend     = ctx_params.use_gpu
@@ -639,6 +646,11 @@ struct clip_ctx {
     }
 };
 
+// the llava MLP projectors work on each image independently, so several images of the same size can be encoded in one graph
+static bool clip_can_batch(const clip_ctx * ctx) {
+    return ctx->has_llava_projector && (ctx->proj_type == PROJECTOR_TYPE_MLP || ctx->proj_type == PROJECTOR_TYPE_MLP_NORM);
+}
+
 static ggml_cgraph * clip_image_build_graph_siglip(clip_ctx * ctx, const clip_image_f32_batch * imgs) {
     const auto & model = ctx->vision_model;
     const auto & hparams = model.hparams;
@@ -837,7 +849,7 @@ static ggml_cgraph * clip_image_build_graph_legacy(clip_ctx * ctx, const clip_im
 
     const int batch_size = imgs->size;
 
-    if (ctx->has_llava_projector || ctx->has_minicpmv_projector || ctx->has_glm_projector) {
+    if ((ctx->has_llava_projector && !clip_can_batch(ctx)) || ctx->has_minicpmv_projector || ctx->has_glm_projector) {
         GGML_ASSERT(batch_size == 1);
     }
 
@@ -892,7 +904,13 @@ static ggml_cgraph * clip_image_build_graph_legacy(clip_ctx * ctx, const clip_im
             embeddings = ggml_new_tensor_3d(ctx0, GGML_TYPE_F32, hidden_size, num_positions, batch_size);
             ggml_set_name(embeddings, "embeddings");
             ggml_set_input(embeddings);
-            embeddings = ggml_acc(ctx0, embeddings, model.class_embedding,
+
+            // one class embedding in front of the patches of each image
+            struct ggml_tensor * class_embd = model.class_embedding;
+            if (batch_size > 1) {
+                class_embd = ggml_repeat(ctx0, class_embd, ggml_new_tensor_3d(ctx0, GGML_TYPE_F32, hidden_size, 1, batch_size));
+            }
+            embeddings = ggml_acc(ctx0, embeddings, class_embd,
                     embeddings->nb[1], embeddings->nb[2], embeddings->nb[3], 0);
             embeddings = ggml_acc(ctx0, embeddings, inp,
                     embeddings->nb[1], embeddings->nb[2], embeddings->nb[3], model.class_embedding->nb[1]);
@@ -1057,14 +1075,14 @@ static ggml_cgraph * clip_image_build_graph_legacy(clip_ctx * ctx, const clip_im
 
     // llava projector
     if (ctx->has_llava_projector) {
-        embeddings = ggml_reshape_2d(ctx0, embeddings, embeddings->ne[0], embeddings->ne[1]);
+        embeddings = ggml_reshape_3d(ctx0, embeddings, embeddings->ne[0], embeddings->ne[1], batch_size);
 
-        struct ggml_tensor * patches = ggml_new_tensor_1d(ctx0, GGML_TYPE_I32, num_patches);
+        struct ggml_tensor * patches = ggml_new_tensor_2d(ctx0, GGML_TYPE_I32, num_patches, batch_size);
         ggml_set_name(patches, "patches");
         ggml_set_input(patches);
 
-        // shape [1, 576, 1024]
-        // ne is whcn, ne = [1024, 576, 1, 1]
+        // shape [b, 576, 1024]
+        // ne is whcn, ne = [1024, 576, b, 1]
         embeddings = ggml_get_rows(ctx0, embeddings, patches);
 
         // print_tensor_info(embeddings, "embeddings");
@@ -1990,12 +2008,34 @@ bool clip_image_load_from_bytes(const unsigned char * bytes, size_t bytes_length
     return true;
 }
 
+// process the rows [0, n_rows) of an image in chunks on up to n_threads threads, f(y0, y1) handles the rows [y0, y1)
+template <typename F>
+static void clip_parallel_rows(int n_threads, int n_rows, const F & f) {
+    n_threads = std::min(n_threads, std::max(1, n_rows / 32));
+    if (n_threads <= 1) {
+        f(0, n_rows);
+        return;
+    }
+
+    const int n_rows_per_thread = (n_rows + n_threads - 1) / n_threads;
+
+    std::vector<std::thread> workers;
+    for (int y0 = n_rows_per_thread; y0 < n_rows; y0 += n_rows_per_thread) {
+        workers.emplace_back(f, y0, std::min(n_rows, y0 + n_rows_per_thread));
+    }
+    f(0, n_rows_per_thread);
+
+    for (auto & w : workers) {
+        w.join();
+    }
+}
+
 // Linear interpolation between two points
 inline float clip_lerp(float s, float e, float t) {
     return s + (e - s) * t;
 }
 // Bilinear resize function
-static void bilinear_resize(const clip_image_u8& src, clip_image_u8& dst, int target_width, int target_height) {
+static void bilinear_resize(const clip_image_u8& src, clip_image_u8& dst, int target_width, int target_height, int n_threads) {
     dst.nx = target_width;
     dst.ny = target_height;
     dst.buf.resize(3 * target_width * target_height);
@@ -2003,49 +2043,55 @@ static void bilinear_resize(const clip_image_u8& src, clip_image_u8& dst, int ta
     float x_ratio = static_cast<float>(src.nx - 1) / target_width;
     float y_ratio = static_cast<float>(src.ny - 1) / target_height;
 
-    for (int y = 0; y < target_height; y++) {
-        for (int x = 0; x < target_width; x++) {
-            float px = x_ratio * x;
-            float py = y_ratio * y;
-            int x_floor = static_cast<int>(px);
-            int y_floor = static_cast<int>(py);
-            float x_lerp = px - x_floor;
-            float y_lerp = py - y_floor;
-
-            for (int c = 0; c < 3; c++) {
-                float top = clip_lerp(
-                    static_cast<float>(src.buf[3 * (y_floor * src.nx + x_floor) + c]),
-                    static_cast<float>(src.buf[3 * (y_floor * src.nx + (x_floor + 1)) + c]),
-                    x_lerp
-                );
-                float bottom = clip_lerp(
-                    static_cast<float>(src.buf[3 * ((y_floor + 1) * src.nx + x_floor) + c]),
-                    static_cast<float>(src.buf[3 * ((y_floor + 1) * src.nx + (x_floor + 1)) + c]),
-                    x_lerp
-                );
-                dst.buf[3 * (y * target_width + x) + c] = static_cast<uint8_t>(clip_lerp(top, bottom, y_lerp));
+    clip_parallel_rows(n_threads, target_height, [&](int y_start, int y_end) {
+        for (int y = y_start; y < y_end; y++) {
+            for (int x = 0; x < target_width; x++) {
+                float px = x_ratio * x;
+                float py = y_ratio * y;
+                int x_floor = static_cast<int>(px);
+                int y_floor = static_cast<int>(py);
+                float x_lerp = px - x_floor;
+                float y_lerp = py - y_floor;
+
+                for (int c = 0; c < 3; c++) {
+                    float top = clip_lerp(
+                        static_cast<float>(src.buf[3 * (y_floor * src.nx + x_floor) + c]),
+                        static_cast<float>(src.buf[3 * (y_floor * src.nx + (x_floor + 1)) + c]),
+                        x_lerp
+                    );
+                    float bottom = clip_lerp(
+                        static_cast<float>(src.buf[3 * ((y_floor + 1) * src.nx + x_floor) + c]),
+                        static_cast<float>(src.buf[3 * ((y_floor + 1) * src.nx + (x_floor + 1)) + c]),
+                        x_lerp
+                    );
+                    dst.buf[3 * (y * target_width + x) + c] = static_cast<uint8_t>(clip_lerp(top, bottom, y_lerp));
+                }
             }
         }
-    }
+    });
 }
 
 // Normalize image to float32 - careful with pytorch .to(model.device, dtype=torch.float16) - this sometimes reduces precision (32>16>32), sometimes not
-static void normalize_image_u8_to_f32(const clip_image_u8* src, clip_image_f32* dst, const float mean[3], const float std[3]) {
+static void normalize_image_u8_to_f32(const clip_image_u8* src, clip_image_f32* dst, const float mean[3], const float std[3], int n_threads) {
     dst->nx = src->nx;
     dst->ny = src->ny;
     dst->buf.resize(src->buf.size());
 
-    for (size_t i = 0; i < src->buf.size(); ++i) {
-        int c = i % 3; // rgb
-        dst->buf[i] = (static_cast<float>(src->buf[i]) / 255.0f - mean[c]) / std[c];
-    }
+    const size_t n_row = 3 * (size_t) src->nx;
+
+    clip_parallel_rows(n_threads, src->ny, [&](int y_start, int y_end) {
+        for (size_t i = y_start * n_row; i < y_end * n_row; ++i) {
+            int c = i % 3; // rgb
+            dst->buf[i] = (static_cast<float>(src->buf[i]) / 255.0f - mean[c]) / std[c];
+        }
+    });
 }
 
 inline int clip(int x, int lower, int upper) {
     return std::max(lower, std::min(x, upper));
 }
 
-static bool bicubic_resize(const clip_image_u8 &img, clip_image_u8 &dst, int target_width, int target_height) {
+static bool bicubic_resize(const clip_image_u8 &img, clip_image_u8 &dst, int target_width, int target_height, int n_threads) {
     const int nx = img.nx;
     const int ny = img.ny;
 
@@ -2053,63 +2099,64 @@ static bool bicubic_resize(const clip_image_u8 &img, clip_image_u8 &dst, int tar
     dst.ny = target_height;
     dst.buf.resize(3 * target_width * target_height);
 
-    float Cc;
-    float C[5];
-    float d0, d2, d3, a0, a1, a2, a3;
-    int i, j, k, jj;
-    int x, y;
-    float dx, dy;
-    float tx, ty;
-
-    tx = (float)nx / (float)target_width;
-    ty = (float)ny / (float)target_height;
+    const float tx = (float)nx / (float)target_width;
+    const float ty = (float)ny / (float)target_height;
 
     // Bicubic interpolation; adapted from ViT.cpp, inspired from :
     //    -> https://github.com/yglukhov/bicubic-interpolation-image-processing/blob/master/libimage.c#L36
     //    -> https://en.wikipedia.org/wiki/Bicubic_interpolation
 
-    for (i = 0; i < target_height; i++) {
-        for (j = 0; j < target_width; j++) {
-            x = (int)(tx * j);
-            y = (int)(ty * i);
-
-            dx = tx * j - x;
-            dy = ty * i - y;
-
-            for (k = 0; k < 3; k++) {
-                for (jj = 0; jj <= 3; jj++) {
-                    d0 = img.buf[(clip(y - 1 + jj, 0, ny - 1) * nx + clip(x - 1, 0, nx - 1)) * 3 + k] - img.buf[(clip(y - 1 + jj, 0, ny - 1) * nx + clip(x, 0, nx - 1)) * 3 + k];
-                    d2 = img.buf[(clip(y - 1 + jj, 0, ny - 1) * nx + clip(x + 1, 0, nx - 1)) * 3 + k] - img.buf[(clip(y - 1 + jj, 0, ny - 1) * nx + clip(x, 0, nx - 1)) * 3 + k];
-                    d3 = img.buf[(clip(y - 1 + jj, 0, ny - 1) * nx + clip(x + 2, 0, nx - 1)) * 3 + k] - img.buf[(clip(y - 1 + jj, 0, ny - 1) * nx + clip(x, 0, nx - 1)) * 3 + k];
-                    a0 = img.buf[(clip(y - 1 + jj, 0, ny - 1) * nx + clip(x, 0, nx - 1)) * 3 + k];
-
-                    a1 = -1.0 / 3 * d0 + d2 - 1.0 / 6 * d3;
-                    a2 =  1.0 / 2 * d0 +      1.0 / 2 * d2;
-                    a3 = -1.0 / 6 * d0 -      1.0 / 2 * d2 + 1.0 / 6 * d3;
-
-                    C[jj] = a0 + a1 * dx + a2 * dx * dx + a3 * dx * dx * dx;
-
-                    d0 = C[0] - C[1];
-                    d2 = C[2] - C[1];
-                    d3 = C[3] - C[1];
-                    a0 = C[1];
-                    a1 = -1.0 / 3 * d0 + d2 - 1.0 / 6 * d3;
-                    a2 =  1.0 / 2 * d0 +      1.0 / 2 * d2;
-                    a3 = -1.0 / 6 * d0 -      1.0 / 2 * d2 + 1.0 / 6 * d3;
-                    Cc = a0 + a1 * dy + a2 * dy * dy + a3 * dy * dy * dy;
-
-                    const uint8_t Cc2 = std::min(std::max(std::round(Cc), 0.0f), 255.0f);
-                    dst.buf[(i * target_width + j) * 3 + k] = float(Cc2);
+    clip_parallel_rows(n_threads, target_height, [&](int i_start, int i_end) {
+        float Cc;
+        float C[5];
+        float d0, d2, d3, a0, a1, a2, a3;
+        int j, k, jj;
+        int x, y;
+        float dx, dy;
+
+        for (int i = i_start; i < i_end; i++) {
+            for (j = 0; j < target_width; j++) {
+                x = (int)(tx * j);
+                y = (int)(ty * i);
+
+                dx = tx * j - x;
+                dy = ty * i - y;
+
+                for (k = 0; k < 3; k++) {
+                    for (jj = 0; jj <= 3; jj++) {
+                        d0 = img.buf[(clip(y - 1 + jj, 0, ny - 1) * nx + clip(x - 1, 0, nx - 1)) * 3 + k] - img.buf[(clip(y - 1 + jj, 0, ny - 1) * nx + clip(x, 0, nx - 1)) * 3 + k];
+                        d2 = img.buf[(clip(y - 1 + jj, 0, ny - 1) * nx + clip(x + 1, 0, nx - 1)) * 3 + k] - img.buf[(clip(y - 1 + jj, 0, ny - 1) * nx + clip(x, 0, nx - 1)) * 3 + k];
+                        d3 = img.buf[(clip(y - 1 + jj, 0, ny - 1) * nx + clip(x + 2, 0, nx - 1)) * 3 + k] - img.buf[(clip(y - 1 + jj, 0, ny - 1) * nx + clip(x, 0, nx - 1)) * 3 + k];
+                        a0 = img.buf[(clip(y - 1 + jj, 0, ny - 1) * nx + clip(x, 0, nx - 1)) * 3 + k];
+
+                        a1 = -1.0 / 3 * d0 + d2 - 1.0 / 6 * d3;
+                        a2 =  1.0 / 2 * d0 +      1.0 / 2 * d2;
+                        a3 = -1.0 / 6 * d0 -      1.0 / 2 * d2 + 1.0 / 6 * d3;
+
+                        C[jj] = a0 + a1 * dx + a2 * dx * dx + a3 * dx * dx * dx;
+
+                        d0 = C[0] - C[1];
+                        d2 = C[2] - C[1];
+                        d3 = C[3] - C[1];
+                        a0 = C[1];
+                        a1 = -1.0 / 3 * d0 + d2 - 1.0 / 6 * d3;
+                        a2 =  1.0 / 2 * d0 +      1.0 / 2 * d2;
+                        a3 = -1.0 / 6 * d0 -      1.0 / 2 * d2 + 1.0 / 6 * d3;
+                        Cc = a0 + a1 * dy + a2 * dy * dy + a3 * dy * dy * dy;
+
+                        const uint8_t Cc2 = std::min(std::max(std::round(Cc), 0.0f), 255.0f);
+                        dst.buf[(i * target_width + j) * 3 + k] = float(Cc2);
+                    }
                 }
             }
         }
-    }
+    });
 
     return true;
 }
 
 // llava-1.6 type of resize_and_pad (black)
-static void resize_and_pad_image(const clip_image_u8& image, clip_image_u8 &image_output, const std::pair<int, int>& target_resolution) {
+static void resize_and_pad_image(const clip_image_u8& image, clip_image_u8 &image_output, const std::pair<int, int>& target_resolution, int n_threads) {
     int target_width = target_resolution.first;
     int target_height = target_resolution.second;
 
@@ -2127,8 +2174,8 @@ static void resize_and_pad_image(const clip_image_u8& image, clip_image_u8 &imag
     }
 
     clip_image_u8 resized_image;
-    // bilinear_resize(image, resized_image, new_width, new_height);
-    bicubic_resize(image, resized_image, new_width, new_height);
+    // bilinear_resize(image, resized_image, new_width, new_height, n_threads);
+    bicubic_resize(image, resized_image, new_width, new_height, n_threads);
 
     clip_image_u8 padded_image;
     padded_image.nx = target_width;
@@ -2281,7 +2328,7 @@ static std::pair<int, int> uhd_best_grid(const int max_slice_nums, const int mul
 //    -> https://arxiv.org/pdf/2403.11703
 //    -> https://github.com/thunlp/LLaVA-UHD
 //    -> https://github.com/thunlp/LLaVA-UHD/blob/302301bc2175f7e717fb8548516188e89f649753/llava_uhd/train/llava-uhd/slice_logic.py#L118
-static std::vector<std::vector<clip_image_u8 *>> uhd_slice_image(const clip_image_u8 * img, const int max_slice_nums=9, const int scale_resolution=448, const int patch_size=14) {
+static std::vector<std::vector<clip_image_u8 *>> uhd_slice_image(const clip_image_u8 * img, const int n_threads, const int max_slice_nums=9, const int scale_resolution=448, const int patch_size=14) {
     const std::pair<int, int> original_size={img->nx,img->ny};
     const int original_width = img->nx;
     const int original_height = img->ny;
@@ -2296,14 +2343,14 @@ static std::vector<std::vector<clip_image_u8 *>> uhd_slice_image(const clip_imag
     if (multiple <= 1) {
         auto best_size = uhd_find_best_resize(original_size, scale_resolution, patch_size, true);
         clip_image_u8 * source_image = clip_image_u8_init();
-        bicubic_resize(*img, *source_image, best_size.first, best_size.second);
+        bicubic_resize(*img, *source_image, best_size.first, best_size.second, n_threads);
         // source_image = image.resize(best_size, Image.Resampling.BICUBIC)
         images[images.size()-1].push_back(source_image);
     }
     else if (multiple > 1) {
         auto best_size = uhd_find_best_resize(original_size, scale_resolution, patch_size);
         clip_image_u8 * source_image = clip_image_u8_init();
-        bicubic_resize(*img, *source_image, best_size.first, best_size.second);
+        bicubic_resize(*img, *source_image, best_size.first, best_size.second, n_threads);
         // source_image = image.copy().resize(best_resize, Image.Resampling.BICUBIC)
         LOG_INF("%s: image_size: %d %d; source_image size: %d %d\n", __func__, img->nx, img->ny, best_size.first, best_size.second);
         images[images.size()-1].push_back(source_image);
@@ -2313,7 +2360,7 @@ static std::vector<std::vector<clip_image_u8 *>> uhd_slice_image(const clip_imag
 
         auto refine_size = uhd_get_refine_size(original_size, best_grid, scale_resolution, patch_size, true);
         clip_image_u8 * refine_image = clip_image_u8_init();
-        bicubic_resize(*img, *refine_image, refine_size.first, refine_size.second);
+        bicubic_resize(*img, *refine_image, refine_size.first, refine_size.second, n_threads);
 
         LOG_INF("%s: refine_image_size: %d %d; refine_size: %d %d\n", __func__, refine_image->nx, refine_image->ny, refine_size.first, refine_size.second);
 
@@ -2364,7 +2411,7 @@ bool clip_image_preprocess(struct clip_ctx * ctx, const clip_image_u8 * img, cli
 
     if(clip_is_minicpmv(ctx)){
         int max_slice_nums = 9;
-        std::vector<std::vector<clip_image_u8 *>> imgs = uhd_slice_image(img, max_slice_nums);
+        std::vector<std::vector<clip_image_u8 *>> imgs = uhd_slice_image(img, ctx->n_threads, max_slice_nums);
         res_imgs->size = 0;
         for (size_t i = 0; i < imgs.size(); ++i){
             res_imgs->size += imgs[i].size();
@@ -2375,7 +2422,7 @@ bool clip_image_preprocess(struct clip_ctx * ctx, const clip_image_u8 * img, cli
             for (size_t j = 0; j < imgs[i].size(); ++j) {
                 LOG_DBG("%s: %d %d\n", __func__,imgs[i][j]->nx,imgs[i][j]->ny);
                 clip_image_f32 * res = clip_image_f32_init();
-                normalize_image_u8_to_f32(imgs[i][j], res, ctx->image_mean, ctx->image_std);
+                normalize_image_u8_to_f32(imgs[i][j], res, ctx->image_mean, ctx->image_std, ctx->n_threads);
                 res_imgs->data[idx++] = *res;
                 clip_image_f32_free(res);
             }
@@ -2394,11 +2441,11 @@ bool clip_image_preprocess(struct clip_ctx * ctx, const clip_image_u8 * img, cli
         auto patch_size = clip_patch_size(ctx) * 2;
         int nx = ceil((float)img->nx / patch_size) * patch_size;
         int ny = ceil((float)img->ny / patch_size) * patch_size;
-        bicubic_resize(*img, *resized, nx, ny);
+        bicubic_resize(*img, *resized, nx, ny, ctx->n_threads);
 
         res_imgs->data = new clip_image_f32[1];
         // clip_image_f32 * res = clip_image_f32_init();
-        normalize_image_u8_to_f32(resized, res_imgs->data, ctx->image_mean, ctx->image_std);
+        normalize_image_u8_to_f32(resized, res_imgs->data, ctx->image_mean, ctx->image_std, ctx->n_threads);
         // res_imgs->data[0] = *res;
         res_imgs->size = 1;
 
@@ -2412,10 +2459,10 @@ bool clip_image_preprocess(struct clip_ctx * ctx, const clip_image_u8 * img, cli
         res_imgs->data = new clip_image_f32[res_imgs->size];
         clip_image_u8 resized_image;
         int32_t sz=ctx->vision_model.hparams.image_size;
-        bicubic_resize(*img, resized_image,sz,sz);
+        bicubic_resize(*img, resized_image,sz,sz, ctx->n_threads);
         clip_image_f32 * res = clip_image_f32_init();
         //clip_image_save_to_bmp(resized_image, "resized.bmp");
-        normalize_image_u8_to_f32(&resized_image, res, ctx->image_mean, ctx->image_std);
+        normalize_image_u8_to_f32(&resized_image, res, ctx->image_mean, ctx->image_std, ctx->n_threads);
         res_imgs->data[0] = *res;
         clip_image_f32_free(res);
         return true;
@@ -2473,10 +2520,10 @@ bool clip_image_preprocess(struct clip_ctx * ctx, const clip_image_u8 * img, cli
             }
             std::pair<int, int> best_resolution = select_best_resolution({img->nx, img->ny}, possible_resolutions);
             // clip_image_save_to_bmp(*img, "input.bmp");
-            resize_and_pad_image(*img, *temp, best_resolution);  // we do not pad with mean-bg color anymore in llava-1.6
+            resize_and_pad_image(*img, *temp, best_resolution, ctx->n_threads);  // we do not pad with mean-bg color anymore in llava-1.6
             // clip_image_save_to_bmp(*temp, "resized.bmp");
             // visually verify normalized image:
-            // normalize_image_u8_to_f32(*temp, *res, ctx->image_mean, ctx->image_std);
+            // normalize_image_u8_to_f32(*temp, *res, ctx->image_mean, ctx->image_std, ctx->n_threads);
             // {
             //     clip_image_u8 * temp2 = clip_image_u8_init();
             //     clip_image_convert_f32_to_u8(*res, *temp2);
@@ -2487,15 +2534,15 @@ bool clip_image_preprocess(struct clip_ctx * ctx, const clip_image_u8 * img, cli
             std::vector<clip_image_u8 *> patches = divide_to_patches_u8(*temp, params.image_size); // prepare spatial sorted main patches of image_size each (336 in llava-1.6)
 
             clip_image_u8 *image_original_resize = clip_image_u8_init();
-            // bilinear_resize(*img, *image_original_resize, params.image_size, params.image_size); // in python this is "shortest_edge", but all CLIP are square
-            bicubic_resize(*img, *image_original_resize, params.image_size, params.image_size); // in python this is "shortest_edge", but all CLIP are square
+            // bilinear_resize(*img, *image_original_resize, params.image_size, params.image_size, ctx->n_threads); // in python this is "shortest_edge", but all CLIP are square
+            bicubic_resize(*img, *image_original_resize, params.image_size, params.image_size, ctx->n_threads); // in python this is "shortest_edge", but all CLIP are square
             patches.insert(patches.begin(), image_original_resize);
             // clip_image_f32_batch_init(patches.size());
             res_imgs->size = patches.size();
             res_imgs->data = new clip_image_f32[res_imgs->size];
             int num=0;
             for (auto& patch : patches) {
-                normalize_image_u8_to_f32(patch, &res_imgs->data[num], ctx->image_mean, ctx->image_std);
+                normalize_image_u8_to_f32(patch, &res_imgs->data[num], ctx->image_mean, ctx->image_std, ctx->n_threads);
                 num++;
             }
 
@@ -2534,45 +2581,47 @@ bool clip_image_preprocess(struct clip_ctx * ctx, const clip_image_u8 * img, cli
     const auto & m3 = ctx->image_mean; // {0.48145466f, 0.4578275f, 0.40821073f};
     const auto & s3 = ctx->image_std;  // {0.26862954f, 0.26130258f, 0.27577711f};
 
-    for (int y = 0; y < ny3; y++) {
-        for (int x = 0; x < nx3; x++) {
-            for (int c = 0; c < 3; c++) {
-                // linear interpolation
-                const float sx = (x + 0.5f) * scale - 0.5f;
-                const float sy = (y + 0.5f) * scale - 0.5f;
+    clip_parallel_rows(ctx->n_threads, ny3, [&](int y_start, int y_end) {
+        for (int y = y_start; y < y_end; y++) {
+            for (int x = 0; x < nx3; x++) {
+                for (int c = 0; c < 3; c++) {
+                    // linear interpolation
+                    const float sx = (x + 0.5f) * scale - 0.5f;
+                    const float sy = (y + 0.5f) * scale - 0.5f;
 
-                const int x0 = std::max(0, (int)std::floor(sx));
-                const int y0 = std::max(0, (int)std::floor(sy));
+                    const int x0 = std::max(0, (int)std::floor(sx));
+                    const int y0 = std::max(0, (int)std::floor(sy));
 
-                const int x1 = std::min(x0 + 1, nx - 1);
-                const int y1 = std::min(y0 + 1, ny - 1);
+                    const int x1 = std::min(x0 + 1, nx - 1);
+                    const int y1 = std::min(y0 + 1, ny - 1);
 
-                const float dx = sx - x0;
-                const float dy = sy - y0;
+                    const float dx = sx - x0;
+                    const float dy = sy - y0;
 
-                const int j00 = 3 * (y0 * nx + x0) + c;
-                const int j01 = 3 * (y0 * nx + x1) + c;
-                const int j10 = 3 * (y1 * nx + x0) + c;
-                const int j11 = 3 * (y1 * nx + x1) + c;
+                    const int j00 = 3 * (y0 * nx + x0) + c;
+                    const int j01 = 3 * (y0 * nx + x1) + c;
+                    const int j10 = 3 * (y1 * nx + x0) + c;
+                    const int j11 = 3 * (y1 * nx + x1) + c;
 
-                const float v00 = temp->buf[j00];
-                const float v01 = temp->buf[j01];
-                const float v10 = temp->buf[j10];
-                const float v11 = temp->buf[j11];
+                    const float v00 = temp->buf[j00];
+                    const float v01 = temp->buf[j01];
+                    const float v10 = temp->buf[j10];
+                    const float v11 = temp->buf[j11];
 
-                const float v0 = v00 * (1.0f - dx) + v01 * dx;
-                const float v1 = v10 * (1.0f - dx) + v11 * dx;
+                    const float v0 = v00 * (1.0f - dx) + v01 * dx;
+                    const float v1 = v10 * (1.0f - dx) + v11 * dx;
 
-                const float v = v0 * (1.0f - dy) + v1 * dy;
+                    const float v = v0 * (1.0f - dy) + v1 * dy;
 
-                const uint8_t v2 = std::min(std::max(std::round(v), 0.0f), 255.0f);
+                    const uint8_t v2 = std::min(std::max(std::round(v), 0.0f), 255.0f);
 
-                const int i = 3 * (y * nx3 + x) + c;
+                    const int i = 3 * (y * nx3 + x) + c;
 
-                res->buf[i] = ((float(v2) / 255.0f) - m3[c]) / s3[c];
+                    res->buf[i] = ((float(v2) / 255.0f) - m3[c]) / s3[c];
+                }
             }
         }
-    }
+    });
     clip_image_u8_free(temp);
 
     // {
@@ -2777,8 +2826,16 @@ bool clip_image_batch_encode(clip_ctx * ctx, const int n_threads, const clip_ima
     }
 
     int batch_size = imgs->size;
-    if (ctx->has_llava_projector) {
-        GGML_ASSERT(batch_size == 1); // TODO: support multiple images
+    if (batch_size > 1 && ((ctx->has_llava_projector && !clip_can_batch(ctx)) || ctx->proj_type == PROJECTOR_TYPE_GEMMA3)) {
+        // the graph of these projectors takes a single image - encode the images one after the other
+        for (size_t i = 0; i < imgs->size; i++) {
+            clip_image_f32_batch img = { &imgs->data[i], 1 };
+            if (!clip_image_batch_encode(ctx, n_threads, &img, vec)) {
+                return false;
+            }
+            vec += clip_embd_nbytes(ctx) / sizeof(float);
+        }
+        return true;
     }
     if (ctx->has_minicpmv_projector) {
         GGML_ASSERT(batch_size == 1);
@@ -2819,21 +2876,21 @@ bool clip_image_batch_encode(clip_ctx * ctx, const int n_threads, const clip_ima
         struct ggml_tensor * inp_raw = ggml_graph_get_tensor(gf, "inp_raw");
         float * data = (float *)malloc(ggml_nbytes(inp_raw));
 
-        for (size_t i = 0; i < imgs->size; i++) {
-            const int nx = imgs->data[i].nx;
-            const int ny = imgs->data[i].ny;
+        for (int b = 0; b < batch_size; b++) {
+            const int nx = imgs->data[b].nx;
+            const int ny = imgs->data[b].ny;
             if (!(ctx->has_minicpmv_projector | ctx->has_qwen2vl_merger)) {
                 GGML_ASSERT(nx == image_size && ny == image_size);
+            } else {
+                GGML_ASSERT(nx == image_size_width && ny == image_size_height);
             }
 
             const int n = nx * ny;
 
-            for (int b = 0; b < batch_size; b++) {
-                for (int k = 0; k < 3; k++) {
-                    for (int y = 0; y < ny; y++) {
-                        for (int x = 0; x < nx; x++) {
-                            data[(b * 3 * n) + k * n + y * nx + x] = imgs->data[b].buf[3 * (y * nx + x) + k];
-                        }
+            for (int k = 0; k < 3; k++) {
+                for (int y = 0; y < ny; y++) {
+                    for (int x = 0; x < nx; x++) {
+                        data[(b * 3 * n) + k * n + y * nx + x] = imgs->data[b].buf[3 * (y * nx + x) + k];
                     }
                 }
             }
@@ -2952,8 +3009,10 @@ bool clip_image_batch_encode(clip_ctx * ctx, const int n_threads, const clip_ima
                 // when retrieving the rows.
                 int patch_offset = ctx->has_class_embedding ? 1 : 0;
                 int* patches_data = (int*)malloc(ggml_nbytes(patches));
-                for (int i = 0; i < num_patches; i++) {
-                    patches_data[i] = i + patch_offset;
+                for (int b = 0; b < batch_size; b++) {
+                    for (int i = 0; i < num_patches; i++) {
+                        patches_data[b * num_patches + i] = i + patch_offset;
+                    }
                 }
                 ggml_backend_tensor_set(patches, patches_data, 0, ggml_nbytes(patches));
                 free(patches_data);
@@ -2985,6 +3044,33 @@ bool clip_image_batch_encode(clip_ctx * ctx, const int n_threads, const clip_ima
     return true;
 }
 
+void clip_embd_cache_set_max_size(struct clip_ctx * ctx, size_t max_size) {
+    ctx->embd_cache.set_max_size(max_size);
+}
+
+int clip_embd_cache_get(struct clip_ctx * ctx, const struct clip_image_u8 * img, float * embd) {
+    const auto * entry = ctx->embd_cache.get(img->nx, img->ny, img->buf.data(), img->buf.size());
+    if (entry == nullptr) {
+        return -1;
+    }
+
+    if (embd) {
+        memcpy(embd, entry->embd.data(), entry->embd.size() * sizeof(float));
+    }
+
+    return entry->n_pos;
+}
+
+void clip_embd_cache_put(struct clip_ctx * ctx, const struct clip_image_u8 * img, const float * embd, int n_pos) {
+    const size_t n_embd = (size_t) n_pos * clip_n_mmproj_embd(ctx);
+
+    ctx->embd_cache.put(img->nx, img->ny, img->buf.data(), img->buf.size(), embd, n_embd, n_pos);
+}
+
+void clip_set_n_threads(struct clip_ctx * ctx, int n_threads) {
+    ctx->n_threads = std::max(1, n_threads);
+}
+
 bool clip_model_quantize(const char * fname_inp, const char * fname_out, const int itype) {
     assert(itype < GGML_TYPE_COUNT);
     ggml_type type = static_cast<ggml_type>(itype);
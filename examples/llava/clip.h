@@ -95,11 +95,24 @@ CLIP_API bool clip_image_load_from_bytes(const unsigned char * bytes, size_t byt
 /** preprocess img and store the result in res_imgs, pad_to_square may be overridden to false depending on model configuration */
 CLIP_API bool clip_image_preprocess(struct clip_ctx * ctx, const struct clip_image_u8 * img, struct clip_image_f32_batch * res_imgs );
 
+/** number of threads of clip_image_preprocess, default: GGML_DEFAULT_N_THREADS */
+CLIP_API void clip_set_n_threads(struct clip_ctx * ctx, int n_threads);
+
 CLIP_API struct ggml_tensor * clip_get_newline_tensor(const struct clip_ctx * ctx);
 
 CLIP_API bool clip_image_encode      (struct clip_ctx * ctx, int n_threads, struct clip_image_f32 * img, float * vec);
 CLIP_API bool clip_image_batch_encode(struct clip_ctx * ctx, int n_threads, const struct clip_image_f32_batch * imgs, float * vec);
 
+// LRU cache of image embeddings, keyed by the size and the pixels of the image
+// used by llava_image_embed_make_with_clip_img to skip the encoder when the same image is seen again
+// the default max size is 256 MiB, which includes the pixels of the cached images - set it to 0 to disable the cache
+CLIP_API void clip_embd_cache_set_max_size(struct clip_ctx * ctx, size_t max_size);
+
+// returns the number of positions of the cached embedding of the image and copies the embedding to embd (when not NULL)
+// returns -1 if the image is not in the cache
+CLIP_API int  clip_embd_cache_get(struct clip_ctx * ctx, const struct clip_image_u8 * img, float * embd);
+CLIP_API void clip_embd_cache_put(struct clip_ctx * ctx, const struct clip_image_u8 * img, const float * embd, int n_pos);
+
 CLIP_API bool clip_model_quantize(const char * fname_inp, const char * fname_out, int itype);
 
 CLIP_API int clip_is_minicpmv(const struct clip_ctx * ctx);
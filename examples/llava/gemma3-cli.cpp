@@ -152,27 +152,34 @@ static int eval_image(gemma3_context & ctx, std::string & fname) {
         return 2; // non-fatal error
     }
 
-    clip_image_f32_batch batch_f32;
-    ok = clip_image_preprocess(ctx.ctx_clip, img_u8, &batch_f32);
-    if (!ok) {
-        LOG_ERR("Unable to preprocess image\n");
-        clip_image_f32_batch_free(&batch_f32);
-        clip_image_u8_free(img_u8);
-        return 1;
-    }
+    if (clip_embd_cache_get(ctx.ctx_clip, img_u8, image_embd_v.data()) >= 0) {
+        LOG("Image %s found in the cache\n", fname.c_str());
+    } else {
+        clip_image_f32_batch batch_f32;
+        clip_set_n_threads(ctx.ctx_clip, ctx.n_threads);
+        ok = clip_image_preprocess(ctx.ctx_clip, img_u8, &batch_f32);
+        if (!ok) {
+            LOG_ERR("Unable to preprocess image\n");
+            clip_image_f32_batch_free(&batch_f32);
+            clip_image_u8_free(img_u8);
+            return 1;
+        }
 
-    int64_t t0 = ggml_time_ms();
-    LOG("Encoding image %s\n", fname.c_str());
-    ok = clip_image_batch_encode(ctx.ctx_clip, ctx.n_threads, &batch_f32, image_embd_v.data());
-    if (!ok) {
-        LOG_ERR("Unable to encode image\n");
+        int64_t t0 = ggml_time_ms();
+        LOG("Encoding image %s\n", fname.c_str());
+        ok = clip_image_batch_encode(ctx.ctx_clip, ctx.n_threads, &batch_f32, image_embd_v.data());
+        if (!ok) {
+            LOG_ERR("Unable to encode image\n");
+            clip_image_f32_batch_free(&batch_f32);
+            clip_image_u8_free(img_u8);
+            return 1;
+        }
+        LOG("Image encoded in %" PRId64 " ms\n", ggml_time_ms() - t0);
+
+        clip_embd_cache_put(ctx.ctx_clip, img_u8, image_embd_v.data(), n_tokens);
         clip_image_f32_batch_free(&batch_f32);
-        clip_image_u8_free(img_u8);
-        return 1;
     }
-    LOG("Image encoded in %" PRId64 " ms\n", ggml_time_ms() - t0);
 
-    clip_image_f32_batch_free(&batch_f32);
     clip_image_u8_free(img_u8);
 
     // decode image embeddings
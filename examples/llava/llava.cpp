@@ -249,6 +249,7 @@ static bool encode_image_with_clip(clip_ctx * ctx_clip, int n_threads, const cli
     clip_image_f32_batch img_res_v;
     img_res_v.size = 0;
     img_res_v.data = nullptr;
+    clip_set_n_threads(ctx_clip, n_threads);
     if (!clip_image_preprocess(ctx_clip, img, &img_res_v)) {
         LOG_ERR("%s: unable to preprocess image\n", __func__);
         delete[] img_res_v.data;
@@ -338,16 +339,19 @@ static bool encode_image_with_clip(clip_ctx * ctx_clip, int n_threads, const cli
     }
     else {
         // spatial_unpad llava-1.6 type embedding
-        // TODO: CLIP needs batching support - in HF the llm projection is separate after encoding, which might be a solution to quickly get batching working
+        // all the segments have the same size, so they are encoded together in one batch
+        std::vector<float> image_embd_batch(clip_embd_nbytes(ctx_clip) / sizeof(float) * img_res_v.size); // 576 patches * 4096 embeddings * 4 bytes = 9437184 per segment
+        const bool encoded = clip_image_batch_encode(ctx_clip, n_threads, &img_res_v, image_embd_batch.data()); // image data is in 3x336x336 format and will be converted to 336x336x3 inside
+        if (!encoded) {
+            LOG_ERR("Unable to encode image - spatial_unpad - %d subimages\n", (int) img_res_v.size);
+            delete[] img_res_v.data;
+            return false;
+        }
+
         std::vector<float *> image_embd_v;
         image_embd_v.resize(img_res_v.size);
         for (size_t i = 0; i < img_res_v.size; i++) {
-            image_embd_v[i] = (float *)malloc(clip_embd_nbytes(ctx_clip)); // 576 patches * 4096 embeddings * 4 bytes = 9437184
-            const bool encoded = clip_image_encode(ctx_clip, n_threads, &img_res_v.data[i], image_embd_v[i]); // image data is in 3x336x336 format and will be converted to 336x336x3 inside
-            if (!encoded) {
-                LOG_ERR("Unable to encode image - spatial_unpad - subimage %d of %d\n", (int) i+1, (int) img_res_v.size);
-                return false;
-            }
+            image_embd_v[i] = image_embd_batch.data() + i * clip_embd_nbytes(ctx_clip) / sizeof(float);
         }
         const int64_t t_img_enc_batch_us = ggml_time_us();
         LOG_INF("%s: %d segments encoded in %8.2f ms\n", __func__, (int)img_res_v.size, (t_img_enc_batch_us - t_img_enc_start_us) / 1000.0);
@@ -373,11 +377,6 @@ static bool encode_image_with_clip(clip_ctx * ctx_clip, int n_threads, const cli
         clip_llava_handle_patches(ctx_clip, image_embd_v, grid_shape, image_embd, &n_img_pos_out);
         *n_img_pos = n_img_pos_out;
 
-        for (size_t i = 0; i < image_embd_v.size(); i++) {
-            free(image_embd_v[i]);
-        }
-        image_embd_v.clear();
-
         // debug image/segment/normalization content:
         // clip_image_u8 * tmp = clip_image_u8_init();
         // clip_image_convert_f32_to_u8(*image_feature, *tmp);
@@ -426,11 +425,17 @@ bool llava_image_embed_make_with_clip_img(clip_ctx * ctx_clip, int n_threads, co
         return false;
     }
 
-    int n_img_pos;
-    if (!encode_image_with_clip(ctx_clip, n_threads, img, image_embd, &n_img_pos)) {
-        LOG_ERR("%s: cannot encode image, aborting\n", __func__);
-        free(image_embd);
-        return false;
+    // the same image is often sent again, e.g. on every turn of a chat
+    int n_img_pos = clip_embd_cache_get(ctx_clip, img, image_embd);
+    if (n_img_pos >= 0) {
+        LOG_INF("%s: image embedding found in the cache: %d tokens\n", __func__, n_img_pos);
+    } else {
+        if (!encode_image_with_clip(ctx_clip, n_threads, img, image_embd, &n_img_pos)) {
+            LOG_ERR("%s: cannot encode image, aborting\n", __func__);
+            free(image_embd);
+            return false;
+        }
+        clip_embd_cache_put(ctx_clip, img, image_embd, n_img_pos);
     }
     *image_embd_out = image_embd;
     *n_img_pos_out = n_img_pos;
@@ -0,0 +1,268 @@
+#include "ggml.h"
+#include "ggml-backend.h"
+#include "vector-index.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+static void print_usage(int, char ** argv) {
+    printf("\nexample usage:\n");
+    printf("\n    %s [-n n_vec] [-d n_embd] [-q n_queries] [-k top_k] [-t n_threads] [-M M] [--ef-c ef_construction] [--ef-s 16,32,64] [-o index.bin]\n", argv[0]);
+    printf("\n");
+    printf("    -n      number of vectors in the index (default: 100000)\n");
+    printf("    -d      size of the vectors (default: 384)\n");
+    printf("    -q      number of queries (default: 1000)\n");
+    printf("    -k      number of results per query (default: 10)\n");
+    printf("    -t      number of threads (default: 4)\n");
+    printf("    -M      max links per node of the HNSW graph (default: 16)\n");
+    printf("    --ef-c  candidates when building the HNSW graph (default: 128)\n");
+    printf("    --ef-s  comma-separated candidates when searching the HNSW graph (default: 16,32,64,128,256)\n");
+    printf("    -o      save the HNSW index to this file and search the memory-mapped copy\n");
+    printf("\n");
+}
+
+static bool parse_int(int argc, char ** argv, int & i, int & value) {
+    if (i + 1 >= argc) {
+        return false;
+    }
+    try {
+        value = std::stoi(argv[++i]);
+    } catch (...) {
+        return false;
+    }
+    return true;
+}
+
+static bool parse_int_list(int argc, char ** argv, int & i, std::vector<int> & values) {
+    if (i + 1 >= argc) {
+        return false;
+    }
+    values.clear();
+    try {
+        std::string s = argv[++i];
+        size_t pos = 0;
+        while (pos < s.size()) {
+            size_t next = s.find(',', pos);
+            if (next == std::string::npos) {
+                next = s.size();
+            }
+            values.push_back(std::stoi(s.substr(pos, next - pos)));
+            pos = next + 1;
+        }
+    } catch (...) {
+        return false;
+    }
+    return !values.empty();
+}
+
+// normalized vectors around random centers, closer to real embeddings than uniformly random vectors
+static void gen_data(std::vector<float> & data, int64_t n, int n_embd, const std::vector<float> & centers, std::mt19937 & rng) {
+    const int64_t n_centers = centers.size() / n_embd;
+
+    std::normal_distribution<float>        noise(0.0f, 0.5f);
+    std::uniform_int_distribution<int64_t> pick(0, n_centers - 1);
+
+    data.resize(n*n_embd);
+    for (int64_t i = 0; i < n; ++i) {
+        const float * c = centers.data() + pick(rng)*n_embd;
+        float       * v = data.data() + i*n_embd;
+
+        double sum = 0.0;
+        for (int j = 0; j < n_embd; ++j) {
+            v[j] = c[j] + noise(rng);
+            sum += v[j]*v[j];
+        }
+
+        const float norm = 1.0/std::sqrt(sum);
+        for (int j = 0; j < n_embd; ++j) {
+            v[j] *= norm;
+        }
+    }
+}
+
+static double recall(const std::vector<std::vector<common_vindex_match>> & res, const std::vector<std::vector<common_vindex_match>> & ref) {
+    int64_t n_found = 0;
+    int64_t n_total = 0;
+
+    for (size_t i = 0; i < ref.size(); ++i) {
+        std::unordered_set<int64_t> ids;
+        for (const auto & m : ref[i]) {
+            ids.insert(m.id);
+        }
+        for (const auto & m : res[i]) {
+            n_found += ids.count(m.id);
+        }
+        n_total += ref[i].size();
+    }
+
+    return n_total > 0 ? (double) n_found/n_total : 0.0;
+}
+
+// search the queries one at a time, returns the queries per second
+static double search_one_by_one(common_vindex * vindex, const std::vector<float> & queries, int n_queries, int k, std::vector<std::vector<common_vindex_match>> & res) {
+    const int n_embd = common_vindex_n_embd(vindex);
+
+    res.resize(n_queries);
+
+    const int64_t t_start_us = ggml_time_us();
+
+    for (int i = 0; i < n_queries; ++i) {
+        res[i] = std::move(common_vindex_search(vindex, queries.data() + (int64_t) i*n_embd, 1, k)[0]);
+    }
+
+    return n_queries/((ggml_time_us() - t_start_us)/1e6);
+}
+
+int main(int argc, char ** argv) {
+    int n_vec     = 100000;
+    int n_embd    = 384;
+    int n_queries = 1000;
+    int k         = 10;
+    int n_threads = 4;
+    int M         = 16;
+    int ef_c      = 128;
+
+    std::vector<int> ef_s = { 16, 32, 64, 128, 256 };
+
+    std::string fname;
+
+    for (int i = 1; i < argc; i++) {
+        bool ok = true;
+        if (strcmp(argv[i], "-n") == 0) {
+            ok = parse_int(argc, argv, i, n_vec);
+        } else if (strcmp(argv[i], "-d") == 0) {
+            ok = parse_int(argc, argv, i, n_embd);
+        } else if (strcmp(argv[i], "-q") == 0) {
+            ok = parse_int(argc, argv, i, n_queries);
+        } else if (strcmp(argv[i], "-k") == 0) {
+            ok = parse_int(argc, argv, i, k);
+        } else if (strcmp(argv[i], "-t") == 0) {
+            ok = parse_int(argc, argv, i, n_threads);
+        } else if (strcmp(argv[i], "-M") == 0) {
+            ok = parse_int(argc, argv, i, M);
+        } else if (strcmp(argv[i], "--ef-c") == 0) {
+            ok = parse_int(argc, argv, i, ef_c);
+        } else if (strcmp(argv[i], "--ef-s") == 0) {
+            ok = parse_int_list(argc, argv, i, ef_s);
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            fname = argv[++i];
+        } else {
+            ok = false;
+        }
+        if (!ok) {
+            print_usage(argc, argv);
+            return 1;
+        }
+    }
+
+    if (n_vec <= 0 || n_embd <= 0 || n_queries <= 0 || k <= 0 || n_threads <= 0 || M < 2 || ef_c <= 0) {
+        print_usage(argc, argv);
+        return 1;
+    }
+
+    ggml_time_init();
+    ggml_backend_load_all();
+
+    std::mt19937 rng(1234);
+
+    std::vector<float> centers(std::max(1, n_vec/1000)*n_embd);
+    {
+        std::normal_distribution<float> dist(0.0f, 1.0f);
+        for (auto & c : centers) {
+            c = dist(rng);
+        }
+    }
+
+    std::vector<float> data;
+    std::vector<float> queries;
+
+    gen_data(data,    n_vec,     n_embd, centers, rng);
+    gen_data(queries, n_queries, n_embd, centers, rng);
+
+    printf("%s: n_vec = %d, n_embd = %d, n_queries = %d, k = %d, n_threads = %d\n\n", __func__, n_vec, n_embd, n_queries, k, n_threads);
+
+    common_vindex_params params;
+    params.n_threads       = n_threads;
+    params.M               = M;
+    params.ef_construction = ef_c;
+
+    // exact results
+    params.type = COMMON_VINDEX_TYPE_FLAT;
+
+    common_vindex * flat = common_vindex_init(data.data(), n_vec, n_embd, params);
+    if (!flat) {
+        fprintf(stderr, "%s: error: failed to create the flat index\n", __func__);
+        return 1;
+    }
+
+    std::vector<std::vector<common_vindex_match>> ref;
+    std::vector<std::vector<common_vindex_match>> res;
+
+    const double qps_flat = search_one_by_one(flat, queries, n_queries, k, ref);
+
+    double qps_flat_batch = 0.0;
+    {
+        const int64_t t_start_us = ggml_time_us();
+        res = common_vindex_search(flat, queries.data(), n_queries, k);
+        qps_flat_batch = n_queries/((ggml_time_us() - t_start_us)/1e6);
+    }
+
+    common_vindex_free(flat);
+
+    // approximate results
+    params.type = COMMON_VINDEX_TYPE_HNSW;
+
+    const int64_t t_build_us = ggml_time_us();
+
+    common_vindex * hnsw = common_vindex_init(data.data(), n_vec, n_embd, params);
+    if (!hnsw) {
+        fprintf(stderr, "%s: error: failed to create the HNSW index\n", __func__);
+        return 1;
+    }
+
+    const double t_build_s = (ggml_time_us() - t_build_us)/1e6;
+
+    if (!fname.empty()) {
+        if (!common_vindex_save(hnsw, fname)) {
+            fprintf(stderr, "%s: error: failed to save the index to '%s'\n", __func__, fname.c_str());
+            return 1;
+        }
+
+        common_vindex_free(hnsw);
+
+        const int64_t t_load_us = ggml_time_us();
+
+        hnsw = common_vindex_load(fname, params);
+        if (!hnsw) {
+            fprintf(stderr, "%s: error: failed to load the index from '%s'\n", __func__, fname.c_str());
+            return 1;
+        }
+
+        printf("%s: saved to and loaded from '%s' in %.3f ms\n\n", __func__, fname.c_str(), (ggml_time_us() - t_load_us)/1000.0);
+    }
+
+    printf("| index | ef_search | recall@%-3d |       QPS |\n", k);
+    printf("| ----- | --------: | ---------: | --------: |\n");
+    printf("| flat  |         - |     1.0000 | %9.1f |\n", qps_flat);
+    printf("| flat  |   batched |     %6.4f | %9.1f |\n", recall(res, ref), qps_flat_batch);
+
+    for (int ef : ef_s) {
+        common_vindex_set_ef_search(hnsw, ef);
+
+        const double qps = search_one_by_one(hnsw, queries, n_queries, k, res);
+
+        printf("| hnsw  | %9d |     %6.4f | %9.1f |\n", ef, recall(res, ref), qps);
+    }
+
+    printf("\n%s: HNSW build time: %.2f s\n", __func__, t_build_s);
+
+    common_vindex_free(hnsw);
+
+    return 0;
+}
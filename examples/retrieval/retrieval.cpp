@@ -2,6 +2,7 @@
 #include "common.h"
 #include "log.h"
 #include "llama.h"
+#include "vector-index.h"
 
 #include <algorithm>
 #include <fstream>
@@ -22,10 +23,35 @@ struct chunk {
     std::string textdata;
     // tokenized text data
     std::vector<llama_token> tokens;
-    // embedding
-    std::vector<float> embedding;
 };
 
+// with more chunks, the auto index type is HNSW
+#define RETRIEVAL_HNSW_MIN_CHUNKS 10000
+
+// identifies the data an index was built from and how its embeddings were computed (FNV-1a)
+static uint64_t chunks_hash(const std::vector<chunk> & chunks, const std::string & model, enum llama_pooling_type pooling_type, int embd_norm) {
+    uint64_t hash = 14695981039346656037ull;
+
+    auto add = [&](const std::string & s) {
+        for (const char c : s) {
+            hash ^= (uint8_t) c;
+            hash *= 1099511628211ull;
+        }
+        hash ^= 0xff;
+        hash *= 1099511628211ull;
+    };
+
+    add(model);
+    add(std::to_string(pooling_type));
+    add(std::to_string(embd_norm));
+    for (const auto & chunk : chunks) {
+        add(chunk.filename);
+        add(chunk.textdata);
+    }
+
+    return hash;
+}
+
 // chunk file data to chunks of size >= chunk_size
 // chunk_separator is the separator between chunks
 static std::vector<chunk> chunk_file(const std::string & filename, int chunk_size, const std::string & chunk_separator) {
@@ -81,7 +107,7 @@ static void batch_add_seq(llama_batch & batch, const std::vector<int32_t> & toke
     }
 }
 
-static void batch_decode(llama_context * ctx, llama_batch & batch, float * output, int n_seq, int n_embd) {
+static void batch_decode(llama_context * ctx, llama_batch & batch, float * output, int n_seq, int n_embd, int embd_norm) {
     // clear previous kv_cache values (irrelevant for embeddings)
     llama_kv_self_clear(ctx);
 
@@ -107,7 +133,7 @@ static void batch_decode(llama_context * ctx, llama_batch & batch, float * outpu
         }
 
         float * out = output + batch.seq_id[i][0] * n_embd;
-        common_embd_normalize(embd, out, n_embd, 2);
+        common_embd_normalize(embd, out, n_embd, embd_norm);
     }
 }
 
@@ -212,47 +238,89 @@ int main(int argc, char ** argv) {
         }
     }
 
-    // initialize batch
     const int n_chunks = chunks.size();
-    struct llama_batch batch = llama_batch_init(n_batch, 0, 1);
-
-    // allocate output
     const int n_embd = llama_model_n_embd(model);
-    std::vector<float> embeddings(n_chunks * n_embd, 0);
-    float * emb = embeddings.data();
-
-    // break into batches
-    int p = 0; // number of prompts processed already
-    int s = 0; // number of prompts in current batch
-    for (int k = 0; k < n_chunks; k++) {
-        // clamp to n_batch tokens
-        auto & inp = chunks[k].tokens;
-
-        const uint64_t n_toks = inp.size();
-
-        // encode if at capacity
-        if (batch.n_tokens + n_toks > n_batch) {
-            float * out = emb + p * n_embd;
-            batch_decode(ctx, batch, out, s, n_embd);
-            common_batch_clear(batch);
-            p += s;
-            s = 0;
-        }
 
-        // add to batch
-        batch_add_seq(batch, inp, s);
-        s += 1;
+    common_vindex_params vparams;
+    vparams.n_threads = params.cpuparams.n_threads;
+    vparams.tag       = chunks_hash(chunks, params.model, pooling_type, params.embd_normalize);
+
+    if (params.index_type == "hnsw" || (params.index_type == "auto" && n_chunks >= RETRIEVAL_HNSW_MIN_CHUNKS)) {
+        vparams.type = COMMON_VINDEX_TYPE_HNSW;
+    }
+
+    common_vindex * vindex = nullptr;
+
+    // reuse the embeddings of a previous run
+    if (!params.index_file.empty()) {
+        vindex = common_vindex_load(params.index_file, vparams);
+
+        if (vindex) {
+            const auto & vparams_file = common_vindex_get_params(vindex);
+
+            if (vparams_file.tag != vparams.tag || common_vindex_n_vec(vindex) != n_chunks || common_vindex_n_embd(vindex) != n_embd ||
+                (params.index_type != "auto" && vparams_file.type != vparams.type)) {
+                LOG_WRN("%s: index file '%s' does not match the chunks, rebuilding it\n", __func__, params.index_file.c_str());
+
+                common_vindex_free(vindex);
+                vindex = nullptr;
+            } else {
+                LOG_INF("%s: loaded index of %d chunks from '%s'\n", __func__, n_chunks, params.index_file.c_str());
+            }
+        }
     }
 
-    // final batch
-    float * out = emb + p * n_embd;
-    batch_decode(ctx, batch, out, s, n_embd);
+    if (!vindex) {
+        // initialize batch
+        struct llama_batch batch = llama_batch_init(n_batch, 0, 1);
+
+        // allocate output
+        std::vector<float> embeddings(n_chunks * n_embd, 0);
+        float * emb = embeddings.data();
+
+        // break into batches
+        int p = 0; // number of prompts processed already
+        int s = 0; // number of prompts in current batch
+        for (int k = 0; k < n_chunks; k++) {
+            // clamp to n_batch tokens
+            auto & inp = chunks[k].tokens;
+
+            const uint64_t n_toks = inp.size();
+
+            // encode if at capacity
+            if (batch.n_tokens + n_toks > n_batch) {
+                float * out = emb + p * n_embd;
+                batch_decode(ctx, batch, out, s, n_embd, params.embd_normalize);
+                common_batch_clear(batch);
+                p += s;
+                s = 0;
+            }
+
+            // add to batch
+            batch_add_seq(batch, inp, s);
+            s += 1;
+        }
+
+        // final batch
+        float * out = emb + p * n_embd;
+        batch_decode(ctx, batch, out, s, n_embd, params.embd_normalize);
+
+        llama_batch_free(batch);
+
+        vindex = common_vindex_init(emb, n_chunks, n_embd, vparams);
+        if (!vindex) {
+            LOG_ERR("%s: failed to create the index\n", __func__);
+            return 1;
+        }
+
+        if (!params.index_file.empty() && common_vindex_save(vindex, params.index_file)) {
+            LOG_INF("%s: saved index to '%s'\n", __func__, params.index_file.c_str());
+        }
+    }
 
-    // save embeddings to chunks
-    for (int i = 0; i < n_chunks; i++) {
-        chunks[i].embedding = std::vector<float>(emb + i * n_embd, emb + (i + 1) * n_embd);
-        // clear tokens as they are no longer needed
-        chunks[i].tokens.clear();
+    // clear tokens as they are no longer needed
+    for (auto & chunk : chunks) {
+        chunk.tokens.clear();
     }
 
     struct llama_batch query_batch = llama_batch_init(n_batch, 0, 1);
@@ -267,29 +335,20 @@ int main(int argc, char ** argv) {
         batch_add_seq(query_batch, query_tokens, 0);
 
         std::vector<float> query_emb(n_embd, 0);
-        batch_decode(ctx, query_batch, query_emb.data(), 1, n_embd);
+        batch_decode(ctx, query_batch, query_emb.data(), 1, n_embd, params.embd_normalize);
 
         common_batch_clear(query_batch);
 
-        // compute cosine similarities
+        // with the default euclidean normalization, the inner product is the cosine similarity
         {
-            std::vector<std::pair<int, float>> similarities;
-            for (int i = 0; i < n_chunks; i++) {
-                float sim = common_embd_similarity_cos(chunks[i].embedding.data(), query_emb.data(), n_embd);
-                similarities.push_back(std::make_pair(i, sim));
-            }
-
-            // sort similarities
-            std::sort(similarities.begin(), similarities.end(), [](const std::pair<int, float> & a, const std::pair<int, float> & b) {
-                return a.second > b.second;
-            });
+            const auto matches = common_vindex_search(vindex, query_emb.data(), 1, params.sampling.top_k)[0];
 
             LOG("Top %d similar chunks:\n", params.sampling.top_k);
-            for (int i = 0; i < std::min(params.sampling.top_k, (int) chunks.size()); i++) {
-                LOG("filename: %s\n", chunks[similarities[i].first].filename.c_str());
-                LOG("filepos: %lld\n", (long long int) chunks[similarities[i].first].filepos);
-                LOG("similarity: %f\n", similarities[i].second);
-                LOG("textdata:\n%s\n", chunks[similarities[i].first].textdata.c_str());
+            for (const auto & match : matches) {
+                LOG("filename: %s\n", chunks[match.id].filename.c_str());
+                LOG("filepos: %lld\n", (long long int) chunks[match.id].filepos);
+                LOG("similarity: %f\n", match.score);
+                LOG("textdata:\n%s\n", chunks[match.id].textdata.c_str());
                 LOG("--------------------\n");
             }
         }
@@ -299,6 +358,7 @@ int main(int argc, char ** argv) {
     llama_perf_context_print(ctx);
 
     // clean up
+    common_vindex_free(vindex);
     llama_batch_free(query_batch);
     llama_backend_free();
 }
@@ -5,6 +5,7 @@
 #include "json-schema-to-grammar.h"
 #include "llama.h"
 #include "log.h"
+#include "ngram-cache.h"
 #include "sampling.h"
 #include "speculative.h"
 
@@ -178,6 +179,9 @@ struct slot_params {
             {"speculative.n_max",         speculative.n_max},
             {"speculative.n_min",         speculative.n_min},
             {"speculative.p_min",         speculative.p_min},
+            {"speculative.lookup",        speculative.lookup},
+            {"speculative.lookahead",     speculative.lookahead},
+            {"speculative.adaptive",      speculative.adaptive},
             {"timings_per_token",         timings_per_token},
             {"post_sampling_probs",       post_sampling_probs},
             {"lora",                      lora},
@@ -273,6 +277,10 @@ struct server_task {
         params.speculative.n_max = json_value(data, "speculative.n_max", defaults.speculative.n_max);
         params.speculative.p_min = json_value(data, "speculative.p_min", defaults.speculative.p_min);
 
+        params.speculative.lookup    = json_value(data, "speculative.lookup",    defaults.speculative.lookup);
+        params.speculative.lookahead = json_value(data, "speculative.lookahead", defaults.speculative.lookahead);
+        params.speculative.adaptive  = json_value(data, "speculative.adaptive",  defaults.speculative.adaptive);
+
         params.speculative.n_min = std::min(params.speculative.n_max, params.speculative.n_min);
         params.speculative.n_min = std::max(params.speculative.n_min, 0);
         params.speculative.n_max = std::max(params.speculative.n_max, 0);
@@ -489,8 +497,12 @@ struct result_timings {
     double predicted_per_token_ms;
     double predicted_per_second;
 
+    // speculative decoding
+    int32_t draft_n          = 0;
+    int32_t draft_n_accepted = 0;
+
     json to_json() const {
-        return {
+        json base = {
             {"prompt_n",               prompt_n},
             {"prompt_ms",              prompt_ms},
             {"prompt_per_token_ms",    prompt_per_token_ms},
@@ -501,6 +513,13 @@ struct result_timings {
             {"predicted_per_token_ms", predicted_per_token_ms},
             {"predicted_per_second",   predicted_per_second},
         };
+
+        if (draft_n > 0) {
+            base["draft_n"]          = draft_n;
+            base["draft_n_accepted"] = draft_n_accepted;
+        }
+
+        return base;
     }
 };
 
@@ -1011,6 +1030,12 @@ struct server_task_result_embd : server_task_result {
     // OAI-compat fields
     oaicompat_type oaicompat = OAICOMPAT_TYPE_NONE;
 
+    // output format, set by the HTTP handler
+    int32_t   n_dims     = 0;  // keep only the first n_dims dimensions (Matryoshka truncation), 0 = all
+    int32_t   embd_norm  = -1; // normalization of the truncated embeddings, see common_embd_normalize()
+    embd_type type       = EMBD_TYPE_FLOAT;
+    bool      use_base64 = false;
+
     virtual int get_index() override {
         return index;
     }
@@ -1021,17 +1046,31 @@ struct server_task_result_embd : server_task_result {
             : to_json_non_oaicompat();
     }
 
+    json format(std::vector<float> embd) const {
+        if (n_dims > 0 && n_dims < (int32_t) embd.size()) {
+            embd.resize(n_dims);
+            common_embd_normalize(embd.data(), embd.data(), n_dims, embd_norm);
+        }
+
+        return format_embedding(embd, type, use_base64);
+    }
+
     json to_json_non_oaicompat() {
+        json embd = json::array();
+        for (const auto & e : embedding) {
+            embd.push_back(format(e));
+        }
+
         return json {
             {"index",     index},
-            {"embedding", embedding},
+            {"embedding", embd},
         };
     }
 
     json to_json_oaicompat() {
         return json {
             {"index",            index},
-            {"embedding",        embedding[0]},
+            {"embedding",        format(embedding[0])},
             {"tokens_evaluated", n_tokens},
         };
     }
@@ -1135,6 +1174,9 @@ struct server_task_result_metrics : server_task_result {
     uint64_t n_decode_total     = 0;
     uint64_t n_busy_slots_total = 0;
 
+    uint64_t n_tokenize_cache_hit  = 0;
+    uint64_t n_tokenize_cache_miss = 0;
+
     // while we can also use std::vector<server_slot> this requires copying the slot object which can be quite messy
     // therefore, we use json to temporarily store the slot.to_json() result
     json slots_data = json::array();
@@ -1159,6 +1201,9 @@ struct server_task_result_metrics : server_task_result {
             { "n_decode_total",                  n_decode_total },
             { "n_busy_slots_total",              n_busy_slots_total },
 
+            { "n_tokenize_cache_hit",            n_tokenize_cache_hit },
+            { "n_tokenize_cache_miss",           n_tokenize_cache_miss },
+
             { "kv_cache_tokens_count",           kv_cache_tokens_count },
             { "kv_cache_used_cells",             kv_cache_used_cells },
 
@@ -1224,13 +1269,32 @@ struct server_slot {
     // only used for completion/embedding/infill/rerank
     server_task_type task_type = SERVER_TASK_TYPE_COMPLETION;
 
-    llama_batch batch_spec = {};
-
     llama_context * ctx = nullptr;
-    llama_context * ctx_dft = nullptr;
+    llama_context * ctx_dft = nullptr; // shared by all slots, each slot drafts in the sequence slot.id
 
     common_speculative * spec = nullptr;
 
+    // the tokens drafted after the sampled token, verified with the next batch - a linear draft is a tree with a single path
+    common_speculative_tree draft;
+
+    // lookahead decoding: the collected n-grams and the window of guesses, the n-grams carry over between tasks
+    common_lookahead * lookahead = nullptr;
+
+    bool guess   = false; // the window of guesses is evaluated with the draft
+    int  i_guess = -1;    // batch index of the last level of the window, relative to i_batch
+
+    // the temporary sequences of the slot, for the branches of the draft and the columns of the window
+    llama_seq_id seq_id_tmp = -1;
+    int          n_seq_tmp  = 0;
+
+    // speculation without a draft model: the n-grams of the prompt and of the generated text
+    common_ngram_cache lookup_cache;
+    llama_tokens       lookup_tokens;       // the tokens in lookup_cache
+    size_t             lookup_n_merged = 0; // the first tokens of lookup_tokens, whose n-grams are in the dynamic cache
+
+    // draft length controller, the measured costs carry over between tasks
+    common_speculative_adaptive spec_adaptive;
+
     std::vector<common_adapter_lora_info> lora;
 
     // the index relative to completion multi-task request
@@ -1265,6 +1329,9 @@ struct server_slot {
 
     llama_tokens cache_tokens;
 
+    // number of cache_tokens that have been decoded, the rest are in the batch that is being built
+    size_t n_cache_decoded = 0;
+
     std::vector<completion_token_output> generated_token_probs;
 
     bool has_next_token = true;
@@ -1292,6 +1359,9 @@ struct server_slot {
     double t_prompt_processing; // ms
     double t_token_generation;  // ms
 
+    int32_t n_draft_total    = 0; // drafted tokens that were verified
+    int32_t n_draft_accepted = 0;
+
     std::function<void(int)> callback_on_release;
 
     void reset() {
@@ -1306,8 +1376,16 @@ struct server_slot {
         stopping_word      = "";
         n_past             = 0;
         n_sent_text        = 0;
+        n_draft_total      = 0;
+        n_draft_accepted   = 0;
         task_type          = SERVER_TASK_TYPE_COMPLETION;
 
+        spec_adaptive.reset_accept();
+
+        draft.clear();
+
+        guess = false;
+
         generated_tokens.clear();
         generated_token_probs.clear();
     }
@@ -1342,7 +1420,55 @@ struct server_slot {
     }
 
     bool can_speculate() const {
-        return ctx_dft && params.speculative.n_max > 0 && params.cache_prompt;
+        return (spec || params.speculative.lookup || params.speculative.lookahead) && params.speculative.n_max > 0 && params.cache_prompt;
+    }
+
+    void set_draft(const llama_tokens & tokens) {
+        draft.clear();
+
+        for (const llama_token id : tokens) {
+            draft.add(id, (int) draft.size() - 1);
+        }
+    }
+
+    // draft up to n_draft tokens that follow id from the n-grams of the context of the slot
+    llama_tokens gen_draft_lookup(llama_token id, int n_draft, common_ngram_cache & nc_dynamic, common_ngram_cache & nc_static) {
+        // the n-gram cache can only be appended to - rebuild it if the context has changed (new prompt, context shift)
+        size_t n_same = 0;
+        while (n_same < lookup_tokens.size() && n_same < cache_tokens.size() && lookup_tokens[n_same] == cache_tokens[n_same]) {
+            n_same++;
+        }
+
+        if (n_same < lookup_tokens.size()) {
+            lookup_cache.clear();
+            lookup_tokens.clear();
+
+            lookup_n_merged = std::min(lookup_n_merged, n_same);
+        }
+
+        const size_t n_old = lookup_tokens.size();
+
+        lookup_tokens.insert(lookup_tokens.end(), cache_tokens.begin() + n_old, cache_tokens.end());
+        lookup_tokens.push_back(id);
+
+        common_ngram_cache_update(lookup_cache, LLAMA_NGRAM_MIN, LLAMA_NGRAM_MAX, lookup_tokens, lookup_tokens.size() - n_old, false);
+
+        llama_tokens draft = { id };
+        common_ngram_cache_draft(lookup_tokens, draft, n_draft, LLAMA_NGRAM_MIN, LLAMA_NGRAM_MAX, lookup_cache, nc_dynamic, nc_static);
+        draft.erase(draft.begin());
+
+        return draft;
+    }
+
+    // add the n-grams of the tokens of the context that have not been added yet to the dynamic n-gram cache
+    void update_lookup_cache_dynamic(common_ngram_cache & nc_dynamic) {
+        if (lookup_tokens.size() <= lookup_n_merged) {
+            return;
+        }
+
+        common_ngram_cache_update(nc_dynamic, LLAMA_NGRAM_MIN, LLAMA_NGRAM_MAX, lookup_tokens, lookup_tokens.size() - lookup_n_merged, false);
+
+        lookup_n_merged = lookup_tokens.size();
     }
 
     void add_token(const completion_token_output & token) {
@@ -1353,6 +1479,13 @@ struct server_slot {
         generated_token_probs.push_back(token);
     }
 
+    // remove the cells of the temporary sequences, e.g. after the batch was split or could not be decoded
+    void clear_seq_tmp() const {
+        for (llama_seq_id s = seq_id_tmp; s < seq_id_tmp + n_seq_tmp; ++s) {
+            llama_kv_self_seq_rm(ctx, s, -1, -1);
+        }
+    }
+
     void release() {
         if (is_processing()) {
             SLT_INF(*this, "stop processing: n_past = %d, truncated = %d\n", n_past, truncated);
@@ -1376,6 +1509,9 @@ struct server_slot {
         timings.predicted_per_token_ms = t_token_generation / n_decoded;
         timings.predicted_per_second = 1e3 / t_token_generation * n_decoded;
 
+        timings.draft_n          = n_draft_total;
+        timings.draft_n_accepted = n_draft_accepted;
+
         return timings;
     }
 
@@ -1423,6 +1559,14 @@ struct server_slot {
                 t_prompt_processing, n_prompt_tokens_processed, t_prompt, n_prompt_second,
                 t_token_generation, n_decoded, t_gen, n_gen_second,
                 t_prompt_processing + t_token_generation, n_prompt_tokens_processed + n_decoded);
+
+        if (n_draft_total > 0) {
+            const float draft_ratio = (float) n_draft_accepted / n_draft_total;
+            SLT_INF(*this,
+                    "\n"
+                    "draft acceptance rate = %0.5f (%5d accepted / %5d generated)\n",
+                    draft_ratio, n_draft_accepted, n_draft_total);
+        }
     }
 
     json to_json() const {
@@ -1796,12 +1940,24 @@ struct server_context {
 
     llama_context_params cparams_dft;
 
+    llama_context * ctx_dft = nullptr;
+
+    int32_t n_ctx_dft = 0; // draft context size of a slot
+
+    // n-gram caches for the speculation without a draft model
+    // the dynamic cache is updated with the context of the slots when they are released and saved at exit
+    common_ngram_cache lookup_cache_dynamic;
+    common_ngram_cache lookup_cache_static;
+
     llama_batch batch = {};
 
     bool clean_kv_cache = true;
     bool add_bos_token  = true;
     bool has_eos_token  = false;
 
+    // the pooled output depends only on the last token, so pooled tasks can reuse the KV cache of a common prefix
+    bool pooled_prefix_reuse = false;
+
     int32_t n_ctx; // total context for all clients / slots
 
     // slots / clients
@@ -1818,21 +1974,33 @@ struct server_context {
 
     common_chat_templates_ptr chat_templates;
 
+    server_tokenizer_cache tokenizer_cache;
+
+    void save_lookup_cache_dynamic() {
+        if (params_base.lookup_cache_dynamic.empty()) {
+            return;
+        }
+
+        SRV_INF("saving dynamic lookup cache '%s'\n", params_base.lookup_cache_dynamic.c_str());
+
+        common_ngram_cache_save(lookup_cache_dynamic, params_base.lookup_cache_dynamic);
+    }
+
     ~server_context() {
         // Clear any sampling context
         for (server_slot & slot : slots) {
             common_sampler_free(slot.smpl);
             slot.smpl = nullptr;
 
-            llama_free(slot.ctx_dft);
-            slot.ctx_dft = nullptr;
-
             common_speculative_free(slot.spec);
             slot.spec = nullptr;
 
-            llama_batch_free(slot.batch_spec);
+            common_lookahead_free(slot.lookahead);
+            slot.lookahead = nullptr;
         }
 
+        llama_free(ctx_dft);
+
         llama_batch_free(batch);
     }
 
@@ -1858,6 +2026,23 @@ struct server_context {
         add_bos_token = llama_vocab_get_add_bos(vocab);
         has_eos_token = llama_vocab_eos(vocab) != LLAMA_TOKEN_NULL;
 
+        {
+            const auto pooling_type = llama_pooling_type(ctx);
+
+            // causal models keep the prompt in the KV cache and pool the last token (for ranking as well)
+            // this allows to prefill the query of a rerank request once and to append only the documents to it
+            pooled_prefix_reuse =
+                llama_model_is_causal(model) && !llama_model_is_recurrent(model) &&
+                (pooling_type == LLAMA_POOLING_TYPE_LAST || pooling_type == LLAMA_POOLING_TYPE_RANK);
+
+            if (params_base.embedding && pooled_prefix_reuse) {
+                SRV_INF("%s", "pooled tasks will reuse the KV cache of common prompt prefixes\n");
+            }
+        }
+
+        // enough for the prompts of a few full contexts
+        tokenizer_cache.init(vocab, params_base.tokenize_cache ? 4*n_ctx : 0);
+
         if (!params_base.speculative.model.empty() || !params_base.speculative.hf_repo.empty()) {
             SRV_INF("loading draft model '%s'\n", params_base.speculative.model.c_str());
 
@@ -1891,15 +2076,39 @@ struct server_context {
                 return false;
             }
 
-            const int n_ctx_dft = llama_n_ctx(llama_init_dft.context.get());
+            n_ctx_dft = llama_n_ctx(llama_init_dft.context.get());
 
+            // the slots share one draft context, with a sequence for each slot
             cparams_dft = common_context_params_to_llama(params_dft);
-            cparams_dft.n_batch = n_ctx_dft;
+            cparams_dft.n_ctx     = n_ctx_dft*params_base.n_parallel;
+            cparams_dft.n_batch   = cparams_dft.n_ctx;
+            cparams_dft.n_seq_max = params_base.n_parallel;
 
-            // the context is not needed - we will create one for each slot
+            // the context is not needed - we will create the shared one in init()
             llama_init_dft.context.reset();
         }
 
+        if (!params_base.lookup_cache_static.empty()) {
+            SRV_INF("loading static lookup cache '%s'\n", params_base.lookup_cache_static.c_str());
+
+            try {
+                lookup_cache_static = common_ngram_cache_load(params_base.lookup_cache_static);
+            } catch (const std::ifstream::failure &) {
+                SRV_ERR("failed to open static lookup cache '%s'\n", params_base.lookup_cache_static.c_str());
+                return false;
+            }
+        }
+
+        if (!params_base.lookup_cache_dynamic.empty()) {
+            SRV_INF("loading dynamic lookup cache '%s'\n", params_base.lookup_cache_dynamic.c_str());
+
+            try {
+                lookup_cache_dynamic = common_ngram_cache_load(params_base.lookup_cache_dynamic);
+            } catch (const std::ifstream::failure &) {
+                // the file is created at exit
+            }
+        }
+
         chat_templates = common_chat_templates_init(model, params_base.chat_template);
         try {
             common_chat_format_example(chat_templates.get(), params.use_jinja);
@@ -1917,6 +2126,14 @@ struct server_context {
 
         SRV_INF("initializing slots, n_slots = %d\n", params_base.n_parallel);
 
+        if (model_dft) {
+            ctx_dft = llama_init_from_model(model_dft, cparams_dft);
+            if (ctx_dft == nullptr) {
+                SRV_ERR("%s", "failed to create draft context\n");
+                return;
+            }
+        }
+
         for (int i = 0; i < params_base.n_parallel; i++) {
             server_slot slot;
 
@@ -1925,27 +2142,42 @@ struct server_context {
             slot.n_ctx = n_ctx_slot;
             slot.n_predict = params_base.n_predict;
 
-            if (model_dft) {
-                slot.batch_spec = llama_batch_init(params_base.speculative.n_max + 1, 0, 1);
+            if (ctx_dft) {
+                slot.ctx_dft = ctx_dft;
 
-                slot.ctx_dft = llama_init_from_model(model_dft, cparams_dft);
-                if (slot.ctx_dft == nullptr) {
-                    SRV_ERR("%s", "failed to create draft context\n");
+                slot.spec = common_speculative_init_seq(ctx_dft, slot.id, n_ctx_dft);
+                if (slot.spec == nullptr) {
+                    SRV_ERR("%s", "failed to create speculator\n");
                     return;
                 }
+            } else if (params_base.speculative.n_layer > 0 || !params_base.speculative.layer_skip.empty()) {
+                // self-speculation: draft with a subset of the layers of the target model
+                const auto layer_skip = common_speculative_layer_skip(model, params_base.speculative.n_layer, params_base.speculative.layer_skip);
 
-                slot.spec = common_speculative_init(slot.ctx_dft);
+                slot.spec = common_speculative_init_self(ctx, slot.id, layer_skip);
                 if (slot.spec == nullptr) {
-                    SRV_ERR("%s", "failed to create speculator\n");
+                    SRV_ERR("%s", "failed to create self-speculator\n");
                     return;
                 }
             }
 
+            {
+                const auto & params_spec = params_base.speculative;
+
+                // the sequences [0, n_parallel) are the slots
+                // note: the lookahead state is created with the first task that uses it
+                slot.n_seq_tmp  = params_spec.lookahead_g + params_spec.lookahead_w;
+                slot.seq_id_tmp = params_base.n_parallel + i*slot.n_seq_tmp;
+            }
+
             SLT_INF(slot, "new slot n_ctx_slot = %d\n", slot.n_ctx);
 
             slot.params.sampling = params_base.sampling;
 
-            slot.callback_on_release = [this](int) {
+            slot.callback_on_release = [this](int id) {
+                if (!params_base.lookup_cache_dynamic.empty()) {
+                    slots[id].update_lookup_cache_dynamic(lookup_cache_dynamic);
+                }
                 queue_tasks.pop_deferred_task();
             };
 
@@ -1961,8 +2193,8 @@ struct server_context {
         {
             const int32_t n_batch = llama_n_batch(ctx);
 
-            // only a single seq_id per token is needed
-            batch = llama_batch_init(std::max(n_batch, params_base.n_parallel), 0, 1);
+            // a single seq_id per token is needed, except for the branches of the drafts and the window of lookahead decoding
+            batch = llama_batch_init(std::max(n_batch, params_base.n_parallel), 0, 1 + params_base.speculative.lookahead_g + params_base.speculative.lookahead_w);
         }
 
         metrics.init();
@@ -2096,12 +2328,6 @@ struct server_context {
             }
         }
 
-        if (slot.ctx_dft) {
-            llama_batch_free(slot.batch_spec);
-
-            slot.batch_spec = llama_batch_init(slot.params.speculative.n_max + 1, 0, 1);
-        }
-
         slot.state = SLOT_STATE_STARTED;
 
         SLT_INF(slot, "%s", "processing task\n");
@@ -2436,9 +2662,9 @@ struct server_context {
             }
 
             // normalize only when there is pooling
-            // TODO: configurable
-            if (llama_pooling_type(slot.ctx) != LLAMA_POOLING_TYPE_NONE) {
-                common_embd_normalize(embd, embd_res.data(), n_embd, 2);
+            // the euclidean normalization is done in the graph (see llama_context_params.embd_norm)
+            if (llama_pooling_type(slot.ctx) != LLAMA_POOLING_TYPE_NONE && params_base.embd_normalize != 2) {
+                common_embd_normalize(embd, embd_res.data(), n_embd, params_base.embd_normalize);
                 res->embedding.push_back(embd_res);
             } else {
                 res->embedding.push_back({ embd, embd + n_embd });
@@ -2671,6 +2897,8 @@ struct server_context {
                     res->n_decode_total          = metrics.n_decode_total;
                     res->n_busy_slots_total      = metrics.n_busy_slots_total;
 
+                    tokenizer_cache.get_stats(res->n_tokenize_cache_hit, res->n_tokenize_cache_miss);
+
                     if (task.metrics_reset_bucket) {
                         metrics.reset_bucket();
                     }
@@ -2791,6 +3019,202 @@ struct server_context {
         }
     }
 
+    // draft the tokens that follow the sampled tokens of the generating slots, for verification with the next batch
+    // n_batch is the expected size of that batch without the drafts
+    void gen_drafts(const std::vector<server_slot *> & slots_gen, int n_batch) {
+        // the drafts have to fit in the batch together with the sampled tokens
+        int n_draft_left = llama_n_batch(ctx) - (int) slots_gen.size();
+
+        // the slots that use the draft model draft together in its shared context
+        std::vector<server_slot *>             slots_dft;
+        std::vector<common_speculative *>      specs;
+        std::vector<common_speculative_params> params_spec;
+        std::vector<const llama_tokens *>      prompts_tgt;
+        llama_tokens                           ids_last;
+
+        for (auto * slot_ptr : slots_gen) {
+            auto & slot = *slot_ptr;
+
+            slot.draft.clear();
+
+            slot.guess = false;
+
+            if (!slot.can_speculate()) {
+                continue;
+            }
+
+            // determine the max draft that fits the current slot state
+            int n_draft_max = std::min(slot.params.speculative.n_max, n_draft_left);
+
+            // note: n_past does not include the sampled token yet
+            //       also, need to leave space for 1 extra token to allow context shifts
+            n_draft_max = std::min(n_draft_max, slot.n_ctx - slot.n_past - 2);
+
+            if (slot.n_remaining > 0) {
+                n_draft_max = std::min(n_draft_max, slot.n_remaining - 1);
+            }
+
+            SLT_DBG(slot, "max possible draft: %d\n", n_draft_max);
+
+            if (!slot.spec && slot.params.speculative.lookahead) {
+                if (slot.lookahead == nullptr) {
+                    const auto & params_spec = params_base.speculative;
+
+                    slot.lookahead = common_lookahead_init(vocab, params_spec.lookahead_w, params_spec.lookahead_n, params_spec.lookahead_g);
+                }
+
+                // the window of guesses is evaluated with each token, even without a draft
+                const int n_window = slot.lookahead->W*(slot.lookahead->N - 1) - 1;
+
+                if (n_draft_left < n_window) {
+                    SLT_DBG(slot, "the window of guesses does not fit in the batch: %d < %d - skipping lookahead decoding\n", n_draft_left, n_window);
+
+                    continue;
+                }
+
+                // the cells of the window are taken from the context of the slot, same as the draft
+                const int n_ctx_left = slot.n_ctx - slot.n_past - 2 - n_window;
+
+                if (n_ctx_left < 0) {
+                    SLT_DBG(slot, "the window of guesses does not fit in the context: %d < %d - skipping lookahead decoding\n", slot.n_ctx - slot.n_past - 2, n_window);
+
+                    continue;
+                }
+
+                n_draft_left -= n_window;
+
+                slot.draft = common_lookahead_gen_draft(slot.lookahead, slot.sampled, std::min({ n_draft_max, n_draft_left, n_ctx_left }));
+                slot.guess = true;
+
+                n_draft_left -= slot.draft.size();
+
+                continue;
+            }
+
+            if (n_draft_max < slot.params.speculative.n_min) {
+                SLT_DBG(slot, "the max possible draft is too small: %d < %d - skipping speculative decoding\n", n_draft_max, slot.params.speculative.n_min);
+
+                continue;
+            }
+
+            if (slot.params.speculative.adaptive) {
+                n_draft_max = slot.spec_adaptive.get_n_draft(slot.params.speculative.n_min, n_draft_max, n_batch);
+
+                if (n_draft_max == 0) {
+                    SLT_DBG(slot, "speculation is not expected to pay off, p_accept = %.3f, n_batch = %d - skipping speculative decoding\n",
+                            slot.spec_adaptive.p_accept(), n_batch);
+
+                    continue;
+                }
+
+                SLT_DBG(slot, "adaptive draft: %d\n", n_draft_max);
+            }
+
+            n_draft_left -= n_draft_max;
+
+            if (slot.spec) {
+                common_speculative_params params;
+                params.n_draft = n_draft_max;
+                // with self-speculation, the drafts are evaluated in the context of the slot in the target model
+                params.n_reuse = (slot.ctx_dft ? n_ctx_dft : slot.n_ctx) - slot.params.speculative.n_max;
+                params.p_min   = slot.params.speculative.p_min;
+
+                slots_dft  .push_back(&slot);
+                specs      .push_back(slot.spec);
+                params_spec.push_back(params);
+                prompts_tgt.push_back(&slot.cache_tokens);
+                ids_last   .push_back(slot.sampled);
+            } else {
+                const int64_t t_start = ggml_time_us();
+
+                slot.set_draft(slot.gen_draft_lookup(slot.sampled, n_draft_max, lookup_cache_dynamic, lookup_cache_static));
+
+                if (slot.params.speculative.adaptive) {
+                    slot.spec_adaptive.add_draft(slot.draft.size(), ggml_time_us() - t_start);
+                }
+            }
+        }
+
+        if (!specs.empty()) {
+            const int64_t t_start = ggml_time_us();
+
+            auto drafts = common_speculative_gen_drafts(specs, params_spec, prompts_tgt, ids_last);
+
+            // the slots share the cost of drafting
+            const int64_t t_draft = (ggml_time_us() - t_start)/specs.size();
+
+            for (size_t i = 0; i < slots_dft.size(); ++i) {
+                auto & slot = *slots_dft[i];
+
+                slot.set_draft(drafts[i]);
+
+                if (slot.params.speculative.adaptive) {
+                    slot.spec_adaptive.add_draft(slot.draft.size(), t_draft);
+                }
+            }
+        }
+
+        // ignore small drafts
+        for (auto * slot_ptr : slots_gen) {
+            auto & slot = *slot_ptr;
+
+            // the draft of lookahead decoding comes for free with the window of guesses
+            if (!slot.guess && !slot.draft.empty() && slot.params.speculative.n_min > (int) slot.draft.size()) {
+                SLT_DBG(slot, "ignoring small draft: %d < %d\n", (int) slot.draft.size(), slot.params.speculative.n_min);
+
+                slot.draft.clear();
+            }
+        }
+    }
+
+    // find the slot with the longest prefix in common with the prompt that is already decoded in its KV cache
+    const server_slot * get_prefix_slot(const server_slot & slot, const llama_tokens & prompt_tokens, size_t & n_prefix) const {
+        const server_slot * res = nullptr;
+
+        n_prefix = 0;
+
+        for (const auto & other : slots) {
+            if (other.id == slot.id || !are_lora_equal(other.lora, slot.lora)) {
+                continue;
+            }
+
+            const size_t n_common = std::min(common_lcp(other.cache_tokens, prompt_tokens), other.n_cache_decoded);
+            if (n_common > n_prefix) {
+                n_prefix = n_common;
+                res = &other;
+            }
+        }
+
+        return res;
+    }
+
+    // check if a longer prefix of the prompt of the slot is still being processed by another slot
+    bool is_prefix_pending(const server_slot & slot) const {
+        // do not delay the prompt for a gain of a few tokens
+        const size_t n_pending_min = 16;
+
+        size_t n_prefix = 0;
+        get_prefix_slot(slot, slot.prompt_tokens, n_prefix);
+
+        n_prefix = std::max(n_prefix, common_lcp(slot.cache_tokens, slot.prompt_tokens));
+
+        for (const auto & other : slots) {
+            if (other.id == slot.id || !other.params.cache_prompt || !are_lora_equal(other.lora, slot.lora)) {
+                continue;
+            }
+
+            if (other.state != SLOT_STATE_PROCESSING_PROMPT && other.state != SLOT_STATE_DONE_PROMPT) {
+                continue;
+            }
+
+            if (common_lcp(other.prompt_tokens, slot.prompt_tokens) >= n_prefix + n_pending_min) {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
     void update_slots() {
         // check if all slots are idle
         {
@@ -2860,6 +3284,10 @@ struct server_context {
         // start populating the batch for this iteration
         common_batch_clear(batch);
 
+        for (auto & slot : slots) {
+            slot.n_cache_decoded = slot.cache_tokens.size();
+        }
+
         // track if given slot can be batched with slots already in the batch
         server_slot * slot_batched = nullptr;
 
@@ -2868,7 +3296,15 @@ struct server_context {
         };
 
         // frist, add sampled tokens from any ongoing sequences
+        std::vector<server_slot *> slots_gen;
+
+        bool has_prompt = false;
+
         for (auto & slot : slots) {
+            if (slot.state == SLOT_STATE_PROCESSING_PROMPT || slot.state == SLOT_STATE_STARTED) {
+                has_prompt = true;
+            }
+
             if (slot.state != SLOT_STATE_GENERATING) {
                 continue;
             }
@@ -2880,9 +3316,34 @@ struct server_context {
                 continue;
             }
 
+            slots_gen.push_back(&slot);
+        }
+
+        if (slot_batched) {
+            // self-speculation drafts with the target context
+            llama_set_embeddings(ctx, false);
+            common_set_adapter_lora(ctx, slot_batched->lora);
+        }
+
+        // the drafts are verified together with the rest of the batch, which is filled up with prompts if there are any
+        gen_drafts(slots_gen, has_prompt ? llama_n_batch(ctx) : (int) slots_gen.size());
+
+        for (auto * slot_ptr : slots_gen) {
+            auto & slot = *slot_ptr;
+
+            // a draft that was split by the batch can leave rejected tokens in the KV cache
+            if (slot.can_speculate()) {
+                llama_kv_self_seq_rm(ctx, slot.id, slot.n_past, -1);
+            }
+
             slot.i_batch = batch.n_tokens;
 
-            common_batch_add(batch, slot.sampled, slot.n_past, { slot.id }, true);
+            // the branches of the draft are evaluated in the temporary sequences of the slot
+            common_speculative_tree_add(ctx, batch, slot.draft, slot.sampled, slot.n_past, slot.id, slot.seq_id_tmp);
+
+            if (slot.guess) {
+                slot.i_guess = common_lookahead_add(ctx, slot.lookahead, batch, slot.i_batch, slot.n_past, slot.id, slot.seq_id_tmp + slot.lookahead->G) - slot.i_batch;
+            }
 
             slot.n_past += 1;
 
@@ -2890,8 +3351,8 @@ struct server_context {
                 slot.cache_tokens.push_back(slot.sampled);
             }
 
-            SLT_DBG(slot, "slot decode token, n_ctx = %d, n_past = %d, n_cache_tokens = %d, truncated = %d\n",
-                    slot.n_ctx, slot.n_past, (int) slot.cache_tokens.size(), slot.truncated);
+            SLT_DBG(slot, "slot decode token, n_ctx = %d, n_past = %d, n_cache_tokens = %d, truncated = %d, n_draft = %d\n",
+                    slot.n_ctx, slot.n_past, (int) slot.cache_tokens.size(), slot.truncated, (int) slot.draft.size());
         }
 
         // process in chunks of params.n_batch
@@ -2916,6 +3377,12 @@ struct server_context {
 
                     // TODO: maybe move branch to outside of this loop in the future
                     if (slot.state == SLOT_STATE_STARTED) {
+                        // another slot is processing a prompt with the same prefix (e.g. the documents of a rerank request)
+                        // wait for it to be decoded, so that it is evaluated only once
+                        if (slot.is_non_causal() && pooled_prefix_reuse && slot.params.cache_prompt && is_prefix_pending(slot)) {
+                            continue;
+                        }
+
                         slot.t_start_process_prompt = ggml_time_us();
                         slot.t_start_generation = 0;
 
@@ -2949,15 +3416,37 @@ struct server_context {
                         }
 
                         if (slot.is_non_causal()) {
-                            if (slot.n_prompt_tokens > n_ubatch) {
+                            if (slot.n_prompt_tokens > slot.n_ctx) {
                                 slot.release();
-                                send_error(slot, "input is too large to process. increase the physical batch size", ERROR_TYPE_SERVER);
+                                send_error(slot, "input is larger than the max context size. skipping", ERROR_TYPE_SERVER);
                                 continue;
                             }
 
-                            if (slot.n_prompt_tokens > slot.n_ctx) {
+                            if (pooled_prefix_reuse && slot.params.cache_prompt) {
+                                slot.n_past = common_lcp(slot.cache_tokens, prompt_tokens);
+
+                                // copy a longer common prefix from the KV cache of another slot
+                                size_t n_prefix = 0;
+
+                                const server_slot * slot_prefix = get_prefix_slot(slot, prompt_tokens, n_prefix);
+                                if (slot_prefix && n_prefix > (size_t) slot.n_past) {
+                                    SLT_INF(slot, "reusing prefix of %zu tokens from slot %d\n", n_prefix, slot_prefix->id);
+
+                                    llama_kv_self_seq_rm(ctx, slot.id, -1, -1);
+                                    llama_kv_self_seq_cp(ctx, slot_prefix->id, slot.id, 0, n_prefix);
+
+                                    slot.cache_tokens.assign(prompt_tokens.begin(), prompt_tokens.begin() + n_prefix);
+                                    slot.n_cache_decoded = n_prefix;
+
+                                    slot.n_past = n_prefix;
+                                }
+                            }
+
+                            // only the part of the prompt that is not in the KV cache has to fit in the physical batch
+                            // (at least one token is evaluated to get the embeddings)
+                            if (slot.n_prompt_tokens - std::min(slot.n_past, slot.n_prompt_tokens - 1) > n_ubatch) {
                                 slot.release();
-                                send_error(slot, "input is larger than the max context size. skipping", ERROR_TYPE_SERVER);
+                                send_error(slot, "input is too large to process. increase the physical batch size", ERROR_TYPE_SERVER);
                                 continue;
                             }
                         } else {
@@ -3065,7 +3554,7 @@ struct server_context {
                     // non-causal tasks require to fit the entire prompt in the physical batch
                     if (slot.is_non_causal()) {
                         // cannot fit the prompt in the current batch - will try next iter
-                        if (batch.n_tokens + slot.n_prompt_tokens > n_batch) {
+                        if (batch.n_tokens + slot.n_prompt_tokens - slot.n_past > n_batch) {
                             continue;
                         }
                     }
@@ -3083,6 +3572,7 @@ struct server_context {
 
                     // remove the non-common part from the cache
                     slot.cache_tokens.resize(slot.n_past);
+                    slot.n_cache_decoded = std::min(slot.n_cache_decoded, slot.cache_tokens.size());
 
                     // add prompt tokens for processing in the current batch
                     while (slot.n_past < slot.n_prompt_tokens && batch.n_tokens < n_batch) {
@@ -3144,6 +3634,9 @@ struct server_context {
             common_set_adapter_lora(ctx, slot_batched->lora);
         }
 
+        // the slots whose temporary sequences can still have cells after the batch is processed
+        std::vector<server_slot *> slots_tmp;
+
         // process the created batch of tokens
         for (int32_t i = 0; i < batch.n_tokens; i += n_batch) {
             const int32_t n_tokens = std::min(n_batch, batch.n_tokens - i);
@@ -3158,9 +3651,29 @@ struct server_context {
                 batch.logits   + i,
             };
 
+            const int64_t t_decode_start = ggml_time_us();
+
             const int ret = llama_decode(ctx, batch_view);
             metrics.on_decoded(slots);
 
+            // measure the cost of the batch for the adaptive draft length
+            // the decode is asynchronous, so the measurement needs a synchronization - only do it when needed
+            const bool measure = std::any_of(slots.begin(), slots.end(), [](const server_slot & slot) {
+                return slot.is_processing() && slot.params.speculative.adaptive;
+            });
+
+            if (ret == 0 && measure) {
+                llama_synchronize(ctx);
+
+                const int64_t t_decode = ggml_time_us() - t_decode_start;
+
+                for (auto & slot : slots) {
+                    if (slot.is_processing() && slot.params.speculative.adaptive) {
+                        slot.spec_adaptive.add_target(n_tokens, t_decode);
+                    }
+                }
+            }
+
             if (ret != 0) {
                 if (n_batch == 1 || ret < 0) {
                     // if you get here, it means the KV cache is full - try increasing it via the context size
@@ -3168,6 +3681,7 @@ struct server_context {
                     for (auto & slot : slots) {
                         slot.release();
                         send_error(slot, "Input prompt is too big compared to KV size. Please try increasing KV size.");
+                        slots_tmp.push_back(&slot);
                     }
                     break; // break loop of n_batch
                 }
@@ -3210,119 +3724,109 @@ struct server_context {
 
                 const int tok_idx = slot.i_batch - i;
 
-                llama_token id = common_sampler_sample(slot.smpl, ctx, tok_idx);
-
                 slot.i_batch = -1;
 
-                common_sampler_accept(slot.smpl, id, true);
+                // the logits of the whole draft and of the window are needed, the last token of the slot is at tok_idx + i_end
+                const int i_end = slot.guess ? slot.i_guess + slot.lookahead->W - 1 : (int) slot.draft.size();
 
-                slot.n_decoded += 1;
+                bool split = false;
 
-                const int64_t t_current = ggml_time_us();
+                if (i_end > 0 && tok_idx + i_end >= n_tokens) {
+                    SLT_WRN(slot, "the draft was split by the batch, n_draft = %d - ignoring it\n", (int) slot.draft.size());
 
-                if (slot.n_decoded == 1) {
-                    slot.t_start_generation = t_current;
-                    slot.t_prompt_processing = (slot.t_start_generation - slot.t_start_process_prompt) / 1e3;
-                    metrics.on_prompt_eval(slot);
+                    split = true;
+
+                    // the rest of the draft and of the window is decoded with the next part of the batch
+                    slots_tmp.push_back(&slot);
                 }
 
-                slot.t_token_generation = (t_current - slot.t_start_generation) / 1e3;
+                // sample the next token, and the token after each drafted token for as long as the draft agrees with the samples
+                std::vector<completion_token_output> results;
 
-                completion_token_output result;
-                result.tok          = id;
-                result.text_to_send = common_token_to_piece(ctx, result.tok, accept_special_token(slot, result.tok));
-                result.prob         = 1.0f; // TODO: set it here instead of doing inside populate_token_probs
+                // the accepted nodes of the draft
+                std::vector<int> path;
 
-                if (slot.params.sampling.n_probs > 0) {
-                    populate_token_probs(slot, result, slot.params.post_sampling_probs, params_base.special, tok_idx);
-                }
+                for (int cur = -1; ; ) {
+                    const llama_token id = common_sampler_sample(slot.smpl, ctx, tok_idx + cur + 1);
 
-                if (!process_token(result, slot)) {
-                    // release slot because of stop condition
-                    slot.release();
-                    slot.print_timings();
-                    send_final_response(slot);
-                    metrics.on_prediction(slot);
-                    continue;
-                }
-            }
+                    common_sampler_accept(slot.smpl, id, true);
 
-            // do speculative decoding
-            for (auto & slot : slots) {
-                if (!slot.is_processing() || !slot.can_speculate()) {
-                    continue;
-                }
+                    completion_token_output result;
+                    result.tok          = id;
+                    result.text_to_send = common_token_to_piece(ctx, result.tok, accept_special_token(slot, result.tok));
+                    result.prob         = 1.0f; // TODO: set it here instead of doing inside populate_token_probs
 
-                if (slot.state != SLOT_STATE_GENERATING) {
-                    continue;
-                }
+                    if (slot.params.sampling.n_probs > 0) {
+                        populate_token_probs(slot, result, slot.params.post_sampling_probs, params_base.special, tok_idx + cur + 1);
+                    }
 
-                // determine the max draft that fits the current slot state
-                int n_draft_max = slot.params.speculative.n_max;
+                    results.push_back(std::move(result));
 
-                // note: n_past is not yet increased for the `id` token sampled above
-                //       also, need to leave space for 1 extra token to allow context shifts
-                n_draft_max = std::min(n_draft_max, slot.n_ctx - slot.n_past - 2);
+                    int next = -1;
+                    for (int k = cur + 1; !split && k < (int) slot.draft.size(); ++k) {
+                        if (slot.draft.parents[k] == cur && slot.draft.tokens[k] == id) {
+                            next = k;
+                            break;
+                        }
+                    }
 
-                if (slot.n_remaining > 0) {
-                    n_draft_max = std::min(n_draft_max, slot.n_remaining - 1);
+                    if (next < 0) {
+                        break;
+                    }
+
+                    path.push_back(next);
+                    cur = next;
                 }
 
-                SLT_DBG(slot, "max possible draft: %d\n", n_draft_max);
+                if (!slot.draft.empty()) {
+                    const int n_draft    = slot.draft.size();
+                    const int n_accepted = path.size();
 
-                if (n_draft_max < slot.params.speculative.n_min) {
-                    SLT_DBG(slot, "the max possible draft is too small: %d < %d - skipping speculative decoding\n", n_draft_max, slot.params.speculative.n_min);
+                    // keep the accepted path in the KV cache of the slot, the sampled token is at n_past - 1
+                    common_speculative_tree_accept(ctx, slot.draft, path, slot.n_past - 1, slot.id, slot.seq_id_tmp);
 
-                    continue;
-                }
+                    // the accepted tokens of the draft are now part of the context
+                    slot.n_past += n_accepted;
 
-                llama_token id = slot.sampled;
+                    if (slot.params.cache_prompt) {
+                        for (const int k : path) {
+                            slot.cache_tokens.push_back(slot.draft.tokens[k]);
+                        }
+                    }
 
-                struct common_speculative_params params_spec;
-                params_spec.n_draft   = n_draft_max;
-                params_spec.n_reuse   = llama_n_ctx(slot.ctx_dft) - slot.params.speculative.n_max;
-                params_spec.p_min     = slot.params.speculative.p_min;
+                    if (!split) {
+                        slot.n_draft_total    += n_draft;
+                        slot.n_draft_accepted += n_accepted;
 
-                llama_tokens draft = common_speculative_gen_draft(slot.spec, params_spec, slot.cache_tokens, id);
+                        if (slot.params.speculative.adaptive && !slot.guess) {
+                            slot.spec_adaptive.add_accept(n_draft, n_accepted);
+                        }
+                    }
 
-                // ignore small drafts
-                if (slot.params.speculative.n_min > (int) draft.size()) {
-                    SLT_DBG(slot, "ignoring small draft: %d < %d\n", (int) draft.size(), slot.params.speculative.n_min);
+                    SLT_DBG(slot, "accepted %d/%d draft tokens, new n_past = %d\n", n_accepted, n_draft, slot.n_past);
 
-                    continue;
+                    slot.draft.clear();
                 }
 
-                // construct the speculation batch
-                common_batch_clear(slot.batch_spec);
-                common_batch_add  (slot.batch_spec, id, slot.n_past, { slot.id }, true);
+                if (slot.guess) {
+                    common_lookahead_accept(ctx, slot.lookahead, split ? -1 : tok_idx + slot.i_guess, path.size(), slot.seq_id_tmp + slot.lookahead->G);
 
-                for (size_t i = 0; i < draft.size(); ++i) {
-                    common_batch_add(slot.batch_spec, draft[i], slot.n_past + 1 + i, { slot.id }, true);
+                    slot.guess = false;
                 }
 
-                SLT_DBG(slot, "decoding speculative batch, size = %d\n", slot.batch_spec.n_tokens);
-
-                llama_decode(ctx, slot.batch_spec);
-
-                // the accepted tokens from the speculation
-                const auto ids = common_sampler_sample_and_accept_n(slot.smpl, ctx, draft);
-
-                slot.n_past    += ids.size();
-                slot.n_decoded += ids.size();
-
-                slot.cache_tokens.push_back(id);
-                slot.cache_tokens.insert(slot.cache_tokens.end(), ids.begin(), ids.end() - 1);
-
-                llama_kv_self_seq_rm(ctx, slot.id, slot.n_past, -1);
+                const int64_t t_current = ggml_time_us();
 
-                for (size_t i = 0; i < ids.size(); ++i) {
-                    completion_token_output result;
+                if (slot.n_decoded == 0) {
+                    slot.t_start_generation = t_current;
+                    slot.t_prompt_processing = (slot.t_start_generation - slot.t_start_process_prompt) / 1e3;
+                    metrics.on_prompt_eval(slot);
+                }
 
-                    result.tok          = ids[i];
-                    result.text_to_send = common_token_to_piece(ctx, result.tok, accept_special_token(slot, result.tok));
-                    result.prob         = 1.0f; // set later
+                slot.t_token_generation = (t_current - slot.t_start_generation) / 1e3;
 
-                    // TODO: set result.probs
+                for (auto & result : results) {
+                    // note: the budget of the slot is checked with each token
+                    slot.n_decoded += 1;
 
                     if (!process_token(result, slot)) {
                         // release slot because of stop condition
@@ -3333,11 +3837,13 @@ struct server_context {
                         break;
                     }
                 }
-
-                SLT_DBG(slot, "accepted %d/%d draft tokens, new n_past = %d\n", (int) ids.size() - 1, (int) draft.size(), slot.n_past);
             }
         }
 
+        for (const auto * slot : slots_tmp) {
+            slot->clear_seq_tmp();
+        }
+
         SRV_DBG("%s", "run slots completed\n");
     }
 
@@ -3656,6 +4162,14 @@ int main(int argc, char ** argv) {
                     {"name",  "n_busy_slots_per_decode"},
                     {"help",  "Average number of busy slots per llama_decode() call"},
                     {"value",  (float) res_metrics->n_busy_slots_total / std::max((float) res_metrics->n_decode_total, 1.f)}
+            }, {
+                    {"name",  "tokenize_cache_hits_total"},
+                    {"help",  "Number of prompt segments found in the tokenization cache."},
+                    {"value",  res_metrics->n_tokenize_cache_hit}
+            }, {
+                    {"name",  "tokenize_cache_misses_total"},
+                    {"help",  "Number of prompt segments tokenized because they were not in the tokenization cache."},
+                    {"value",  res_metrics->n_tokenize_cache_miss}
             }}},
             {"gauge", {{
                     {"name",  "prompt_tokens_seconds"},
@@ -3871,7 +4385,7 @@ int main(int argc, char ** argv) {
             // TODO: this log can become very long, put it behind a flag or think about a more compact format
             //SRV_DBG("Prompt: %s\n", prompt.is_string() ? prompt.get<std::string>().c_str() : prompt.dump(2).c_str());
 
-            std::vector<llama_tokens> tokenized_prompts = tokenize_input_prompts(ctx_server.vocab, prompt, true, true);
+            std::vector<llama_tokens> tokenized_prompts = tokenize_input_prompts(ctx_server.vocab, prompt, true, true, &ctx_server.tokenizer_cache);
             tasks.reserve(tokenized_prompts.size());
             for (size_t i = 0; i < tokenized_prompts.size(); i++) {
                 server_task task = server_task(type);
@@ -4106,7 +4620,7 @@ int main(int argc, char ** argv) {
             const bool add_special = json_value(body, "add_special", false);
             const bool with_pieces = json_value(body, "with_pieces", false);
 
-            llama_tokens tokens = tokenize_mixed(ctx_server.vocab, body.at("content"), add_special, true);
+            llama_tokens tokens = tokenize_mixed(ctx_server.vocab, body.at("content"), add_special, true, &ctx_server.tokenizer_cache);
 
             if (with_pieces) {
                 for (const auto& token : tokens) {
@@ -4182,7 +4696,26 @@ int main(int argc, char ** argv) {
             }
         }
 
-        std::vector<llama_tokens> tokenized_prompts = tokenize_input_prompts(ctx_server.vocab, prompt, true, true);
+        embd_type type = EMBD_TYPE_FLOAT;
+        try {
+            type = embd_type_from_str(json_value(body, "embedding_type", std::string("float")));
+        } catch (const std::exception & e) {
+            res_error(res, format_error_response(e.what(), ERROR_TYPE_INVALID_REQUEST));
+            return;
+        }
+
+        // Matryoshka truncation
+        const int32_t n_embd = llama_model_n_embd(ctx_server.model);
+        const int32_t n_dims = json_value(body, "dimensions", 0);
+        if (n_dims < 0 || n_dims > n_embd) {
+            res_error(res, format_error_response(string_format("\"dimensions\" must be between 1 and %d, or 0 to keep all of them", n_embd), ERROR_TYPE_INVALID_REQUEST));
+            return;
+        }
+
+        // the truncated pooled embeddings are normalized again
+        const int32_t embd_norm = llama_pooling_type(ctx_server.ctx) != LLAMA_POOLING_TYPE_NONE ? ctx_server.params_base.embd_normalize : -1;
+
+        std::vector<llama_tokens> tokenized_prompts = tokenize_input_prompts(ctx_server.vocab, prompt, true, true, &ctx_server.tokenizer_cache);
         for (const auto & tokens : tokenized_prompts) {
             // this check is necessary for models that do not add BOS token to the input
             if (tokens.empty()) {
@@ -4217,7 +4750,14 @@ int main(int argc, char ** argv) {
 
             ctx_server.receive_multi_results(task_ids, [&](std::vector<server_task_result_ptr> & results) {
                 for (auto & res : results) {
-                    GGML_ASSERT(dynamic_cast<server_task_result_embd*>(res.get()) != nullptr);
+                    auto * res_embd = dynamic_cast<server_task_result_embd*>(res.get());
+                    GGML_ASSERT(res_embd != nullptr);
+
+                    res_embd->n_dims     = n_dims;
+                    res_embd->embd_norm  = embd_norm;
+                    res_embd->type       = type;
+                    res_embd->use_base64 = use_base64;
+
                     responses.push_back(res->to_json());
                 }
             }, [&](const json & error_data) {
@@ -4529,6 +5069,8 @@ int main(int argc, char ** argv) {
     // this call blocks the main thread until queue_tasks.terminate() is called
     ctx_server.queue_tasks.start_loop();
 
+    ctx_server.save_lookup_cache_dynamic();
+
     clean_up();
     // t.join(); // FIXME: http thread may stuck if there is an on-going request. we don't need to care about this for now as the HTTP connection will already be closed at this point, but it's better to fix this
 
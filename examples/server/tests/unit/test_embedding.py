@@ -235,3 +235,118 @@ def test_embedding_openai_library_base64():
     # make sure the decoded data is the same as the original
     for x, y in zip(floats, vec0):
         assert abs(x - y) < EPSILON
+
+
+def test_embedding_dimensions():
+    server.start()
+    test_input = "Test truncated embedding output"
+
+    res = server.make_request("POST", "/v1/embeddings", data={
+        "input": test_input
+    })
+    assert res.status_code == 200
+    vec0 = res.body["data"][0]["embedding"]
+
+    n_dims = 64
+    res = server.make_request("POST", "/v1/embeddings", data={
+        "input": test_input,
+        "dimensions": n_dims,
+    })
+    assert res.status_code == 200
+    vec1 = res.body["data"][0]["embedding"]
+    assert len(vec1) == n_dims
+
+    # the truncated embedding is the normalized prefix of the full one
+    norm = sum([x ** 2 for x in vec0[:n_dims]]) ** 0.5
+    for x, y in zip(vec1, vec0[:n_dims]):
+        assert abs(x - y / norm) < EPSILON
+
+    res = server.make_request("POST", "/v1/embeddings", data={
+        "input": test_input,
+        "dimensions": len(vec0) + 1,
+    })
+    assert res.status_code == 400
+
+    # 0 keeps all the dimensions
+    res = server.make_request("POST", "/v1/embeddings", data={
+        "input": test_input,
+        "dimensions": 0,
+    })
+    assert res.status_code == 200
+    assert len(res.body["data"][0]["embedding"]) == len(vec0)
+
+
+@pytest.mark.parametrize("encoding_format", ["float", "base64"])
+def test_embedding_quantized(encoding_format: str):
+    server.start()
+    test_input = "Test quantized embedding output"
+
+    res = server.make_request("POST", "/v1/embeddings", data={
+        "input": test_input
+    })
+    assert res.status_code == 200
+    vec0 = res.body["data"][0]["embedding"]
+
+    res = server.make_request("POST", "/v1/embeddings", data={
+        "input": test_input,
+        "embedding_type": "int8",
+        "encoding_format": encoding_format,
+    })
+    assert res.status_code == 200
+    vec_i8 = res.body["data"][0]["embedding"]
+    if encoding_format == "base64":
+        vec_i8 = struct.unpack(f'{len(vec0)}b', base64.b64decode(vec_i8))
+    assert len(vec_i8) == len(vec0)
+    assert max(abs(x) for x in vec_i8) == 127
+    cos = sum(x * y for x, y in zip(vec_i8, vec0)) / sum(x ** 2 for x in vec_i8) ** 0.5
+    assert cos > 0.99
+
+    res = server.make_request("POST", "/v1/embeddings", data={
+        "input": test_input,
+        "embedding_type": "binary",
+        "encoding_format": encoding_format,
+    })
+    assert res.status_code == 200
+    vec_bin = res.body["data"][0]["embedding"]
+    if encoding_format == "base64":
+        vec_bin = base64.b64decode(vec_bin)
+    assert len(vec_bin) == (len(vec0) + 7) // 8
+    for i, x in enumerate(vec0):
+        assert ((vec_bin[i // 8] >> (7 - i % 8)) & 1) == (x > 0)
+
+
+def test_embedding_shared_prefix():
+    global server
+    # causal models with last-token pooling reuse the KV cache of a prompt prefix shared with an earlier request
+    server = ServerPreset.tinyllama2()
+    server.server_embeddings = True
+    server.pooling = 'last'
+    server.n_batch = 32
+    server.n_ubatch = 32
+    server.start()
+    prefix = list(range(10, 34))
+    prompt_a = prefix + list(range(100, 106))
+    prompt_b = prefix + list(range(200, 220))
+    prompt_c = prefix + list(range(300, 340))
+    res = server.make_request("POST", "/v1/embeddings", data={"input": prompt_a})
+    assert res.status_code == 200
+    vec_a = res.body['data'][0]['embedding']
+    # longer than the physical batch, but only the part after the prefix is evaluated
+    res = server.make_request("POST", "/v1/embeddings", data={"input": prompt_b})
+    assert res.status_code == 200
+    vec_b = res.body['data'][0]['embedding']
+    # the part after the prefix does not fit in the physical batch
+    res = server.make_request("POST", "/v1/embeddings", data={"input": prompt_c})
+    assert res.status_code != 200
+    assert "too large" in res.body["error"]["message"]
+
+    # the same vectors as without the prefix in the KV cache: prompt_b first, then prompt_a that reuses its prefix
+    server.stop()
+    server.n_batch = 64
+    server.n_ubatch = 64
+    server.start()
+    for prompt, vec in [(prompt_b, vec_b), (prompt_a, vec_a)]:
+        res = server.make_request("POST", "/v1/embeddings", data={"input": prompt})
+        assert res.status_code == 200
+        for x, y in zip(res.body['data'][0]['embedding'], vec):
+            assert abs(x - y) < EPSILON
@@ -48,6 +48,86 @@ def test_with_and_without_draft():
     assert content_no_draft == content_draft
 
 
+def test_with_and_without_lookup():
+    global server
+    server.model_draft = None  # draft from the n-grams of the context
+    server.start()
+    prompt = "Once upon a time, there was a little girl named Lily. " * 4
+    contents = []
+    for lookup in [False, True]:
+        res = server.make_request("POST", "/completion", data={
+            "prompt": prompt,
+            "temperature": 0.0,
+            "top_k": 1,
+            "n_predict": 64,
+            "speculative.lookup": lookup,
+        })
+        assert res.status_code == 200
+        contents.append(res.body["content"])
+    assert contents[0] == contents[1]
+    assert res.body["timings"]["draft_n"] > 0
+
+
+def test_with_and_without_self_draft():
+    global server
+    server.model_draft = None  # draft with the first layers of the model itself
+    server.draft_layers = 3
+    server.start()
+    prompts = ["I believe the meaning of life is", "Write a joke about AI"]
+    contents = []
+    for draft_max in [0, 8]:
+        for prompt in prompts:
+            res = server.make_request("POST", "/completion", data={
+                "prompt": prompt,
+                "temperature": 0.0,
+                "top_k": 1,
+                "n_predict": 64,
+                "speculative.n_max": draft_max,
+                "speculative.p_min": 0.0,
+            })
+            assert res.status_code == 200
+            contents.append(res.body["content"])
+    assert contents[:2] == contents[2:]
+    assert res.body["timings"]["draft_n"] > 0
+
+
+def test_with_and_without_lookahead():
+    global server
+    server.model_draft = None  # guess the next tokens with the model itself
+    server.start()
+    prompt = "Once upon a time, there was a little girl named Lily. " * 4
+    contents = []
+    for lookahead in [False, True]:
+        res = server.make_request("POST", "/completion", data={
+            "prompt": prompt,
+            "temperature": 0.0,
+            "top_k": 1,
+            "n_predict": 64,
+            "speculative.lookahead": lookahead,
+        })
+        assert res.status_code == 200
+        contents.append(res.body["content"])
+    assert contents[0] == contents[1]
+    assert res.body["timings"]["draft_n"] > 0
+
+
+def test_with_and_without_adaptive():
+    global server
+    server.start()
+    contents = []
+    for adaptive in [False, True]:
+        res = server.make_request("POST", "/completion", data={
+            "prompt": "I believe the meaning of life is",
+            "temperature": 0.0,
+            "top_k": 1,
+            "n_predict": 64,
+            "speculative.adaptive": adaptive,
+        })
+        assert res.status_code == 200
+        contents.append(res.body["content"])
+    assert contents[0] == contents[1]
+
+
 def test_different_draft_min_draft_max():
     global server
     test_values = [
@@ -108,6 +188,7 @@ def test_with_ctx_shift():
 @pytest.mark.parametrize("n_slots,n_requests", [
     (1, 2),
     (2, 2),
+    (4, 8),
 ])
 def test_multi_requests_parallel(n_slots: int, n_requests: int):
     global server
@@ -124,3 +205,5 @@ def test_multi_requests_parallel(n_slots: int, n_requests: int):
     for res in results:
         assert res.status_code == 200
         assert match_regex("(wise|kind|owl|answer)+", res.body["content"])
+    # the drafts of the slots are generated and verified together
+    assert all(res.body["content"] == results[0].body["content"] for res in results)
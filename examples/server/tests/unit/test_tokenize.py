@@ -57,3 +57,40 @@ def test_tokenize_with_pieces():
         assert token["id"] > 0
         assert "piece" in token
         assert len(token["piece"]) > 0
+
+
+def test_tokenize_cache():
+    global server
+    # the prompts are cut before the special tokens, each segment is cached separately
+    contents = [
+        "<s>[INST] You are a helpful assistant. [/INST] OK</s><s>[INST] What is the capital of France ? [/INST]",
+        "<s>[INST] You are a helpful assistant. [/INST] OK</s><s>[INST] What is the capital of Germany ? [/INST]",
+        "  leading spaces</s>trailing spaces  </s></s>\n<s>",
+    ]
+
+    def tokenize_all():
+        res = []
+        for content in contents:
+            for add_special in [False, True]:
+                res_tok = server.make_request("POST", "/tokenize", data={
+                    "content": content,
+                    "add_special": add_special,
+                })
+                assert res_tok.status_code == 200
+                res.append(res_tok.body["tokens"])
+        return res
+
+    server.no_tokenize_cache = True
+    server.start()
+    tokens_ref = tokenize_all()
+    server.stop()
+
+    server.no_tokenize_cache = False
+    server.server_metrics = True
+    server.start()
+    assert tokenize_all() == tokens_ref
+    assert tokenize_all() == tokens_ref # from the cache
+
+    res = requests.get(f"http://{server.server_host}:{server.server_port}/metrics")
+    assert res.status_code == 200
+    assert match_regex(r"llamacpp:tokenize_cache_hits_total [1-9]", res.text)
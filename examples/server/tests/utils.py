@@ -82,7 +82,9 @@ class ServerProcess:
     disable_ctx_shift: int | None = False
     draft_min: int | None = None
     draft_max: int | None = None
+    draft_layers: int | None = None
     no_webui: bool | None = None
+    no_tokenize_cache: bool | None = None
     jinja: bool | None = None
     reasoning_format: Literal['deepseek', 'none'] | None = None
     chat_template: str | None = None
@@ -184,8 +186,12 @@ class ServerProcess:
             server_args.extend(["--draft-max", self.draft_max])
         if self.draft_min:
             server_args.extend(["--draft-min", self.draft_min])
+        if self.draft_layers:
+            server_args.extend(["--draft-layers", self.draft_layers])
         if self.no_webui:
             server_args.append("--no-webui")
+        if self.no_tokenize_cache:
+            server_args.append("--no-tokenize-cache")
         if self.jinja:
             server_args.append("--jinja")
         if self.reasoning_format is not None:
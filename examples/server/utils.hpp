@@ -16,9 +16,12 @@
 #include "json.hpp"
 #include "chat.h"
 
+#include <list>
+#include <mutex>
 #include <random>
 #include <sstream>
 #include <string>
+#include <unordered_map>
 #include <vector>
 #include <memory>
 
@@ -112,16 +115,222 @@ static json json_get_nested_values(const std::vector<std::string> & paths, const
     return result;
 }
 
+/**
+ * LRU cache of the tokenization of prompt segments
+ *
+ * chat requests re-send the same chat template, system prompt and conversation history over and over, so the prompt
+ * is cut right before the control tokens that delimit the messages (e.g. <|im_start|>) and each segment is looked up
+ * separately - only the new messages have to be tokenized
+ *
+ * the text between special tokens is tokenized independently of the rest of the prompt, so concatenating the tokens
+ * of the segments gives the same result as tokenizing the whole prompt. to guarantee this, a control token is used
+ * as a cut point only if the special token partitioning of the tokenizer always isolates it:
+ * - no other special token overlaps with it
+ * - it does not strip the whitespace on its left
+ * - it starts and ends with a non-whitespace character, so that the whitespace stripping of the other special
+ *   tokens cannot reach it
+ */
+struct server_tokenizer_cache {
+    struct special_token {
+        std::string text;
+        bool is_cut;
+    };
+
+    struct entry {
+        std::string  key;
+        llama_tokens tokens;
+    };
+
+    const llama_vocab * vocab = nullptr;
+
+    std::vector<special_token> specials;
+    std::vector<std::vector<size_t>> specials_by_byte; // indices of the special tokens by first byte
+
+    size_t n_tokens_max = 0; // capacity of the cache in tokens
+    size_t n_tokens     = 0;
+
+    uint64_t n_hit  = 0; // looked up segments found in the cache
+    uint64_t n_miss = 0;
+
+    std::list<entry> entries; // most recently used first
+    std::unordered_map<std::string, std::list<entry>::iterator> map;
+
+    std::mutex mutex;
+
+    void init(const llama_vocab * vocab, size_t n_tokens_max) {
+        this->vocab        = vocab;
+        this->n_tokens_max = n_tokens_max;
+
+        specials.clear();
+        specials_by_byte.assign(256, {});
+
+        const int32_t n_vocab = llama_vocab_n_tokens(vocab);
+        for (llama_token id = 0; id < n_vocab; ++id) {
+            const auto attr = llama_vocab_get_attr(vocab, id);
+            if (!(attr & (LLAMA_TOKEN_ATTR_CONTROL | LLAMA_TOKEN_ATTR_USER_DEFINED | LLAMA_TOKEN_ATTR_UNKNOWN))) {
+                continue;
+            }
+
+            const std::string text = llama_vocab_get_text(vocab, id);
+            if (text.empty()) {
+                continue;
+            }
+
+            const bool is_cut =
+                (attr & LLAMA_TOKEN_ATTR_CONTROL) && !(attr & LLAMA_TOKEN_ATTR_LSTRIP) &&
+                !isspace((unsigned char) text.front()) && !isspace((unsigned char) text.back());
+
+            specials_by_byte[(uint8_t) text[0]].push_back(specials.size());
+            specials.push_back({ text, is_cut });
+        }
+    }
+
+    // find the positions at which the text can be cut
+    std::vector<size_t> find_cuts(const std::string & text) const {
+        struct occurrence {
+            size_t start;
+            size_t end;
+            bool   is_cut;
+        };
+
+        // every occurrence of every special token, ordered by start
+        std::vector<occurrence> occs;
+        for (size_t i = 0; i < text.size(); ++i) {
+            for (size_t idx : specials_by_byte[(uint8_t) text[i]]) {
+                const auto & st = specials[idx];
+                if (text.compare(i, st.text.size(), st.text) == 0) {
+                    occs.push_back({ i, i + st.text.size(), st.is_cut });
+                }
+            }
+        }
+
+        // occurrences of tokens with the same text are the same occurrence
+        std::sort(occs.begin(), occs.end(), [](const occurrence & a, const occurrence & b) {
+            return a.start < b.start || (a.start == b.start && a.end < b.end);
+        });
+        std::vector<occurrence> uniq;
+        for (const auto & occ : occs) {
+            if (!uniq.empty() && uniq.back().start == occ.start && uniq.back().end == occ.end) {
+                uniq.back().is_cut = uniq.back().is_cut && occ.is_cut;
+            } else {
+                uniq.push_back(occ);
+            }
+        }
+
+        std::vector<size_t> cuts;
+
+        size_t end_max = 0; // max end of the previous occurrences
+        for (size_t i = 0; i < uniq.size(); ++i) {
+            const auto & occ = uniq[i];
+
+            const bool isolated =
+                end_max <= occ.start &&
+                (i + 1 == uniq.size() || uniq[i + 1].start >= occ.end);
+
+            if (occ.is_cut && isolated && occ.start > 0) {
+                cuts.push_back(occ.start);
+            }
+
+            end_max = std::max(end_max, occ.end);
+        }
+
+        return cuts;
+    }
+
+    llama_tokens tokenize(const std::string & text, bool add_special, bool parse_special) {
+        // the cuts rely on the special tokens being parsed, and only a BOS at the start can be added to the tokens
+        if (!parse_special || n_tokens_max == 0 ||
+            (add_special && (llama_vocab_get_add_eos(vocab) || llama_vocab_type(vocab) == LLAMA_VOCAB_TYPE_WPM))) {
+            return common_tokenize(vocab, text, add_special, parse_special);
+        }
+
+        std::vector<size_t> cuts = find_cuts(text);
+        cuts.push_back(text.size());
+
+        llama_tokens result;
+
+        size_t start = 0;
+        for (size_t cut : cuts) {
+            const bool add = add_special && start == 0;
+
+            std::string key;
+            key.reserve(cut - start + 1);
+            key += add ? '1' : '0';
+            key.append(text, start, cut - start);
+
+            if (!lookup(key, result)) {
+                const llama_tokens tokens = common_tokenize(vocab, key.substr(1), add, true);
+                result.insert(result.end(), tokens.begin(), tokens.end());
+                insert(std::move(key), tokens);
+            }
+
+            start = cut;
+        }
+
+        return result;
+    }
+
+    // append the cached tokens of the key to the result
+    bool lookup(const std::string & key, llama_tokens & result) {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        auto it = map.find(key);
+        if (it == map.end()) {
+            n_miss++;
+            return false;
+        }
+        n_hit++;
+
+        entries.splice(entries.begin(), entries, it->second);
+        result.insert(result.end(), it->second->tokens.begin(), it->second->tokens.end());
+
+        return true;
+    }
+
+    void get_stats(uint64_t & n_hit, uint64_t & n_miss) {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        n_hit  = this->n_hit;
+        n_miss = this->n_miss;
+    }
+
+    void insert(std::string && key, const llama_tokens & tokens) {
+        if (tokens.size() > n_tokens_max) {
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+
+        if (map.find(key) != map.end()) {
+            return; // inserted concurrently
+        }
+
+        entries.push_front({ std::move(key), tokens });
+        map[entries.front().key] = entries.begin();
+        n_tokens += tokens.size();
+
+        while (n_tokens > n_tokens_max) {
+            n_tokens -= entries.back().tokens.size();
+            map.erase(entries.back().key);
+            entries.pop_back();
+        }
+    }
+};
+
 /**
  * this handles 2 cases:
  * - only string, example: "string"
  * - mixed string and tokens, example: [12, 34, "string", 56, 78]
  */
-static llama_tokens tokenize_mixed(const llama_vocab * vocab, const json & json_prompt, bool add_special, bool parse_special) {
+static llama_tokens tokenize_mixed(const llama_vocab * vocab, const json & json_prompt, bool add_special, bool parse_special, server_tokenizer_cache * cache = nullptr) {
     // If `add_bos` is true, we only add BOS, when json_prompt is a string,
     // or the first element of the json_prompt array is a string.
     llama_tokens prompt_tokens;
 
+    auto tokenize = [&](const std::string & s, bool add_special) {
+        return cache ? cache->tokenize(s, add_special, parse_special) : common_tokenize(vocab, s, add_special, parse_special);
+    };
+
     if (json_prompt.is_array()) {
         bool first = true;
         for (const auto & p : json_prompt) {
@@ -130,10 +339,10 @@ static llama_tokens tokenize_mixed(const llama_vocab * vocab, const json & json_
 
                 llama_tokens p;
                 if (first) {
-                    p = common_tokenize(vocab, s, add_special, parse_special);
+                    p = tokenize(s, add_special);
                     first = false;
                 } else {
-                    p = common_tokenize(vocab, s, false, parse_special);
+                    p = tokenize(s, false);
                 }
 
                 prompt_tokens.insert(prompt_tokens.end(), p.begin(), p.end());
@@ -147,7 +356,7 @@ static llama_tokens tokenize_mixed(const llama_vocab * vocab, const json & json_
         }
     } else {
         auto s = json_prompt.template get<std::string>();
-        prompt_tokens = common_tokenize(vocab, s, add_special, parse_special);
+        prompt_tokens = tokenize(s, add_special);
     }
 
     return prompt_tokens;
@@ -165,11 +374,11 @@ static llama_tokens tokenize_mixed(const llama_vocab * vocab, const json & json_
  * - "prompt": [[12, 34, 56], [78, 90, 12]]
  * - "prompt": [[12, 34, "string", 56, 78], [12, 34, 56]]
  */
-static std::vector<llama_tokens> tokenize_input_prompts(const llama_vocab * vocab, const json & json_prompt, bool add_special, bool parse_special) {
+static std::vector<llama_tokens> tokenize_input_prompts(const llama_vocab * vocab, const json & json_prompt, bool add_special, bool parse_special, server_tokenizer_cache * cache = nullptr) {
     std::vector<llama_tokens> result;
     if (json_prompt.is_string() || json_is_array_of_mixed_numbers_strings(json_prompt)) {
         // string or mixed
-        result.push_back(tokenize_mixed(vocab, json_prompt, add_special, parse_special));
+        result.push_back(tokenize_mixed(vocab, json_prompt, add_special, parse_special, cache));
     } else if (json_is_array_of_numbers(json_prompt)) {
         // array of tokens
         result.push_back(json_prompt.get<llama_tokens>());
@@ -178,7 +387,7 @@ static std::vector<llama_tokens> tokenize_input_prompts(const llama_vocab * voca
         result.reserve(json_prompt.size());
         for (const auto & p : json_prompt) {
             if (p.is_string() || json_is_array_of_mixed_numbers_strings(p)) {
-                result.push_back(tokenize_mixed(vocab, p, add_special, parse_special));
+                result.push_back(tokenize_mixed(vocab, p, add_special, parse_special, cache));
             } else if (json_is_array_of_numbers(p)) {
                 // array of tokens
                 result.push_back(p.get<llama_tokens>());
@@ -662,6 +871,61 @@ static json oaicompat_completion_params_parse(
     return llama_params;
 }
 
+enum embd_type {
+    EMBD_TYPE_FLOAT,
+    EMBD_TYPE_INT8,
+    EMBD_TYPE_BINARY,
+};
+
+static embd_type embd_type_from_str(const std::string & str) {
+    if (str == "float") {
+        return EMBD_TYPE_FLOAT;
+    }
+    if (str == "int8") {
+        return EMBD_TYPE_INT8;
+    }
+    if (str == "binary") {
+        return EMBD_TYPE_BINARY;
+    }
+    throw std::invalid_argument("invalid embedding type: " + str + ", must be one of float, int8, binary");
+}
+
+// format an embedding as a JSON array of numbers, or as a base64 string of its raw bytes:
+//   float:  float32, little-endian
+//   int8:   int8, see common_embd_quantize_i8()
+//   binary: packed sign bits, see common_embd_quantize_bin()
+static json format_embedding(const std::vector<float> & embd, embd_type type, bool use_base64) {
+    switch (type) {
+        case EMBD_TYPE_FLOAT:
+            {
+                if (use_base64) {
+                    return base64::encode(reinterpret_cast<const char *>(embd.data()), embd.size()*sizeof(float));
+                }
+                return embd;
+            }
+        case EMBD_TYPE_INT8:
+            {
+                std::vector<int8_t> res(embd.size());
+                common_embd_quantize_i8(embd.data(), res.data(), embd.size());
+                if (use_base64) {
+                    return base64::encode(reinterpret_cast<const char *>(res.data()), res.size());
+                }
+                return res;
+            }
+        case EMBD_TYPE_BINARY:
+            {
+                std::vector<uint8_t> res((embd.size() + 7)/8);
+                common_embd_quantize_bin(embd.data(), res.data(), embd.size());
+                if (use_base64) {
+                    return base64::encode(reinterpret_cast<const char *>(res.data()), res.size());
+                }
+                return res;
+            }
+    }
+
+    GGML_ABORT("unknown embedding type");
+}
+
 static json format_embeddings_response_oaicompat(const json & request, const json & embeddings, bool use_base64 = false) {
     json data = json::array();
     int32_t n_tokens = 0;
@@ -670,11 +934,9 @@ static json format_embeddings_response_oaicompat(const json & request, const jso
         json embedding_obj;
 
         if (use_base64) {
-            const auto& vec = json_value(elem, "embedding", json::array()).get<std::vector<float>>();
-            const char* data_ptr = reinterpret_cast<const char*>(vec.data());
-            size_t data_size = vec.size() * sizeof(float);
+            // already encoded by format_embedding()
             embedding_obj = {
-                {"embedding", base64::encode(data_ptr, data_size)},
+                {"embedding", json_value(elem, "embedding", std::string())},
                 {"index", i++},
                 {"object", "embedding"},
                 {"encoding_format", "base64"}
@@ -24,8 +24,16 @@ int main(int argc, char ** argv) {
 
     common_init();
 
-    if (params.speculative.model.empty()) {
-        LOG_ERR("%s: --model-draft is required\n", __func__);
+    // self-speculation: draft with a subset of the layers of the target model
+    const bool self = params.speculative.n_layer > 0 || !params.speculative.layer_skip.empty();
+
+    if (params.speculative.model.empty() && !self) {
+        LOG_ERR("%s: --model-draft or --draft-layers/--draft-skip-layers is required\n", __func__);
+        return 1;
+    }
+
+    if (self && params.speculative.n_branch > 1) {
+        LOG_ERR("%s: tree drafts are not supported with self-speculation\n", __func__);
         return 1;
     }
 
@@ -47,25 +55,31 @@ int main(int argc, char ** argv) {
 
     const llama_vocab * vocab = llama_model_get_vocab(model_tgt);
 
-    // load the draft model
-    params.devices      = params.speculative.devices;
-    params.model        = params.speculative.model;
-    params.n_ctx        = params.speculative.n_ctx;
-    params.n_batch      = params.speculative.n_ctx > 0 ? params.speculative.n_ctx : params.n_batch;
-    params.n_gpu_layers = params.speculative.n_gpu_layers;
+    common_init_result llama_init_dft;
 
-    if (params.speculative.cpuparams.n_threads > 0) {
-        params.cpuparams.n_threads = params.speculative.cpuparams.n_threads;
-    }
+    if (self) {
+        ctx_dft = ctx_tgt;
+    } else {
+        // load the draft model
+        params.devices      = params.speculative.devices;
+        params.model        = params.speculative.model;
+        params.n_ctx        = params.speculative.n_ctx;
+        params.n_batch      = params.speculative.n_ctx > 0 ? params.speculative.n_ctx : params.n_batch;
+        params.n_gpu_layers = params.speculative.n_gpu_layers;
 
-    params.cpuparams_batch.n_threads = params.speculative.cpuparams_batch.n_threads;
-    common_init_result llama_init_dft = common_init_from_params(params);
+        if (params.speculative.cpuparams.n_threads > 0) {
+            params.cpuparams.n_threads = params.speculative.cpuparams.n_threads;
+        }
 
-    //model_dft = llama_init_dft.model.get();
-    ctx_dft   = llama_init_dft.context.get();
+        params.cpuparams_batch.n_threads = params.speculative.cpuparams_batch.n_threads;
+        llama_init_dft = common_init_from_params(params);
 
-    if (!common_speculative_are_compatible(ctx_tgt, ctx_dft)) {
-        return 1;
+        //model_dft = llama_init_dft.model.get();
+        ctx_dft   = llama_init_dft.context.get();
+
+        if (!common_speculative_are_compatible(ctx_tgt, ctx_dft)) {
+            return 1;
+        }
     }
 
     // Tokenize the prompt
@@ -94,7 +108,11 @@ int main(int argc, char ** argv) {
     int n_draft     = params.speculative.n_max;
     int n_draft_min = params.speculative.n_min;
 
-    float p_min = params.speculative.p_min;
+    // draft a tree of tokens instead of a single sequence
+    const int n_branch = params.speculative.n_branch;
+
+    float p_min   = params.speculative.p_min;
+    float p_split = params.speculative.p_split;
 
     int n_predict = 0;
     int n_drafted = 0;
@@ -126,13 +144,22 @@ int main(int argc, char ** argv) {
 
     // init the speculator
     struct common_speculative_params params_spec;
-    params_spec.n_draft = n_draft;
-    params_spec.n_reuse = llama_n_ctx(ctx_dft) - n_draft;
-    params_spec.p_min   = p_min;
+    params_spec.n_draft  = n_draft;
+    params_spec.n_reuse  = llama_n_ctx(ctx_dft) - n_draft;
+    params_spec.n_branch = n_branch;
+    params_spec.p_min    = p_min;
+    params_spec.p_split  = p_split;
 
-    struct common_speculative * spec = common_speculative_init(ctx_dft);
+    struct common_speculative * spec = self ?
+        common_speculative_init_self(ctx_tgt, 0, common_speculative_layer_skip(model_tgt, params.speculative.n_layer, params.speculative.layer_skip)) :
+        common_speculative_init(ctx_dft);
+
+    if (spec == nullptr) {
+        return 1;
+    }
 
-    llama_batch batch_tgt = llama_batch_init(llama_n_batch(ctx_tgt), 0, 1);
+    // with tree drafts, a token can belong to a sequence for each path of the tree
+    llama_batch batch_tgt = llama_batch_init(llama_n_batch(ctx_tgt), 0, n_branch > 1 ? n_draft + 1 : 1);
 
     const auto t_enc_end = ggml_time_us();
 
@@ -146,40 +173,66 @@ int main(int argc, char ** argv) {
         // offloaded to a remote device. it doesn't even have to be based on an LLM. instead, it can provide tokens
         // from a cache or lookup tables.
         //
-        llama_tokens draft = common_speculative_gen_draft(spec, params_spec, prompt_tgt, id_last);
+        llama_tokens draft;
+        std::vector<llama_token> ids;
 
-        //LOG_DBG("draft: %s\n", string_from(ctx_dft, draft).c_str());
+        if (n_branch == 1) {
+            draft = common_speculative_gen_draft(spec, params_spec, prompt_tgt, id_last);
 
-        // always have a token to evaluate from before - id_last
-        common_batch_clear(batch_tgt);
-        common_batch_add  (batch_tgt, id_last, n_past++, { 0 }, true);
+            //LOG_DBG("draft: %s\n", string_from(ctx_dft, draft).c_str());
 
-        // evaluate the target model on [id_last, draft0, draft1, ..., draftN-1]
-        {
-            // do not waste time on small drafts
-            if (draft.size() < (size_t) n_draft_min) {
-                draft.clear();
+            // always have a token to evaluate from before - id_last
+            common_batch_clear(batch_tgt);
+            common_batch_add  (batch_tgt, id_last, n_past++, { 0 }, true);
+
+            // evaluate the target model on [id_last, draft0, draft1, ..., draftN-1]
+            {
+                // do not waste time on small drafts
+                if (draft.size() < (size_t) n_draft_min) {
+                    draft.clear();
+                }
+
+                for (size_t i = 0; i < draft.size(); ++i) {
+                    common_batch_add(batch_tgt, draft[i], n_past + i, { 0 }, true);
+                }
+
+                //LOG_DBG("target batch: %s\n", string_from(ctx_tgt, batch_tgt).c_str());
+
+                llama_decode(ctx_tgt, batch_tgt);
             }
 
-            for (size_t i = 0; i < draft.size(); ++i) {
-                common_batch_add(batch_tgt, draft[i], n_past + i, { 0 }, true);
+            // sample from the full target batch and return the accepted tokens based on the target sampler
+            //
+            // for each token to be accepted, the sampler would have to sample that same token
+            // in such cases, instead of decoding the sampled token as we normally do, we simply continue with the
+            // available logits from the batch and sample the next token until we run out of logits or the sampler
+            // disagrees with the draft
+            //
+            ids = common_sampler_sample_and_accept_n(smpl, ctx_tgt, draft);
+        } else {
+            // the tree is verified with a single decode - each node only attends to its ancestors in the tree
+            common_speculative_tree tree = common_speculative_gen_draft_tree(spec, params_spec, prompt_tgt, id_last);
+
+            if (tree.size() < (size_t) n_draft_min) {
+                tree.clear();
             }
 
-            //LOG_DBG("target batch: %s\n", string_from(ctx_tgt, batch_tgt).c_str());
+            common_batch_clear(batch_tgt);
+            common_speculative_tree_add(ctx_tgt, batch_tgt, tree, id_last, n_past, 0, 1);
 
             llama_decode(ctx_tgt, batch_tgt);
-        }
 
-        // sample from the full target batch and return the accepted tokens based on the target sampler
-        //
-        // for each token to be accepted, the sampler would have to sample that same token
-        // in such cases, instead of decoding the sampled token as we normally do, we simply continue with the
-        // available logits from the batch and sample the next token until we run out of logits or the sampler
-        // disagrees with the draft
-        //
-        const auto ids = common_sampler_sample_and_accept_n(smpl, ctx_tgt, draft);
+            // follow the tree for as long as the target sampler agrees with one of the branches
+            std::vector<int> path;
+            ids = common_sampler_sample_and_accept_tree(smpl, ctx_tgt, tree.parents, tree.tokens, path);
+
+            // keep only the accepted path in the KV cache
+            common_speculative_tree_accept(ctx_tgt, tree, path, n_past, 0, 1);
+
+            n_past++;
 
-        //LOG_DBG("ids: %s\n", string_from(ctx_tgt, ids).c_str());
+            draft = tree.tokens;
+        }
 
         GGML_ASSERT(ids.size() > 0); // there will always be at least one accepted token
 
@@ -236,15 +289,18 @@ int main(int argc, char ** argv) {
 
     LOG_INF("\n");
     LOG_INF("n_draft   = %d\n", n_draft);
+    LOG_INF("n_branch  = %d\n", n_branch);
     LOG_INF("n_predict = %d\n", n_predict);
     LOG_INF("n_drafted = %d\n", n_drafted);
     LOG_INF("n_accept  = %d\n", n_accept);
     LOG_INF("accept    = %.3f%%\n", 100.0f * n_accept / n_drafted);
 
-    LOG_INF("\n");
-    LOG_INF("draft:\n\n");
+    if (!self) {
+        LOG_INF("\n");
+        LOG_INF("draft:\n\n");
 
-    llama_perf_context_print(ctx_dft);
+        llama_perf_context_print(ctx_dft);
+    }
 
     LOG_INF("\n");
     LOG_INF("target:\n\n");
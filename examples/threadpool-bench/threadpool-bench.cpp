@@ -0,0 +1,269 @@
+#include "ggml.h"
+#include "ggml-alloc.h"
+#include "ggml-backend.h"
+
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <random>
+#include <string>
+#include <vector>
+
+static void print_usage(int, char ** argv) {
+    printf("\nexample usage:\n");
+    printf("\n    %s [-t 1,2,4,8] [-d n_embd] [-b n_tokens] [-l n_nodes] [-r n_reps]\n", argv[0]);
+    printf("\n");
+    printf("    -t      comma-separated numbers of threads (default: 1,2,4,8)\n");
+    printf("    -d      size of the activations (default: 4096)\n");
+    printf("    -b      number of tokens (default: 1)\n");
+    printf("    -l      number of nodes of each graph (default: 256)\n");
+    printf("    -r      number of repetitions (default: 20)\n");
+    printf("\n");
+}
+
+static bool parse_int(int argc, char ** argv, int & i, int & value) {
+    if (i + 1 >= argc) {
+        return false;
+    }
+    try {
+        value = std::stoi(argv[++i]);
+    } catch (...) {
+        return false;
+    }
+    return true;
+}
+
+static bool parse_int_list(int argc, char ** argv, int & i, std::vector<int> & values) {
+    if (i + 1 >= argc) {
+        return false;
+    }
+    values.clear();
+    try {
+        std::string s = argv[++i];
+        size_t pos = 0;
+        while (pos < s.size()) {
+            size_t next = s.find(',', pos);
+            if (next == std::string::npos) {
+                next = s.size();
+            }
+            values.push_back(std::stoi(s.substr(pos, next - pos)));
+            pos = next + 1;
+        }
+    } catch (...) {
+        return false;
+    }
+    return !values.empty();
+}
+
+// builds one node of the op, the graph has n_nodes independent nodes and each one is followed by a barrier
+typedef std::function<ggml_tensor * (ggml_context * ctx, ggml_tensor * x)> build_op_t;
+
+struct bench_op {
+    std::string name;
+    build_op_t  build;
+};
+
+struct bench_graph {
+    ggml_context          * ctx = nullptr;
+    ggml_cgraph           * gf  = nullptr;
+    ggml_backend_buffer_t   buf = nullptr;
+
+    ~bench_graph() {
+        ggml_backend_buffer_free(buf);
+        ggml_free(ctx);
+    }
+};
+
+// average time of one node in microseconds
+static double bench_run(ggml_backend_t backend, ggml_backend_set_n_threads_t set_n_threads_fn, ggml_cgraph * gf, int n_nodes, int n_threads, int n_reps) {
+    set_n_threads_fn(backend, n_threads);
+
+    // warmup
+    ggml_backend_graph_compute(backend, gf);
+
+    const int64_t t_start_us = ggml_time_us();
+
+    for (int i = 0; i < n_reps; ++i) {
+        ggml_backend_graph_compute(backend, gf);
+    }
+
+    return (double) (ggml_time_us() - t_start_us)/n_reps/n_nodes;
+}
+
+int main(int argc, char ** argv) {
+    int n_embd   = 4096;
+    int n_tokens = 1;
+    int n_nodes  = 256;
+    int n_reps   = 20;
+
+    std::vector<int> n_threads = { 1, 2, 4, 8 };
+
+    for (int i = 1; i < argc; i++) {
+        bool ok = true;
+        if (strcmp(argv[i], "-t") == 0) {
+            ok = parse_int_list(argc, argv, i, n_threads);
+        } else if (strcmp(argv[i], "-d") == 0) {
+            ok = parse_int(argc, argv, i, n_embd);
+        } else if (strcmp(argv[i], "-b") == 0) {
+            ok = parse_int(argc, argv, i, n_tokens);
+        } else if (strcmp(argv[i], "-l") == 0) {
+            ok = parse_int(argc, argv, i, n_nodes);
+        } else if (strcmp(argv[i], "-r") == 0) {
+            ok = parse_int(argc, argv, i, n_reps);
+        } else {
+            ok = false;
+        }
+        if (!ok) {
+            print_usage(argc, argv);
+            return 1;
+        }
+    }
+
+    const int n_rot = 128;
+
+    if (n_embd <= 0 || n_embd % n_rot != 0 || n_tokens <= 0 || n_nodes <= 0 || n_reps <= 0) {
+        print_usage(argc, argv);
+        return 1;
+    }
+    for (int t : n_threads) {
+        if (t <= 0) {
+            print_usage(argc, argv);
+            return 1;
+        }
+    }
+
+    ggml_time_init();
+    ggml_backend_load_all();
+
+    ggml_backend_dev_t dev = ggml_backend_dev_by_type(GGML_BACKEND_DEVICE_TYPE_CPU);
+    if (!dev) {
+        fprintf(stderr, "%s: error: no CPU backend found\n", __func__);
+        return 1;
+    }
+
+    ggml_backend_t backend = ggml_backend_dev_init(dev, nullptr);
+    if (!backend) {
+        fprintf(stderr, "%s: error: failed to initialize the CPU backend\n", __func__);
+        return 1;
+    }
+
+    ggml_backend_reg_t reg = ggml_backend_dev_backend_reg(dev);
+
+    auto * set_n_threads_fn = (ggml_backend_set_n_threads_t) ggml_backend_reg_get_proc_address(reg, "ggml_backend_set_n_threads");
+    if (!set_n_threads_fn) {
+        fprintf(stderr, "%s: error: the CPU backend does not support setting the number of threads\n", __func__);
+        return 1;
+    }
+
+    const int n_vocab = 1000;
+
+    const std::vector<bench_op> ops = {
+        // a single element: the time of the barrier alone
+        { "barrier", [](ggml_context * ctx, ggml_tensor * x) {
+            return ggml_scale(ctx, ggml_view_1d(ctx, x, 1, 0), 1.0f);
+        } },
+        { "scale", [](ggml_context * ctx, ggml_tensor * x) {
+            return ggml_scale(ctx, x, 1.0f);
+        } },
+        { "add", [](ggml_context * ctx, ggml_tensor * x) {
+            return ggml_add(ctx, x, x);
+        } },
+        { "rms_norm", [](ggml_context * ctx, ggml_tensor * x) {
+            return ggml_rms_norm(ctx, x, 1e-5f);
+        } },
+        { "silu", [](ggml_context * ctx, ggml_tensor * x) {
+            return ggml_silu(ctx, x);
+        } },
+        { "soft_max", [](ggml_context * ctx, ggml_tensor * x) {
+            return ggml_soft_max(ctx, x);
+        } },
+        { "rope", [&](ggml_context * ctx, ggml_tensor * x) {
+            ggml_tensor * cur = ggml_reshape_3d(ctx, x, n_rot, n_embd/n_rot, n_tokens);
+            return ggml_rope_ext(ctx, cur, ggml_get_tensor(ctx, "pos"), nullptr, n_rot, 0, 4096, 10000.0f, 1.0f, 0.0f, 1.0f, 0.0f, 0.0f);
+        } },
+        { "cpy f32->f16", [&](ggml_context * ctx, ggml_tensor * x) {
+            return ggml_cpy(ctx, x, ggml_new_tensor_2d(ctx, GGML_TYPE_F16, n_embd, n_tokens));
+        } },
+        { "get_rows", [&](ggml_context * ctx, ggml_tensor *) {
+            return ggml_get_rows(ctx, ggml_get_tensor(ctx, "table"), ggml_get_tensor(ctx, "ids"));
+        } },
+    };
+
+    std::mt19937 rng(1234);
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+
+    printf("%s: n_embd = %d, n_tokens = %d, n_nodes = %d, n_reps = %d\n\n", __func__, n_embd, n_tokens, n_nodes, n_reps);
+
+    // the overhead is the time per node above a perfect split of the single thread time: waiting at the barrier,
+    // waking up the threads and the threads that have no work
+    printf("| op           | threads | us/node | speedup | overhead us/node |\n");
+    printf("| ------------ | ------: | ------: | ------: | ---------------: |\n");
+
+    for (const auto & op : ops) {
+        bench_graph g;
+
+        ggml_init_params params = {
+            /*.mem_size   =*/ (size_t) (4*n_nodes + 16)*ggml_tensor_overhead() + ggml_graph_overhead_custom(8*n_nodes, false),
+            /*.mem_buffer =*/ NULL,
+            /*.no_alloc   =*/ true,
+        };
+
+        g.ctx = ggml_init(params);
+
+        ggml_tensor * x     = ggml_new_tensor_2d(g.ctx, GGML_TYPE_F32, n_embd, n_tokens);
+        ggml_tensor * pos   = ggml_new_tensor_1d(g.ctx, GGML_TYPE_I32, n_tokens);
+        ggml_tensor * table = ggml_new_tensor_2d(g.ctx, GGML_TYPE_F32, n_embd, n_vocab);
+        ggml_tensor * ids   = ggml_new_tensor_1d(g.ctx, GGML_TYPE_I32, n_tokens);
+
+        ggml_set_name(x,     "x");
+        ggml_set_name(pos,   "pos");
+        ggml_set_name(table, "table");
+        ggml_set_name(ids,   "ids");
+
+        g.gf = ggml_new_graph_custom(g.ctx, 8*n_nodes, false);
+
+        for (int i = 0; i < n_nodes; ++i) {
+            ggml_build_forward_expand(g.gf, op.build(g.ctx, x));
+        }
+
+        g.buf = ggml_backend_alloc_ctx_tensors(g.ctx, backend);
+        if (!g.buf) {
+            fprintf(stderr, "%s: error: failed to allocate the tensors\n", __func__);
+            return 1;
+        }
+
+        {
+            std::vector<float> data(ggml_nelements(table));
+            for (auto & v : data) {
+                v = dist(rng);
+            }
+            ggml_backend_tensor_set(x,     data.data(), 0, ggml_nbytes(x));
+            ggml_backend_tensor_set(table, data.data(), 0, ggml_nbytes(table));
+
+            std::vector<int32_t> idx(n_tokens);
+            for (int i = 0; i < n_tokens; ++i) {
+                idx[i] = i % n_vocab;
+            }
+            ggml_backend_tensor_set(pos, idx.data(), 0, ggml_nbytes(pos));
+            ggml_backend_tensor_set(ids, idx.data(), 0, ggml_nbytes(ids));
+        }
+
+        double t_1 = 0.0;
+
+        for (size_t i = 0; i < n_threads.size(); ++i) {
+            const int nt = n_threads[i];
+
+            if (i == 0) {
+                t_1 = bench_run(backend, set_n_threads_fn, g.gf, n_nodes, 1, n_reps);
+            }
+
+            const double t = nt == 1 ? t_1 : bench_run(backend, set_n_threads_fn, g.gf, n_nodes, nt, n_reps);
+
+            printf("| %-12s | %7d | %7.2f | %7.2f | %16.2f |\n", op.name.c_str(), nt, t, t_1/t, t - t_1/nt);
+        }
+    }
+
+    ggml_backend_free(backend);
+
+    return 0;
+}
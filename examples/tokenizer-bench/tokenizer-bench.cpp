@@ -0,0 +1,171 @@
+#include "llama.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+static void print_usage(int, char ** argv) {
+    printf("\nexample usage:\n");
+    printf("\n    %s -m vocab.gguf [-f text.txt] [-r n_reps] [-c chunk_size] [-o tokens.txt]\n", argv[0]);
+    printf("\n");
+    printf("    -f  text to tokenize (default: built-in sample)\n");
+    printf("    -r  number of repetitions (default: 5)\n");
+    printf("    -c  tokenize the text in chunks of this many bytes, 0 = whole text (default: 0)\n");
+    printf("    -o  write the tokens of the last repetition to this file, one per line\n");
+    printf("\n");
+}
+
+// used when no text file is given - mixed prose, code, numbers and non-ASCII text
+static const char * k_sample =
+    "The quick brown fox jumps over the lazy dog. It's 3:14 PM and we've got 1,234,567 things to do!\n"
+    "    for (int i = 0; i < n; ++i) {\n        sum += a[i] * b[i];\n    }\n"
+    "Лорем ипсум долор сит амет, 敏捷的棕色狐狸跳过了懒狗。 Ελληνικά κείμενα 🦙🚀 naïve café\n"
+    "\t\tIndented\ttext   with    irregular     spacing\n\n\n";
+
+static bool parse_int(int argc, char ** argv, int & i, int & value) {
+    if (i + 1 >= argc) {
+        return false;
+    }
+    try {
+        value = std::stoi(argv[++i]);
+    } catch (...) {
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char ** argv) {
+    std::string vocab_path;
+    std::string text_path;
+    std::string out_path;
+    int n_reps = 5;
+    int chunk_size = 0;
+
+    for (int i = 1; i < argc; i++) {
+        bool ok = true;
+        if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+            vocab_path = argv[++i];
+        } else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+            text_path = argv[++i];
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            out_path = argv[++i];
+        } else if (strcmp(argv[i], "-r") == 0) {
+            ok = parse_int(argc, argv, i, n_reps);
+        } else if (strcmp(argv[i], "-c") == 0) {
+            ok = parse_int(argc, argv, i, chunk_size);
+        } else {
+            ok = false;
+        }
+        if (!ok) {
+            print_usage(argc, argv);
+            return 1;
+        }
+    }
+
+    if (vocab_path.empty() || n_reps <= 0 || chunk_size < 0) {
+        print_usage(argc, argv);
+        return 1;
+    }
+
+    std::string text;
+    if (text_path.empty()) {
+        for (int i = 0; i < 2000; ++i) {
+            text += k_sample;
+        }
+    } else {
+        std::ifstream ifs(text_path, std::ios::binary);
+        if (!ifs) {
+            fprintf(stderr, "%s: error: could not open file '%s'\n", __func__, text_path.c_str());
+            return 1;
+        }
+        text = std::string(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
+    }
+
+    llama_backend_init();
+
+    llama_model_params mparams = llama_model_default_params();
+    mparams.vocab_only = true;
+
+    llama_model * model = llama_model_load_from_file(vocab_path.c_str(), mparams);
+    if (model == NULL) {
+        fprintf(stderr, "%s: error: failed to load vocab '%s'\n", __func__, vocab_path.c_str());
+        return 1;
+    }
+
+    const llama_vocab * vocab = llama_model_get_vocab(model);
+
+    // split the text in chunks on UTF-8 character boundaries
+    std::vector<std::string> chunks;
+    if (chunk_size == 0) {
+        chunks.push_back(text);
+    } else {
+        size_t pos = 0;
+        while (pos < text.size()) {
+            size_t end = std::min(text.size(), pos + chunk_size);
+            while (end < text.size() && (text[end] & 0xC0) == 0x80) {
+                end++;
+            }
+            chunks.push_back(text.substr(pos, end - pos));
+            pos = end;
+        }
+    }
+
+    std::vector<llama_token> tokens;
+    std::vector<llama_token> buf;
+
+    double t_first_ms = 0.0;
+    double t_best_ms  = 0.0;
+    double t_total_ms = 0.0;
+
+    for (int r = 0; r < n_reps; ++r) {
+        tokens.clear();
+
+        const int64_t t_start_us = llama_time_us();
+
+        for (const auto & chunk : chunks) {
+            buf.resize(chunk.size() + 2);
+            int n = llama_tokenize(vocab, chunk.c_str(), chunk.size(), buf.data(), buf.size(), false, false);
+            if (n < 0) {
+                buf.resize(-n);
+                n = llama_tokenize(vocab, chunk.c_str(), chunk.size(), buf.data(), buf.size(), false, false);
+            }
+            tokens.insert(tokens.end(), buf.begin(), buf.begin() + n);
+        }
+
+        const double t_ms = (llama_time_us() - t_start_us) / 1000.0;
+
+        if (r == 0) {
+            t_first_ms = t_ms;
+            t_best_ms  = t_ms;
+        }
+        t_best_ms   = std::min(t_best_ms, t_ms);
+        t_total_ms += t_ms;
+    }
+
+    const double mib = text.size() / (1024.0 * 1024.0);
+
+    printf("%s: text: %zu bytes in %zu chunks, %zu tokens\n", __func__, text.size(), chunks.size(), tokens.size());
+    printf("%s: first: %10.3f ms, %8.2f MiB/s\n", __func__, t_first_ms, mib / (t_first_ms / 1000.0));
+    printf("%s: best:  %10.3f ms, %8.2f MiB/s, %10.0f tokens/s\n", __func__, t_best_ms, mib / (t_best_ms / 1000.0), tokens.size() / (t_best_ms / 1000.0));
+    printf("%s: avg:   %10.3f ms over %d reps\n", __func__, t_total_ms / n_reps, n_reps);
+
+    if (!out_path.empty()) {
+        std::ofstream ofs(out_path);
+        if (!ofs) {
+            fprintf(stderr, "%s: error: could not open file '%s'\n", __func__, out_path.c_str());
+        } else {
+            for (const auto & token : tokens) {
+                ofs << token << "\n";
+            }
+        }
+    }
+
+    llama_model_free(model);
+
+    llama_backend_free();
+
+    return 0;
+}
@@ -192,6 +192,12 @@ extern "C" {
     typedef ggml_backend_buffer_type_t * (*ggml_backend_dev_get_extra_bufts_t)(ggml_backend_dev_t device);
     // Set the abort callback for the backend
     typedef void                         (*ggml_backend_set_abort_callback_t)(ggml_backend_t backend, ggml_abort_callback abort_callback, void * abort_callback_data);
+    // Enable or disable the profiling of the graphs computed by the backend (clears the collected data)
+    typedef void                         (*ggml_backend_set_profile_t)(ggml_backend_t backend, bool enable);
+    // Print the profile of the backend, aggregated by op
+    typedef void                         (*ggml_backend_profile_print_t)(ggml_backend_t backend);
+    // Save the profile of the backend as a Chrome trace (JSON), e.g. for chrome://tracing or https://ui.perfetto.dev
+    typedef bool                         (*ggml_backend_profile_save_trace_t)(ggml_backend_t backend, const char * fname);
     // Get a list of feature flags supported by the backend (returns a NULL-terminated array)
     struct ggml_backend_feature {
         const char * name;
@@ -7,6 +7,13 @@
 extern "C" {
 #endif
 
+    // timings of a node in one thread, in nanoseconds from an arbitrary point
+    struct ggml_cpu_node_timing {
+        int64_t t_start;   // the thread starts the node
+        int64_t t_end;     // the thread is done with the node
+        int64_t t_barrier; // the thread leaves the barrier after the node
+    };
+
     // the compute plan that needs to be prepared for ggml_graph_compute()
     // since https://github.com/ggml-org/ggml/issues/287
     struct ggml_cplan {
@@ -19,6 +26,10 @@ extern "C" {
         // abort ggml_graph_compute when true
         ggml_abort_callback abort_callback;
         void *              abort_callback_data;
+
+        // optional, n_threads timings per node, zero-initialized by the caller and filled by ggml_graph_compute()
+        // the nodes computed together with the previous node (fused ops) are left at zero
+        struct ggml_cpu_node_timing * timings;
     };
 
     // numa strategies
@@ -131,6 +142,15 @@ extern "C" {
     GGML_BACKEND_API void ggml_backend_cpu_set_threadpool    (ggml_backend_t backend_cpu, ggml_threadpool_t threadpool);
     GGML_BACKEND_API void ggml_backend_cpu_set_abort_callback(ggml_backend_t backend_cpu, ggml_abort_callback abort_callback, void * abort_callback_data);
 
+    // profiling of the graphs computed by the backend: per-node wall time, per-thread busy and wait time (including the
+    // barriers), and an estimate of the bytes and FLOPs of each op
+    // enabling or disabling the profiling clears the collected data
+    // it can also be enabled with the environment variable GGML_CPU_PROFILE: the table is printed when the backend is
+    // freed and, unless the value is 1, the Chrome trace is saved to the file named by the value
+    GGML_BACKEND_API void ggml_backend_cpu_set_profile       (ggml_backend_t backend_cpu, bool enable);
+    GGML_BACKEND_API void ggml_backend_cpu_profile_print     (ggml_backend_t backend_cpu);
+    GGML_BACKEND_API bool ggml_backend_cpu_profile_save_trace(ggml_backend_t backend_cpu, const char * fname);
+
     GGML_BACKEND_API ggml_backend_reg_t ggml_backend_cpu_reg(void);
 
 #ifdef __cplusplus
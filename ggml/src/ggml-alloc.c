@@ -11,6 +11,7 @@
 
 #define MAX(a, b) ((a) > (b) ? (a) : (b))
 #define MAX_FREE_BLOCKS 256
+#define MAX_PLAN_BLOCKS 8192 // the re-plan is quadratic in the number of allocations, larger graphs keep the online offsets
 
 //#define GGML_ALLOCATOR_DEBUG
 
@@ -343,9 +344,20 @@ struct hash_node {
     int n_views;
     int buffer_id;
     size_t offset; // offset within the buffer
+    int block;     // index of the allocation in ggml_gallocr::blocks, shared with the tensors that reuse it inplace
     bool allocated;
 };
 
+// an allocation of the dynamic allocator and its lifetime, in allocation and free events of the graph
+// the offsets chosen while walking the graph are re-planned once all the lifetimes are known
+struct alloc_block {
+    int buffer_id;
+    size_t size;   // aligned size
+    size_t offset;
+    int t_alloc;
+    int t_free;    // INT_MAX if the allocation is never freed
+};
+
 struct tensor_alloc {
     int buffer_id;
     size_t offset;
@@ -375,6 +387,11 @@ struct ggml_gallocr {
 
     struct leaf_alloc * leaf_allocs; // [n_leafs]
     int n_leafs;
+
+    struct alloc_block * blocks; // [n_blocks]
+    int n_blocks;
+    int blocks_size;
+    int n_events;
 };
 
 ggml_gallocr_t ggml_gallocr_new_n(ggml_backend_buffer_type_t * bufts, int n_bufs) {
@@ -457,6 +474,7 @@ void ggml_gallocr_free(ggml_gallocr_t galloc) {
     free(galloc->buf_tallocs);
     free(galloc->node_allocs);
     free(galloc->leaf_allocs);
+    free(galloc->blocks);
     free(galloc);
 }
 
@@ -516,8 +534,9 @@ static void ggml_gallocr_allocate_node(ggml_gallocr_t galloc, struct ggml_tensor
                         if (view_src_hn->n_views == 1 && view_src_hn->n_children == 0 && view_src->data == parent->data) {
                             AT_PRINTF("reusing view parent %s (%s) for %s\n", parent->name, view_src->name, node->name);
                             assert(view_src_hn->offset == p_hn->offset);
-                            hn->buffer_id = p_hn->buffer_id;
-                            hn->offset = p_hn->offset;
+                            hn->buffer_id = view_src_hn->buffer_id;
+                            hn->offset = view_src_hn->offset;
+                            hn->block = view_src_hn->block;
                             p_hn->allocated = false; // avoid freeing the parent
                             view_src_hn->allocated = false;
                             return;
@@ -526,6 +545,7 @@ static void ggml_gallocr_allocate_node(ggml_gallocr_t galloc, struct ggml_tensor
                         AT_PRINTF("reusing parent %s for %s\n", parent->name, node->name);
                         hn->buffer_id = p_hn->buffer_id;
                         hn->offset = p_hn->offset;
+                        hn->block = p_hn->block;
                         p_hn->allocated = false; // avoid freeing the parent
                         return;
                     }
@@ -539,6 +559,21 @@ static void ggml_gallocr_allocate_node(ggml_gallocr_t galloc, struct ggml_tensor
         size_t offset = ggml_dyn_tallocr_alloc(alloc, size, node);
         hn->buffer_id = buffer_id;
         hn->offset = offset;
+
+        // record the lifetime of the allocation
+        if (galloc->n_blocks == galloc->blocks_size) {
+            galloc->blocks_size = MAX(256, 2*galloc->blocks_size);
+            galloc->blocks = realloc(galloc->blocks, galloc->blocks_size * sizeof(struct alloc_block));
+            GGML_ASSERT(galloc->blocks != NULL);
+        }
+        hn->block = galloc->n_blocks++;
+        galloc->blocks[hn->block] = (struct alloc_block) {
+            /*.buffer_id = */ buffer_id,
+            /*.size      = */ aligned_offset(NULL, size, alloc->alignment),
+            /*.offset    = */ offset,
+            /*.t_alloc   = */ galloc->n_events++,
+            /*.t_free    = */ INT_MAX,
+        };
     }
 }
 
@@ -557,16 +592,112 @@ static void ggml_gallocr_free_node(ggml_gallocr_t galloc, struct ggml_tensor * n
     size_t size = ggml_backend_buft_get_alloc_size(buft, node);
     ggml_dyn_tallocr_free_tensor(alloc, offset, size, node);
     hn->allocated = false;
+    galloc->blocks[hn->block].t_free = galloc->n_events++;
 }
 
 static int get_node_buffer_id(const int * node_buffer_ids, int i) {
     return node_buffer_ids ? node_buffer_ids[i] : 0;
 }
 
+static int ggml_gallocr_cmp_block_size(const void * a, const void * b) {
+    const struct alloc_block * ba = *(const struct alloc_block * const *) a;
+    const struct alloc_block * bb = *(const struct alloc_block * const *) b;
+    if (ba->size != bb->size) {
+        return ba->size > bb->size ? -1 : 1;
+    }
+    return (ba->t_alloc > bb->t_alloc) - (ba->t_alloc < bb->t_alloc);
+}
+
+// the dynamic allocator places each tensor as soon as it is allocated, without knowing the tensors that come later,
+// which can leave gaps that no later tensor fits in
+// with the lifetimes of all the allocations known, the blocks are placed again from the largest to the smallest, each
+// one in the smallest gap left by the already placed blocks that are alive at the same time
+// the new plan is used only if it needs a smaller buffer
+static void ggml_gallocr_plan_blocks(ggml_gallocr_t galloc, struct ggml_dyn_tallocr * alloc) {
+    int n = 0;
+    for (int i = 0; i < galloc->n_blocks; i++) {
+        n += galloc->buf_tallocs[galloc->blocks[i].buffer_id] == alloc;
+    }
+    if (n < 2 || n > MAX_PLAN_BLOCKS) {
+        return;
+    }
+
+    struct alloc_block ** sorted  = malloc(n * sizeof(struct alloc_block *));
+    struct alloc_block ** placed  = malloc(n * sizeof(struct alloc_block *)); // the placed blocks, sorted by offset
+    size_t              * offsets = malloc(n * sizeof(size_t));
+    GGML_ASSERT(sorted != NULL && placed != NULL && offsets != NULL);
+
+    n = 0;
+    for (int i = 0; i < galloc->n_blocks; i++) {
+        if (galloc->buf_tallocs[galloc->blocks[i].buffer_id] == alloc) {
+            sorted[n++] = &galloc->blocks[i];
+        }
+    }
+    qsort(sorted, n, sizeof(struct alloc_block *), ggml_gallocr_cmp_block_size);
+
+    // the online offsets are kept in offsets while the blocks are re-placed
+    for (int i = 0; i < n; i++) {
+        offsets[i] = sorted[i]->offset;
+    }
+
+    size_t max_size = 0;
+    for (int i = 0; i < n; i++) {
+        struct alloc_block * block = sorted[i];
+
+        // the gaps between the placed blocks that are alive at the same time, in order of offset
+        size_t best_offset = SIZE_MAX;
+        size_t best_size   = SIZE_MAX;
+        size_t end         = 0;
+        for (int j = 0; j < i; j++) {
+            const struct alloc_block * other = placed[j];
+            if (other->t_alloc >= block->t_free || block->t_alloc >= other->t_free) {
+                continue;
+            }
+            if (other->offset >= end + block->size && other->offset - end < best_size) {
+                best_offset = end;
+                best_size   = other->offset - end;
+            }
+            end = MAX(end, other->offset + other->size);
+        }
+        block->offset = best_offset != SIZE_MAX ? best_offset : end;
+        max_size = MAX(max_size, block->offset + block->size);
+
+        int pos = i;
+        while (pos > 0 && placed[pos - 1]->offset > block->offset) {
+            placed[pos] = placed[pos - 1];
+            pos--;
+        }
+        placed[pos] = block;
+    }
+
+    if (max_size < ggml_dyn_tallocr_max_size(alloc)) {
+        AT_PRINTF("%s: re-planned buffer: %zu -> %zu bytes\n", __func__, ggml_dyn_tallocr_max_size(alloc), max_size);
+        alloc->max_size = max_size;
+    } else {
+        for (int i = 0; i < n; i++) {
+            sorted[i]->offset = offsets[i];
+        }
+    }
+
+    free(sorted);
+    free(placed);
+    free(offsets);
+}
+
+static void ggml_gallocr_update_offset(ggml_gallocr_t galloc, struct ggml_tensor * t) {
+    if (t->view_src || t->data) {
+        return;
+    }
+    struct hash_node * hn = ggml_gallocr_hash_get(galloc, t);
+    hn->offset = galloc->blocks[hn->block].offset;
+}
+
 static void ggml_gallocr_alloc_graph_impl(ggml_gallocr_t galloc, struct ggml_cgraph * graph, const int * node_buffer_ids, const int * leaf_buffer_ids) {
     // clear hash tables
     ggml_hash_set_reset(&galloc->hash_set);
     memset(galloc->hash_values, 0, sizeof(struct hash_node) * galloc->hash_set.size);
+    galloc->n_blocks = 0;
+    galloc->n_events = 0;
 
     // allocate leafs
     // these may be tensors that the application is not using in the graph, but may still want to allocate for other purposes
@@ -668,6 +799,29 @@ static void ggml_gallocr_alloc_graph_impl(ggml_gallocr_t galloc, struct ggml_cgr
             AT_PRINTF("\n");
         }
     }
+
+    // re-plan the offsets with the lifetimes of all the allocations
+    for (int i = 0; i < galloc->n_buffers; i++) {
+        bool planned = false;
+        for (int j = 0; j < i; j++) {
+            planned = planned || galloc->buf_tallocs[j] == galloc->buf_tallocs[i];
+        }
+        if (!planned) {
+            ggml_gallocr_plan_blocks(galloc, galloc->buf_tallocs[i]);
+        }
+    }
+    for (int i = 0; i < graph->n_leafs; i++) {
+        ggml_gallocr_update_offset(galloc, graph->leafs[i]);
+    }
+    for (int i = 0; i < graph->n_nodes; i++) {
+        struct ggml_tensor * node = graph->nodes[i];
+        ggml_gallocr_update_offset(galloc, node);
+        for (int j = 0; j < GGML_MAX_SRC; j++) {
+            if (node->src[j]) {
+                ggml_gallocr_update_offset(galloc, node->src[j]);
+            }
+        }
+    }
 }
 
 bool ggml_gallocr_reserve_n(ggml_gallocr_t galloc, struct ggml_cgraph * graph, const int * node_buffer_ids, const int * leaf_buffer_ids) {
@@ -15,6 +15,10 @@
 #include <cfloat>
 #include <cstdlib> // for qsort
 #include <cstdio>  // for GGML_ASSERT
+#include <algorithm>
+#include <atomic>
+#include <new>
+#include <type_traits>
 
 #include "ggml-cpu-aarch64.h"
 
@@ -70,6 +74,37 @@ struct block_iq4_nlx4 {
 
 static_assert(sizeof(block_iq4_nlx4) == 4 * sizeof(ggml_half) + QK4_NL * 2, "wrong iq4_nlx4 block size/padding");
 
+// the blocks below interleave the quants of 8 rows in groups of 4 bytes, so that a 256-bit load holds
+// the same 4 quants of each of the 8 rows - see make_block_q5_Kx8 for the layout of the quants
+
+struct block_q5_Kx8 {
+    ggml_half d[8];      // super-block scale for quantized scales
+    ggml_half dmin[8];   // super-block scale for quantized mins
+    uint8_t scales[96];  // low 4 bits of the scales and mins (64 bytes), then their high 2 bits (32 bytes)
+    uint8_t qh[256];     // high bit of the quants
+    uint8_t qs[1024];    // low 4 bits of the quants
+};
+
+static_assert(sizeof(block_q5_Kx8) == 8 * sizeof(block_q5_K), "wrong q5_K block size/padding");
+
+struct block_q6_Kx8 {
+    ggml_half d[8];      // super-block scale
+    int8_t scales[128];  // scales, quantized with 8 bits
+    uint8_t ql[1024];    // low 4 bits of the quants
+    uint8_t qh[512];     // high 2 bits of the quants
+};
+
+static_assert(sizeof(block_q6_Kx8) == 8 * sizeof(block_q6_K), "wrong q6_K block size/padding");
+
+struct block_iq4_xsx8 {
+    ggml_half d[8];        // super-block scale
+    uint8_t scales_l[32];  // low 4 bits of the scales
+    uint8_t scales_h[16];  // high 2 bits of the scales
+    uint8_t qs[1024];      // nibbles / quants
+};
+
+static_assert(sizeof(block_iq4_xsx8) == 8 * sizeof(block_iq4_xs), "wrong iq4_xs block size/padding");
+
 #if defined(__GNUC__)
 #pragma GCC diagnostic ignored "-Woverlength-strings"
 #elif defined(_MSC_VER)
@@ -1629,39 +1664,795 @@ static void ggml_gemv_iq4_nl_4x4_q8_0(int n, float * GGML_RESTRICT s, size_t bs,
                 float32x4_t b_d = vcvt_f32_f16(vld1_f16((const float16_t *)b_ptr[l].d));
                 float32x4_t d = a_d * b_d;
 
-                sumf = vmlaq_f32(sumf, d, vcvtq_f32_s32(sumi));
-            }
+                sumf = vmlaq_f32(sumf, d, vcvtq_f32_s32(sumi));
+            }
+
+            vst1q_f32(res_ptr + x * 4, sumf);
+        }
+        return;
+    }
+#endif // #if ! ((defined(_MSC_VER)) && ! defined(__clang__)) && defined(__aarch64__) && defined(__ARM_NEON)
+    {
+        float sumf[4];
+        int sumi;
+
+        const block_q8_0 * a_ptr = (const block_q8_0 *) vy;
+        for (int x = 0; x < nc / ncols_interleaved; x++) {
+            const block_iq4_nlx4 * b_ptr = (const block_iq4_nlx4 *) vx + (x * nb);
+
+            for (int j = 0; j < ncols_interleaved; j++) sumf[j] = 0.0;
+            for (int l = 0; l < nb; l++) {
+                for (int k = 0; k < (qk / (2 * blocklen)); k++) {
+                    for (int j = 0; j < ncols_interleaved; j++) {
+                        sumi = 0;
+                        for (int i = 0; i < blocklen; ++i) {
+                            const int v0 = kvalues_iq4nl[b_ptr[l].qs[k * ncols_interleaved * blocklen + j * blocklen + i] & 0x0F];
+                            const int v1 = kvalues_iq4nl[b_ptr[l].qs[k * ncols_interleaved * blocklen + j * blocklen + i] >> 4];
+                            sumi += ((v0 * a_ptr[l].qs[k * blocklen + i]) + (v1 * a_ptr[l].qs[k * blocklen + i + qk / 2]));
+                        }
+                        sumf[j] += sumi * GGML_FP16_TO_FP32(b_ptr[l].d[j]) * GGML_FP16_TO_FP32(a_ptr[l].d);
+                    }
+                }
+            }
+            for (int j = 0; j < ncols_interleaved; j++) s[x * ncols_interleaved + j] = sumf[j];
+        }
+    }
+}
+
+// The 8-row blocks interleaved in groups of 4 bytes share the code of their gemv and gemm: the gemv reads a
+// single block_q8_0/block_q8_K row and the gemm 4 rows interleaved in groups of 8 bytes (quantize_q8_0_4x8
+// and quantize_q8_K_4x8). The helpers below hide the difference, k is the index of a group of 4 quants.
+
+static inline const int8_t * q8_row_qs(const block_q8_0 & a, int m, int k) {
+    UNUSED(m);
+    return a.qs + k * 4;
+}
+
+static inline const int8_t * q8_row_qs(const block_q8_0x4 & a, int m, int k) {
+    return a.qs + (k >> 1) * 32 + m * 8 + (k & 1) * 4;
+}
+
+static inline const int8_t * q8_row_qs(const block_q8_K & a, int m, int k) {
+    UNUSED(m);
+    return a.qs + k * 4;
+}
+
+static inline const int8_t * q8_row_qs(const block_q8_Kx4 & a, int m, int k) {
+    return a.qs + (k >> 1) * 32 + m * 8 + (k & 1) * 4;
+}
+
+static inline float q8_row_d(const block_q8_0 & a, int m) {
+    UNUSED(m);
+    return GGML_FP16_TO_FP32(a.d);
+}
+
+static inline float q8_row_d(const block_q8_0x4 & a, int m) {
+    return GGML_FP16_TO_FP32(a.d[m]);
+}
+
+static inline float q8_row_d(const block_q8_K & a, int m) {
+    UNUSED(m);
+    return a.d;
+}
+
+static inline float q8_row_d(const block_q8_Kx4 & a, int m) {
+    return a.d[m];
+}
+
+// sum of the g-th group of 16 quants
+static inline int q8_row_bsum(const block_q8_K & a, int m, int g) {
+    UNUSED(m);
+    return a.bsums[g];
+}
+
+static inline int q8_row_bsum(const block_q8_Kx4 & a, int m, int g) {
+    return a.bsums[(g >> 2) * 16 + m * 4 + (g & 3)];
+}
+
+#if defined(__AVX2__)
+// multiply unsigned int8_t with int8_t, add the 4 products of each int32_t to acc
+static inline __m256i mul_sum_us8_pairs_acc_int32x8(const __m256i acc, const __m256i ax, const __m256i sy) {
+#if defined(__AVX512VNNI__) && defined(__AVX512VL__)
+    return _mm256_dpbusd_epi32(acc, ax, sy);
+#elif defined(__AVXVNNI__)
+    return _mm256_dpbusd_avx_epi32(acc, ax, sy);
+#else
+    return _mm256_add_epi32(acc, sum_i16_pairs_int32x8(_mm256_maddubs_epi16(ax, sy)));
+#endif
+}
+
+// the 4 quants at qs repeated in each int32_t
+static inline __m256i q8_row_broadcast(const int8_t * qs) {
+    int32_t v;
+    memcpy(&v, qs, sizeof(v));
+    return _mm256_set1_epi32(v);
+}
+
+// the hardware prefetchers do not keep up with the large interleaved blocks, fetch the next ones early
+template <typename BLOC_TYPE>
+static inline void prefetch_block(const BLOC_TYPE * b) {
+    for (size_t i = 0; i < sizeof(BLOC_TYPE); i += 64) {
+        _mm_prefetch((const char *) b + i, _MM_HINT_T0);
+    }
+}
+#endif
+
+template <typename block_a, int nrows>
+static void mul_mat_q8_0_8x8_q8_0(int n, float * GGML_RESTRICT s, size_t bs, const void * GGML_RESTRICT vx, const void * GGML_RESTRICT vy, int nr, int nc) {
+    const int qk = QK8_0;
+    const int nb = n / qk;
+    const int ncols_interleaved = 8;
+
+    assert (n % qk == 0);
+    assert (nr % nrows == 0);
+    assert (nc % ncols_interleaved == 0);
+
+    for (int y = 0; y < nr / nrows; y++) {
+        const block_a * a_ptr = (const block_a *) vy + (y * nb);
+        for (int x = 0; x < nc / ncols_interleaved; x++) {
+            const block_q8_0x8 * b_ptr = (const block_q8_0x8 *) vx + (x * nb);
+#if defined(__AVX2__)
+            __m256 acc[nrows];
+            for (int m = 0; m < nrows; m++) {
+                acc[m] = _mm256_setzero_ps();
+            }
+            for (int l = 0; l < nb; l++) {
+                __m256i sumi[nrows];
+                for (int m = 0; m < nrows; m++) {
+                    sumi[m] = _mm256_setzero_si256();
+                }
+                prefetch_block(b_ptr + l + 2);
+                for (int k = 0; k < qk / 4; k++) {
+                    const __m256i w  = _mm256_loadu_si256((const __m256i *) (b_ptr[l].qs + k * 32));
+                    const __m256i aw = _mm256_sign_epi8(w, w);
+                    for (int m = 0; m < nrows; m++) {
+                        const __m256i sa = _mm256_sign_epi8(q8_row_broadcast(q8_row_qs(a_ptr[l], m, k)), w);
+                        sumi[m] = mul_sum_us8_pairs_acc_int32x8(sumi[m], aw, sa);
+                    }
+                }
+                const __m256 d = GGML_F32Cx8_LOAD(b_ptr[l].d);
+                for (int m = 0; m < nrows; m++) {
+                    const __m256 da = _mm256_set1_ps(q8_row_d(a_ptr[l], m));
+                    acc[m] = _mm256_fmadd_ps(_mm256_cvtepi32_ps(sumi[m]), _mm256_mul_ps(d, da), acc[m]);
+                }
+            }
+            for (int m = 0; m < nrows; m++) {
+                _mm256_storeu_ps(s + (y * nrows + m) * bs + x * ncols_interleaved, acc[m]);
+            }
+#else
+            float sumf[nrows][8] = {};
+            for (int l = 0; l < nb; l++) {
+                for (int m = 0; m < nrows; m++) {
+                    for (int j = 0; j < ncols_interleaved; j++) {
+                        int sumi = 0;
+                        for (int k = 0; k < qk / 4; k++) {
+                            const int8_t * a = q8_row_qs(a_ptr[l], m, k);
+                            for (int i = 0; i < 4; ++i) {
+                                sumi += b_ptr[l].qs[k * 32 + j * 4 + i] * a[i];
+                            }
+                        }
+                        sumf[m][j] += sumi * GGML_FP16_TO_FP32(b_ptr[l].d[j]) * q8_row_d(a_ptr[l], m);
+                    }
+                }
+            }
+            for (int m = 0; m < nrows; m++) {
+                for (int j = 0; j < ncols_interleaved; j++) {
+                    s[(y * nrows + m) * bs + x * ncols_interleaved + j] = sumf[m][j];
+                }
+            }
+#endif
+        }
+    }
+}
+
+// Q4_K and Q5_K share the layout of the 4-bit quants and of the scales, Q5_K adds the 5-th bits in qh
+template <bool has_qh, typename block_a, int nrows>
+static void mul_mat_q4_K_q5_K_8x8_q8_K(int n, float * GGML_RESTRICT s, size_t bs, const void * GGML_RESTRICT vx, const void * GGML_RESTRICT vy, int nr, int nc) {
+    using block_b = typename std::conditional<has_qh, block_q5_Kx8, block_q4_Kx8>::type;
+
+    const int qk = QK_K;
+    const int nb = n / qk;
+    const int ncols_interleaved = 8;
+
+    assert (n % qk == 0);
+    assert (nr % nrows == 0);
+    assert (nc % ncols_interleaved == 0);
+
+#if defined(__AVX2__)
+    const __m256i m4  = _mm256_set1_epi8(0x0F);
+    const __m256i m16 = _mm256_set1_epi8(0x10);
+    const __m256i m3  = _mm256_set1_epi32(3);
+    const __m256i m15 = _mm256_set1_epi32(15);
+#endif
+
+    for (int y = 0; y < nr / nrows; y++) {
+        const block_a * a_ptr = (const block_a *) vy + (y * nb);
+        for (int x = 0; x < nc / ncols_interleaved; x++) {
+            const block_b * b_ptr = (const block_b *) vx + (x * nb);
+#if defined(__AVX2__)
+            __m256 acc[nrows];
+            for (int m = 0; m < nrows; m++) {
+                acc[m] = _mm256_setzero_ps();
+            }
+            for (int l = 0; l < nb; l++) {
+                __m256i sumi[nrows];
+                __m256i summ[nrows];
+                for (int m = 0; m < nrows; m++) {
+                    sumi[m] = _mm256_setzero_si256();
+                    summ[m] = _mm256_setzero_si256();
+                }
+                prefetch_block(b_ptr + l + 2);
+                for (int sb = 0; sb < qk / 32; sb++) {
+                    // scales and mins of the sub-block of the 8 rows
+                    const __m128i shift_h = _mm_cvtsi32_si128(4 * (sb & 1));
+                    const __m256i sm_l = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) (b_ptr[l].scales + sb * 8)));
+                    const __m256i sm_h = _mm256_srl_epi32(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) (b_ptr[l].scales + 64 + (sb >> 1) * 8))), shift_h);
+                    const __m256i sc = _mm256_or_si256(_mm256_and_si256(sm_l, m15), _mm256_slli_epi32(_mm256_and_si256(sm_h, m3), 4));
+                    const __m256i mn = _mm256_or_si256(_mm256_srli_epi32(sm_l, 4), _mm256_slli_epi32(_mm256_and_si256(_mm256_srli_epi32(sm_h, 2), m3), 4));
+
+                    __m256i sumb[nrows];
+                    for (int m = 0; m < nrows; m++) {
+                        sumb[m] = _mm256_setzero_si256();
+                    }
+                    for (int k = 0; k < 8; k++) {
+                        const __m256i ql = _mm256_loadu_si256((const __m256i *) (b_ptr[l].qs + ((sb >> 1) * 8 + k) * 32));
+                        __m256i q = _mm256_and_si256(_mm256_srl_epi16(ql, shift_h), m4);
+                        if constexpr (has_qh) {
+                            const __m256i hmask = _mm256_set1_epi8((char) (1 << sb));
+                            const __m256i qh    = _mm256_loadu_si256((const __m256i *) (b_ptr[l].qh + k * 32));
+                            q = _mm256_or_si256(q, _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_and_si256(qh, hmask), hmask), m16));
+                        }
+                        for (int m = 0; m < nrows; m++) {
+                            sumb[m] = mul_sum_us8_pairs_acc_int32x8(sumb[m], q, q8_row_broadcast(q8_row_qs(a_ptr[l], m, sb * 8 + k)));
+                        }
+                    }
+                    for (int m = 0; m < nrows; m++) {
+                        const int bsum = q8_row_bsum(a_ptr[l], m, sb * 2) + q8_row_bsum(a_ptr[l], m, sb * 2 + 1);
+                        sumi[m] = _mm256_add_epi32(sumi[m], _mm256_mullo_epi32(sumb[m], sc));
+                        summ[m] = _mm256_add_epi32(summ[m], _mm256_mullo_epi32(mn, _mm256_set1_epi32(bsum)));
+                    }
+                }
+                const __m256 d    = GGML_F32Cx8_LOAD(b_ptr[l].d);
+                const __m256 dmin = GGML_F32Cx8_LOAD(b_ptr[l].dmin);
+                for (int m = 0; m < nrows; m++) {
+                    const __m256 da = _mm256_set1_ps(q8_row_d(a_ptr[l], m));
+                    acc[m] = _mm256_fmadd_ps(_mm256_cvtepi32_ps(sumi[m]), _mm256_mul_ps(d, da), acc[m]);
+                    acc[m] = _mm256_fnmadd_ps(_mm256_cvtepi32_ps(summ[m]), _mm256_mul_ps(dmin, da), acc[m]);
+                }
+            }
+            for (int m = 0; m < nrows; m++) {
+                _mm256_storeu_ps(s + (y * nrows + m) * bs + x * ncols_interleaved, acc[m]);
+            }
+#else
+            float sumf[nrows][8] = {};
+            for (int l = 0; l < nb; l++) {
+                for (int sb = 0; sb < qk / 32; sb++) {
+                    for (int j = 0; j < ncols_interleaved; j++) {
+                        const int sm_l = b_ptr[l].scales[sb * 8 + j];
+                        const int sm_h = b_ptr[l].scales[64 + (sb >> 1) * 8 + j] >> (4 * (sb & 1));
+                        const int sc = (sm_l & 15) | ((sm_h & 3) << 4);
+                        const int mn = (sm_l >> 4) | (((sm_h >> 2) & 3) << 4);
+                        for (int m = 0; m < nrows; m++) {
+                            int sumi = 0;
+                            for (int k = 0; k < 8; k++) {
+                                const int8_t * a = q8_row_qs(a_ptr[l], m, sb * 8 + k);
+                                for (int i = 0; i < 4; ++i) {
+                                    int q = (b_ptr[l].qs[((sb >> 1) * 8 + k) * 32 + j * 4 + i] >> (4 * (sb & 1))) & 0xF;
+                                    if constexpr (has_qh) {
+                                        q |= ((b_ptr[l].qh[k * 32 + j * 4 + i] >> sb) & 1) << 4;
+                                    }
+                                    sumi += q * a[i];
+                                }
+                            }
+                            const int bsum = q8_row_bsum(a_ptr[l], m, sb * 2) + q8_row_bsum(a_ptr[l], m, sb * 2 + 1);
+                            sumf[m][j] += (GGML_FP16_TO_FP32(b_ptr[l].d[j]) * sc * sumi - GGML_FP16_TO_FP32(b_ptr[l].dmin[j]) * mn * bsum) * q8_row_d(a_ptr[l], m);
+                        }
+                    }
+                }
+            }
+            for (int m = 0; m < nrows; m++) {
+                for (int j = 0; j < ncols_interleaved; j++) {
+                    s[(y * nrows + m) * bs + x * ncols_interleaved + j] = sumf[m][j];
+                }
+            }
+#endif
+        }
+    }
+}
+
+template <typename block_a, int nrows>
+static void mul_mat_q6_K_8x8_q8_K(int n, float * GGML_RESTRICT s, size_t bs, const void * GGML_RESTRICT vx, const void * GGML_RESTRICT vy, int nr, int nc) {
+    const int qk = QK_K;
+    const int nb = n / qk;
+    const int ncols_interleaved = 8;
+
+    assert (n % qk == 0);
+    assert (nr % nrows == 0);
+    assert (nc % ncols_interleaved == 0);
+
+#if defined(__AVX2__)
+    const __m256i m4  = _mm256_set1_epi8(0x0F);
+    const __m256i m48 = _mm256_set1_epi8(0x30);
+#endif
+
+    for (int y = 0; y < nr / nrows; y++) {
+        const block_a * a_ptr = (const block_a *) vy + (y * nb);
+        for (int x = 0; x < nc / ncols_interleaved; x++) {
+            const block_q6_Kx8 * b_ptr = (const block_q6_Kx8 *) vx + (x * nb);
+#if defined(__AVX2__)
+            __m256 acc[nrows];
+            for (int m = 0; m < nrows; m++) {
+                acc[m] = _mm256_setzero_ps();
+            }
+            for (int l = 0; l < nb; l++) {
+                __m256i sumi[nrows];
+                for (int m = 0; m < nrows; m++) {
+                    sumi[m] = _mm256_setzero_si256();
+                }
+                prefetch_block(b_ptr + l + 2);
+                // 128 quants at a time: the low 4 bits of the 4 groups of 32 are in 2 vectors, their high 2 bits in 1
+                for (int h = 0; h < qk / 128; h++) {
+                    const uint8_t * ql = b_ptr[l].ql + h * 512;
+                    const uint8_t * qh = b_ptr[l].qh + h * 256;
+                    for (int is = 0; is < 2; is++) {
+                        __m256i sumb[4][nrows];
+                        for (int c = 0; c < 4; c++) {
+                            for (int m = 0; m < nrows; m++) {
+                                sumb[c][m] = _mm256_setzero_si256();
+                            }
+                        }
+                        for (int k = is * 4; k < is * 4 + 4; k++) {
+                            const __m256i ql_0 = _mm256_loadu_si256((const __m256i *) (ql + k * 32));
+                            const __m256i ql_1 = _mm256_loadu_si256((const __m256i *) (ql + k * 32 + 256));
+                            const __m256i qhb  = _mm256_loadu_si256((const __m256i *) (qh + k * 32));
+                            const __m256i q[4] = {
+                                _mm256_or_si256(_mm256_and_si256(ql_0, m4),                        _mm256_and_si256(_mm256_slli_epi16(qhb, 4), m48)),
+                                _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi16(ql_0, 4), m4), _mm256_and_si256(_mm256_slli_epi16(qhb, 2), m48)),
+                                _mm256_or_si256(_mm256_and_si256(ql_1, m4),                        _mm256_and_si256(qhb, m48)),
+                                _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi16(ql_1, 4), m4), _mm256_and_si256(_mm256_srli_epi16(qhb, 2), m48)),
+                            };
+                            for (int c = 0; c < 4; c++) {
+                                for (int m = 0; m < nrows; m++) {
+                                    sumb[c][m] = mul_sum_us8_pairs_acc_int32x8(sumb[c][m], q[c], q8_row_broadcast(q8_row_qs(a_ptr[l], m, (h * 4 + c) * 8 + k)));
+                                }
+                            }
+                        }
+                        // the quants are stored with an offset of 32
+                        for (int c = 0; c < 4; c++) {
+                            const int g = (h * 4 + c) * 2 + is;
+                            const __m256i sc = _mm256_cvtepi8_epi32(_mm_loadl_epi64((const __m128i *) (b_ptr[l].scales + g * 8)));
+                            for (int m = 0; m < nrows; m++) {
+                                sumb[c][m] = _mm256_sub_epi32(sumb[c][m], _mm256_set1_epi32(32 * q8_row_bsum(a_ptr[l], m, g)));
+                                sumi[m] = _mm256_add_epi32(sumi[m], _mm256_mullo_epi32(sumb[c][m], sc));
+                            }
+                        }
+                    }
+                }
+                const __m256 d = GGML_F32Cx8_LOAD(b_ptr[l].d);
+                for (int m = 0; m < nrows; m++) {
+                    const __m256 da = _mm256_set1_ps(q8_row_d(a_ptr[l], m));
+                    acc[m] = _mm256_fmadd_ps(_mm256_cvtepi32_ps(sumi[m]), _mm256_mul_ps(d, da), acc[m]);
+                }
+            }
+            for (int m = 0; m < nrows; m++) {
+                _mm256_storeu_ps(s + (y * nrows + m) * bs + x * ncols_interleaved, acc[m]);
+            }
+#else
+            float sumf[nrows][8] = {};
+            for (int l = 0; l < nb; l++) {
+                for (int j = 0; j < ncols_interleaved; j++) {
+                    for (int m = 0; m < nrows; m++) {
+                        int sumi = 0;
+                        for (int ib = 0; ib < qk / 32; ib++) {
+                            for (int is = 0; is < 2; is++) {
+                                int sumb = 0;
+                                for (int k = is * 4; k < is * 4 + 4; k++) {
+                                    const int8_t * a = q8_row_qs(a_ptr[l], m, ib * 8 + k);
+                                    for (int i = 0; i < 4; ++i) {
+                                        const int ql = (b_ptr[l].ql[((ib >> 1) * 8 + k) * 32 + j * 4 + i] >> (4 * (ib & 1))) & 0xF;
+                                        const int qh = (b_ptr[l].qh[((ib >> 2) * 8 + k) * 32 + j * 4 + i] >> (2 * (ib & 3))) & 3;
+                                        sumb += (ql | (qh << 4)) * a[i];
+                                    }
+                                }
+                                sumi += b_ptr[l].scales[(ib * 2 + is) * 8 + j] * (sumb - 32 * q8_row_bsum(a_ptr[l], m, ib * 2 + is));
+                            }
+                        }
+                        sumf[m][j] += sumi * GGML_FP16_TO_FP32(b_ptr[l].d[j]) * q8_row_d(a_ptr[l], m);
+                    }
+                }
+            }
+            for (int m = 0; m < nrows; m++) {
+                for (int j = 0; j < ncols_interleaved; j++) {
+                    s[(y * nrows + m) * bs + x * ncols_interleaved + j] = sumf[m][j];
+                }
+            }
+#endif
+        }
+    }
+}
+
+template <typename block_a, int nrows>
+static void mul_mat_iq4_xs_8x8_q8_K(int n, float * GGML_RESTRICT s, size_t bs, const void * GGML_RESTRICT vx, const void * GGML_RESTRICT vy, int nr, int nc) {
+    const int qk = QK_K;
+    const int nb = n / qk;
+    const int ncols_interleaved = 8;
+
+    assert (n % qk == 0);
+    assert (nr % nrows == 0);
+    assert (nc % ncols_interleaved == 0);
+
+#if defined(__AVX2__)
+    const __m256i values = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) kvalues_iq4nl));
+    const __m256i m4  = _mm256_set1_epi8(0x0F);
+    const __m256i m3  = _mm256_set1_epi32(3);
+    const __m256i m15 = _mm256_set1_epi32(15);
+    const __m256i m32 = _mm256_set1_epi32(32);
+#endif
+
+    for (int y = 0; y < nr / nrows; y++) {
+        const block_a * a_ptr = (const block_a *) vy + (y * nb);
+        for (int x = 0; x < nc / ncols_interleaved; x++) {
+            const block_iq4_xsx8 * b_ptr = (const block_iq4_xsx8 *) vx + (x * nb);
+#if defined(__AVX2__)
+            __m256 acc[nrows];
+            for (int m = 0; m < nrows; m++) {
+                acc[m] = _mm256_setzero_ps();
+            }
+            for (int l = 0; l < nb; l++) {
+                __m256i sumi[nrows];
+                for (int m = 0; m < nrows; m++) {
+                    sumi[m] = _mm256_setzero_si256();
+                }
+                prefetch_block(b_ptr + l + 2);
+                for (int ib = 0; ib < qk / 32; ib++) {
+                    const __m128i shift_l = _mm_cvtsi32_si128(4 * (ib & 1));
+                    const __m128i shift_h = _mm_cvtsi32_si128(2 * (ib & 3));
+                    const __m256i ls_l = _mm256_srl_epi32(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) (b_ptr[l].scales_l + (ib >> 1) * 8))), shift_l);
+                    const __m256i ls_h = _mm256_srl_epi32(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) (b_ptr[l].scales_h + (ib >> 2) * 8))), shift_h);
+                    const __m256i sc = _mm256_sub_epi32(_mm256_or_si256(_mm256_and_si256(ls_l, m15), _mm256_slli_epi32(_mm256_and_si256(ls_h, m3), 4)), m32);
+
+                    __m256i sumb[nrows];
+                    for (int m = 0; m < nrows; m++) {
+                        sumb[m] = _mm256_setzero_si256();
+                    }
+                    for (int k = 0; k < 8; k++) {
+                        const __m256i q  = _mm256_loadu_si256((const __m256i *) (b_ptr[l].qs + ((ib >> 1) * 8 + k) * 32));
+                        const __m256i w  = _mm256_shuffle_epi8(values, _mm256_and_si256(_mm256_srl_epi16(q, shift_l), m4));
+                        const __m256i aw = _mm256_sign_epi8(w, w);
+                        for (int m = 0; m < nrows; m++) {
+                            const __m256i sa = _mm256_sign_epi8(q8_row_broadcast(q8_row_qs(a_ptr[l], m, ib * 8 + k)), w);
+                            sumb[m] = mul_sum_us8_pairs_acc_int32x8(sumb[m], aw, sa);
+                        }
+                    }
+                    for (int m = 0; m < nrows; m++) {
+                        sumi[m] = _mm256_add_epi32(sumi[m], _mm256_mullo_epi32(sumb[m], sc));
+                    }
+                }
+                const __m256 d = GGML_F32Cx8_LOAD(b_ptr[l].d);
+                for (int m = 0; m < nrows; m++) {
+                    const __m256 da = _mm256_set1_ps(q8_row_d(a_ptr[l], m));
+                    acc[m] = _mm256_fmadd_ps(_mm256_cvtepi32_ps(sumi[m]), _mm256_mul_ps(d, da), acc[m]);
+                }
+            }
+            for (int m = 0; m < nrows; m++) {
+                _mm256_storeu_ps(s + (y * nrows + m) * bs + x * ncols_interleaved, acc[m]);
+            }
+#else
+            float sumf[nrows][8] = {};
+            for (int l = 0; l < nb; l++) {
+                for (int j = 0; j < ncols_interleaved; j++) {
+                    for (int m = 0; m < nrows; m++) {
+                        int sumi = 0;
+                        for (int ib = 0; ib < qk / 32; ib++) {
+                            const int ls_l = b_ptr[l].scales_l[(ib >> 1) * 8 + j] >> (4 * (ib & 1));
+                            const int ls_h = b_ptr[l].scales_h[(ib >> 2) * 8 + j] >> (2 * (ib & 3));
+                            int sumb = 0;
+                            for (int k = 0; k < 8; k++) {
+                                const int8_t * a = q8_row_qs(a_ptr[l], m, ib * 8 + k);
+                                for (int i = 0; i < 4; ++i) {
+                                    const int q = (b_ptr[l].qs[((ib >> 1) * 8 + k) * 32 + j * 4 + i] >> (4 * (ib & 1))) & 0xF;
+                                    sumb += kvalues_iq4nl[q] * a[i];
+                                }
+                            }
+                            sumi += (((ls_l & 15) | ((ls_h & 3) << 4)) - 32) * sumb;
+                        }
+                        sumf[m][j] += sumi * GGML_FP16_TO_FP32(b_ptr[l].d[j]) * q8_row_d(a_ptr[l], m);
+                    }
+                }
+            }
+            for (int m = 0; m < nrows; m++) {
+                for (int j = 0; j < ncols_interleaved; j++) {
+                    s[(y * nrows + m) * bs + x * ncols_interleaved + j] = sumf[m][j];
+                }
+            }
+#endif
+        }
+    }
+}
+
+#if defined(__AVX512F__) && defined(__AVX512BW__) && defined(__AVX512VNNI__)
+// AVX-512 VNNI micro-kernels working on tiles of nrows activation rows x 16 weight rows. The 16 rows are the two
+// consecutive blocks of 8 interleaved rows of the 8x8 layouts, so the weights are repacked in the same way and the
+// 8 columns kernels above can be used where the tile does not apply.
+// The activation rows of a tile come from (nrows + 3) / 4 block_q8_Kx4 (or one block_q8_K for nrows == 1).
+
+static inline __m512i load_2x8x4_epi8(const uint8_t * lo, const uint8_t * hi) {
+    return _mm512_inserti64x4(_mm512_castsi256_si512(_mm256_loadu_si256((const __m256i *) lo)), _mm256_loadu_si256((const __m256i *) hi), 1);
+}
+
+static inline __m512i load_2x8_epu8_epi32(const uint8_t * lo, const uint8_t * hi) {
+    return _mm512_cvtepu8_epi32(_mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i *) lo), _mm_loadl_epi64((const __m128i *) hi)));
+}
+
+static inline __m512i load_2x8_epi8_epi32(const int8_t * lo, const int8_t * hi) {
+    return _mm512_cvtepi8_epi32(_mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i *) lo), _mm_loadl_epi64((const __m128i *) hi)));
+}
+
+static inline __m512 load_2x8_fp16(const ggml_half * lo, const ggml_half * hi) {
+    return _mm512_cvtph_ps(_mm256_set_m128i(_mm_loadu_si128((const __m128i *) hi), _mm_loadu_si128((const __m128i *) lo)));
+}
+
+static inline __m512i q8_row_broadcast_x16(const int8_t * qs) {
+    int32_t v;
+    memcpy(&v, qs, sizeof(v));
+    return _mm512_set1_epi32(v);
+}
+
+template <bool has_qh, typename block_a, int nrows>
+static void mul_mat_q4_K_q5_K_16x8_q8_K(int n, float * GGML_RESTRICT s, size_t bs, const void * GGML_RESTRICT vx, const void * GGML_RESTRICT vy, int nr, int nc) {
+    using block_b = typename std::conditional<has_qh, block_q5_Kx8, block_q4_Kx8>::type;
+
+    const int qk = QK_K;
+    const int nb = n / qk;
+    const int ncols_interleaved = 16;
+    const int ngroups = (nrows + 3) / 4;
+
+    assert (n % qk == 0);
+    assert (nr % nrows == 0);
+    assert (nc % ncols_interleaved == 0);
+
+    const __m512i m4  = _mm512_set1_epi8(0x0F);
+    const __m512i m16 = _mm512_set1_epi8(0x10);
+    const __m512i m3  = _mm512_set1_epi32(3);
+    const __m512i m15 = _mm512_set1_epi32(15);
+
+    for (int y = 0; y < nr / nrows; y++) {
+        const block_a * a_ptr = (const block_a *) vy + (y * ngroups * nb);
+        for (int x = 0; x < nc / ncols_interleaved; x++) {
+            const block_b * b_ptr_0 = (const block_b *) vx + (x * 2 * nb);
+            const block_b * b_ptr_1 = b_ptr_0 + nb;
+
+            __m512 acc[nrows];
+            for (int m = 0; m < nrows; m++) {
+                acc[m] = _mm512_setzero_ps();
+            }
+            for (int l = 0; l < nb; l++) {
+                const block_b & b0 = b_ptr_0[l];
+                const block_b & b1 = b_ptr_1[l];
+
+                __m512i sumi[nrows];
+                for (int m = 0; m < nrows; m++) {
+                    sumi[m] = _mm512_setzero_si512();
+                }
+                prefetch_block(b_ptr_0 + l + 2);
+                prefetch_block(b_ptr_1 + l + 2);
+                for (int sb = 0; sb < qk / 32; sb++) {
+                    const __m128i shift_h = _mm_cvtsi32_si128(4 * (sb & 1));
+                    const __m512i sm_l = load_2x8_epu8_epi32(b0.scales + sb * 8, b1.scales + sb * 8);
+                    const __m512i sm_h = _mm512_srl_epi32(load_2x8_epu8_epi32(b0.scales + 64 + (sb >> 1) * 8, b1.scales + 64 + (sb >> 1) * 8), shift_h);
+                    const __m512i sc = _mm512_or_si512(_mm512_and_si512(sm_l, m15), _mm512_slli_epi32(_mm512_and_si512(sm_h, m3), 4));
+
+                    __m512i sumb[nrows];
+                    for (int m = 0; m < nrows; m++) {
+                        sumb[m] = _mm512_setzero_si512();
+                    }
+                    for (int k = 0; k < 8; k++) {
+                        const int o = ((sb >> 1) * 8 + k) * 32;
+                        __m512i q = _mm512_and_si512(_mm512_srl_epi16(load_2x8x4_epi8(b0.qs + o, b1.qs + o), shift_h), m4);
+                        if constexpr (has_qh) {
+                            const __m512i qh = load_2x8x4_epi8(b0.qh + k * 32, b1.qh + k * 32);
+                            q = _mm512_mask_add_epi8(q, _mm512_test_epi8_mask(qh, _mm512_set1_epi8((char) (1 << sb))), q, m16);
+                        }
+                        for (int m = 0; m < nrows; m++) {
+                            const int8_t * a = q8_row_qs(a_ptr[(m >> 2) * nb + l], m & 3, sb * 8 + k);
+                            sumb[m] = _mm512_dpbusd_epi32(sumb[m], q, q8_row_broadcast_x16(a));
+                        }
+                    }
+                    for (int m = 0; m < nrows; m++) {
+                        sumi[m] = _mm512_add_epi32(sumi[m], _mm512_mullo_epi32(sumb[m], sc));
+                    }
+                }
+
+                // the mins, in a second pass to keep the accumulators in registers
+                __m512i summ[nrows];
+                for (int m = 0; m < nrows; m++) {
+                    summ[m] = _mm512_setzero_si512();
+                }
+                for (int sb = 0; sb < qk / 32; sb++) {
+                    const __m512i sm_l = load_2x8_epu8_epi32(b0.scales + sb * 8, b1.scales + sb * 8);
+                    const __m512i sm_h = _mm512_srl_epi32(load_2x8_epu8_epi32(b0.scales + 64 + (sb >> 1) * 8, b1.scales + 64 + (sb >> 1) * 8), _mm_cvtsi32_si128(4 * (sb & 1) + 2));
+                    const __m512i mn = _mm512_or_si512(_mm512_srli_epi32(sm_l, 4), _mm512_slli_epi32(_mm512_and_si512(sm_h, m3), 4));
+                    for (int m = 0; m < nrows; m++) {
+                        const block_a & a = a_ptr[(m >> 2) * nb + l];
+                        const int bsum = q8_row_bsum(a, m & 3, sb * 2) + q8_row_bsum(a, m & 3, sb * 2 + 1);
+                        summ[m] = _mm512_add_epi32(summ[m], _mm512_mullo_epi32(mn, _mm512_set1_epi32(bsum)));
+                    }
+                }
+
+                const __m512 d    = load_2x8_fp16(b0.d, b1.d);
+                const __m512 dmin = load_2x8_fp16(b0.dmin, b1.dmin);
+                for (int m = 0; m < nrows; m++) {
+                    const __m512 da = _mm512_set1_ps(q8_row_d(a_ptr[(m >> 2) * nb + l], m & 3));
+                    acc[m] = _mm512_fmadd_ps(_mm512_cvtepi32_ps(sumi[m]), _mm512_mul_ps(d, da), acc[m]);
+                    acc[m] = _mm512_fnmadd_ps(_mm512_cvtepi32_ps(summ[m]), _mm512_mul_ps(dmin, da), acc[m]);
+                }
+            }
+            for (int m = 0; m < nrows; m++) {
+                _mm512_storeu_ps(s + (y * nrows + m) * bs + x * ncols_interleaved, acc[m]);
+            }
+        }
+    }
+}
+
+template <typename block_a, int nrows>
+static void mul_mat_q6_K_16x8_q8_K(int n, float * GGML_RESTRICT s, size_t bs, const void * GGML_RESTRICT vx, const void * GGML_RESTRICT vy, int nr, int nc) {
+    const int qk = QK_K;
+    const int nb = n / qk;
+    const int ncols_interleaved = 16;
+    const int ngroups = (nrows + 3) / 4;
+
+    assert (n % qk == 0);
+    assert (nr % nrows == 0);
+    assert (nc % ncols_interleaved == 0);
+
+    const __m512i m4 = _mm512_set1_epi8(0x0F);
+    const __m512i m3 = _mm512_set1_epi8(0x03);
+
+    for (int y = 0; y < nr / nrows; y++) {
+        const block_a * a_ptr = (const block_a *) vy + (y * ngroups * nb);
+        for (int x = 0; x < nc / ncols_interleaved; x++) {
+            const block_q6_Kx8 * b_ptr_0 = (const block_q6_Kx8 *) vx + (x * 2 * nb);
+            const block_q6_Kx8 * b_ptr_1 = b_ptr_0 + nb;
+
+            __m512 acc[nrows];
+            for (int m = 0; m < nrows; m++) {
+                acc[m] = _mm512_setzero_ps();
+            }
+            for (int l = 0; l < nb; l++) {
+                const block_q6_Kx8 & b0 = b_ptr_0[l];
+                const block_q6_Kx8 & b1 = b_ptr_1[l];
+
+                __m512i sumi[nrows];
+                for (int m = 0; m < nrows; m++) {
+                    sumi[m] = _mm512_setzero_si512();
+                }
+                prefetch_block(b_ptr_0 + l + 2);
+                prefetch_block(b_ptr_1 + l + 2);
+                for (int ib = 0; ib < qk / 32; ib++) {
+                    const __m128i shift_l = _mm_cvtsi32_si128(4 * (ib & 1));
+                    const __m128i shift_h = _mm_cvtsi32_si128(2 * (ib & 3));
+                    const uint8_t * ql_0 = b0.ql + (ib >> 1) * 256;
+                    const uint8_t * ql_1 = b1.ql + (ib >> 1) * 256;
+                    const uint8_t * qh_0 = b0.qh + (ib >> 2) * 256;
+                    const uint8_t * qh_1 = b1.qh + (ib >> 2) * 256;
+                    for (int is = 0; is < 2; is++) {
+                        const int g = ib * 2 + is;
+                        const __m512i sc = load_2x8_epi8_epi32(b0.scales + g * 8, b1.scales + g * 8);
+
+                        __m512i sumb[nrows];
+                        for (int m = 0; m < nrows; m++) {
+                            sumb[m] = _mm512_setzero_si512();
+                        }
+                        for (int k = 0; k < 4; k++) {
+                            const int o = (is * 4 + k) * 32;
+                            const __m512i ql = _mm512_and_si512(_mm512_srl_epi16(load_2x8x4_epi8(ql_0 + o, ql_1 + o), shift_l), m4);
+                            const __m512i qh = _mm512_and_si512(_mm512_srl_epi16(load_2x8x4_epi8(qh_0 + o, qh_1 + o), shift_h), m3);
+                            const __m512i q  = _mm512_or_si512(ql, _mm512_slli_epi16(qh, 4));
+                            for (int m = 0; m < nrows; m++) {
+                                const int8_t * a = q8_row_qs(a_ptr[(m >> 2) * nb + l], m & 3, ib * 8 + is * 4 + k);
+                                sumb[m] = _mm512_dpbusd_epi32(sumb[m], q, q8_row_broadcast_x16(a));
+                            }
+                        }
+                        // the quants are stored with an offset of 32
+                        for (int m = 0; m < nrows; m++) {
+                            const int bsum = q8_row_bsum(a_ptr[(m >> 2) * nb + l], m & 3, g);
+                            sumb[m] = _mm512_sub_epi32(sumb[m], _mm512_set1_epi32(32 * bsum));
+                            sumi[m] = _mm512_add_epi32(sumi[m], _mm512_mullo_epi32(sumb[m], sc));
+                        }
+                    }
+                }
+                const __m512 d = load_2x8_fp16(b0.d, b1.d);
+                for (int m = 0; m < nrows; m++) {
+                    const __m512 da = _mm512_set1_ps(q8_row_d(a_ptr[(m >> 2) * nb + l], m & 3));
+                    acc[m] = _mm512_fmadd_ps(_mm512_cvtepi32_ps(sumi[m]), _mm512_mul_ps(d, da), acc[m]);
+                }
+            }
+            for (int m = 0; m < nrows; m++) {
+                _mm512_storeu_ps(s + (y * nrows + m) * bs + x * ncols_interleaved, acc[m]);
+            }
+        }
+    }
+}
+
+// tiles of 8 activation rows, and of 4 rows for the rest
+template <void (*mul_mat_8)(int, float *, size_t, const void *, const void *, int, int),
+          void (*mul_mat_4)(int, float *, size_t, const void *, const void *, int, int)>
+static void mul_mat_16x8_q8_K_tiled(int n, float * GGML_RESTRICT s, size_t bs, const void * GGML_RESTRICT vx, const void * GGML_RESTRICT vy, int nr, int nc) {
+    const int nr8 = nr - nr % 8;
+    if (nr8 > 0) {
+        mul_mat_8(n, s, bs, vx, vy, nr8, nc);
+    }
+    if (nr8 < nr) {
+        mul_mat_4(n, s + nr8 * bs, bs, vx, (const block_q8_Kx4 *) vy + (nr8 / 4) * (n / QK_K), nr - nr8, nc);
+    }
+}
+#endif
+
+static void ggml_gemv_q4_K_16x8_q8_K(int n, float * GGML_RESTRICT s, size_t bs, const void * GGML_RESTRICT vx, const void * GGML_RESTRICT vy, int nr, int nc) {
+#if defined(__AVX512F__) && defined(__AVX512BW__) && defined(__AVX512VNNI__)
+    mul_mat_q4_K_q5_K_16x8_q8_K<false, block_q8_K, 1>(n, s, bs, vx, vy, nr, nc);
+#else
+    mul_mat_q4_K_q5_K_8x8_q8_K<false, block_q8_K, 1>(n, s, bs, vx, vy, nr, nc);
+#endif
+}
+
+static void ggml_gemv_q5_K_16x8_q8_K(int n, float * GGML_RESTRICT s, size_t bs, const void * GGML_RESTRICT vx, const void * GGML_RESTRICT vy, int nr, int nc) {
+#if defined(__AVX512F__) && defined(__AVX512BW__) && defined(__AVX512VNNI__)
+    mul_mat_q4_K_q5_K_16x8_q8_K<true, block_q8_K, 1>(n, s, bs, vx, vy, nr, nc);
+#else
+    mul_mat_q4_K_q5_K_8x8_q8_K<true, block_q8_K, 1>(n, s, bs, vx, vy, nr, nc);
+#endif
+}
+
+static void ggml_gemv_q6_K_16x8_q8_K(int n, float * GGML_RESTRICT s, size_t bs, const void * GGML_RESTRICT vx, const void * GGML_RESTRICT vy, int nr, int nc) {
+#if defined(__AVX512F__) && defined(__AVX512BW__) && defined(__AVX512VNNI__)
+    mul_mat_q6_K_16x8_q8_K<block_q8_K, 1>(n, s, bs, vx, vy, nr, nc);
+#else
+    mul_mat_q6_K_8x8_q8_K<block_q8_K, 1>(n, s, bs, vx, vy, nr, nc);
+#endif
+}
+
+static void ggml_gemm_q4_K_16x8_q8_K(int n, float * GGML_RESTRICT s, size_t bs, const void * GGML_RESTRICT vx, const void * GGML_RESTRICT vy, int nr, int nc) {
+#if defined(__AVX512F__) && defined(__AVX512BW__) && defined(__AVX512VNNI__)
+    mul_mat_16x8_q8_K_tiled<mul_mat_q4_K_q5_K_16x8_q8_K<false, block_q8_Kx4, 8>,
+                            mul_mat_q4_K_q5_K_16x8_q8_K<false, block_q8_Kx4, 4>>(n, s, bs, vx, vy, nr, nc);
+#else
+    mul_mat_q4_K_q5_K_8x8_q8_K<false, block_q8_Kx4, 4>(n, s, bs, vx, vy, nr, nc);
+#endif
+}
+
+static void ggml_gemm_q5_K_16x8_q8_K(int n, float * GGML_RESTRICT s, size_t bs, const void * GGML_RESTRICT vx, const void * GGML_RESTRICT vy, int nr, int nc) {
+#if defined(__AVX512F__) && defined(__AVX512BW__) && defined(__AVX512VNNI__)
+    mul_mat_16x8_q8_K_tiled<mul_mat_q4_K_q5_K_16x8_q8_K<true, block_q8_Kx4, 8>,
+                            mul_mat_q4_K_q5_K_16x8_q8_K<true, block_q8_Kx4, 4>>(n, s, bs, vx, vy, nr, nc);
+#else
+    mul_mat_q4_K_q5_K_8x8_q8_K<true, block_q8_Kx4, 4>(n, s, bs, vx, vy, nr, nc);
+#endif
+}
+
+static void ggml_gemm_q6_K_16x8_q8_K(int n, float * GGML_RESTRICT s, size_t bs, const void * GGML_RESTRICT vx, const void * GGML_RESTRICT vy, int nr, int nc) {
+#if defined(__AVX512F__) && defined(__AVX512BW__) && defined(__AVX512VNNI__)
+    mul_mat_16x8_q8_K_tiled<mul_mat_q6_K_16x8_q8_K<block_q8_Kx4, 8>,
+                            mul_mat_q6_K_16x8_q8_K<block_q8_Kx4, 4>>(n, s, bs, vx, vy, nr, nc);
+#else
+    mul_mat_q6_K_8x8_q8_K<block_q8_Kx4, 4>(n, s, bs, vx, vy, nr, nc);
+#endif
+}
 
-            vst1q_f32(res_ptr + x * 4, sumf);
-        }
-        return;
-    }
-#endif // #if ! ((defined(_MSC_VER)) && ! defined(__clang__)) && defined(__aarch64__) && defined(__ARM_NEON)
-    {
-        float sumf[4];
-        int sumi;
+static void ggml_gemv_q8_0_8x8_q8_0(int n, float * GGML_RESTRICT s, size_t bs, const void * GGML_RESTRICT vx, const void * GGML_RESTRICT vy, int nr, int nc) {
+    mul_mat_q8_0_8x8_q8_0<block_q8_0, 1>(n, s, bs, vx, vy, nr, nc);
+}
 
-        const block_q8_0 * a_ptr = (const block_q8_0 *) vy;
-        for (int x = 0; x < nc / ncols_interleaved; x++) {
-            const block_iq4_nlx4 * b_ptr = (const block_iq4_nlx4 *) vx + (x * nb);
+static void ggml_gemv_q5_K_8x8_q8_K(int n, float * GGML_RESTRICT s, size_t bs, const void * GGML_RESTRICT vx, const void * GGML_RESTRICT vy, int nr, int nc) {
+    mul_mat_q4_K_q5_K_8x8_q8_K<true, block_q8_K, 1>(n, s, bs, vx, vy, nr, nc);
+}
 
-            for (int j = 0; j < ncols_interleaved; j++) sumf[j] = 0.0;
-            for (int l = 0; l < nb; l++) {
-                for (int k = 0; k < (qk / (2 * blocklen)); k++) {
-                    for (int j = 0; j < ncols_interleaved; j++) {
-                        sumi = 0;
-                        for (int i = 0; i < blocklen; ++i) {
-                            const int v0 = kvalues_iq4nl[b_ptr[l].qs[k * ncols_interleaved * blocklen + j * blocklen + i] & 0x0F];
-                            const int v1 = kvalues_iq4nl[b_ptr[l].qs[k * ncols_interleaved * blocklen + j * blocklen + i] >> 4];
-                            sumi += ((v0 * a_ptr[l].qs[k * blocklen + i]) + (v1 * a_ptr[l].qs[k * blocklen + i + qk / 2]));
-                        }
-                        sumf[j] += sumi * GGML_FP16_TO_FP32(b_ptr[l].d[j]) * GGML_FP16_TO_FP32(a_ptr[l].d);
-                    }
-                }
-            }
-            for (int j = 0; j < ncols_interleaved; j++) s[x * ncols_interleaved + j] = sumf[j];
-        }
-    }
+static void ggml_gemv_q6_K_8x8_q8_K(int n, float * GGML_RESTRICT s, size_t bs, const void * GGML_RESTRICT vx, const void * GGML_RESTRICT vy, int nr, int nc) {
+    mul_mat_q6_K_8x8_q8_K<block_q8_K, 1>(n, s, bs, vx, vy, nr, nc);
+}
+
+static void ggml_gemv_iq4_xs_8x8_q8_K(int n, float * GGML_RESTRICT s, size_t bs, const void * GGML_RESTRICT vx, const void * GGML_RESTRICT vy, int nr, int nc) {
+    mul_mat_iq4_xs_8x8_q8_K<block_q8_K, 1>(n, s, bs, vx, vy, nr, nc);
 }
 
 static void ggml_gemm_q4_0_4x4_q8_0(int n, float * GGML_RESTRICT s, size_t bs, const void * GGML_RESTRICT vx, const void * GGML_RESTRICT vy, int nr, int nc) {
@@ -4940,6 +5731,22 @@ static void ggml_gemm_iq4_nl_4x4_q8_0(int n, float * GGML_RESTRICT s, size_t bs,
     }
 }
 
+static void ggml_gemm_q8_0_8x8_q8_0(int n, float * GGML_RESTRICT s, size_t bs, const void * GGML_RESTRICT vx, const void * GGML_RESTRICT vy, int nr, int nc) {
+    mul_mat_q8_0_8x8_q8_0<block_q8_0x4, 4>(n, s, bs, vx, vy, nr, nc);
+}
+
+static void ggml_gemm_q5_K_8x8_q8_K(int n, float * GGML_RESTRICT s, size_t bs, const void * GGML_RESTRICT vx, const void * GGML_RESTRICT vy, int nr, int nc) {
+    mul_mat_q4_K_q5_K_8x8_q8_K<true, block_q8_Kx4, 4>(n, s, bs, vx, vy, nr, nc);
+}
+
+static void ggml_gemm_q6_K_8x8_q8_K(int n, float * GGML_RESTRICT s, size_t bs, const void * GGML_RESTRICT vx, const void * GGML_RESTRICT vy, int nr, int nc) {
+    mul_mat_q6_K_8x8_q8_K<block_q8_Kx4, 4>(n, s, bs, vx, vy, nr, nc);
+}
+
+static void ggml_gemm_iq4_xs_8x8_q8_K(int n, float * GGML_RESTRICT s, size_t bs, const void * GGML_RESTRICT vx, const void * GGML_RESTRICT vy, int nr, int nc) {
+    mul_mat_iq4_xs_8x8_q8_K<block_q8_Kx4, 4>(n, s, bs, vx, vy, nr, nc);
+}
+
 static block_q4_0x4 make_block_q4_0x4(block_q4_0 * in, unsigned int blck_size_interleave) {
     block_q4_0x4 out;
 
@@ -5009,6 +5816,16 @@ static block_q4_0x8 make_block_q4_0x8(block_q4_0 * in, unsigned int blck_size_in
     return out;
 }
 
+static inline void get_scale_min_k4(int j, const uint8_t * GGML_RESTRICT q, uint8_t * GGML_RESTRICT d, uint8_t * GGML_RESTRICT m) {
+    if (j < 4) {
+        *d = q[j] & 63; *m = q[j + 4] & 63;
+    } else {
+        *d = (q[j+4] & 0xF) | ((q[j-4] >> 6) << 4);
+        *m = (q[j+4] >>  4) | ((q[j-0] >> 6) << 4);
+    }
+}
+
+// with blck_size_interleave == 4 the quants and the scales have the layout of block_q5_Kx8 (see make_block_q5_Kx8)
 static block_q4_Kx8 make_block_q4_Kx8(block_q4_K * in, unsigned int blck_size_interleave) {
     block_q4_Kx8 out;
     //Delta(scale) and dmin values of the eight Q4_K structures are copied onto the output interleaved structure
@@ -5020,6 +5837,25 @@ static block_q4_Kx8 make_block_q4_Kx8(block_q4_K * in, unsigned int blck_size_in
         out.dmin[i] = in[i].GGML_COMMON_AGGR_U.GGML_COMMON_AGGR_S.dmin;
     }
 
+    if (blck_size_interleave == 4) {
+        for (int i = 0; i < QK_K * 4 / 4; ++i) {
+            memcpy(&out.qs[i * 4], &in[i % 8].qs[(i / 8) * 4], 4);
+        }
+
+        memset(out.scales + 64, 0, 32);
+
+        for (int sb = 0; sb < QK_K / 32; sb++) {
+            for (int j = 0; j < 8; j++) {
+                uint8_t sc, m;
+                get_scale_min_k4(sb, in[j].scales, &sc, &m);
+                out.scales[sb * 8 + j] = (sc & 15) | ((m & 15) << 4);
+                out.scales[64 + (sb >> 1) * 8 + j] |= ((sc >> 4) | ((m >> 4) << 2)) << (4 * (sb & 1));
+            }
+        }
+
+        return out;
+    }
+
     const int end = QK_K * 4 / blck_size_interleave;
 
     // Interleave Q4_K quants by taking 8 bytes at a time
@@ -5117,7 +5953,7 @@ static int repack_q4_0_to_q4_0_4_bl(struct ggml_tensor * t, int interleave_block
 }
 static int repack_q4_K_to_q4_K_8_bl(struct ggml_tensor * t, int interleave_block, const void * GGML_RESTRICT data, size_t data_size) {
     GGML_ASSERT(t->type == GGML_TYPE_Q4_K);
-    GGML_ASSERT(interleave_block == 8);
+    GGML_ASSERT(interleave_block == 4 || interleave_block == 8);
     constexpr int nrows_interleaved = 8;
 
     block_q4_Kx8 * dst = (block_q4_Kx8*)t->data;
@@ -5244,6 +6080,182 @@ static int repack_iq4_nl_to_iq4_nl_4_bl(struct ggml_tensor * t, int interleave_b
     GGML_UNUSED(data_size);
 }
 
+// interleave 8 block_q8_0s in groups of 4 quants
+static block_q8_0x8 make_block_q8_0x8(block_q8_0 * in) {
+    block_q8_0x8 out;
+
+    for (int j = 0; j < 8; j++) {
+        out.d[j] = in[j].d;
+    }
+
+    for (int k = 0; k < QK8_0 / 4; k++) {
+        for (int j = 0; j < 8; j++) {
+            memcpy(&out.qs[k * 32 + j * 4], &in[j].qs[k * 4], 4);
+        }
+    }
+
+    return out;
+}
+
+// interleave 8 block_q5_Ks in groups of 4 bytes
+// qs[(p * 8 + k) * 32 + j * 4 + i] holds the low 4 bits of the quants 64 * p + 4 * k + i (low nibble) and
+// 64 * p + 32 + 4 * k + i (high nibble) of the row j, as in block_q5_K
+// qh[k * 32 + j * 4 + i] holds the high bit of the quant 32 * sb + 4 * k + i in its bit sb, as in block_q5_K
+// the 6-bit scales and mins are split in their low 4 bits and high 2 bits, which only take shifts to unpack
+static block_q5_Kx8 make_block_q5_Kx8(block_q5_K * in) {
+    block_q5_Kx8 out;
+
+    for (int j = 0; j < 8; j++) {
+        out.d[j]    = in[j].GGML_COMMON_AGGR_U.GGML_COMMON_AGGR_S.d;
+        out.dmin[j] = in[j].GGML_COMMON_AGGR_U.GGML_COMMON_AGGR_S.dmin;
+    }
+
+    for (int p = 0; p < QK_K / 64; p++) {
+        for (int k = 0; k < 8; k++) {
+            for (int j = 0; j < 8; j++) {
+                memcpy(&out.qs[(p * 8 + k) * 32 + j * 4], &in[j].qs[p * 32 + k * 4], 4);
+            }
+        }
+    }
+
+    for (int k = 0; k < 8; k++) {
+        for (int j = 0; j < 8; j++) {
+            memcpy(&out.qh[k * 32 + j * 4], &in[j].qh[k * 4], 4);
+        }
+    }
+
+    memset(out.scales + 64, 0, 32);
+
+    for (int sb = 0; sb < QK_K / 32; sb++) {
+        for (int j = 0; j < 8; j++) {
+            uint8_t sc, m;
+            get_scale_min_k4(sb, in[j].scales, &sc, &m);
+            out.scales[sb * 8 + j] = (sc & 15) | ((m & 15) << 4);
+            out.scales[64 + (sb >> 1) * 8 + j] |= ((sc >> 4) | ((m >> 4) << 2)) << (4 * (sb & 1));
+        }
+    }
+
+    return out;
+}
+
+// interleave 8 block_q6_Ks in groups of 4 bytes
+// the 6-bit quants are stored in the order of the values (unlike block_q6_K): ql has the same layout as qs in
+// block_q5_Kx8 and qh[(h * 8 + k) * 32 + j * 4 + i] holds the high 2 bits of the quants 128 * h + 32 * c + 4 * k + i
+// of the row j in its bits 2 * c
+static block_q6_Kx8 make_block_q6_Kx8(block_q6_K * in) {
+    block_q6_Kx8 out;
+    uint8_t q[QK_K];
+
+    memset(out.qh, 0, sizeof(out.qh));
+
+    for (int j = 0; j < 8; j++) {
+        out.d[j] = in[j].d;
+
+        for (int g = 0; g < QK_K / 16; g++) {
+            out.scales[g * 8 + j] = in[j].scales[g];
+        }
+
+        for (int n = 0; n < QK_K / 128; n++) {
+            const uint8_t * ql = in[j].ql + n * 64;
+            const uint8_t * qh = in[j].qh + n * 32;
+            for (int l = 0; l < 32; l++) {
+                q[n * 128 + l +  0] = (ql[l +  0] & 0xF) | (((qh[l] >> 0) & 3) << 4);
+                q[n * 128 + l + 32] = (ql[l + 32] & 0xF) | (((qh[l] >> 2) & 3) << 4);
+                q[n * 128 + l + 64] = (ql[l +  0] >>  4) | (((qh[l] >> 4) & 3) << 4);
+                q[n * 128 + l + 96] = (ql[l + 32] >>  4) | (((qh[l] >> 6) & 3) << 4);
+            }
+        }
+
+        for (int p = 0; p < QK_K / 64; p++) {
+            for (int k = 0; k < 8; k++) {
+                for (int i = 0; i < 4; i++) {
+                    out.ql[(p * 8 + k) * 32 + j * 4 + i] = (q[p * 64 + k * 4 + i] & 0xF) | ((q[p * 64 + 32 + k * 4 + i] & 0xF) << 4);
+                }
+            }
+        }
+
+        for (int h = 0; h < QK_K / 128; h++) {
+            for (int k = 0; k < 8; k++) {
+                for (int i = 0; i < 4; i++) {
+                    for (int c = 0; c < 4; c++) {
+                        out.qh[(h * 8 + k) * 32 + j * 4 + i] |= (q[h * 128 + c * 32 + k * 4 + i] >> 4) << (2 * c);
+                    }
+                }
+            }
+        }
+    }
+
+    return out;
+}
+
+// interleave 8 block_iq4_xss in groups of 4 bytes
+// the nibbles are stored in the order of the values (unlike block_iq4_xs), with the same layout as qs in
+// block_q5_Kx8, and the 6-bit scales are split as in block_q5_Kx8
+static block_iq4_xsx8 make_block_iq4_xsx8(block_iq4_xs * in) {
+    block_iq4_xsx8 out;
+    uint8_t q[QK_K];
+
+    memset(out.scales_l, 0, sizeof(out.scales_l));
+    memset(out.scales_h, 0, sizeof(out.scales_h));
+
+    for (int j = 0; j < 8; j++) {
+        out.d[j] = in[j].d;
+
+        for (int ib = 0; ib < QK_K / 32; ib++) {
+            const int ls = ((in[j].scales_l[ib / 2] >> 4 * (ib % 2)) & 0xF) | (((in[j].scales_h >> 2 * ib) & 3) << 4);
+            out.scales_l[(ib >> 1) * 8 + j] |= (ls & 15) << (4 * (ib & 1));
+            out.scales_h[(ib >> 2) * 8 + j] |= (ls >> 4) << (2 * (ib & 3));
+
+            for (int l = 0; l < 16; l++) {
+                q[ib * 32 + l +  0] = in[j].qs[ib * 16 + l] & 0xF;
+                q[ib * 32 + l + 16] = in[j].qs[ib * 16 + l] >> 4;
+            }
+        }
+
+        for (int p = 0; p < QK_K / 64; p++) {
+            for (int k = 0; k < 8; k++) {
+                for (int i = 0; i < 4; i++) {
+                    out.qs[(p * 8 + k) * 32 + j * 4 + i] = q[p * 64 + k * 4 + i] | (q[p * 64 + 32 + k * 4 + i] << 4);
+                }
+            }
+        }
+    }
+
+    return out;
+}
+
+// repack the rows of t in groups of 8, make_block interleaves the blocks of the 8 rows
+template <typename BLOC_TYPE, typename BLOC_TYPE_X8>
+static int repack_to_x8_bl(struct ggml_tensor * t, BLOC_TYPE_X8 (*make_block)(BLOC_TYPE *), const void * GGML_RESTRICT data, size_t data_size) {
+    static_assert(sizeof(BLOC_TYPE_X8) == 8 * sizeof(BLOC_TYPE), "wrong interleaved block size");
+    constexpr int nrows_interleaved = 8;
+
+    BLOC_TYPE_X8 * dst = (BLOC_TYPE_X8 *) t->data;
+    const BLOC_TYPE * src = (const BLOC_TYPE *) data;
+    BLOC_TYPE dst_tmp[8];
+    int nrow = ggml_nrows(t);
+    int nblocks = t->ne[0] / ggml_blck_size(t->type);
+
+    GGML_ASSERT(data_size == nrow * nblocks * sizeof(BLOC_TYPE));
+
+    if (t->ne[1] % nrows_interleaved != 0) {
+        return -1;
+    }
+
+    for (int b = 0; b < nrow; b += nrows_interleaved) {
+        for (int64_t x = 0; x < nblocks; x++) {
+            for (int i = 0; i < nrows_interleaved; i++) {
+                dst_tmp[i] = src[x + i * nblocks];
+            }
+            *dst++ = make_block(dst_tmp);
+        }
+        src += nrows_interleaved * nblocks;
+    }
+    return 0;
+
+    GGML_UNUSED(data_size);
+}
+
 namespace ggml::cpu::aarch64 {
 // repack
 template <typename BLOC_TYPE, int64_t INTER_SIZE, int64_t NB_COLS>
@@ -5266,10 +6278,43 @@ template <> int repack<block_q4_K, 8, 8>(struct ggml_tensor * t, const void * da
     return repack_q4_K_to_q4_K_8_bl(t, 8, data, data_size);
 }
 
+template <> int repack<block_q4_K, 8, 16>(struct ggml_tensor * t, const void * data, size_t data_size) {
+    return repack_q4_K_to_q4_K_8_bl(t, 4, data, data_size);
+}
+
 template <> int repack<block_iq4_nl, 4, 4>(struct ggml_tensor * t, const void * data, size_t data_size) {
     return repack_iq4_nl_to_iq4_nl_4_bl(t, 4, data, data_size);
 }
 
+template <> int repack<block_q8_0, 8, 8>(struct ggml_tensor * t, const void * data, size_t data_size) {
+    GGML_ASSERT(t->type == GGML_TYPE_Q8_0);
+    return repack_to_x8_bl(t, make_block_q8_0x8, data, data_size);
+}
+
+template <> int repack<block_q5_K, 8, 8>(struct ggml_tensor * t, const void * data, size_t data_size) {
+    GGML_ASSERT(t->type == GGML_TYPE_Q5_K);
+    return repack_to_x8_bl(t, make_block_q5_Kx8, data, data_size);
+}
+
+template <> int repack<block_q6_K, 8, 8>(struct ggml_tensor * t, const void * data, size_t data_size) {
+    GGML_ASSERT(t->type == GGML_TYPE_Q6_K);
+    return repack_to_x8_bl(t, make_block_q6_Kx8, data, data_size);
+}
+
+// the 16 columns kernels use the layout of the 8 columns ones
+template <> int repack<block_q5_K, 8, 16>(struct ggml_tensor * t, const void * data, size_t data_size) {
+    return repack<block_q5_K, 8, 8>(t, data, data_size);
+}
+
+template <> int repack<block_q6_K, 8, 16>(struct ggml_tensor * t, const void * data, size_t data_size) {
+    return repack<block_q6_K, 8, 8>(t, data, data_size);
+}
+
+template <> int repack<block_iq4_xs, 8, 8>(struct ggml_tensor * t, const void * data, size_t data_size) {
+    GGML_ASSERT(t->type == GGML_TYPE_IQ4_XS);
+    return repack_to_x8_bl(t, make_block_iq4_xsx8, data, data_size);
+}
+
 // TODO: needs to be revisited
 //template <> int repack<block_iq4_nl, 8, 4>(struct ggml_tensor * t, const void * data, size_t data_size) {
 //    return repack_iq4_nl_to_iq4_nl_4_bl(t, 8, data, data_size);
@@ -5300,6 +6345,34 @@ void gemv<block_iq4_nl, 4, 4>(int n, float * s, size_t bs, const void * vx, cons
     ggml_gemv_iq4_nl_4x4_q8_0(n, s, bs, vx, vy, nr, nc);
 }
 
+template <> void gemv<block_q8_0, 8, 8>(int n, float * s, size_t bs, const void * vx, const void * vy, int nr, int nc) {
+    ggml_gemv_q8_0_8x8_q8_0(n, s, bs, vx, vy, nr, nc);
+}
+
+template <> void gemv<block_q5_K, 8, 8>(int n, float * s, size_t bs, const void * vx, const void * vy, int nr, int nc) {
+    ggml_gemv_q5_K_8x8_q8_K(n, s, bs, vx, vy, nr, nc);
+}
+
+template <> void gemv<block_q6_K, 8, 8>(int n, float * s, size_t bs, const void * vx, const void * vy, int nr, int nc) {
+    ggml_gemv_q6_K_8x8_q8_K(n, s, bs, vx, vy, nr, nc);
+}
+
+template <> void gemv<block_q4_K, 8, 16>(int n, float * s, size_t bs, const void * vx, const void * vy, int nr, int nc) {
+    ggml_gemv_q4_K_16x8_q8_K(n, s, bs, vx, vy, nr, nc);
+}
+
+template <> void gemv<block_q5_K, 8, 16>(int n, float * s, size_t bs, const void * vx, const void * vy, int nr, int nc) {
+    ggml_gemv_q5_K_16x8_q8_K(n, s, bs, vx, vy, nr, nc);
+}
+
+template <> void gemv<block_q6_K, 8, 16>(int n, float * s, size_t bs, const void * vx, const void * vy, int nr, int nc) {
+    ggml_gemv_q6_K_16x8_q8_K(n, s, bs, vx, vy, nr, nc);
+}
+
+template <> void gemv<block_iq4_xs, 8, 8>(int n, float * s, size_t bs, const void * vx, const void * vy, int nr, int nc) {
+    ggml_gemv_iq4_xs_8x8_q8_K(n, s, bs, vx, vy, nr, nc);
+}
+
 // gemm
 template <typename BLOC_TYPE, int64_t INTER_SIZE, int64_t NB_COLS>
 void gemm(int, float *, size_t, const void *, const void *, int, int);
@@ -5325,6 +6398,34 @@ void gemm<block_iq4_nl, 4, 4>(int n, float * s, size_t bs, const void * vx, cons
     ggml_gemm_iq4_nl_4x4_q8_0(n, s, bs, vx, vy, nr, nc);
 }
 
+template <> void gemm<block_q8_0, 8, 8>(int n, float * s, size_t bs, const void * vx, const void * vy, int nr, int nc) {
+    ggml_gemm_q8_0_8x8_q8_0(n, s, bs, vx, vy, nr, nc);
+}
+
+template <> void gemm<block_q5_K, 8, 8>(int n, float * s, size_t bs, const void * vx, const void * vy, int nr, int nc) {
+    ggml_gemm_q5_K_8x8_q8_K(n, s, bs, vx, vy, nr, nc);
+}
+
+template <> void gemm<block_q6_K, 8, 8>(int n, float * s, size_t bs, const void * vx, const void * vy, int nr, int nc) {
+    ggml_gemm_q6_K_8x8_q8_K(n, s, bs, vx, vy, nr, nc);
+}
+
+template <> void gemm<block_q4_K, 8, 16>(int n, float * s, size_t bs, const void * vx, const void * vy, int nr, int nc) {
+    ggml_gemm_q4_K_16x8_q8_K(n, s, bs, vx, vy, nr, nc);
+}
+
+template <> void gemm<block_q5_K, 8, 16>(int n, float * s, size_t bs, const void * vx, const void * vy, int nr, int nc) {
+    ggml_gemm_q5_K_16x8_q8_K(n, s, bs, vx, vy, nr, nc);
+}
+
+template <> void gemm<block_q6_K, 8, 16>(int n, float * s, size_t bs, const void * vx, const void * vy, int nr, int nc) {
+    ggml_gemm_q6_K_16x8_q8_K(n, s, bs, vx, vy, nr, nc);
+}
+
+template <> void gemm<block_iq4_xs, 8, 8>(int n, float * s, size_t bs, const void * vx, const void * vy, int nr, int nc) {
+    ggml_gemm_iq4_xs_8x8_q8_K(n, s, bs, vx, vy, nr, nc);
+}
+
 class tensor_traits_base : public ggml::cpu::tensor_traits {
   public:
     virtual int repack(struct ggml_tensor * t, const void * data, size_t data_size) = 0;
@@ -5332,16 +6433,59 @@ class tensor_traits_base : public ggml::cpu::tensor_traits {
 
 template <typename BLOC_TYPE, int64_t INTER_SIZE, int64_t NB_COLS, ggml_type PARAM_TYPE> class tensor_traits : public tensor_traits_base {
 
-    bool work_size(int /* n_threads */, const struct ggml_tensor * op, size_t & size) override {
+    // MUL_MAT_ID is computed in chunks of up to MMID_CHUNK_ROWS rows of src1 routed to the same expert by up to
+    // MMID_CHUNK_COLS rows of the expert
+    static constexpr int64_t MMID_CHUNK_ROWS = 64;
+    static constexpr int64_t MMID_CHUNK_COLS = 256;
+
+    struct mmid_row_mapping {
+        int32_t i1;
+        int32_t i2;
+    };
+
+    // offsets in the work buffer of MUL_MAT_ID
+    struct mmid_work_layout {
+        size_t src1;         // [n_ids*n_tokens] rows of src1 grouped by expert, quantized for gemm/gemv
+        size_t row_counts;   // [n_as] int64_t
+        size_t rows;         // [n_as][n_tokens] mmid_row_mapping
+        size_t chunk;        // std::atomic<int>
+        size_t thread;       // [n_threads][thread_size]
+        size_t thread_size;  // floats: 4 rows of src1 and the output of a chunk
+        size_t size;
+    };
+
+    static mmid_work_layout mmid_get_work_layout(const struct ggml_tensor * op, int n_threads) {
+        const ggml_tensor * src0 = op->src[0];
+        const ggml_tensor * src1 = op->src[1];
+        const ggml_tensor * ids  = op->src[2];
+
+        mmid_work_layout l;
+        l.src1        = 0;
+        l.row_counts  = GGML_PAD(l.src1 + ggml_row_size(PARAM_TYPE, src1->ne[0]) * ids->ne[0] * ids->ne[1], sizeof(int64_t));
+        l.rows        = l.row_counts + sizeof(int64_t) * src0->ne[2];
+        l.chunk       = GGML_PAD(l.rows + sizeof(mmid_row_mapping) * src0->ne[2] * ids->ne[1], 64);
+        l.thread      = l.chunk + 64;
+        l.thread_size = GGML_PAD(sizeof(float) * (4 * src1->ne[0] + MMID_CHUNK_ROWS * MMID_CHUNK_COLS), 64);
+        l.size        = l.thread + l.thread_size * n_threads + 64; // + alignment of wdata
+        return l;
+    }
+
+    static void quantize_mat(const float * GGML_RESTRICT x, void * GGML_RESTRICT vy, int64_t n_per_row) {
+        if (PARAM_TYPE == GGML_TYPE_Q8_K) {
+            quantize_mat_q8_K(x, vy, 4, n_per_row, INTER_SIZE);
+        } else {
+            quantize_mat_q8_0(x, vy, 4, n_per_row, INTER_SIZE);
+        }
+    }
+
+    bool work_size(int n_threads, const struct ggml_tensor * op, size_t & size) override {
         // not realy a GGML_TYPE_Q8_0 but same size.
         switch (op->op) {
         case GGML_OP_MUL_MAT:
             size = ggml_row_size(PARAM_TYPE, ggml_nelements(op->src[1]));
             return true;
         case GGML_OP_MUL_MAT_ID:
-            size = ggml_row_size(PARAM_TYPE, ggml_nelements(op->src[1]));
-            size = GGML_PAD(size, sizeof(int64_t));  // + padding for next bloc.
-            size += sizeof(int64_t) * (1+op->src[0]->ne[2]) * op->src[1]->ne[2];
+            size = mmid_get_work_layout(op, n_threads).size;
             return true;
         default:
             // GGML_ABORT("fatal error");
@@ -5441,6 +6585,9 @@ template <typename BLOC_TYPE, int64_t INTER_SIZE, int64_t NB_COLS, ggml_type PAR
         }
     }
 
+    // the rows of src1 are grouped by expert and quantized for the gemm kernels, so that the experts are multiplied
+    // like regular matrices. The work is split in chunks of (expert, rows of src1, rows of the expert) that are
+    // balanced across the threads independently of the routing
     void forward_mul_mat_id(ggml_compute_params * params, ggml_tensor * op) {
         const ggml_tensor * src0 = op->src[0];
         const ggml_tensor * src1 = op->src[1];
@@ -5452,7 +6599,7 @@ template <typename BLOC_TYPE, int64_t INTER_SIZE, int64_t NB_COLS, ggml_type PAR
         const int ith = params->ith;
         const int nth = params->nth;
 
-        const ggml_from_float_t from_float = ggml_get_type_traits_cpu(GGML_TYPE_Q8_0)->from_float;
+        const ggml_from_float_t from_float = ggml_get_type_traits_cpu(PARAM_TYPE)->from_float;
 
         // we don't support permuted src0 or src1
         GGML_ASSERT(nb00 == ggml_type_size(src0->type));
@@ -5474,31 +6621,17 @@ template <typename BLOC_TYPE, int64_t INTER_SIZE, int64_t NB_COLS, ggml_type PAR
         const int n_ids = ids->ne[0]; // n_expert_used
         const int n_as  = ne02;       // n_expert
 
-        const size_t nbw1 = ggml_row_size(GGML_TYPE_Q8_0, ne10);
-        const size_t nbw2 = nbw1*ne11;
-        const size_t nbw3 = nbw2*ne12;
+        const size_t nbw1 = ggml_row_size(PARAM_TYPE, ne10);
 
-        struct mmid_row_mapping {
-            int32_t i1;
-            int32_t i2;
-        };
-
-        GGML_ASSERT(params->wsize >= (GGML_PAD(nbw3, sizeof(int64_t)) + n_as * sizeof(int64_t) +
-                                      n_as * ne12 * sizeof(mmid_row_mapping)));
+        const mmid_work_layout layout = mmid_get_work_layout(op, nth);
 
-        auto                      wdata             = (char *) params->wdata;
-        auto                      wdata_src1_end    = (char *) wdata + GGML_PAD(nbw3, sizeof(int64_t));
-        int64_t *                 matrix_row_counts = (int64_t *) (wdata_src1_end);                      // [n_as]
-        struct mmid_row_mapping * matrix_rows = (struct mmid_row_mapping *) (matrix_row_counts + n_as);  // [n_as][ne12]
+        GGML_ASSERT(params->wsize >= layout.size);
 
-        // src1: float32 => block_q8_0
-        for (int64_t i12 = 0; i12 < ne12; ++i12) {
-            for (int64_t i11 = ith; i11 < ne11; i11 += nth) {
-                from_float((float *)((char *) src1->data + i12 * nb12 + i11 * nb11),
-                           (void *)               (wdata + i12 * nbw2 + i11 * nbw1),
-                           ne10);
-            }
-        }
+        auto                      wdata             = (char *) GGML_PAD((uintptr_t) params->wdata, 64);
+        auto                      wdata_src1        = wdata + layout.src1;
+        int64_t *                 matrix_row_counts = (int64_t *) (wdata + layout.row_counts);          // [n_as]
+        struct mmid_row_mapping * matrix_rows       = (struct mmid_row_mapping *) (wdata + layout.rows); // [n_as][ne12]
+        float *                   wdata_thread      = (float *) (wdata + layout.thread + layout.thread_size * ith);
 
 #define MMID_MATRIX_ROW(row_id, i1) matrix_rows[(row_id) * ne12 + (i1)]
 
@@ -5518,47 +6651,101 @@ template <typename BLOC_TYPE, int64_t INTER_SIZE, int64_t NB_COLS, ggml_type PAR
                     matrix_row_counts[i02] += 1;
                 }
             }
+
+            // the first chunk of each thread is its index
+            new (wdata + layout.chunk) std::atomic<int>(nth);
         }
 
         ggml_barrier(params->threadpool);
 
-        // compute each matrix multiplication in sequence
-        for (int cur_a = 0; cur_a < n_as; ++cur_a) {
-            const int64_t cne1 = matrix_row_counts[cur_a];
+        auto src1_row = [&](int cur_a, int64_t ir1) {
+            const struct mmid_row_mapping row_mapping = MMID_MATRIX_ROW(cur_a, ir1);
+            return (const float *) ((const char *) src1->data + (row_mapping.i1 % ne11) * nb11 + row_mapping.i2 * nb12);
+        };
 
-            if (cne1 == 0) {
-                continue;
+        // src1: float32 => block_q8_0x4 / block_q8_Kx4 for the groups of 4 rows of an expert, block_q8_0 / block_q8_K
+        // for the remaining rows
+        {
+            int64_t n_items  = 0;
+            int64_t row_base = 0;
+            for (int cur_a = 0; cur_a < n_as; ++cur_a) {
+                const int64_t cne1 = matrix_row_counts[cur_a];
+                for (int64_t ir1 = 0; ir1 < cne1; ) {
+                    const int64_t n = cne1 - ir1 >= 4 ? 4 : 1;
+                    if (n_items++ % nth == ith) {
+                        void * dst_q = wdata_src1 + (row_base + ir1) * nbw1;
+                        if (n == 4) {
+                            for (int i = 0; i < 4; ++i) {
+                                memcpy(wdata_thread + i * ne10, src1_row(cur_a, ir1 + i), ne10 * sizeof(float));
+                            }
+                            quantize_mat(wdata_thread, dst_q, ne10);
+                        } else {
+                            from_float(src1_row(cur_a, ir1), dst_q, ne10);
+                        }
+                    }
+                    ir1 += n;
+                }
+                row_base += cne1;
             }
+        }
+
+        ggml_barrier(params->threadpool);
+
+        int64_t n_row_chunks = 0;
+        for (int cur_a = 0; cur_a < n_as; ++cur_a) {
+            n_row_chunks += (matrix_row_counts[cur_a] + MMID_CHUNK_ROWS - 1) / MMID_CHUNK_ROWS;
+        }
+
+        // split the rows of the experts in enough chunks to balance the work
+        int64_t chunk_cols = (ne01 * n_row_chunks + 4 * nth - 1) / (4 * nth);
+        chunk_cols = std::min<int64_t>(std::max<int64_t>(GGML_PAD(chunk_cols, NB_COLS), NB_COLS), MMID_CHUNK_COLS);
+
+        const int64_t n_col_chunks = (ne01 + chunk_cols - 1) / chunk_cols;
+        const int64_t n_chunks     = n_row_chunks * n_col_chunks;
 
-            auto src0_cur = (const char *) src0->data + cur_a*nb02;
+        std::atomic<int> * current_chunk = (std::atomic<int> *) (wdata + layout.chunk);
 
-            //const int64_t nr0 = ne01; // src0 rows
-            const int64_t nr1 = cne1; // src1 rows
+        float * tmp = wdata_thread + 4 * ne10;
 
-            int64_t src0_cur_start = (ith * ne01) / nth;
-            int64_t src0_cur_end   = ((ith + 1) * ne01) / nth;
-            src0_cur_start =
-                (src0_cur_start % NB_COLS) ? src0_cur_start + NB_COLS - (src0_cur_start % NB_COLS) : src0_cur_start;
-            src0_cur_end = (src0_cur_end % NB_COLS) ? src0_cur_end + NB_COLS - (src0_cur_end % NB_COLS) : src0_cur_end;
+        // the chunks are taken in increasing order, so the expert of a chunk is found by moving forward
+        int     cur_a      = 0;
+        int64_t chunk_base = 0; // first chunk of cur_a
+        int64_t row_base   = 0; // first row of cur_a in wdata_src1
 
-            if (src0_cur_start >= src0_cur_end) return;
+        for (int64_t chunk = ith; chunk < n_chunks; chunk = current_chunk->fetch_add(1, std::memory_order_relaxed)) {
+            while (chunk >= chunk_base + (matrix_row_counts[cur_a] + MMID_CHUNK_ROWS - 1) / MMID_CHUNK_ROWS * n_col_chunks) {
+                chunk_base += (matrix_row_counts[cur_a] + MMID_CHUNK_ROWS - 1) / MMID_CHUNK_ROWS * n_col_chunks;
+                row_base   += matrix_row_counts[cur_a];
+                cur_a++;
+            }
+
+            const int64_t cne1 = matrix_row_counts[cur_a];
 
-            for (int ir1 = 0; ir1 < nr1; ir1++) {
-                struct mmid_row_mapping row_mapping = MMID_MATRIX_ROW(cur_a, ir1);
-                const int id       = row_mapping.i1; // selected expert index
+            const int64_t ir1_start = (chunk - chunk_base) / n_col_chunks * MMID_CHUNK_ROWS;
+            const int64_t ir1_end   = std::min(ir1_start + MMID_CHUNK_ROWS, cne1);
+            const int64_t ir1_gemm  = std::max(ir1_start, std::min(ir1_end, cne1 - cne1 % 4));
 
-                const int64_t  i11 = id % ne11;
-                const int64_t  i12 = row_mapping.i2; // row index in src1
+            const int64_t ir0_start = (chunk - chunk_base) % n_col_chunks * chunk_cols;
+            const int64_t ir0_end   = std::min(ir0_start + chunk_cols, ne01);
+            const int64_t nc        = ir0_end - ir0_start;
 
-                const int64_t  i1 = id;  // selected expert index
-                const int64_t  i2 = i12; // row
+            auto src0_cur = (const char *) src0->data + cur_a * nb02 + ir0_start * nb01;
 
-                auto src1_col = (const char *) wdata + (i11 * nbw1 + i12 * nbw2);
+            auto dst_row = [&](int64_t ir1) {
+                const struct mmid_row_mapping row_mapping = MMID_MATRIX_ROW(cur_a, ir1);
+                return (float *) ((char *) dst->data + row_mapping.i1 * nb1 + row_mapping.i2 * nb2) + ir0_start;
+            };
 
-                gemv<BLOC_TYPE, INTER_SIZE, NB_COLS>(
-                        ne00, (float *)((char *) dst->data + (i1 * nb1 + i2 * nb2)) + src0_cur_start,
-                        ne01,                    src0_cur + src0_cur_start * nb01,
-                        src1_col, 1, src0_cur_end - src0_cur_start);
+            if (ir1_gemm > ir1_start) {
+                gemm<BLOC_TYPE, INTER_SIZE, NB_COLS>(ne00, tmp, nc, src0_cur, wdata_src1 + (row_base + ir1_start) * nbw1,
+                                                     ir1_gemm - ir1_start, nc);
+                for (int64_t ir1 = ir1_start; ir1 < ir1_gemm; ir1++) {
+                    memcpy(dst_row(ir1), tmp + (ir1 - ir1_start) * nc, nc * sizeof(float));
+                }
+            }
+            for (int64_t ir1 = ir1_gemm; ir1 < ir1_end; ir1++) {
+                gemv<BLOC_TYPE, INTER_SIZE, NB_COLS>(ne00, dst_row(ir1), ne01, src0_cur, wdata_src1 + (row_base + ir1) * nbw1,
+                                                     1, nc);
             }
         }
 #undef MMID_MATRIX_ROW
@@ -5576,9 +6763,18 @@ static const tensor_traits<block_q4_0, 4, 4, GGML_TYPE_Q8_0> q4_0_4x4_q8_0;
 static const tensor_traits<block_q4_0, 8, 4, GGML_TYPE_Q8_0> q4_0_4x8_q8_0;
 static const tensor_traits<block_q4_0, 8, 8, GGML_TYPE_Q8_0> q4_0_8x8_q8_0;
 static const tensor_traits<block_q4_K, 8, 8, GGML_TYPE_Q8_K> q4_K_8x8_q8_K;
+static const tensor_traits<block_q4_K, 8, 16, GGML_TYPE_Q8_K> q4_K_16x8_q8_K;
+
+// instance for Q5, Q6 and Q8
+static const tensor_traits<block_q5_K, 8, 8, GGML_TYPE_Q8_K> q5_K_8x8_q8_K;
+static const tensor_traits<block_q6_K, 8, 8, GGML_TYPE_Q8_K> q6_K_8x8_q8_K;
+static const tensor_traits<block_q5_K, 8, 16, GGML_TYPE_Q8_K> q5_K_16x8_q8_K;
+static const tensor_traits<block_q6_K, 8, 16, GGML_TYPE_Q8_K> q6_K_16x8_q8_K;
+static const tensor_traits<block_q8_0, 8, 8, GGML_TYPE_Q8_0> q8_0_8x8_q8_0;
 
 // instance for IQ4
-static const tensor_traits<block_iq4_nl, 4, 4, GGML_TYPE_IQ4_NL> iq4_nl_4x4_q8_0;
+static const tensor_traits<block_iq4_nl, 4, 4, GGML_TYPE_Q8_0> iq4_nl_4x4_q8_0;
+static const tensor_traits<block_iq4_xs, 8, 8, GGML_TYPE_Q8_K> iq4_xs_8x8_q8_K;
 
 }  // namespace ggml::cpu::aarch64
 
@@ -5600,17 +6796,56 @@ static const ggml::cpu::tensor_traits * ggml_aarch64_get_optimal_repack_type(con
             }
         }
     } else if (cur->type == GGML_TYPE_Q4_K) {
+        if (ggml_cpu_has_avx512_vnni()) {
+            if (cur->ne[1] % 16 == 0) {
+                return &ggml::cpu::aarch64::q4_K_16x8_q8_K;
+            }
+        }
         if (ggml_cpu_has_avx2()) {
             if (cur->ne[1] % 8 == 0) {
                 return &ggml::cpu::aarch64::q4_K_8x8_q8_K;
             }
         }
+    } else if (cur->type == GGML_TYPE_Q5_K) {
+        if (ggml_cpu_has_avx512_vnni()) {
+            if (cur->ne[1] % 16 == 0) {
+                return &ggml::cpu::aarch64::q5_K_16x8_q8_K;
+            }
+        }
+        if (ggml_cpu_has_avx2()) {
+            if (cur->ne[1] % 8 == 0) {
+                return &ggml::cpu::aarch64::q5_K_8x8_q8_K;
+            }
+        }
+    } else if (cur->type == GGML_TYPE_Q6_K) {
+        if (ggml_cpu_has_avx512_vnni()) {
+            if (cur->ne[1] % 16 == 0) {
+                return &ggml::cpu::aarch64::q6_K_16x8_q8_K;
+            }
+        }
+        if (ggml_cpu_has_avx2()) {
+            if (cur->ne[1] % 8 == 0) {
+                return &ggml::cpu::aarch64::q6_K_8x8_q8_K;
+            }
+        }
+    } else if (cur->type == GGML_TYPE_Q8_0) {
+        if (ggml_cpu_has_avx2()) {
+            if (cur->ne[1] % 8 == 0) {
+                return &ggml::cpu::aarch64::q8_0_8x8_q8_0;
+            }
+        }
     } else if (cur->type == GGML_TYPE_IQ4_NL) {
         if (ggml_cpu_has_neon() && ggml_cpu_has_dotprod()) {
             if (cur->ne[1] % 4 == 0) {
                 return &ggml::cpu::aarch64::iq4_nl_4x4_q8_0;
             }
         }
+    } else if (cur->type == GGML_TYPE_IQ4_XS) {
+        if (ggml_cpu_has_avx2()) {
+            if (cur->ne[1] % 8 == 0) {
+                return &ggml::cpu::aarch64::iq4_xs_8x8_q8_K;
+            }
+        }
     }
 
     return nullptr;
@@ -0,0 +1,301 @@
+#include "ggml-cpu-profile.h"
+#include "ggml-cpu-impl.h"
+
+#include <algorithm>
+#include <cstdio>
+
+// max number of events kept for the Chrome trace (two per node and thread: compute and wait)
+#define GGML_CPU_PROFILE_MAX_EVENTS (4*1024*1024)
+
+// bytes read and written by the op, assuming that each tensor is read or written once
+static double ggml_cpu_profile_bytes(const struct ggml_tensor * t) {
+    double bytes = ggml_nbytes(t);
+
+    for (int i = 0; i < GGML_MAX_SRC; i++) {
+        const struct ggml_tensor * src = t->src[i];
+        if (!src) {
+            continue;
+        }
+
+        double src_bytes = ggml_nbytes(src);
+
+        if (t->op == GGML_OP_CPY && i == 1) {
+            // destination of the copy, it is the view t
+            continue;
+        }
+        if (t->op == GGML_OP_GET_ROWS && i == 0) {
+            // only the selected rows are read
+            src_bytes = (double) ggml_row_size(src->type, src->ne[0])*ggml_nelements(t->src[1]);
+        }
+        if (t->op == GGML_OP_MUL_MAT_ID && i == 0) {
+            // at most one expert per id is read
+            const int64_t n_as  = src->ne[2];
+            const int64_t n_ids = ggml_nelements(t->src[2]);
+            src_bytes *= (double) std::min(n_as, n_ids)/n_as;
+        }
+
+        bytes += src_bytes;
+    }
+
+    return bytes;
+}
+
+static double ggml_cpu_profile_flops(const struct ggml_tensor * t) {
+    switch (t->op) {
+        case GGML_OP_MUL_MAT:
+        case GGML_OP_MUL_MAT_ID:
+            {
+                return 2.0*t->src[0]->ne[0]*ggml_nelements(t);
+            }
+        case GGML_OP_FLASH_ATTN_EXT:
+            {
+                const struct ggml_tensor * q = t->src[0];
+                const struct ggml_tensor * k = t->src[1];
+                const struct ggml_tensor * v = t->src[2];
+
+                // KQ and KQ*V
+                return 2.0*q->ne[1]*q->ne[2]*q->ne[3]*k->ne[1]*(k->ne[0] + v->ne[0]);
+            }
+        default:
+            {
+                // about one operation per element
+                return (double) ggml_nelements(t);
+            }
+    }
+}
+
+void ggml_cpu_profile::reset() {
+    n_threads = 0;
+    n_graphs  = 0;
+    t_first   = -1;
+    t_total   = 0;
+    n_dropped = 0;
+
+    ops.clear();
+    thread_busy.clear();
+    thread_wait.clear();
+    events.clear();
+    names.clear();
+    name_ids.clear();
+}
+
+int32_t ggml_cpu_profile::name_id(const std::string & name) {
+    auto it = name_ids.find(name);
+    if (it != name_ids.end()) {
+        return it->second;
+    }
+
+    const int32_t id = (int32_t) names.size();
+
+    names.push_back(name);
+    name_ids.emplace(name, id);
+
+    return id;
+}
+
+ggml_cpu_node_timing * ggml_cpu_profile::begin(struct ggml_cgraph * cgraph, int n_threads) {
+    timings.assign((size_t) ggml_graph_n_nodes(cgraph)*n_threads, ggml_cpu_node_timing { 0, 0, 0 });
+
+    return timings.data();
+}
+
+void ggml_cpu_profile::end(struct ggml_cgraph * cgraph, int n_threads) {
+    const int n_nodes = ggml_graph_n_nodes(cgraph);
+
+    this->n_threads = std::max(this->n_threads, n_threads);
+
+    if ((int) thread_busy.size() < n_threads) {
+        thread_busy.resize(n_threads, 0);
+        thread_wait.resize(n_threads, 0);
+    }
+
+    // the nodes of a fused chain are recorded in the first node of the chain, and aggregated as "OP+OP"
+    std::string key;
+    op_stats    stats;
+
+    auto flush = [&]() {
+        if (key.empty()) {
+            return;
+        }
+
+        op_stats & s = ops[key];
+
+        s.count  += 1;
+        s.t_wall += stats.t_wall;
+        s.t_busy += stats.t_busy;
+        s.t_wait += stats.t_wait;
+        s.bytes  += stats.bytes;
+        s.flops  += stats.flops;
+
+        key.clear();
+    };
+
+    for (int i = 0; i < n_nodes; i++) {
+        const struct ggml_tensor * node = ggml_graph_node(cgraph, i);
+
+        if (ggml_op_is_noop(node)) {
+            continue;
+        }
+
+        const ggml_cpu_node_timing * t = timings.data() + (size_t) i*n_threads;
+
+        int64_t t_start = INT64_MAX;
+        int64_t t_end   = 0;
+
+        for (int j = 0; j < n_threads; j++) {
+            if (t[j].t_start > 0) {
+                t_start = std::min(t_start, t[j].t_start);
+                t_end   = std::max(t_end,   t[j].t_barrier);
+            }
+        }
+
+        if (t_end == 0) {
+            // computed with the previous node, or the graph was aborted
+            if (!key.empty()) {
+                key += "+";
+                key += ggml_op_desc(node);
+
+                stats.bytes += ggml_cpu_profile_bytes(node);
+                stats.flops += ggml_cpu_profile_flops(node);
+            }
+            continue;
+        }
+
+        flush();
+
+        if (t_first < 0) {
+            t_first = t_start;
+        }
+
+        key   = ggml_op_desc(node);
+        stats = op_stats();
+
+        stats.t_wall = t_end - t_start;
+        stats.bytes  = ggml_cpu_profile_bytes(node);
+        stats.flops  = ggml_cpu_profile_flops(node);
+
+        t_total += stats.t_wall;
+
+        const int32_t name    = name_id(node->name[0] ? node->name : ggml_op_desc(node));
+        const int32_t cat     = name_id(ggml_op_desc(node));
+        const int32_t wait    = name_id("wait");
+        const int32_t barrier = name_id("barrier");
+
+        for (int j = 0; j < n_threads; j++) {
+            if (t[j].t_start == 0) {
+                continue;
+            }
+
+            const int64_t t_busy = t[j].t_end     - t[j].t_start;
+            const int64_t t_wait = t[j].t_barrier - t[j].t_end;
+
+            stats.t_busy   += t_busy;
+            stats.t_wait   += t_wait;
+            thread_busy[j] += t_busy;
+            thread_wait[j] += t_wait;
+
+            if (events.size() + 2 > GGML_CPU_PROFILE_MAX_EVENTS) {
+                n_dropped += 2;
+                continue;
+            }
+
+            events.push_back({ t[j].t_start, t[j].t_end, j, name, cat });
+            if (t_wait > 0) {
+                events.push_back({ t[j].t_end, t[j].t_barrier, j, wait, barrier });
+            }
+        }
+    }
+
+    flush();
+
+    n_graphs++;
+}
+
+void ggml_cpu_profile::print() const {
+    std::vector<std::pair<std::string, op_stats>> sorted(ops.begin(), ops.end());
+
+    std::sort(sorted.begin(), sorted.end(), [](const auto & a, const auto & b) {
+        return a.second.t_wall > b.second.t_wall;
+    });
+
+    GGML_LOG_INFO("CPU profile: %lld graphs, %.3f ms in the nodes, %d threads\n", (long long) n_graphs, t_total/1e6, n_threads);
+    GGML_LOG_INFO("\n");
+    GGML_LOG_INFO("| op                           |    count |    time ms |      %% |   avg us | busy %% |     GB/s |  GFLOP/s |\n");
+    GGML_LOG_INFO("| ---------------------------- | -------: | ---------: | -----: | -------: | -----: | -------: | -------: |\n");
+
+    for (const auto & it : sorted) {
+        const op_stats & s = it.second;
+
+        const int64_t t_threads = s.t_busy + s.t_wait;
+
+        GGML_LOG_INFO("| %-28s | %8lld | %10.3f | %6.2f | %8.2f | %6.1f | %8.2f | %8.2f |\n",
+                it.first.c_str(),
+                (long long) s.count,
+                s.t_wall/1e6,
+                t_total > 0 ? 100.0*s.t_wall/t_total : 0.0,
+                s.t_wall/1e3/s.count,
+                t_threads > 0 ? 100.0*s.t_busy/t_threads : 0.0,
+                s.t_wall > 0 ? s.bytes/s.t_wall : 0.0,
+                s.t_wall > 0 ? s.flops/s.t_wall : 0.0);
+    }
+
+    GGML_LOG_INFO("\n");
+    GGML_LOG_INFO("| thread |    busy ms |    wait ms | busy %% |\n");
+    GGML_LOG_INFO("| -----: | ---------: | ---------: | -----: |\n");
+
+    for (size_t j = 0; j < thread_busy.size(); j++) {
+        const int64_t t_threads = thread_busy[j] + thread_wait[j];
+
+        GGML_LOG_INFO("| %6zu | %10.3f | %10.3f | %6.1f |\n",
+                j, thread_busy[j]/1e6, thread_wait[j]/1e6, t_threads > 0 ? 100.0*thread_busy[j]/t_threads : 0.0);
+    }
+
+    if (n_dropped > 0) {
+        GGML_LOG_INFO("\n%lld trace events were dropped\n", (long long) n_dropped);
+    }
+}
+
+static void ggml_cpu_profile_write_json_string(FILE * f, const std::string & s) {
+    fputc('"', f);
+    for (const char c : s) {
+        if (c == '"' || c == '\\') {
+            fputc('\\', f);
+            fputc(c, f);
+        } else if ((unsigned char) c < 0x20) {
+            fprintf(f, "\\u%04x", c);
+        } else {
+            fputc(c, f);
+        }
+    }
+    fputc('"', f);
+}
+
+bool ggml_cpu_profile::save_trace(const char * fname) const {
+    FILE * f = ggml_fopen(fname, "w");
+    if (!f) {
+        GGML_LOG_ERROR("%s: failed to open '%s'\n", __func__, fname);
+        return false;
+    }
+
+    fprintf(f, "{\"traceEvents\":[\n");
+
+    for (size_t i = 0; i < events.size(); i++) {
+        const event & e = events[i];
+
+        fprintf(f, "{\"name\":");
+        ggml_cpu_profile_write_json_string(f, names[e.name]);
+        fprintf(f, ",\"cat\":");
+        ggml_cpu_profile_write_json_string(f, names[e.cat]);
+        fprintf(f, ",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":0,\"tid\":%d}%s\n",
+                (e.t_start - t_first)/1e3, (e.t_end - e.t_start)/1e3, e.tid, i + 1 < events.size() ? "," : "");
+    }
+
+    fprintf(f, "],\"otherData\":{\"graphs\":%lld,\"threads\":%d,\"dropped_events\":%lld}}\n",
+            (long long) n_graphs, n_threads, (long long) n_dropped);
+
+    const bool ok = ferror(f) == 0;
+
+    fclose(f);
+
+    return ok;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "ggml.h"
+#include "ggml-cpu.h"
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// profile of the graphs computed by the CPU backend: per-node wall time, per-thread busy and wait time, and an
+// estimate of the bytes and FLOPs of each op
+// the timings of each node are recorded by ggml_graph_compute() in the cplan and aggregated after each graph
+struct ggml_cpu_profile {
+    struct op_stats {
+        int64_t count  = 0;
+        int64_t t_wall = 0; // ns
+        int64_t t_busy = 0; // ns, sum of the threads
+        int64_t t_wait = 0; // ns, sum of the threads
+        double  bytes  = 0.0;
+        double  flops  = 0.0;
+    };
+
+    struct event {
+        int64_t t_start;
+        int64_t t_end;
+        int32_t tid;
+        int32_t name; // index in names
+        int32_t cat;  // index in names
+    };
+
+    int     n_threads = 0;
+    int64_t n_graphs  = 0;
+    int64_t t_first   = -1;
+    int64_t t_total   = 0; // ns, sum of the wall time of the nodes
+
+    std::unordered_map<std::string, op_stats> ops;
+
+    std::vector<int64_t> thread_busy;
+    std::vector<int64_t> thread_wait;
+
+    // events of the Chrome trace, up to GGML_CPU_PROFILE_MAX_EVENTS
+    std::vector<event>                       events;
+    std::vector<std::string>                 names;
+    std::unordered_map<std::string, int32_t> name_ids;
+    int64_t                                  n_dropped = 0;
+
+    // timings of the graph being computed
+    std::vector<ggml_cpu_node_timing> timings;
+
+    void reset();
+
+    // returns the buffer for cplan.timings
+    ggml_cpu_node_timing * begin(struct ggml_cgraph * cgraph, int n_threads);
+
+    // aggregates the timings of the graph computed since begin()
+    void end(struct ggml_cgraph * cgraph, int n_threads);
+
+    void print() const;
+
+    bool save_trace(const char * fname) const;
+
+  private:
+    int32_t name_id(const std::string & name);
+};
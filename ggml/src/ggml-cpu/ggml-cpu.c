@@ -6820,11 +6820,69 @@ static void ggml_compute_forward_concat_f32(
     }
 }
 
+static void ggml_compute_forward_concat_rows(
+    const struct ggml_compute_params * params,
+    struct ggml_tensor * dst) {
+
+    const struct ggml_tensor * src0 = dst->src[0];
+    const struct ggml_tensor * src1 = dst->src[1];
+
+    const int ith = params->ith;
+    const int nth = params->nth;
+
+    GGML_TENSOR_BINARY_OP_LOCALS
+
+    const int32_t dim = ggml_get_op_params_i32(dst, 0);
+
+    GGML_ASSERT(dim > 0 && dim < 4);
+
+    int64_t o[4] = {0, 0, 0, 0};
+    o[dim] = src0->ne[dim];
+
+    // the rows are not split - copy them whole
+    const size_t row_size = ne0*nb0;
+
+    const int64_t nr = ne1*ne2*ne3;
+
+    // rows per thread
+    const int64_t dr = (nr + nth - 1)/nth;
+
+    // row range for this thread
+    const int64_t ir0 = dr*ith;
+    const int64_t ir1 = MIN(ir0 + dr, nr);
+
+    for (int64_t ir = ir0; ir < ir1; ++ir) {
+        const int64_t i3 = ir/(ne2*ne1);
+        const int64_t i2 = (ir - i3*ne2*ne1)/ne1;
+        const int64_t i1 = (ir - i3*ne2*ne1 - i2*ne1);
+
+        const char * x;
+
+        if (i1 < ne01 && i2 < ne02 && i3 < ne03) {
+            x = (const char *)src0->data + (i1       )*nb01 + (i2       )*nb02 + (i3       )*nb03;
+        } else {
+            x = (const char *)src1->data + (i1 - o[1])*nb11 + (i2 - o[2])*nb12 + (i3 - o[3])*nb13;
+        }
+
+        memcpy((char *)dst->data + i1*nb1 + i2*nb2 + i3*nb3, x, row_size);
+    }
+}
+
 static void ggml_compute_forward_concat(
     const struct ggml_compute_params * params,
     struct ggml_tensor * dst) {
 
     const struct ggml_tensor * src0 = dst->src[0];
+    const struct ggml_tensor * src1 = dst->src[1];
+
+    const int32_t dim = ggml_get_op_params_i32(dst, 0);
+
+    const size_t ts = ggml_type_size(src0->type);
+
+    if (dim > 0 && ggml_blck_size(src0->type) == 1 && src0->nb[0] == ts && src1->nb[0] == ts && dst->nb[0] == ts) {
+        ggml_compute_forward_concat_rows(params, dst);
+        return;
+    }
 
     switch (src0->type) {
         case GGML_TYPE_F16:
@@ -12216,13 +12274,77 @@ static void ggml_compute_forward_argsort(
 
 // ggml_compute_forward_flash_attn_ext
 
-static void ggml_compute_forward_flash_attn_ext_f16(
-        const struct ggml_compute_params * params,
+// min number of KV values per chunk when the KV sequence is split across threads
+#define GGML_FA_MIN_KV_CHUNK 256
+
+// number of q heads computed together, sharing the loads and conversions of their K and V rows
+// with grouped-query attention this is the number of q heads per KV head
+static int64_t ggml_flash_attn_ext_n_group(const struct ggml_tensor * dst) {
+    const struct ggml_tensor * q = dst->src[0];
+    const struct ggml_tensor * k = dst->src[1];
+    const struct ggml_tensor * v = dst->src[2];
+
+    if (k->ne[2] != v->ne[2] || k->ne[3] != v->ne[3]) {
+        return 1;
+    }
+
+    return q->ne[2]/k->ne[2];
+}
+
+// size of the per-thread buffers in floats: the VKQ accumulators and the q rows converted for the dot product of the
+// heads of a group, a V row converted to F32, and the max KQ value, sum and ALiBi slope of each head
+static size_t ggml_flash_attn_ext_thread_size(const struct ggml_tensor * dst) {
+    const int64_t D = dst->src[0]->ne[0];
+    const int64_t G = ggml_flash_attn_ext_n_group(dst);
+
+    return 3*G*D + D + 3*G + CACHE_LINE_SIZE_F32;
+}
+
+// number of chunks of the KV sequence of each group of q rows
+// with few q rows (e.g. single token decode) there is not enough work for all the threads, so each row is split in chunks
+// of the KV sequence that are computed separately and reduced at the end (flash-decoding)
+static int64_t ggml_flash_attn_ext_n_kv_chunks(const struct ggml_tensor * dst, int n_threads) {
+    const struct ggml_tensor * q = dst->src[0];
+    const struct ggml_tensor * k = dst->src[1];
+
+    const int64_t n_groups = q->ne[1]*q->ne[2]*q->ne[3]/ggml_flash_attn_ext_n_group(dst);
+
+    if (n_threads <= 1 || n_groups >= 2*n_threads) {
+        return 1;
+    }
+
+    // aim for about 4 chunks per thread
+    const int64_t n_chunks = (4*n_threads + n_groups - 1)/n_groups;
+
+    return MAX(1, MIN(n_chunks, k->ne[1]/GGML_FA_MIN_KV_CHUNK));
+}
+
+// size of the scratch buffer for the partial results of the chunks
+static size_t ggml_flash_attn_ext_chunks_size(const struct ggml_tensor * dst, int n_threads) {
+    const struct ggml_tensor * q = dst->src[0];
+
+    const int64_t n_chunks = ggml_flash_attn_ext_n_kv_chunks(dst, n_threads);
+    if (n_chunks == 1) {
+        return 0;
+    }
+
+    // M, S and VKQ of each chunk of each row
+    return sizeof(float)*(q->ne[1]*q->ne[2]*q->ne[3])*n_chunks*(q->ne[0] + 2);
+}
+
+// online softmax / attention of the G q heads [iq2_0, iq2_0 + G) of the q row (iq1, iq3) over the KV values [ic0, ic1)
+// all the heads use the same K and V head, so each K and V row is loaded (and converted) once for the G heads
+// the unnormalized results are returned at the start of wdata as VKQ32[G*D], followed by D floats and by the max KQ
+// values M[G] and the sums S[G]
+static inline void ggml_compute_forward_flash_attn_ext_f16_group_impl(
         const struct ggml_tensor * q,
         const struct ggml_tensor * k,
         const struct ggml_tensor * v,
         const struct ggml_tensor * mask,
-        struct ggml_tensor * dst) {
+        const struct ggml_tensor * dst,
+        int64_t iq1, int64_t iq2_0, int64_t iq3, int64_t G,
+        int64_t ic0, int64_t ic1,
+        float * wdata) {
 
     GGML_TENSOR_LOCALS(int64_t, neq, q,   ne)
     GGML_TENSOR_LOCALS(size_t,  nbq, q,   nb)
@@ -12230,35 +12352,8 @@ static void ggml_compute_forward_flash_attn_ext_f16(
     GGML_TENSOR_LOCALS(size_t,  nbk, k,   nb)
     GGML_TENSOR_LOCALS(int64_t, nev, v,   ne)
     GGML_TENSOR_LOCALS(size_t,  nbv, v,   nb)
-    GGML_TENSOR_LOCALS(int64_t, ne,  dst, ne)
-    GGML_TENSOR_LOCALS(size_t,  nb,  dst, nb)
-
-    const int ith = params->ith;
-    const int nth = params->nth;
 
     const int64_t D = neq0;
-    const int64_t N = neq1;
-
-    GGML_ASSERT(ne0 == D);
-    GGML_ASSERT(ne2 == N);
-
-    // input tensor rows must be contiguous
-    GGML_ASSERT(nbq0 == ggml_type_size(q->type));
-    GGML_ASSERT(nbk0 == ggml_type_size(k->type));
-    GGML_ASSERT(nbv0 == ggml_type_size(v->type));
-
-    GGML_ASSERT(neq0 == D);
-    GGML_ASSERT(nek0 == D);
-    GGML_ASSERT(nev0 == D);
-
-    GGML_ASSERT(neq1 == N);
-    GGML_ASSERT(nev0 == D);
-
-    // dst cannot be transposed or permuted
-    GGML_ASSERT(nb0 == sizeof(float));
-    GGML_ASSERT(nb0 <= nb1);
-    GGML_ASSERT(nb1 <= nb2);
-    GGML_ASSERT(nb2 <= nb3);
 
     // broadcast factors
     const int64_t rk2 = neq2/nek2;
@@ -12267,25 +12362,13 @@ static void ggml_compute_forward_flash_attn_ext_f16(
     const int64_t rv2 = neq2/nev2;
     const int64_t rv3 = neq3/nev3;
 
-    // parallelize by q rows using ggml_vec_dot_f32
-
-    // total rows in q
-    const int nr = neq1*neq2*neq3;
-
-    // rows per thread
-    const int dr = (nr + nth - 1)/nth;
-
-    // row range for this thread
-    const int ir0 = dr*ith;
-    const int ir1 = MIN(ir0 + dr, nr);
-
     float scale         = 1.0f;
     float max_bias      = 0.0f;
     float logit_softcap = 0.0f;
 
-    memcpy(&scale,         (float *) dst->op_params + 0, sizeof(float));
-    memcpy(&max_bias,      (float *) dst->op_params + 1, sizeof(float));
-    memcpy(&logit_softcap, (float *) dst->op_params + 2, sizeof(float));
+    memcpy(&scale,         (const float *) dst->op_params + 0, sizeof(float));
+    memcpy(&max_bias,      (const float *) dst->op_params + 1, sizeof(float));
+    memcpy(&logit_softcap, (const float *) dst->op_params + 2, sizeof(float));
 
     if (logit_softcap != 0) {
         scale /= logit_softcap;
@@ -12302,59 +12385,63 @@ static void ggml_compute_forward_flash_attn_ext_f16(
     ggml_vec_dot_t    const kq_vec_dot     = type_traits_cpu[k->type].vec_dot;
     ggml_to_float_t   const v_to_float     = ggml_get_type_traits(v->type)->to_float;
 
-    GGML_ASSERT(q_to_vec_dot && "fattn: unsupported K-type");
-    GGML_ASSERT(v_to_float   && "fattn: unsupported V-type");
+    float       * GGML_RESTRICT VKQ32 =                 (wdata);         // FP32 VKQ accumulators [G*D]
+    ggml_fp16_t * GGML_RESTRICT VKQ16 = (ggml_fp16_t *) (wdata + 1*G*D); // FP16 VKQ accumulators [G*D]
+    char        * GGML_RESTRICT Q_q   = (char        *) (wdata + 2*G*D); // Q converted to quantized/FP16 [G*D]
+    float       * GGML_RESTRICT V32   =                 (wdata + 3*G*D); // (temporary) FP32 V buffer [D]
+    float       * GGML_RESTRICT M     =                 (V32 + D);       // maximum KQ value of each head [G]
+    float       * GGML_RESTRICT S     =                 (M + G);         // sum of each head [G]
+    float       * GGML_RESTRICT slope =                 (S + G);         // ALiBi slope of each head [G]
 
-    // loop over n_batch and n_head
-    for (int ir = ir0; ir < ir1; ++ir) {
-        // q indices
-        const int iq3 = ir/(neq2*neq1);
-        const int iq2 = (ir - iq3*neq2*neq1)/neq1;
-        const int iq1 = (ir - iq3*neq2*neq1 - iq2*neq1);
+    const size_t q_row_size = ggml_row_size(k_vec_dot_type, D);
 
-        const uint32_t h = iq2; // head index
-        const float slope = (max_bias > 0.0f) ? h < n_head_log2 ? powf(m0, h + 1) : powf(m1, 2*(h - n_head_log2) + 1) : 1.0f;
+    for (int64_t j = 0; j < G; ++j) {
+        const uint32_t h = iq2_0 + j; // head index
+        slope[j] = (max_bias > 0.0f) ? h < n_head_log2 ? powf(m0, h + 1) : powf(m1, 2*(h - n_head_log2) + 1) : 1.0f;
 
-        float S = 0.0f;      // sum
-        float M = -INFINITY; // maximum KQ value
+        S[j] = 0.0f;      // sum
+        M[j] = -INFINITY; // maximum KQ value
 
-        float       * VKQ32 = (float       *) params->wdata + ith*(3*D + CACHE_LINE_SIZE_F32); // FP32 VKQ accumulator
-        float       * V32   =                 (VKQ32 + 1*D); // (temporary) FP32 V buffer
-        ggml_fp16_t * VKQ16 = (ggml_fp16_t *) (VKQ32 + 1*D); // (temporary) FP16 VKQ accumulator
-        ggml_fp16_t * Q_q   = (ggml_fp16_t *) (VKQ32 + 2*D); // (temporary) buffer for Q converted to quantized/FP16
+        const float * pq = (const float *) ((char *) q->data + (iq1*nbq1 + (iq2_0 + j)*nbq2 + iq3*nbq3));
+        q_to_vec_dot(pq, Q_q + j*q_row_size, D);
+    }
 
-        if (v->type == GGML_TYPE_F16) {
-            memset(VKQ16, 0, D*sizeof(ggml_fp16_t));
-        } else {
-            memset(VKQ32, 0, D*sizeof(float));
-        }
+    if (v->type == GGML_TYPE_F16) {
+        memset(VKQ16, 0, G*D*sizeof(ggml_fp16_t));
+    } else {
+        memset(VKQ32, 0, G*D*sizeof(float));
+    }
 
-        const ggml_fp16_t * mp = mask ? (ggml_fp16_t *)((char *) mask->data + iq1*mask->nb[1]) : NULL;
+    const ggml_fp16_t * mp = mask ? (ggml_fp16_t *)((char *) mask->data + iq1*mask->nb[1]) : NULL;
 
-        // k indices
-        const int ik3 = iq3 / rk3;
-        const int ik2 = iq2 / rk2;
+    // k indices
+    const int ik3 = iq3 / rk3;
+    const int ik2 = iq2_0 / rk2;
 
-        // v indices
-        const int iv3 = iq3 / rv3;
-        const int iv2 = iq2 / rv2;
+    // v indices
+    const int iv3 = iq3 / rv3;
+    const int iv2 = iq2_0 / rv2;
 
-        const float * pq = (const float *) ((char *) q->data + (iq1*nbq1 + iq2*nbq2 + iq3*nbq3));
-        q_to_vec_dot(pq, Q_q, D);
+    // online softmax / attention
+    // loop over n_kv and n_head_kv
+    // ref: https://arxiv.org/pdf/2112.05682.pdf
+    for (int64_t ic = ic0; ic < ic1; ++ic) {
+        const float mvf = mp ? GGML_FP16_TO_FP32(mp[ic]) : 0.0f;
+        if (mvf == -INFINITY) {
+            continue;
+        }
 
-        // online softmax / attention
-        // loop over n_kv and n_head_kv
-        // ref: https://arxiv.org/pdf/2112.05682.pdf
-        for (int64_t ic = 0; ic < nek1; ++ic) {
-            const float mv = mp ? slope*GGML_FP16_TO_FP32(mp[ic]) : 0.0f;
-            if (mv == -INFINITY) {
-                continue;
-            }
+        const char * k_data = (const char *) k->data + ( ic*nbk1 + ik2*nbk2 + ik3*nbk3);
+        const char * v_data = (const char *) v->data + ( ic*nbv1 + iv2*nbv2 + iv3*nbv3);
+
+        bool v_is_f32 = false; // V32 holds v_data, converted once for all the heads of the group
+
+        for (int64_t j = 0; j < G; ++j) {
+            const float mv = slope[j]*mvf;
 
             float s; // KQ value
 
-            const char * k_data = (const char *) k->data + ( ic*nbk1 + ik2*nbk2 + ik3*nbk3);
-            kq_vec_dot(D, &s, 0, k_data, 0, Q_q, 0, 1);
+            kq_vec_dot(D, &s, 0, k_data, 0, Q_q + j*q_row_size, 0, 1);
 
             s = s*scale; // scale KQ value
 
@@ -12364,70 +12451,260 @@ static void ggml_compute_forward_flash_attn_ext_f16(
 
             s += mv; // apply mask
 
-            const float Mold = M;
+            const float Mold = M[j];
 
             float ms = 1.0f; // upon new higher max val, scale VKQ and KQ sum with this value
             float vs = 1.0f; // post-softmax KQ value, expf(s - M)
 
-            const char * v_data = ((const char *) v->data + (ic*nbv1 + iv2*nbv2 + iv3*nbv3));
-
             if (v->type == GGML_TYPE_F16) {
-                if (s > M) {
+                if (s > Mold) {
                     // s is new maximum, ms < 1.0f, vs == expf(s - s) == 1.0f
-                    M = s;
-                    ms = expf(Mold - M);
+                    M[j] = s;
+                    ms = expf(Mold - s);
 
                     // V = V*expf(Mold - M)
-                    ggml_vec_scale_f16(D, VKQ16, ms);
+                    ggml_vec_scale_f16(D, VKQ16 + j*D, ms);
                 } else {
                     // no new maximum, ms == 1.0f, vs != 1.0f
-                    vs = expf(s - M);
+                    vs = expf(s - Mold);
                 }
 
                 // V += v*expf(s - M)
-                ggml_vec_mad_f16(D, VKQ16, (const ggml_fp16_t *) v_data, vs);
+                ggml_vec_mad_f16(D, VKQ16 + j*D, (const ggml_fp16_t *) v_data, vs);
             } else {
-                if (s > M) {
+                if (s > Mold) {
                     // s is new maximum, ms < 1.0f, vs == expf(s - s) == 1.0f
-                    M = s;
-                    ms = expf(Mold - M);
+                    M[j] = s;
+                    ms = expf(Mold - s);
 
                     // V = V*expf(Mold - M)
-                    ggml_vec_scale_f32(D, VKQ32, ms);
+                    ggml_vec_scale_f32(D, VKQ32 + j*D, ms);
                 } else {
                     // no new maximum, ms == 1.0f, vs != 1.0f
-                    vs = expf(s - M);
+                    vs = expf(s - Mold);
                 }
 
-                v_to_float(v_data, V32, D);
+                if (!v_is_f32) {
+                    v_to_float(v_data, V32, D);
+                    v_is_f32 = true;
+                }
 
                 // V += v*expf(s - M)
-                ggml_vec_mad_f32(D, VKQ32, V32, vs);
+                ggml_vec_mad_f32(D, VKQ32 + j*D, V32, vs);
             }
 
-            S = S*ms + vs; // scale and increment sum with partial sum
+            S[j] = S[j]*ms + vs; // scale and increment sum with partial sum
+        }
+    }
+
+    if (v->type == GGML_TYPE_F16) {
+        for (int64_t d = 0; d < G*D; ++d) {
+            VKQ32[d] = GGML_FP16_TO_FP32(VKQ16[d]);
         }
+    }
+}
+
+// G == 1 (multi-head attention) is dispatched with a constant G so that the loops over the heads are removed
+static void ggml_compute_forward_flash_attn_ext_f16_group(
+        const struct ggml_tensor * q,
+        const struct ggml_tensor * k,
+        const struct ggml_tensor * v,
+        const struct ggml_tensor * mask,
+        const struct ggml_tensor * dst,
+        int64_t iq1, int64_t iq2_0, int64_t iq3, int64_t G,
+        int64_t ic0, int64_t ic1,
+        float * wdata) {
+    if (G == 1) {
+        ggml_compute_forward_flash_attn_ext_f16_group_impl(q, k, v, mask, dst, iq1, iq2_0, iq3, 1, ic0, ic1, wdata);
+    } else {
+        ggml_compute_forward_flash_attn_ext_f16_group_impl(q, k, v, mask, dst, iq1, iq2_0, iq3, G, ic0, ic1, wdata);
+    }
+}
+
+static void ggml_compute_forward_flash_attn_ext_f16(
+        const struct ggml_compute_params * params,
+        const struct ggml_tensor * q,
+        const struct ggml_tensor * k,
+        const struct ggml_tensor * v,
+        const struct ggml_tensor * mask,
+        struct ggml_tensor * dst) {
+
+    GGML_TENSOR_LOCALS(int64_t, neq, q,   ne)
+    GGML_TENSOR_LOCALS(size_t,  nbq, q,   nb)
+    GGML_TENSOR_LOCALS(int64_t, nek, k,   ne)
+    GGML_TENSOR_LOCALS(size_t,  nbk, k,   nb)
+    GGML_TENSOR_LOCALS(int64_t, nev, v,   ne)
+    GGML_TENSOR_LOCALS(size_t,  nbv, v,   nb)
+    GGML_TENSOR_LOCALS(int64_t, ne,  dst, ne)
+    GGML_TENSOR_LOCALS(size_t,  nb,  dst, nb)
+
+    const int ith = params->ith;
+    const int nth = params->nth;
+
+    const int64_t D = neq0;
+    const int64_t N = neq1;
+
+    GGML_ASSERT(ne0 == D);
+    GGML_ASSERT(ne2 == N);
+
+    // input tensor rows must be contiguous
+    GGML_ASSERT(nbq0 == ggml_type_size(q->type));
+    GGML_ASSERT(nbk0 == ggml_type_size(k->type));
+    GGML_ASSERT(nbv0 == ggml_type_size(v->type));
+
+    GGML_ASSERT(neq0 == D);
+    GGML_ASSERT(nek0 == D);
+    GGML_ASSERT(nev0 == D);
+
+    GGML_ASSERT(neq1 == N);
+    GGML_ASSERT(nev0 == D);
+
+    // dst cannot be transposed or permuted
+    GGML_ASSERT(nb0 == sizeof(float));
+    GGML_ASSERT(nb0 <= nb1);
+    GGML_ASSERT(nb1 <= nb2);
+    GGML_ASSERT(nb2 <= nb3);
+
+    enum ggml_type    const k_vec_dot_type = type_traits_cpu[k->type].vec_dot_type;
+    ggml_from_float_t const q_to_vec_dot   = type_traits_cpu[k_vec_dot_type].from_float;
+    ggml_to_float_t   const v_to_float     = ggml_get_type_traits(v->type)->to_float;
+
+    GGML_ASSERT(q_to_vec_dot && "fattn: unsupported K-type");
+    GGML_ASSERT(v_to_float   && "fattn: unsupported V-type");
+
+    // the q heads are processed in groups of G heads that share the same K and V heads
+    const int64_t G = ggml_flash_attn_ext_n_group(dst);
+
+    // total groups of q rows
+    const int64_t ng = neq1*(neq2/G)*neq3;
+
+    float * wdata = (float *) params->wdata + ith*ggml_flash_attn_ext_thread_size(dst);
+
+    float * VKQ32 = wdata;
+    float * M     = wdata + 3*G*D + D;
+    float * S     = M + G;
+
+    const int64_t n_chunks = ggml_flash_attn_ext_n_kv_chunks(dst, nth);
+
+    if (n_chunks == 1) {
+        // parallelize by groups of q rows
+
+        // groups per thread
+        const int64_t dg = (ng + nth - 1)/nth;
+
+        // group range for this thread
+        const int64_t ig0 = dg*ith;
+        const int64_t ig1 = MIN(ig0 + dg, ng);
+
+        // loop over n_batch and n_head
+        for (int64_t ig = ig0; ig < ig1; ++ig) {
+            const int64_t iq1   = ig%neq1;
+            const int64_t iq2_0 = ((ig/neq1)%(neq2/G))*G;
+            const int64_t iq3   = ig/(neq1*(neq2/G));
+
+            ggml_compute_forward_flash_attn_ext_f16_group(q, k, v, mask, dst, iq1, iq2_0, iq3, G, 0, nek1, wdata);
 
-        if (v->type == GGML_TYPE_F16) {
-            for (int64_t d = 0; d < D; ++d) {
-                VKQ32[d] = GGML_FP16_TO_FP32(VKQ16[d]);
+            for (int64_t j = 0; j < G; ++j) {
+                // V /= S
+                const float S_inv = 1.0f/S[j];
+                ggml_vec_scale_f32(D, VKQ32 + j*D, S_inv);
+
+                // dst indices
+                const int64_t i1 = iq1;
+                const int64_t i2 = iq2_0 + j;
+                const int64_t i3 = iq3;
+
+                // original
+                //memcpy((char *) dst->data + (i1*nb1 + i2*nb2 + i3*nb3), V, nev0*sizeof(float));
+
+                // permute(0, 2, 1, 3)
+                memcpy((char *) dst->data + (i3*ne2*ne1 + i2 + i1*ne1)*nb1, VKQ32 + j*D, nb1);
             }
         }
 
-        // V /= S
-        const float S_inv = 1.0f/S;
-        ggml_vec_scale_f32(D, VKQ32, S_inv);
+        return;
+    }
 
-        // dst indices
-        const int i1 = iq1;
-        const int i2 = iq2;
-        const int i3 = iq3;
+    // split the KV sequence of each group in chunks, the partial results are stored after the per-thread buffers
+    // as [M, S, VKQ[D]] for each head of each chunk of each group
+    float * partials = (float *) params->wdata + nth*ggml_flash_attn_ext_thread_size(dst);
+
+    const int64_t chunk_size = (nek1 + n_chunks - 1)/n_chunks;
 
-        // original
-        //memcpy((char *) dst->data + (i1*nb1 + i2*nb2 + i3*nb3), V, nev0*sizeof(float));
+    // (group, chunk) pairs per thread
+    const int64_t n_items = ng*n_chunks;
+    const int64_t di      = (n_items + nth - 1)/nth;
 
-        // permute(0, 2, 1, 3)
-        memcpy((char *) dst->data + (i3*ne2*ne1 + i2 + i1*ne1)*nb1, VKQ32, nb1);
+    const int64_t it0 = di*ith;
+    const int64_t it1 = MIN(it0 + di, n_items);
+
+    for (int64_t it = it0; it < it1; ++it) {
+        const int64_t ig  = it/n_chunks;
+        const int64_t ic0 = (it%n_chunks)*chunk_size;
+        const int64_t ic1 = MIN(ic0 + chunk_size, nek1);
+
+        const int64_t iq1   = ig%neq1;
+        const int64_t iq2_0 = ((ig/neq1)%(neq2/G))*G;
+        const int64_t iq3   = ig/(neq1*(neq2/G));
+
+        ggml_compute_forward_flash_attn_ext_f16_group(q, k, v, mask, dst, iq1, iq2_0, iq3, G, ic0, ic1, wdata);
+
+        for (int64_t j = 0; j < G; ++j) {
+            float * part = partials + (it*G + j)*(D + 2);
+
+            part[0] = M[j];
+            part[1] = S[j];
+            memcpy(part + 2, VKQ32 + j*D, D*sizeof(float));
+        }
+    }
+
+    ggml_barrier(params->threadpool);
+
+    // reduce the chunks of each group
+    const int64_t dg = (ng + nth - 1)/nth;
+
+    const int64_t ig0 = dg*ith;
+    const int64_t ig1 = MIN(ig0 + dg, ng);
+
+    for (int64_t ig = ig0; ig < ig1; ++ig) {
+        const int64_t iq1   = ig%neq1;
+        const int64_t iq2_0 = ((ig/neq1)%(neq2/G))*G;
+        const int64_t iq3   = ig/(neq1*(neq2/G));
+
+        for (int64_t j = 0; j < G; ++j) {
+            float Mj = -INFINITY;
+            for (int64_t c = 0; c < n_chunks; ++c) {
+                Mj = MAX(Mj, partials[((ig*n_chunks + c)*G + j)*(D + 2)]);
+            }
+
+            float Sj = 0.0f;
+            memset(VKQ32, 0, D*sizeof(float));
+
+            for (int64_t c = 0; c < n_chunks; ++c) {
+                const float * pc = partials + ((ig*n_chunks + c)*G + j)*(D + 2);
+                if (pc[0] == -INFINITY) {
+                    // all the KV values of the chunk are masked
+                    continue;
+                }
+
+                const float ms = expf(pc[0] - Mj);
+
+                Sj += pc[1]*ms;
+                ggml_vec_mad_f32(D, VKQ32, pc + 2, ms);
+            }
+
+            // V /= S
+            const float S_inv = 1.0f/Sj;
+            ggml_vec_scale_f32(D, VKQ32, S_inv);
+
+            // dst indices
+            const int64_t i1 = iq1;
+            const int64_t i2 = iq2_0 + j;
+            const int64_t i3 = iq3;
+
+            // permute(0, 2, 1, 3)
+            memcpy((char *) dst->data + (i3*ne2*ne1 + i2 + i1*ne1)*nb1, VKQ32, nb1);
+        }
     }
 }
 
@@ -14300,6 +14577,374 @@ static void ggml_compute_forward_opt_step_adamw(
 }
 /////////////////////////////////
 
+// ggml_compute_forward_fused
+//
+// short chains of row-wise ops are computed one row at a time, while the row is still in the cache, and without a
+// barrier between the ops of the chain:
+//
+//   - [ADD ->] RMS_NORM -> MUL   (residual + norm + weight)
+//   - SILU -> MUL                (SwiGLU)
+//   - ROPE -> CPY                (K stored in the KV cache, the CPY does not have to be the next node)
+//
+// the results of all the ops are still written, so they can be used by other nodes
+
+// max distance between a ROPE and the CPY of its result
+#define GGML_ROPE_CPY_MAX_DIST 16
+
+static bool ggml_is_f32_rows(const struct ggml_tensor * t) {
+    return t->type == GGML_TYPE_F32 && t->nb[0] == sizeof(float);
+}
+
+static bool ggml_tensors_overlap(const struct ggml_tensor * a, const struct ggml_tensor * b) {
+    const char * a0 = (const char *) a->data;
+    const char * b0 = (const char *) b->data;
+
+    return a0 < b0 + ggml_nbytes(b) && b0 < a0 + ggml_nbytes(a);
+}
+
+// a tensor written by a fused chain must not overlap with the other tensors of the chain, unless it has the same rows
+// (in-place op)
+static bool ggml_fused_rows_safe(struct ggml_tensor ** tensors, int n, int n_dst) {
+    // the first n_dst tensors are written
+    for (int i = 0; i < n_dst; i++) {
+        const struct ggml_tensor * a = tensors[i];
+        for (int j = 0; j < n; j++) {
+            const struct ggml_tensor * b = tensors[j];
+            if (i == j || a == b || !ggml_tensors_overlap(a, b)) {
+                continue;
+            }
+            if (a->data != b->data || !ggml_are_same_shape(a, b) || !ggml_are_same_stride(a, b)) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+static inline float * ggml_row_f32(const struct ggml_tensor * t, int64_t i1, int64_t i2, int64_t i3) {
+    return (float *) ((char *) t->data + (i1 % t->ne[1])*t->nb[1] + (i2 % t->ne[2])*t->nb[2] + (i3 % t->ne[3])*t->nb[3]);
+}
+
+// number of nodes of the [ADD ->] RMS_NORM -> MUL chain that starts at node_n, 0 if there is none
+static int ggml_fused_rms_norm_mul_nodes(const struct ggml_cgraph * cgraph, int node_n) {
+    struct ggml_tensor * add = NULL;
+
+    int i = node_n;
+    if (cgraph->nodes[i]->op == GGML_OP_ADD) {
+        add = cgraph->nodes[i++];
+    }
+    if (i + 1 >= cgraph->n_nodes) {
+        return 0;
+    }
+
+    struct ggml_tensor * norm = cgraph->nodes[i];
+    struct ggml_tensor * mul  = cgraph->nodes[i + 1];
+
+    if (norm->op != GGML_OP_RMS_NORM || mul->op != GGML_OP_MUL || mul->src[0] != norm) {
+        return 0;
+    }
+    if (add && norm->src[0] != add) {
+        return 0;
+    }
+
+    struct ggml_tensor * w = mul->src[1];
+
+    if (!ggml_is_f32_rows(norm->src[0]) || !ggml_is_f32_rows(norm) || !ggml_is_f32_rows(mul) || !ggml_is_f32_rows(w) ||
+        !ggml_are_same_shape(norm, mul) || w->ne[0] != norm->ne[0] || !ggml_can_repeat(w, norm)) {
+        return 0;
+    }
+    if (add && (!ggml_is_f32_rows(add->src[0]) || !ggml_is_f32_rows(add->src[1]) ||
+        !ggml_are_same_shape(add->src[0], add) || add->src[1]->ne[0] != add->ne[0] || !ggml_can_repeat(add->src[1], add))) {
+        return 0;
+    }
+
+    struct ggml_tensor * tensors[] = { mul, norm, norm->src[0], w, add ? add->src[0] : w, add ? add->src[1] : w };
+    if (!ggml_fused_rows_safe(tensors, 6, add ? 3 : 2)) {
+        return 0;
+    }
+
+    return add ? 3 : 2;
+}
+
+static void ggml_compute_forward_add_rms_norm_mul_f32(
+        const struct ggml_compute_params * params,
+        struct ggml_tensor * add,
+        struct ggml_tensor * norm,
+        struct ggml_tensor * mul) {
+
+    const struct ggml_tensor * src = norm->src[0];
+    const struct ggml_tensor * w   = mul->src[1];
+
+    float eps;
+    memcpy(&eps, norm->op_params, sizeof(float));
+
+    GGML_ASSERT(eps >= 0.0f);
+
+    const int64_t ne0 = norm->ne[0];
+    const int64_t ne1 = norm->ne[1];
+    const int64_t ne2 = norm->ne[2];
+
+    const int64_t nr = ggml_nrows(norm);
+
+    // rows per thread
+    const int64_t dr = (nr + params->nth - 1)/params->nth;
+
+    // row range for this thread
+    const int64_t ir0 = dr*params->ith;
+    const int64_t ir1 = MIN(ir0 + dr, nr);
+
+    for (int64_t ir = ir0; ir < ir1; ++ir) {
+        const int64_t i3 = ir/(ne2*ne1);
+        const int64_t i2 = (ir - i3*ne2*ne1)/ne1;
+        const int64_t i1 = (ir - i3*ne2*ne1 - i2*ne1);
+
+        float * x = ggml_row_f32(src, i1, i2, i3);
+
+        if (add) {
+            ggml_vec_add_f32(ne0, x, ggml_row_f32(add->src[0], i1, i2, i3), ggml_row_f32(add->src[1], i1, i2, i3));
+        }
+
+        ggml_float sum = 0.0;
+        for (int64_t i0 = 0; i0 < ne0; i0++) {
+            sum += (ggml_float)(x[i0] * x[i0]);
+        }
+
+        const float mean = sum/ne0;
+
+        float * y = ggml_row_f32(norm, i1, i2, i3);
+
+        memcpy(y, x, ne0 * sizeof(float));
+
+        const float scale = 1.0f/sqrtf(mean + eps);
+
+        ggml_vec_scale_f32(ne0, y, scale);
+
+        ggml_vec_mul_f32(ne0, ggml_row_f32(mul, i1, i2, i3), y, ggml_row_f32(w, i1, i2, i3));
+    }
+}
+
+// SILU -> MUL, the result of the SILU can be either operand of the MUL
+static bool ggml_fused_silu_mul(const struct ggml_cgraph * cgraph, int node_n) {
+    if (node_n + 1 >= cgraph->n_nodes) {
+        return false;
+    }
+
+    struct ggml_tensor * silu = cgraph->nodes[node_n];
+    struct ggml_tensor * mul  = cgraph->nodes[node_n + 1];
+
+    if (silu->op != GGML_OP_UNARY || ggml_get_unary_op(silu) != GGML_UNARY_OP_SILU || mul->op != GGML_OP_MUL) {
+        return false;
+    }
+    if (mul->src[0] != silu && mul->src[1] != silu) {
+        return false;
+    }
+
+    struct ggml_tensor * other = mul->src[0] == silu ? mul->src[1] : mul->src[0];
+
+    if (!ggml_is_f32_rows(silu->src[0]) || !ggml_is_f32_rows(silu) || !ggml_is_f32_rows(mul) || !ggml_is_f32_rows(other) ||
+        !ggml_are_same_shape(silu, mul) || !ggml_are_same_shape(other, mul)) {
+        return false;
+    }
+
+    struct ggml_tensor * tensors[] = { mul, silu, silu->src[0], other };
+
+    return ggml_fused_rows_safe(tensors, 4, 2);
+}
+
+static void ggml_compute_forward_silu_mul_f32(
+        const struct ggml_compute_params * params,
+        struct ggml_tensor * silu,
+        struct ggml_tensor * mul) {
+
+    const struct ggml_tensor * src   = silu->src[0];
+    const struct ggml_tensor * other = mul->src[0] == silu ? mul->src[1] : mul->src[0];
+
+    const int64_t ne0 = silu->ne[0];
+    const int64_t ne1 = silu->ne[1];
+    const int64_t ne2 = silu->ne[2];
+
+    const int64_t nr = ggml_nrows(silu);
+
+    // rows per thread
+    const int64_t dr = (nr + params->nth - 1)/params->nth;
+
+    // row range for this thread
+    const int64_t ir0 = dr*params->ith;
+    const int64_t ir1 = MIN(ir0 + dr, nr);
+
+    for (int64_t ir = ir0; ir < ir1; ++ir) {
+        const int64_t i3 = ir/(ne2*ne1);
+        const int64_t i2 = (ir - i3*ne2*ne1)/ne1;
+        const int64_t i1 = (ir - i3*ne2*ne1 - i2*ne1);
+
+        float * y = ggml_row_f32(silu, i1, i2, i3);
+
+        ggml_vec_silu_f32(ne0, y, ggml_row_f32(src, i1, i2, i3));
+        ggml_vec_mul_f32(ne0, ggml_row_f32(mul, i1, i2, i3), y, ggml_row_f32(other, i1, i2, i3));
+    }
+}
+
+// index of the CPY of the result of the ROPE at node_n that can be done right after the ROPE, -1 if there is none
+static int ggml_fused_rope_cpy_node(const struct ggml_cgraph * cgraph, int node_n) {
+    struct ggml_tensor * rope = cgraph->nodes[node_n];
+
+    if (rope->op != GGML_OP_ROPE || rope->type != GGML_TYPE_F32 || !ggml_is_contiguous(rope)) {
+        return -1;
+    }
+
+    const int n_last = MIN(node_n + GGML_ROPE_CPY_MAX_DIST, cgraph->n_nodes - 1);
+
+    for (int i = node_n + 1; i <= n_last; i++) {
+        struct ggml_tensor * cpy = cgraph->nodes[i];
+
+        if (cpy->op != GGML_OP_CPY || cpy->src[0] != rope) {
+            continue;
+        }
+
+        const struct ggml_tensor * dst = cpy->src[1];
+
+        if (!ggml_is_contiguous(dst) || ggml_tensors_overlap(dst, rope) ||
+            (dst->type != GGML_TYPE_F32 && dst->type != GGML_TYPE_F16 && dst->type != GGML_TYPE_BF16)) {
+            return -1;
+        }
+
+        // the nodes in between must not use the destination of the copy or modify the result of the ROPE
+        for (int j = node_n + 1; j < i; j++) {
+            const struct ggml_tensor * node = cgraph->nodes[j];
+
+            if (ggml_op_is_noop(node)) {
+                continue;
+            }
+            if (ggml_tensors_overlap(node, dst) || ggml_tensors_overlap(node, rope)) {
+                return -1;
+            }
+            for (int k = 0; k < GGML_MAX_SRC; k++) {
+                if (node->src[k] && ggml_tensors_overlap(node->src[k], dst)) {
+                    return -1;
+                }
+            }
+        }
+
+        return i;
+    }
+
+    return -1;
+}
+
+// ROPE, then copy the rows of this thread to the destination of the CPY
+static void ggml_compute_forward_rope_cpy(
+        const struct ggml_compute_params * params,
+        struct ggml_tensor * rope,
+        struct ggml_tensor * cpy) {
+
+    ggml_compute_forward_rope(params, rope);
+
+    const struct ggml_tensor * dst = cpy->src[1];
+
+    const int64_t ne0 = rope->ne[0];
+    const int64_t nr  = ggml_nrows(rope);
+
+    // same rows as ggml_compute_forward_rope_f32
+    const int64_t dr = (nr + params->nth - 1)/params->nth;
+
+    const int64_t ir0 = dr*params->ith;
+    const int64_t ir1 = MIN(ir0 + dr, nr);
+
+    if (ir0 >= ir1) {
+        return;
+    }
+
+    const float  * x = (const float *) rope->data + ir0*ne0;
+    const int64_t  n = (ir1 - ir0)*ne0;
+
+    switch (dst->type) {
+        case GGML_TYPE_F32:
+            {
+                memcpy((float *) dst->data + ir0*ne0, x, n*sizeof(float));
+            } break;
+        case GGML_TYPE_F16:
+            {
+                ggml_fp32_to_fp16_row(x, (ggml_fp16_t *) dst->data + ir0*ne0, n);
+            } break;
+        case GGML_TYPE_BF16:
+            {
+                ggml_fp32_to_bf16_row(x, (ggml_bf16_t *) dst->data + ir0*ne0, n);
+            } break;
+        default:
+            {
+                GGML_ABORT("fatal error");
+            }
+    }
+}
+
+// number of nodes of the fused chain that starts at node_n, 0 if node_n is not fused
+static int ggml_get_n_fused(const struct ggml_cgraph * cgraph, int node_n) {
+    const struct ggml_tensor * node = cgraph->nodes[node_n];
+
+    switch (node->op) {
+        case GGML_OP_ADD:
+        case GGML_OP_RMS_NORM:
+            {
+                return ggml_fused_rms_norm_mul_nodes(cgraph, node_n);
+            }
+        case GGML_OP_UNARY:
+            {
+                return ggml_fused_silu_mul(cgraph, node_n) ? 2 : 0;
+            }
+        case GGML_OP_ROPE:
+            {
+                return ggml_fused_rope_cpy_node(cgraph, node_n) >= 0 ? 1 : 0;
+            }
+        case GGML_OP_CPY:
+            {
+                // already done with the ROPE
+                for (int i = MAX(0, node_n - GGML_ROPE_CPY_MAX_DIST); i < node_n; i++) {
+                    if (cgraph->nodes[i] == node->src[0] && ggml_fused_rope_cpy_node(cgraph, i) == node_n) {
+                        return 1;
+                    }
+                }
+                return 0;
+            }
+        default:
+            return 0;
+    }
+}
+
+static void ggml_compute_forward_fused(
+        const struct ggml_compute_params * params,
+        const struct ggml_cgraph * cgraph,
+        int node_n,
+        int n_fused) {
+
+    struct ggml_tensor * node = cgraph->nodes[node_n];
+
+    switch (node->op) {
+        case GGML_OP_ADD:
+        case GGML_OP_RMS_NORM:
+            {
+                struct ggml_tensor * add = n_fused == 3 ? node : NULL;
+                ggml_compute_forward_add_rms_norm_mul_f32(params, add, cgraph->nodes[node_n + n_fused - 2], cgraph->nodes[node_n + n_fused - 1]);
+            } break;
+        case GGML_OP_UNARY:
+            {
+                ggml_compute_forward_silu_mul_f32(params, node, cgraph->nodes[node_n + 1]);
+            } break;
+        case GGML_OP_ROPE:
+            {
+                ggml_compute_forward_rope_cpy(params, node, cgraph->nodes[ggml_fused_rope_cpy_node(cgraph, node_n)]);
+            } break;
+        case GGML_OP_CPY:
+            {
+                // nop
+            } break;
+        default:
+            {
+                GGML_ABORT("fatal error");
+            }
+    }
+}
+
 static void ggml_compute_forward(struct ggml_compute_params * params, struct ggml_tensor * tensor) {
     GGML_ASSERT(params);
 
@@ -14756,6 +15401,49 @@ static void set_numa_thread_affinity(int thread_n) { UNUSED(thread_n);  }
 static void clear_numa_thread_affinity(void) {}
 #endif
 
+// minimum amount of work for each thread of the small ops, in units of about one element read and written
+#define GGML_MIN_WORK_PER_TASK (32*1024)
+
+// n_tasks of the ops that are split by rows, so that each thread gets at least GGML_MIN_WORK_PER_TASK
+// for small tensors the cost of waking up and synchronizing more threads is higher than the gain
+static int ggml_get_n_tasks_by_work(const struct ggml_tensor * node, int n_threads, int64_t cost_per_element) {
+    const int64_t n_work  = (ggml_nelements(node)*cost_per_element + GGML_MIN_WORK_PER_TASK - 1)/GGML_MIN_WORK_PER_TASK;
+    const int64_t n_tasks = MIN(MIN(n_threads, ggml_nrows(node)), n_work);
+
+    return MAX(1, n_tasks);
+}
+
+// the ops that do not synchronize their threads internally and use only ith < nth
+// they are computed by the first n_tasks threads only, the other threads go directly to the barrier
+static bool ggml_can_skip_threads(const struct ggml_tensor * node) {
+    switch (node->op) {
+        case GGML_OP_CPY:
+        case GGML_OP_DUP:
+        case GGML_OP_CONT:
+        case GGML_OP_ADD:
+        case GGML_OP_MUL:
+        case GGML_OP_DIV:
+        case GGML_OP_SCALE:
+        case GGML_OP_NORM:
+        case GGML_OP_RMS_NORM:
+        case GGML_OP_GET_ROWS:
+        case GGML_OP_ROPE:
+        case GGML_OP_SOFT_MAX:
+            return true;
+        case GGML_OP_UNARY:
+            switch (ggml_get_unary_op(node)) {
+                case GGML_UNARY_OP_GELU:
+                case GGML_UNARY_OP_GELU_QUICK:
+                case GGML_UNARY_OP_SILU:
+                    return true;
+                default:
+                    return false;
+            }
+        default:
+            return false;
+    }
+}
+
 static int ggml_get_n_tasks(struct ggml_tensor * node, int n_threads) {
     int n_tasks = 0;
 
@@ -14769,7 +15457,13 @@ static int ggml_get_n_tasks(struct ggml_tensor * node, int n_threads) {
         case GGML_OP_CPY:
         case GGML_OP_DUP:
         case GGML_OP_CONT:
+            {
+                n_tasks = ggml_get_n_tasks_by_work(node, n_threads, ggml_is_quantized(node->type) ? 4 : 1);
+            } break;
         case GGML_OP_ADD:
+            {
+                n_tasks = ggml_get_n_tasks_by_work(node, n_threads, 1);
+            } break;
         case GGML_OP_ADD1:
         case GGML_OP_ACC:
             {
@@ -14819,17 +15513,23 @@ static int ggml_get_n_tasks(struct ggml_tensor * node, int n_threads) {
                 case GGML_UNARY_OP_GELU_QUICK:
                 case GGML_UNARY_OP_SILU:
                     {
-                        n_tasks = n_threads;
+                        n_tasks = ggml_get_n_tasks_by_work(node, n_threads, 4);
                     } break;
                 default:
                     GGML_ABORT("fatal error");
             }
             break;
-        case GGML_OP_SILU_BACK:
         case GGML_OP_MUL:
         case GGML_OP_DIV:
+            {
+                n_tasks = ggml_get_n_tasks_by_work(node, n_threads, 1);
+            } break;
         case GGML_OP_NORM:
         case GGML_OP_RMS_NORM:
+            {
+                n_tasks = ggml_get_n_tasks_by_work(node, n_threads, 2);
+            } break;
+        case GGML_OP_SILU_BACK:
         case GGML_OP_RMS_NORM_BACK:
         case GGML_OP_L2_NORM:
         case GGML_OP_GROUP_NORM:
@@ -14841,13 +15541,10 @@ static int ggml_get_n_tasks(struct ggml_tensor * node, int n_threads) {
                 n_tasks = n_threads;
             } break;
         case GGML_OP_GET_ROWS:
+        case GGML_OP_SCALE:
             {
-                // FIXME: get_rows can use additional threads, but the cost of launching additional threads
-                // decreases performance with GPU offloading
-                //n_tasks = n_threads;
-                n_tasks = 1;
+                n_tasks = ggml_get_n_tasks_by_work(node, n_threads, 1);
             } break;
-        case GGML_OP_SCALE:
         case GGML_OP_SET:
         case GGML_OP_RESHAPE:
         case GGML_OP_VIEW:
@@ -14861,7 +15558,6 @@ static int ggml_get_n_tasks(struct ggml_tensor * node, int n_threads) {
         case GGML_OP_DIAG_MASK_ZERO:
         case GGML_OP_DIAG_MASK_INF:
         case GGML_OP_SOFT_MAX_BACK:
-        case GGML_OP_ROPE:
         case GGML_OP_ROPE_BACK:
         case GGML_OP_ADD_REL_POS:
             {
@@ -14871,9 +15567,10 @@ static int ggml_get_n_tasks(struct ggml_tensor * node, int n_threads) {
             {
                 n_tasks = 1; //TODO
             } break;
+        case GGML_OP_ROPE:
         case GGML_OP_SOFT_MAX:
             {
-                n_tasks = MIN(n_threads, ggml_nrows(node->src[0]));
+                n_tasks = ggml_get_n_tasks_by_work(node, n_threads, 4);
             } break;
         case GGML_OP_IM2COL:
         case GGML_OP_IM2COL_BACK:
@@ -15382,9 +16079,8 @@ struct ggml_cplan ggml_graph_plan(
                     } break;
                 case GGML_OP_FLASH_ATTN_EXT:
                     {
-                        const int64_t ne00 = node->src[0]->ne[0]; // D
-
-                        cur = 3*sizeof(float)*ne00*n_tasks; // 3x head size/thread
+                        cur  = sizeof(float)*ggml_flash_attn_ext_thread_size(node)*n_tasks;
+                        cur += ggml_flash_attn_ext_chunks_size(node, n_tasks);
                     } break;
                 case GGML_OP_FLASH_ATTN_BACK:
                     {
@@ -15431,6 +16127,25 @@ struct ggml_cplan ggml_graph_plan(
     return cplan;
 }
 
+// time for cplan.timings, in nanoseconds
+#if defined(_WIN32)
+static int64_t ggml_time_ns_cpu(void) {
+    static LARGE_INTEGER freq = { 0 };
+    if (freq.QuadPart == 0) {
+        QueryPerformanceFrequency(&freq);
+    }
+    LARGE_INTEGER t;
+    QueryPerformanceCounter(&t);
+    return (int64_t) ((double) t.QuadPart*1e9/freq.QuadPart);
+}
+#else
+static int64_t ggml_time_ns_cpu(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec*1000000000 + (int64_t)ts.tv_nsec;
+}
+#endif
+
 static thread_ret_t ggml_graph_compute_thread(void * data) {
     struct ggml_compute_state * state = (struct ggml_compute_state *) data;
     struct ggml_threadpool    * tp    = state->threadpool;
@@ -15440,9 +16155,11 @@ static thread_ret_t ggml_graph_compute_thread(void * data) {
 
     set_numa_thread_affinity(state->ith);
 
+    const int n_threads = atomic_load_explicit(&tp->n_threads_cur, memory_order_relaxed);
+
     struct ggml_compute_params params = {
         /*.ith       =*/ state->ith,
-        /*.nth       =*/ atomic_load_explicit(&tp->n_threads_cur, memory_order_relaxed),
+        /*.nth       =*/ n_threads,
         /*.wsize     =*/ cplan->work_size,
         /*.wdata     =*/ cplan->work_data,
         /*.threadpool=*/ tp,
@@ -15451,16 +16168,44 @@ static thread_ret_t ggml_graph_compute_thread(void * data) {
     for (int node_n = 0; node_n < cgraph->n_nodes && atomic_load_explicit(&tp->abort, memory_order_relaxed) != node_n; node_n++) {
         struct ggml_tensor * node = cgraph->nodes[node_n];
 
-        ggml_compute_forward(&params, node);
+        struct ggml_cpu_node_timing * timing = cplan->timings ? &cplan->timings[node_n*cplan->n_threads + state->ith] : NULL;
+        if (timing) {
+            timing->t_start = ggml_time_ns_cpu();
+        }
+
+        const int n_fused = ggml_get_n_fused(cgraph, node_n);
+
+        params.nth = ggml_can_skip_threads(node) ? ggml_get_n_tasks(node, n_threads) : n_threads;
 
-        if (state->ith == 0 && cplan->abort_callback &&
-                cplan->abort_callback(cplan->abort_callback_data)) {
-            atomic_store_explicit(&tp->abort, node_n + 1, memory_order_relaxed);
-            tp->ec    = GGML_STATUS_ABORTED;
+        if (params.ith < params.nth) {
+            if (n_fused > 0) {
+                ggml_compute_forward_fused(&params, cgraph, node_n, n_fused);
+            } else {
+                ggml_compute_forward(&params, node);
+            }
         }
 
-        if (node_n + 1 < cgraph->n_nodes) {
+        node_n += MAX(n_fused, 1) - 1;
+
+        if (timing) {
+            timing->t_end     = ggml_time_ns_cpu();
+            timing->t_barrier = timing->t_end;
+        }
+
+        // no barrier is needed after the nodes that do not compute anything
+        // the abort check is done only before a barrier, so that all the threads stop at the same node
+        if (node_n + 1 < cgraph->n_nodes && !ggml_op_is_noop(node)) {
+            if (state->ith == 0 && cplan->abort_callback &&
+                    cplan->abort_callback(cplan->abort_callback_data)) {
+                atomic_store_explicit(&tp->abort, node_n + 1, memory_order_relaxed);
+                tp->ec    = GGML_STATUS_ABORTED;
+            }
+
             ggml_barrier(state->threadpool);
+
+            if (timing) {
+                timing->t_barrier = ggml_time_ns_cpu();
+            }
         }
     }
 
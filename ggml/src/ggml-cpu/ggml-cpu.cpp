@@ -2,6 +2,7 @@
 #include "ggml-backend-impl.h"
 #include "ggml-cpu.h"
 #include "ggml-cpu-aarch64.h"
+#include "ggml-cpu-profile.h"
 #include "ggml-cpu-traits.h"
 #include "ggml-impl.h"
 #include "amx/amx.h"
@@ -87,6 +88,10 @@ struct ggml_backend_cpu_context {
 
     ggml_abort_callback abort_callback;
     void *              abort_callback_data;
+
+    ggml_cpu_profile *  profile;       // NULL when the profiling is disabled
+    bool                profile_env;   // enabled with GGML_CPU_PROFILE, printed when the backend is freed
+    std::string         profile_trace; // from GGML_CPU_PROFILE, saved when the backend is freed
 };
 
 static const char * ggml_backend_cpu_get_name(ggml_backend_t backend) {
@@ -97,6 +102,13 @@ static const char * ggml_backend_cpu_get_name(ggml_backend_t backend) {
 
 static void ggml_backend_cpu_free(ggml_backend_t backend) {
     struct ggml_backend_cpu_context * cpu_ctx = (struct ggml_backend_cpu_context *)backend->context;
+    if (cpu_ctx->profile && cpu_ctx->profile_env) {
+        cpu_ctx->profile->print();
+        if (!cpu_ctx->profile_trace.empty()) {
+            cpu_ctx->profile->save_trace(cpu_ctx->profile_trace.c_str());
+        }
+    }
+    delete cpu_ctx->profile;
     delete[] cpu_ctx->work_data;
     delete cpu_ctx;
     delete backend;
@@ -138,12 +150,27 @@ static void ggml_backend_cpu_graph_plan_free(ggml_backend_t backend, ggml_backen
     GGML_UNUSED(backend);
 }
 
+// ggml_graph_compute() with the timings of the nodes recorded in the profile, if enabled
+static enum ggml_status ggml_backend_cpu_graph_compute_profile(struct ggml_backend_cpu_context * cpu_ctx, struct ggml_cgraph * cgraph, struct ggml_cplan * cplan) {
+    if (!cpu_ctx->profile) {
+        return ggml_graph_compute(cgraph, cplan);
+    }
+
+    cplan->timings = cpu_ctx->profile->begin(cgraph, cplan->n_threads);
+
+    enum ggml_status status = ggml_graph_compute(cgraph, cplan);
+
+    cpu_ctx->profile->end(cgraph, cplan->n_threads);
+    cplan->timings = NULL;
+
+    return status;
+}
+
 static enum ggml_status ggml_backend_cpu_graph_plan_compute(ggml_backend_t backend, ggml_backend_graph_plan_t plan) {
+    struct ggml_backend_cpu_context * cpu_ctx = (struct ggml_backend_cpu_context *)backend->context;
     struct ggml_backend_plan_cpu * cpu_plan = (struct ggml_backend_plan_cpu *)plan;
 
-    return ggml_graph_compute(&cpu_plan->cgraph, &cpu_plan->cplan);
-
-    GGML_UNUSED(backend);
+    return ggml_backend_cpu_graph_compute_profile(cpu_ctx, &cpu_plan->cgraph, &cpu_plan->cplan);
 }
 
 static enum ggml_status ggml_backend_cpu_graph_compute(ggml_backend_t backend, struct ggml_cgraph * cgraph) {
@@ -165,7 +192,7 @@ static enum ggml_status ggml_backend_cpu_graph_compute(ggml_backend_t backend, s
     cplan.abort_callback      = cpu_ctx->abort_callback;
     cplan.abort_callback_data = cpu_ctx->abort_callback_data;
 
-    return ggml_graph_compute(cgraph, &cplan);
+    return ggml_backend_cpu_graph_compute_profile(cpu_ctx, cgraph, &cplan);
 }
 
 static const struct ggml_backend_i ggml_backend_cpu_i = {
@@ -204,6 +231,17 @@ ggml_backend_t ggml_backend_cpu_init(void) {
     ctx->work_size           = 0;
     ctx->abort_callback      = NULL;
     ctx->abort_callback_data = NULL;
+    ctx->profile             = NULL;
+    ctx->profile_env         = false;
+
+    const char * GGML_CPU_PROFILE = getenv("GGML_CPU_PROFILE");
+    if (GGML_CPU_PROFILE) {
+        ctx->profile     = new ggml_cpu_profile;
+        ctx->profile_env = true;
+        if (strcmp(GGML_CPU_PROFILE, "1") != 0) {
+            ctx->profile_trace = GGML_CPU_PROFILE;
+        }
+    }
 
     ggml_backend_t cpu_backend = new ggml_backend {
         /* .guid      = */ ggml_backend_cpu_guid(),
@@ -251,6 +289,43 @@ void ggml_backend_cpu_set_abort_callback(ggml_backend_t backend_cpu, ggml_abort_
     ctx->abort_callback_data = abort_callback_data;
 }
 
+void ggml_backend_cpu_set_profile(ggml_backend_t backend_cpu, bool enable) {
+    GGML_ASSERT(ggml_backend_is_cpu(backend_cpu));
+
+    struct ggml_backend_cpu_context * ctx = (struct ggml_backend_cpu_context *)backend_cpu->context;
+    if (enable) {
+        if (!ctx->profile) {
+            ctx->profile = new ggml_cpu_profile;
+        }
+        ctx->profile->reset();
+    } else {
+        delete ctx->profile;
+        ctx->profile = NULL;
+    }
+}
+
+void ggml_backend_cpu_profile_print(ggml_backend_t backend_cpu) {
+    GGML_ASSERT(ggml_backend_is_cpu(backend_cpu));
+
+    struct ggml_backend_cpu_context * ctx = (struct ggml_backend_cpu_context *)backend_cpu->context;
+    if (!ctx->profile) {
+        GGML_LOG_WARN("%s: the profiling is not enabled\n", __func__);
+        return;
+    }
+    ctx->profile->print();
+}
+
+bool ggml_backend_cpu_profile_save_trace(ggml_backend_t backend_cpu, const char * fname) {
+    GGML_ASSERT(ggml_backend_is_cpu(backend_cpu));
+
+    struct ggml_backend_cpu_context * ctx = (struct ggml_backend_cpu_context *)backend_cpu->context;
+    if (!ctx->profile) {
+        GGML_LOG_ERROR("%s: the profiling is not enabled\n", __func__);
+        return false;
+    }
+    return ctx->profile->save_trace(fname);
+}
+
 // CPU backend - device
 
 struct ggml_backend_cpu_device_context {
@@ -610,6 +685,18 @@ static void * ggml_backend_cpu_get_proc_address(ggml_backend_reg_t reg, const ch
     if (strcmp(name, "ggml_backend_set_abort_callback") == 0) {
         return (void *)ggml_backend_cpu_set_abort_callback;
     }
+    if (strcmp(name, "ggml_backend_set_profile") == 0) {
+        ggml_backend_set_profile_t fct = ggml_backend_cpu_set_profile;
+        return (void *)fct;
+    }
+    if (strcmp(name, "ggml_backend_profile_print") == 0) {
+        ggml_backend_profile_print_t fct = ggml_backend_cpu_profile_print;
+        return (void *)fct;
+    }
+    if (strcmp(name, "ggml_backend_profile_save_trace") == 0) {
+        ggml_backend_profile_save_trace_t fct = ggml_backend_cpu_profile_save_trace;
+        return (void *)fct;
+    }
     if (strcmp(name, "ggml_backend_cpu_numa_init") == 0) {
         return (void *)ggml_numa_init;
     }
@@ -345,6 +345,7 @@ extern "C" {
         bool offload_kqv; // whether to offload the KQV ops (including the KV cache) to GPU
         bool flash_attn;  // whether to use flash attention [EXPERIMENTAL]
         bool no_perf;     // whether to measure performance timings
+        bool embd_norm;   // L2-normalize the pooled embeddings in the graph (MEAN, CLS and LAST pooling)
 
         // Abort callback
         // if it returns true, execution of llama_decode() will be aborted
@@ -520,6 +521,12 @@ extern "C" {
     // Returns the total number of parameters in the model
     LLAMA_API uint64_t llama_model_n_params(const struct llama_model * model);
 
+    // Set the max number of threads used to tokenize long texts with the vocab of the model (default: 1, no extra threads)
+    // The BPE tokenizer splits the pre-tokenized words of long texts in ranges that are tokenized in parallel,
+    // the result is identical to the single-threaded tokenization. The value is capped to 64.
+    // This applies to the whole model, i.e. to all the contexts created from it.
+    LLAMA_API void llama_model_set_n_threads_tokenize(struct llama_model * model, int32_t n_threads);
+
     // Returns true if the model contains an encoder that requires llama_encode() call
     LLAMA_API bool llama_model_has_encoder(const struct llama_model * model);
 
@@ -530,9 +537,15 @@ extern "C" {
     // to the decoder to start generating output sequence. For other models, it returns -1.
     LLAMA_API llama_token llama_model_decoder_start_token(const struct llama_model * model);
 
+    // Returns true if the model can skip layers with llama_set_layer_skip()
+    LLAMA_API bool llama_model_can_skip_layers(const struct llama_model * model);
+
     // Returns true if the model is recurrent (like Mamba, RWKV, etc.)
     LLAMA_API bool llama_model_is_recurrent(const struct llama_model * model);
 
+    // Returns true if the model uses causal attention and keeps the processed tokens in the KV cache
+    LLAMA_API bool llama_model_is_causal(const struct llama_model * model);
+
     // Returns 0 on success
     LLAMA_API uint32_t llama_model_quantize(
             const char * fname_inp,
@@ -949,6 +962,13 @@ extern "C" {
     // If true, all model tensors are activated during llama_decode() to load and cache their weights.
     LLAMA_API void llama_set_warmup(struct llama_context * ctx, bool warmup);
 
+    // Skip some layers of the model during llama_decode(), e.g. to draft tokens with a part of the model
+    // skip[il] skips layer il - n_layer must be llama_model_n_layer(), or 0 to evaluate all layers again
+    // The KV cache of the skipped layers is not updated: the tokens evaluated this way must be removed from the
+    // KV cache before they are evaluated again with all layers
+    // Returns 0 on success, -1 if the model does not support it or all layers are skipped
+    LLAMA_API int32_t llama_set_layer_skip(struct llama_context * ctx, const bool * skip, int32_t n_layer);
+
     // Set abort callback
     LLAMA_API void llama_set_abort_callback(struct llama_context * ctx, ggml_abort_callback abort_callback, void * abort_callback_data);
 
@@ -6,6 +6,7 @@
 #include "llama-model.h"
 #include "llama-kv-cache.h"
 
+#include <algorithm>
 #include <cassert>
 #include <cstring>
 #include <stdexcept>
@@ -38,8 +39,10 @@ llama_context::llama_context(
     cparams.offload_kqv      = params.offload_kqv;
     cparams.flash_attn       = params.flash_attn;
     cparams.no_perf          = params.no_perf;
+    cparams.embd_norm        = params.embd_norm;
     cparams.pooling_type     = params.pooling_type;
     cparams.warmup           = false;
+    cparams.kq_chunk_size    = LLAMA_ATTN_KQ_CHUNK_SIZE;
 
     cparams.n_ctx            = params.n_ctx           == 0    ? hparams.n_ctx_train           : params.n_ctx;
     cparams.rope_freq_base   = params.rope_freq_base  == 0.0f ? hparams.rope_freq_base_train  : params.rope_freq_base;
@@ -961,6 +964,34 @@ void llama_context::set_warmup(bool value) {
     cparams.warmup = value;
 }
 
+int32_t llama_context::set_layer_skip(const bool * skip, int32_t n_layer) {
+    LLAMA_LOG_DEBUG("%s: n_layer = %d\n", __func__, n_layer);
+
+    if (n_layer == 0) {
+        cparams.layer_skip.clear();
+        return 0;
+    }
+
+    if (!llama_model_can_skip_layers(&model)) {
+        LLAMA_LOG_ERROR("%s: the model architecture does not support skipping layers\n", __func__);
+        return -1;
+    }
+
+    if (n_layer != (int32_t) model.hparams.n_layer) {
+        LLAMA_LOG_ERROR("%s: n_layer = %d does not match the model (%d)\n", __func__, n_layer, model.hparams.n_layer);
+        return -1;
+    }
+
+    if (std::all_of(skip, skip + n_layer, [](bool s) { return s; })) {
+        LLAMA_LOG_ERROR("%s: at least one layer must be evaluated\n", __func__);
+        return -1;
+    }
+
+    cparams.layer_skip.assign(skip, skip + n_layer);
+
+    return 0;
+}
+
 void llama_context::set_adapter_lora(
             llama_adapter_lora * adapter,
             float scale) {
@@ -1619,7 +1650,18 @@ void llama_context::output_reorder() {
 //
 
 int32_t llama_context::graph_max_nodes() const {
-    return std::max<int32_t>(65536, 5*model.n_tensors());
+    int64_t res = std::max<int32_t>(65536, 5*model.n_tensors());
+
+    // the non-flash attention adds the nodes of its chunks of queries to every layer
+    for (uint32_t il = 0; il < model.hparams.n_layer; ++il) {
+        const int64_t n_chunks = llm_graph_attn_n_chunks(cparams.n_ubatch, std::max(cparams.n_ctx, cparams.n_ubatch), model.hparams.n_head(il), cparams.kq_chunk_size);
+
+        if (n_chunks > 1) {
+            res += n_chunks*LLAMA_ATTN_KQ_CHUNK_MAX_NODES;
+        }
+    }
+
+    return std::min<int64_t>(res, INT32_MAX);
 }
 
 ggml_cgraph * llama_context::graph_init() {
@@ -2269,6 +2311,7 @@ llama_context_params llama_context_default_params() {
         /*.offload_kqv                 =*/ true,
         /*.flash_attn                  =*/ false,
         /*.no_perf                     =*/ true,
+        /*.embd_norm                   =*/ false,
         /*.abort_callback              =*/ nullptr,
         /*.abort_callback_data         =*/ nullptr,
     };
@@ -2401,6 +2444,10 @@ void llama_set_warmup(llama_context * ctx, bool warmup) {
     ctx->set_warmup(warmup);
 }
 
+int32_t llama_set_layer_skip(llama_context * ctx, const bool * skip, int32_t n_layer) {
+    return ctx->set_layer_skip(skip, n_layer);
+}
+
 void llama_synchronize(llama_context * ctx) {
     ctx->synchronize();
 }
@@ -66,6 +66,8 @@ struct llama_context {
     void set_causal_attn(bool value);
     void set_warmup(bool value);
 
+    int32_t set_layer_skip(const bool * skip, int32_t n_layer);
+
     void set_adapter_lora(
             llama_adapter_lora * adapter,
             float scale);
@@ -3,6 +3,7 @@
 #include "llama.h"
 
 #include <cstdint>
+#include <vector>
 
 struct llama_cparams {
     uint32_t n_ctx;           // context size used during inference
@@ -24,15 +25,20 @@ struct llama_cparams {
     float yarn_beta_slow;
     float defrag_thold;
 
+    size_t kq_chunk_size; // max size of the KQ matrix of a chunk of queries of the non-flash attention
+
     bool embeddings;
     bool causal_attn;
     bool offload_kqv;
     bool flash_attn;
     bool no_perf;
     bool warmup;
+    bool embd_norm;
 
     enum llama_pooling_type pooling_type;
 
+    std::vector<bool> layer_skip; // layers that are not evaluated, empty - evaluate all layers
+
     ggml_backend_sched_eval_callback cb_eval;
     void * cb_eval_user_data;
 };
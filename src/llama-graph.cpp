@@ -9,6 +9,18 @@
 #include <cmath>
 #include <cstring>
 
+int64_t llm_graph_attn_n_chunks(int64_t n_tokens, int64_t n_kv, int64_t n_head, size_t chunk_size) {
+    const size_t kq_row_size = n_kv*n_head*sizeof(float);
+
+    if (kq_row_size*n_tokens <= chunk_size) {
+        return 1;
+    }
+
+    const int64_t n_chunk_tokens = std::max<int64_t>(1, chunk_size/kq_row_size);
+
+    return (n_tokens + n_chunk_tokens - 1)/n_chunk_tokens;
+}
+
 static int32_t llama_relative_position_bucket(llama_pos x, llama_pos y, uint64_t n_buckets, bool bidirectional) {
     // TODO move to hparams if a T5 variant appears that uses a different value
     const int64_t max_distance = 128;
@@ -143,22 +155,23 @@ void llm_graph_input_mean::set_input(const llama_ubatch * ubatch) {
         GGML_ASSERT(mean);
         GGML_ASSERT(ggml_backend_buffer_is_host(mean->buffer));
 
+        const int64_t n_seqs_pool = mean->ne[1];
+
         float * data = (float *) mean->data;
-        memset(mean->data, 0, n_tokens * n_tokens * ggml_element_size(mean));
+        memset(mean->data, 0, n_tokens * n_seqs_pool * ggml_element_size(mean));
 
-        std::vector<uint64_t> sum(n_tokens, 0);
+        std::vector<uint64_t> sum(n_seqs_pool, 0);
 
         for (int s = 0; s < n_seqs; ++s) {
             const llama_seq_id seq_id = ubatch->seq_id[s][0];
 
-            // TODO: adapt limits to n_seqs when ubatch->equal_seqs is true
-            GGML_ASSERT(seq_id < n_tokens && "seq_id cannot be larger than n_tokens with pooling_type == MEAN");
+            GGML_ASSERT(seq_id < n_seqs_pool && "seq_id cannot be larger than the number of pooled sequences");
 
             sum[seq_id] += ubatch->n_seq_tokens;
         }
 
-        std::vector<float> div(n_tokens, 0.0f);
-        for (int i = 0; i < n_tokens; ++i) {
+        std::vector<float> div(n_seqs_pool, 0.0f);
+        for (int i = 0; i < n_seqs_pool; ++i) {
             const uint64_t s = sum[i];
             if (s > 0) {
                 div[i] = 1.0f/float(s);
@@ -176,24 +189,27 @@ void llm_graph_input_mean::set_input(const llama_ubatch * ubatch) {
 }
 
 void llm_graph_input_cls::set_input(const llama_ubatch * ubatch) {
+    // with causal attention only the last token has seen the entire sequence, so the classification head is applied to it
+    const bool rank_last = cparams.pooling_type == LLAMA_POOLING_TYPE_RANK && cparams.causal_attn;
+
     if (cparams.embeddings && (
                 cparams.pooling_type == LLAMA_POOLING_TYPE_CLS ||
-                cparams.pooling_type == LLAMA_POOLING_TYPE_RANK)) {
-        const int64_t n_tokens     = ubatch->n_tokens;
+               (cparams.pooling_type == LLAMA_POOLING_TYPE_RANK && !rank_last))) {
         const int64_t n_seq_tokens = ubatch->n_seq_tokens;
         const int64_t n_seqs       = ubatch->n_seqs;
 
         GGML_ASSERT(cls);
         GGML_ASSERT(ggml_backend_buffer_is_host(cls->buffer));
 
+        const int64_t n_seqs_pool = cls->ne[0];
+
         uint32_t * data = (uint32_t *) cls->data;
-        memset(cls->data, 0, n_tokens * ggml_element_size(cls));
+        memset(cls->data, 0, n_seqs_pool * ggml_element_size(cls));
 
         for (int s = 0; s < n_seqs; ++s) {
             const llama_seq_id seq_id = ubatch->seq_id[s][0];
 
-            // TODO: adapt limits to n_seqs when ubatch->equal_seqs is true
-            GGML_ASSERT(seq_id < n_tokens && "seq_id cannot be larger than n_tokens with pooling_type == CLS or RANK");
+            GGML_ASSERT(seq_id < n_seqs_pool && "seq_id cannot be larger than the number of pooled sequences");
 
             for (int i = 0; i < n_seq_tokens; ++i) {
                 const llama_pos pos = ubatch->pos[s*n_seq_tokens + i];
@@ -205,25 +221,25 @@ void llm_graph_input_cls::set_input(const llama_ubatch * ubatch) {
         }
     }
 
-    if (cparams.embeddings && cparams.pooling_type == LLAMA_POOLING_TYPE_LAST) {
-        const int64_t n_tokens     = ubatch->n_tokens;
+    if (cparams.embeddings && (cparams.pooling_type == LLAMA_POOLING_TYPE_LAST || rank_last)) {
         const int64_t n_seq_tokens = ubatch->n_seq_tokens;
         const int64_t n_seqs       = ubatch->n_seqs;
 
         GGML_ASSERT(cls);
         GGML_ASSERT(ggml_backend_buffer_is_host(cls->buffer));
 
+        const int64_t n_seqs_pool = cls->ne[0];
+
         uint32_t * data = (uint32_t *) cls->data;
-        memset(cls->data, 0, n_tokens * ggml_element_size(cls));
+        memset(cls->data, 0, n_seqs_pool * ggml_element_size(cls));
 
-        std::vector<int> last_pos(n_tokens, -1);
-        std::vector<int> last_row(n_tokens, -1);
+        std::vector<int> last_pos(n_seqs_pool, -1);
+        std::vector<int> last_row(n_seqs_pool, -1);
 
         for (int s = 0; s < n_seqs; ++s) {
             const llama_seq_id seq_id = ubatch->seq_id[s][0];
 
-            // TODO: adapt limits to n_seqs when ubatch->equal_seqs is true
-            GGML_ASSERT(seq_id < n_tokens && "seq_id cannot be larger than n_tokens with pooling_type == LAST");
+            GGML_ASSERT(seq_id < n_seqs_pool && "seq_id cannot be larger than the number of pooled sequences");
 
             for (int i = 0; i < n_seq_tokens; ++i) {
                 const llama_pos pos = ubatch->pos[s*n_seq_tokens + i];
@@ -235,7 +251,7 @@ void llm_graph_input_cls::set_input(const llama_ubatch * ubatch) {
             }
         }
 
-        for (int i = 0; i < n_tokens; ++i) {
+        for (int i = 0; i < n_seqs_pool; ++i) {
             if (last_row[i] >= 0) {
                 data[i] = last_row[i];
             }
@@ -315,85 +331,48 @@ void llm_graph_input_cross_embd::set_input(const llama_ubatch * ubatch) {
 
 void llm_graph_input_attn_no_cache::set_input(const llama_ubatch * ubatch) {
     if (kq_mask) {
-        if (cparams.causal_attn) {
-            const int64_t n_kv         = ubatch->n_tokens;
-            const int64_t n_tokens     = ubatch->n_tokens;
-            const int64_t n_seq_tokens = ubatch->n_seq_tokens;
-            const int64_t n_seqs       = ubatch->n_seqs;
-
-            GGML_ASSERT(ggml_backend_buffer_is_host(kq_mask->buffer));
-            float * data = (float *) kq_mask->data;
-
-            for (int h = 0; h < 1; ++h) {
-                for (int s1 = 0; s1 < n_seqs; ++s1) {
-                    const llama_seq_id seq_id = ubatch->seq_id[s1][0];
-
-                    for (int j = 0; j < n_seq_tokens; ++j) {
-                        const int32_t tj = s1*n_seq_tokens + j;
+        const int64_t n_seq_tokens = ubatch->n_seq_tokens;
 
-                        for (int s0 = 0; s0 < n_seqs; ++s0) {
-                            for (int i = 0; i < n_seq_tokens; ++i) {
-                                const int32_t ti = s0*n_seq_tokens + i;
-                                float f = -INFINITY;
+        GGML_ASSERT(ggml_backend_buffer_is_host(kq_mask->buffer));
 
-                                for (int s = 0; s < ubatch->n_seq_id[s0]; ++s) {
-                                    if (ubatch->seq_id[s0][s] == seq_id && ubatch->pos[ti] <= ubatch->pos[tj]) {
-                                        if (hparams.use_alibi) {
-                                            f = -std::abs(ubatch->pos[ti] - ubatch->pos[tj]);
-                                        } else {
-                                            f = 0.0f;
-                                        }
-                                        break;
-                                    }
-                                }
+        float * data = (float *) kq_mask->data;
 
-                                data[h*(n_kv*n_tokens) + tj*n_kv + ti] = f;
-                            }
-                        }
-                    }
-                }
+        for (const auto & grp : groups) {
+            if (grp.offs < 0) {
+                continue;
             }
-        } else {
-            const int64_t n_tokens     = ubatch->n_tokens;
-            const int64_t n_seq_tokens = ubatch->n_seq_tokens;
-            const int64_t n_seqs       = ubatch->n_seqs;
-            const int64_t n_stride     = ubatch->n_tokens;
-
-            GGML_ASSERT(ggml_backend_buffer_is_host(kq_mask->buffer));
 
-            float * data = (float *) kq_mask->data;
+            float * data_grp = data + grp.offs;
 
-            for (int h = 0; h < 1; ++h) {
-                for (int s1 = 0; s1 < n_seqs; ++s1) {
-                    const llama_seq_id seq_id = ubatch->seq_id[s1][0];
+            for (int j = 0; j < grp.n; ++j) {
+                const int32_t tj = grp.i0 + j;
 
-                    for (int j = 0; j < n_seq_tokens; ++j) {
-                        const int32_t tj = s1*n_seq_tokens + j;
+                const llama_seq_id seq_id = ubatch->seq_id[tj/n_seq_tokens][0];
 
-                        for (int s0 = 0; s0 < n_seqs; ++s0) {
-                            for (int i = 0; i < n_seq_tokens; ++i) {
-                                const int32_t ti = s0*n_seq_tokens + i;
-                                float f = -INFINITY;
+                for (int i = 0; i < grp.n; ++i) {
+                    const int32_t ti = grp.i0 + i;
+                    const int32_t s0 = ti/n_seq_tokens;
 
-                                for (int s = 0; s < ubatch->n_seq_id[s0]; ++s) {
-                                    if (ubatch->seq_id[s0][s] == seq_id) {
-                                        if (hparams.use_alibi) {
-                                            f = -std::abs(ubatch->pos[ti] - ubatch->pos[tj]);
-                                        } else {
-                                            f = 0.0f;
-                                        }
-                                        break;
-                                    }
-                                }
+                    float f = -INFINITY;
 
-                                data[h*(n_tokens*n_tokens) + tj*n_stride + ti] = f;
+                    for (int s = 0; s < ubatch->n_seq_id[s0]; ++s) {
+                        if (ubatch->seq_id[s0][s] == seq_id && (!cparams.causal_attn || ubatch->pos[ti] <= ubatch->pos[tj])) {
+                            if (hparams.use_alibi) {
+                                f = -std::abs(ubatch->pos[ti] - ubatch->pos[tj]);
+                            } else {
+                                f = 0.0f;
                             }
-                        }
-
-                        for (int i = n_tokens; i < n_stride; ++i) {
-                            data[h*(n_tokens*n_tokens) + tj*n_stride + i] = -INFINITY;
+                            break;
                         }
                     }
+
+                    data_grp[j*grp.n + i] = f;
+                }
+            }
+
+            for (int j = grp.n; j < GGML_PAD(grp.n, GGML_KQ_MASK_PAD); ++j) {
+                for (int i = 0; i < grp.n; ++i) {
+                    data_grp[j*grp.n + i] = -INFINITY;
                 }
             }
         }
@@ -424,7 +403,9 @@ void llm_graph_input_attn_kv_unified::set_input(const llama_ubatch * ubatch) {
 
             // For causal attention, use only the previous KV cells
             // of the correct sequence for each token of the ubatch.
-            // It's assumed that if a token in the batch has multiple sequences, they are equivalent.
+            // The mask of a token is determined by its first sequence. If a token in the batch has multiple sequences,
+            // they are either equivalent or the first one is the most specific - e.g. for a tree of draft tokens, each
+            // node is in the sequences of the leaves below it, the first one only shared with its ancestors.
             for (int h = 0; h < 1; ++h) {
                 for (int s = 0; s < n_seqs; ++s) {
                     const llama_seq_id seq_id = ubatch->seq_id[s][0];
@@ -606,6 +587,32 @@ int64_t llm_graph_context::n_pos_per_token() const {
     return arch == LLM_ARCH_QWEN2VL ? 4 : 1;
 }
 
+int64_t llm_graph_context::n_seqs_pool() const {
+    if (!ubatch.seq_id) {
+        // worst case, used when reserving the graph
+        return n_tokens;
+    }
+
+    llama_seq_id seq_id_max = 0;
+    for (uint32_t s = 0; s < ubatch.n_seqs; ++s) {
+        seq_id_max = std::max(seq_id_max, ubatch.seq_id[s][0]);
+    }
+
+    return seq_id_max + 1;
+}
+
+bool llm_graph_context::skip_layer(int il) const {
+    return !cparams.layer_skip.empty() && cparams.layer_skip[il];
+}
+
+int llm_graph_context::il_last() const {
+    int il = n_layer - 1;
+    while (il > 0 && skip_layer(il)) {
+        --il;
+    }
+    return il;
+}
+
 void llm_graph_context::cb(ggml_tensor * cur, const char * name, int il) const {
     if (cb_func) {
         cb_func(ubatch, cur, name, il);
@@ -1033,7 +1040,7 @@ ggml_tensor * llm_graph_context::build_inp_mean() const {
 
     auto & cur = inp->mean;
 
-    cur = ggml_new_tensor_2d(ctx0, GGML_TYPE_F32, n_tokens, n_tokens);
+    cur = ggml_new_tensor_2d(ctx0, GGML_TYPE_F32, n_tokens, n_seqs_pool());
     ggml_set_input(cur);
 
     res->add_input(std::move(inp));
@@ -1046,7 +1053,7 @@ ggml_tensor * llm_graph_context::build_inp_cls() const {
 
     auto & cur = inp->cls;
 
-    cur = ggml_new_tensor_1d(ctx0, GGML_TYPE_I32, n_tokens);
+    cur = ggml_new_tensor_1d(ctx0, GGML_TYPE_I32, n_seqs_pool());
     ggml_set_input(cur);
 
     res->add_input(std::move(inp));
@@ -1198,49 +1205,106 @@ ggml_tensor * llm_graph_context::build_attn_mha(
 
         cur = ggml_reshape_2d(ctx0, cur, n_embd_head_v*n_head, n_tokens);
     } else {
-        ggml_tensor * kq = ggml_mul_mat(ctx0, k, q);
+        if (!v_trans) {
+            // note: avoid this branch
+            v = ggml_cont(ctx0, ggml_transpose(ctx0, v));
+        }
 
-        // note: this op tends to require high floating point range
-        //       while for some models F16 is enough, for others it is not, so we default to F32 here
-        ggml_mul_mat_set_prec(kq, GGML_PREC_F32);
+        // the KQ matrix is [n_kv, n_tokens, n_head] F32 and with long contexts it dominates the compute buffer
+        // the queries are split in chunks with a KQ matrix of at most cparams.kq_chunk_size bytes each
+        // the softmax of a query only depends on its own row of KQ, so each chunk gives its own rows of the output
+        // note: the graph has room for the nodes of the chunks, see llama_context::graph_max_nodes
+        int64_t n_chunks = 1;
+        if (kq_b == nullptr || kq_b->ne[1] == n_tokens) {
+            n_chunks = llm_graph_attn_n_chunks(n_tokens, n_kv, n_head, cparams.kq_chunk_size);
+        }
 
-        if (arch == LLM_ARCH_GROK) {
-            // need to do the following:
-            // multiply by attn_output_multiplyer of 0.08838834764831845
-            // and then :
-            // kq = 30 * tanh(kq / 30)
-            // before the softmax below
+        // balance the chunks
+        const int64_t n_chunk_tokens = (n_tokens + n_chunks - 1)/n_chunks;
 
-            kq = ggml_tanh(ctx0, ggml_scale(ctx0, kq, 0.08838834764831845f/30.0f));
-            kq = ggml_scale(ctx0, kq, 30);
-        }
+        cur = nullptr;
 
-        if (hparams.attn_soft_cap) {
-            kq = ggml_scale(ctx0, kq, 1.0f / hparams.f_attn_logit_softcapping);
-            kq = ggml_tanh (ctx0, kq);
-            kq = ggml_scale(ctx0, kq, hparams.f_attn_logit_softcapping);
-        }
+        for (int64_t i0 = 0; i0 < n_tokens; i0 += n_chunk_tokens) {
+            const int64_t n = std::min(n_chunk_tokens, n_tokens - i0);
 
-        if (kq_b) {
-            kq = ggml_add(ctx0, kq, kq_b);
-        }
+            // the nodes before the attention are added to the graph with the first chunk
+            const int n_nodes_prev = ggml_graph_n_nodes(gf);
 
-        kq = ggml_soft_max_ext(ctx0, kq, kq_mask, kq_scale, hparams.f_max_alibi_bias);
+            ggml_tensor * q_chunk       = q;
+            ggml_tensor * kq_b_chunk    = kq_b;
+            ggml_tensor * kq_mask_chunk = kq_mask;
 
-        if (!v_trans) {
-            // note: avoid this branch
-            v = ggml_cont(ctx0, ggml_transpose(ctx0, v));
-        }
+            if (n < n_tokens) {
+                q_chunk = ggml_view_3d(ctx0, q, q->ne[0], n, q->ne[2], q->nb[1], q->nb[2], i0*q->nb[1]);
 
-        ggml_tensor * kqv = ggml_mul_mat(ctx0, v, kq);
+                if (kq_b) {
+                    kq_b_chunk = ggml_view_3d(ctx0, kq_b, kq_b->ne[0], n, kq_b->ne[2], kq_b->nb[1], kq_b->nb[2], i0*kq_b->nb[1]);
+                }
+                if (kq_mask) {
+                    kq_mask_chunk = ggml_view_2d(ctx0, kq_mask, kq_mask->ne[0], n, kq_mask->nb[1], i0*kq_mask->nb[1]);
+                }
+            }
+
+            ggml_tensor * kq = ggml_mul_mat(ctx0, k, q_chunk);
+
+            // note: this op tends to require high floating point range
+            //       while for some models F16 is enough, for others it is not, so we default to F32 here
+            ggml_mul_mat_set_prec(kq, GGML_PREC_F32);
+
+            if (arch == LLM_ARCH_GROK) {
+                // need to do the following:
+                // multiply by attn_output_multiplyer of 0.08838834764831845
+                // and then :
+                // kq = 30 * tanh(kq / 30)
+                // before the softmax below
+
+                kq = ggml_tanh(ctx0, ggml_scale(ctx0, kq, 0.08838834764831845f/30.0f));
+                kq = ggml_scale(ctx0, kq, 30);
+            }
+
+            if (hparams.attn_soft_cap) {
+                kq = ggml_scale(ctx0, kq, 1.0f / hparams.f_attn_logit_softcapping);
+                kq = ggml_tanh (ctx0, kq);
+                kq = ggml_scale(ctx0, kq, hparams.f_attn_logit_softcapping);
+            }
+
+            if (kq_b_chunk) {
+                kq = ggml_add(ctx0, kq, kq_b_chunk);
+            }
 
-        ggml_tensor * kqv_merged = ggml_permute(ctx0, kqv, 0, 2, 1, 3);
+            kq = ggml_soft_max_ext(ctx0, kq, kq_mask_chunk, kq_scale, hparams.f_max_alibi_bias);
 
-        cur = ggml_cont_2d(ctx0, kqv_merged, n_embd_head_v*n_head, n_tokens);
+            ggml_tensor * kqv = ggml_mul_mat(ctx0, v, kq);
 
-        if (!cparams.offload_kqv) {
-            // all nodes between the KV store and the attention output are run on the CPU
-            ggml_backend_sched_set_tensor_backend(sched, cur, backend_cpu);
+            ggml_tensor * kqv_merged = ggml_permute(ctx0, kqv, 0, 2, 1, 3);
+
+            ggml_tensor * out;
+
+            if (cur == nullptr) {
+                out = ggml_cont_2d(ctx0, kqv_merged, n_embd_head_v*n_head, n);
+
+                // the output of the first chunk is extended to the rows of all the chunks, which write into it
+                if (n < n_tokens) {
+                    out = ggml_pad(ctx0, out, 0, n_tokens - n, 0, 0);
+                }
+
+                cur = out;
+            } else {
+                ggml_tensor * rows = ggml_view_3d(ctx0, cur, n_embd_head_v, n_head, n, cur->nb[1]/n_head, cur->nb[1], i0*cur->nb[1]);
+
+                out = ggml_cpy(ctx0, kqv_merged, rows);
+            }
+
+            if (!cparams.offload_kqv) {
+                // all nodes between the KV store and the attention output are run on the CPU
+                ggml_backend_sched_set_tensor_backend(sched, out, backend_cpu);
+            }
+
+            // compute the chunks one after the other, so that their KQ matrices can share the same memory
+            // the copies into the output are in the graph before the users of the output, as with the KV cache store
+            ggml_build_forward_expand(gf, out);
+
+            GGML_ASSERT(i0 == 0 || ggml_graph_n_nodes(gf) - n_nodes_prev <= LLAMA_ATTN_KQ_CHUNK_MAX_NODES);
         }
     }
 
@@ -1252,12 +1316,89 @@ ggml_tensor * llm_graph_context::build_attn_mha(
 llm_graph_input_attn_no_cache * llm_graph_context::build_attn_inp_no_cache() const {
     auto inp = std::make_unique<llm_graph_input_attn_no_cache>(hparams, cparams);
 
+    auto & groups = inp->groups;
+
     // note: there is no KV cache, so the number of KV values is equal to the number of tokens in the batch
-    inp->kq_mask = ggml_new_tensor_2d(ctx0, GGML_TYPE_F32, n_tokens, GGML_PAD(n_tokens, GGML_KQ_MASK_PAD));
-    //cb(inp_kq_mask, "KQ_mask", -1);
-    ggml_set_input(inp->kq_mask);
+    // the tokens of different sequences do not attend to each other, so if each token belongs to a single sequence
+    // and the tokens of each sequence are contiguous in the ubatch, the attention is evaluated separately for each run
+    if (ubatch.seq_id) {
+        std::set<llama_seq_id> seq_ids;
+
+        for (uint32_t s = 0; s < ubatch.n_seqs; ++s) {
+            if (ubatch.n_seq_id[s] != 1) {
+                groups.clear();
+                break;
+            }
 
-    inp->kq_mask_cnv = cparams.flash_attn ? ggml_cast(ctx0, inp->kq_mask, GGML_TYPE_F16) : inp->kq_mask;
+            const llama_seq_id seq_id = ubatch.seq_id[s][0];
+
+            if (s > 0 && ubatch.seq_id[s - 1][0] == seq_id) {
+                groups.back().n += ubatch.n_seq_tokens;
+                continue;
+            }
+
+            if (!seq_ids.insert(seq_id).second) {
+                // the sequence is scattered across the ubatch
+                groups.clear();
+                break;
+            }
+
+            groups.push_back({ (int32_t) (s*ubatch.n_seq_tokens), (int32_t) ubatch.n_seq_tokens });
+        }
+    }
+
+    // each group adds its own nodes to every layer of the graph, so past a certain number of runs,
+    // the neighbouring runs are merged into groups of roughly n_tokens/n_groups_max tokens that use a mask
+    const int64_t n_groups_max = std::max<int64_t>(1, 1024/n_layer);
+
+    if ((int64_t) groups.size() > n_groups_max) {
+        const int32_t n_group_tokens = (n_tokens + n_groups_max - 1)/n_groups_max;
+
+        std::vector<llm_graph_input_attn_no_cache::group> merged;
+
+        for (const auto & run : groups) {
+            if (!merged.empty() && merged.back().n + run.n <= n_group_tokens) {
+                merged.back().n   += run.n;
+                merged.back().offs = 0;
+            } else {
+                merged.push_back(run);
+            }
+        }
+
+        groups = std::move(merged);
+    }
+
+    if (groups.empty()) {
+        // a single group with a mask over the full batch
+        groups.push_back({ 0, n_tokens, 0 });
+    }
+
+    int64_t n_mask = 0;
+
+    for (auto & grp : groups) {
+        if (grp.offs < 0 && !cparams.causal_attn && !hparams.use_alibi) {
+            continue;
+        }
+
+        grp.offs = n_mask;
+        n_mask += grp.n*GGML_PAD(grp.n, GGML_KQ_MASK_PAD);
+    }
+
+    if (n_mask > 0) {
+        inp->kq_mask = ggml_new_tensor_1d(ctx0, GGML_TYPE_F32, n_mask);
+        //cb(inp_kq_mask, "KQ_mask", -1);
+        ggml_set_input(inp->kq_mask);
+
+        inp->kq_mask_cnv = cparams.flash_attn ? ggml_cast(ctx0, inp->kq_mask, GGML_TYPE_F16) : inp->kq_mask;
+
+        const size_t es = ggml_element_size(inp->kq_mask_cnv);
+
+        for (auto & grp : groups) {
+            if (grp.offs >= 0) {
+                grp.kq_mask = ggml_view_2d(ctx0, inp->kq_mask_cnv, grp.n, GGML_PAD(grp.n, GGML_KQ_MASK_PAD), grp.n*es, grp.offs*es);
+            }
+        }
+    }
 
     return (llm_graph_input_attn_no_cache *) res->add_input(std::move(inp));
 }
@@ -1281,7 +1422,7 @@ ggml_tensor * llm_graph_context::build_attn(
     ggml_build_forward_expand(gf, k_cur);
     ggml_build_forward_expand(gf, v_cur);
 
-    const auto & kq_mask = inp->get_kq_mask();
+    const auto & groups = inp->groups;
 
     ggml_tensor * q = ggml_permute(ctx0, q_cur, 0, 2, 1, 3);
     //cb(q, "q", il);
@@ -1292,7 +1433,40 @@ ggml_tensor * llm_graph_context::build_attn(
     ggml_tensor * v = ggml_permute(ctx0, v_cur, 0, 2, 1, 3);
     //cb(k, "v", il);
 
-    ggml_tensor * cur = build_attn_mha(gf, q, k, v, kq_b, kq_mask, false, kq_scale);
+    ggml_tensor * cur;
+
+    if (groups.size() == 1) {
+        cur = build_attn_mha(gf, q, k, v, kq_b, groups[0].kq_mask, false, kq_scale);
+    } else {
+        std::vector<ggml_tensor *> outs;
+        outs.reserve(groups.size());
+
+        for (const auto & grp : groups) {
+            ggml_tensor * q_grp = ggml_view_3d(ctx0, q, q->ne[0], grp.n, q->ne[2], q->nb[1], q->nb[2], grp.i0*q->nb[1]);
+            ggml_tensor * k_grp = ggml_view_3d(ctx0, k, k->ne[0], grp.n, k->ne[2], k->nb[1], k->nb[2], grp.i0*k->nb[1]);
+            ggml_tensor * v_grp = ggml_view_3d(ctx0, v, v->ne[0], grp.n, v->ne[2], v->nb[1], v->nb[2], grp.i0*v->nb[1]);
+
+            ggml_tensor * kq_b_grp = nullptr;
+            if (kq_b) {
+                kq_b_grp = ggml_view_3d(ctx0, kq_b, grp.n, grp.n, kq_b->ne[2], kq_b->nb[1], kq_b->nb[2], grp.i0*(kq_b->nb[0] + kq_b->nb[1]));
+            }
+
+            outs.push_back(build_attn_mha(gf, q_grp, k_grp, v_grp, kq_b_grp, grp.kq_mask, false, kq_scale));
+        }
+
+        // merge the outputs of the groups pairwise to keep the amount of copied data low
+        while (outs.size() > 1) {
+            size_t n_outs = 0;
+
+            for (size_t i = 0; i < outs.size(); i += 2) {
+                outs[n_outs++] = i + 1 < outs.size() ? ggml_concat(ctx0, outs[i], outs[i + 1], 1) : outs[i];
+            }
+
+            outs.resize(n_outs);
+        }
+
+        cur = outs[0];
+    }
 
     cb(cur, "kqv_out", il);
 
@@ -1620,12 +1794,20 @@ void llm_graph_context::build_pooling(
             {
                 ggml_tensor * inp_mean = build_inp_mean();
                 cur = ggml_mul_mat(ctx0, ggml_cont(ctx0, ggml_transpose(ctx0, inp)), inp_mean);
+
+                if (cparams.embd_norm) {
+                    cur = ggml_l2_norm(ctx0, cur, 1e-12f);
+                }
             } break;
         case LLAMA_POOLING_TYPE_CLS:
         case LLAMA_POOLING_TYPE_LAST:
             {
                 ggml_tensor * inp_cls = build_inp_cls();
                 cur = ggml_get_rows(ctx0, inp, inp_cls);
+
+                if (cparams.embd_norm) {
+                    cur = ggml_l2_norm(ctx0, cur, 1e-12f);
+                }
             } break;
         case LLAMA_POOLING_TYPE_RANK:
             {
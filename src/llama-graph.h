@@ -63,6 +63,17 @@ struct llama_cross {
     std::vector<std::set<llama_seq_id>> seq_ids_enc;
 };
 
+// default max size of the KQ matrix of the non-flash attention, larger matrices are computed in chunks of queries
+#define LLAMA_ATTN_KQ_CHUNK_SIZE (256ull*1024*1024)
+
+// max number of graph nodes of a chunk after the first one, see llm_graph_context::build_attn_mha:
+//   the views of q, kq_b and kq_mask (3), KQ (1), the scale-tanh-scale of Grok (3) and of the logit softcapping (3),
+//   the KQ bias (1), the softmax (1), KQV (1), the permute (1), the view of the output and the copy into it (2)
+#define LLAMA_ATTN_KQ_CHUNK_MAX_NODES (3 + 1 + 3 + 3 + 1 + 1 + 1 + 1 + 2)
+
+// number of chunks of queries of the non-flash attention with a KQ matrix of at most chunk_size bytes each
+int64_t llm_graph_attn_n_chunks(int64_t n_tokens, int64_t n_kv, int64_t n_head, size_t chunk_size);
+
 //
 // llm_graph_input
 //
@@ -152,7 +163,7 @@ public:
 
     void set_input(const llama_ubatch * ubatch) override;
 
-    ggml_tensor * mean; // F32 [n_batch, n_batch]
+    ggml_tensor * mean; // F32 [n_batch, n_seqs_pool]
 
     const llama_cparams & cparams;
 };
@@ -164,7 +175,7 @@ public:
 
     void set_input(const llama_ubatch * ubatch) override;
 
-    ggml_tensor * cls; // I32 [n_batch]
+    ggml_tensor * cls; // I32 [n_seqs_pool]
 
     const llama_cparams & cparams;
 };
@@ -216,10 +227,22 @@ public:
 
     void set_input(const llama_ubatch * ubatch) override;
 
-    ggml_tensor * get_kq_mask() const { return kq_mask_cnv; }
+    // a range of consecutive tokens in the ubatch that do not attend to the tokens outside of it
+    // when the sequences in the ubatch are stored in contiguous runs, each run (or a few neighbouring runs)
+    // forms a group and the attention is evaluated per group instead of over the full [n_tokens, n_tokens] matrix
+    struct group {
+        int32_t i0; // first token of the group
+        int32_t n;  // number of tokens in the group
+
+        int64_t offs = -1; // offset of the group mask in kq_mask, -1 if the group does not need a mask
+
+        ggml_tensor * kq_mask = nullptr; // [n, GGML_PAD(n, GGML_KQ_MASK_PAD)] view of kq_mask_cnv
+    };
 
-    ggml_tensor * kq_mask     = nullptr; // F32 [n_tokens, n_batch]
-    ggml_tensor * kq_mask_cnv = nullptr; //     [n_tokens, n_batch]
+    std::vector<group> groups;
+
+    ggml_tensor * kq_mask     = nullptr; // F32 [sum of the group mask sizes]
+    ggml_tensor * kq_mask_cnv = nullptr; //     [sum of the group mask sizes]
 
     const llama_hparams & hparams;
     const llama_cparams & cparams;
@@ -404,6 +427,15 @@ struct llm_graph_context {
 
     int64_t n_pos_per_token() const;
 
+    // the number of rows of the pooled embeddings - the pooled embedding of a sequence is stored at row seq_id
+    int64_t n_seqs_pool() const;
+
+    // the layers skipped with llama_set_layer_skip(), supported by the builders of llama_model_can_skip_layers()
+    bool skip_layer(int il) const;
+
+    // the last layer that is evaluated
+    int il_last() const;
+
     void cb(ggml_tensor * cur, const char * name, int il) const;
 
     //
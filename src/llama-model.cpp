@@ -4073,6 +4073,10 @@ struct llm_build_llama : public llm_graph_context {
 
         const float kq_scale = hparams.f_attention_scale == 0.0f ? 1.0f/sqrtf(float(n_embd_head)) : hparams.f_attention_scale;
         for (int il = 0; il < n_layer; ++il) {
+            if (skip_layer(il)) {
+                continue;
+            }
+
             ggml_tensor * inpSA = inpL;
 
             // norm
@@ -4133,7 +4137,7 @@ struct llm_build_llama : public llm_graph_context {
                         Qcur, Kcur, Vcur, nullptr, kq_scale, il);
             }
 
-            if (il == n_layer - 1) {
+            if (il == il_last()) {
                 // skip computing output for unused tokens
                 ggml_tensor * inp_out_ids = build_inp_out_ids();
                 cur   = ggml_get_rows(ctx0,   cur, inp_out_ids);
@@ -5942,6 +5946,10 @@ struct llm_build_qwen2 : public llm_graph_context {
         auto * inp_attn = build_attn_inp_kv_unified();
 
         for (int il = 0; il < n_layer; ++il) {
+            if (skip_layer(il)) {
+                continue;
+            }
+
             ggml_tensor * inpSA = inpL;
 
             // norm
@@ -5990,7 +5998,7 @@ struct llm_build_qwen2 : public llm_graph_context {
                         Qcur, Kcur, Vcur, nullptr, 1.0f/sqrtf(float(n_embd_head)), il);
             }
 
-            if (il == n_layer - 1) {
+            if (il == il_last()) {
                 // skip computing output for unused tokens
                 ggml_tensor * inp_out_ids = build_inp_out_ids();
                 cur   = ggml_get_rows(ctx0,   cur, inp_out_ids);
@@ -12105,6 +12113,10 @@ uint64_t llama_model_n_params(const llama_model * model) {
     return model->n_elements();
 }
 
+void llama_model_set_n_threads_tokenize(llama_model * model, int32_t n_threads) {
+    model->vocab.set_n_threads(n_threads);
+}
+
 bool llama_model_has_encoder(const llama_model * model) {
     switch (model->arch) {
         case LLM_ARCH_T5:        return true;
@@ -12124,6 +12136,19 @@ llama_token llama_model_decoder_start_token(const llama_model * model) {
     return model->hparams.dec_start_token_id;
 }
 
+bool llama_model_can_skip_layers(const llama_model * model) {
+    switch (model->arch) {
+        case LLM_ARCH_LLAMA:
+        case LLM_ARCH_MINICPM:
+        case LLM_ARCH_GRANITE:
+        case LLM_ARCH_GRANITE_MOE:
+        case LLM_ARCH_QWEN2:
+            return true;
+        default:
+            return false;
+    }
+}
+
 bool llama_model_is_recurrent(const llama_model * model) {
     switch (model->arch) {
         case     LLM_ARCH_MAMBA:      return true;
@@ -12135,6 +12160,10 @@ bool llama_model_is_recurrent(const llama_model * model) {
     }
 }
 
+bool llama_model_is_causal(const llama_model * model) {
+    return model->hparams.causal_attn;
+}
+
 const std::vector<std::pair<std::string, ggml_tensor *>> & llama_internal_get_tensor_map(const llama_model * model) {
     return model->tensors_by_name;
 }
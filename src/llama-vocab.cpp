@@ -6,15 +6,20 @@
 #include "unicode.h"
 
 #include <algorithm>
+#include <array>
+#include <atomic>
 #include <cassert>
 #include <cfloat>
 #include <climits>
 #include <cstdarg>
 #include <cstring>
+#include <exception>
 #include <forward_list>
 #include <map>
+#include <mutex>
 #include <queue>
 #include <set>
+#include <thread>
 #include <unordered_map>
 #include <cctype>
 
@@ -255,6 +260,11 @@ public:
     }
 
     void pop() =  delete;
+
+    // keeps the allocated storage
+    void clear() {
+        this->c.clear();
+    }
 };
 
 struct llm_bigram_bpe {
@@ -268,11 +278,80 @@ struct llm_bigram_bpe {
     using queue = llama_priority_queue<llm_bigram_bpe, queue_storage, comparator>;
     llm_symbol::index left;
     llm_symbol::index right;
-    std::string text;
+    llama_token id; // token of the merged text
     int rank;
     size_t size;
 };
 
+// symbols of the BPE tokenizer also track the token of their text (LLAMA_TOKEN_NULL if the text is not a token)
+struct llm_symbol_bpe {
+    llm_symbol::index prev;
+    llm_symbol::index next;
+    const char * text;
+    size_t n;
+    llama_token id;
+};
+
+// open-addressing hash table of the merges, keyed on the token ids of the pair
+struct llm_bpe_merge_table {
+    struct entry {
+        uint64_t key;
+        int rank;
+        llama_token id;
+    };
+
+    static constexpr uint64_t key_empty = UINT64_MAX;
+
+    static uint64_t make_key(llama_token left, llama_token right) {
+        return ((uint64_t) (uint32_t) left << 32) | (uint32_t) right;
+    }
+
+    static uint64_t hash(uint64_t key) {
+        key ^= key >> 33;
+        key *= 0xff51afd7ed558ccdULL;
+        key ^= key >> 33;
+        return key;
+    }
+
+    void init(size_t n_merges) {
+        size_t n = 16;
+        while (n < 2*n_merges) {
+            n *= 2;
+        }
+        entries.assign(n, entry{key_empty, -1, LLAMA_TOKEN_NULL});
+        mask = n - 1;
+    }
+
+    // the first insertion of a pair wins, same as the rank map of the vocab
+    void insert(llama_token left, llama_token right, int rank, llama_token id) {
+        const uint64_t key = make_key(left, right);
+        for (uint64_t i = hash(key) & mask; ; i = (i + 1) & mask) {
+            if (entries[i].key == key) {
+                return;
+            }
+            if (entries[i].key == key_empty) {
+                entries[i] = entry{key, rank, id};
+                return;
+            }
+        }
+    }
+
+    const entry * find(llama_token left, llama_token right) const {
+        const uint64_t key = make_key(left, right);
+        for (uint64_t i = hash(key) & mask; ; i = (i + 1) & mask) {
+            if (entries[i].key == key) {
+                return &entries[i];
+            }
+            if (entries[i].key == key_empty) {
+                return nullptr;
+            }
+        }
+    }
+
+    std::vector<entry> entries;
+    uint64_t mask = 0;
+};
+
 struct llm_tokenizer_bpe : llm_tokenizer {
     llm_tokenizer_bpe(const llama_vocab & vocab) {
         GGML_ASSERT(vocab.get_type() == LLAMA_VOCAB_TYPE_BPE);
@@ -410,12 +489,69 @@ struct llm_tokenizer_bpe : llm_tokenizer {
                 };
                 break;
         }
+
+        const auto merges = vocab.get_bpe_merges();
+
+        merge_table.init(merges.size());
+
+        for (size_t i = 0; i < merges.size(); ++i) {
+            const auto & merge = merges[i];
+            if (merge.first.empty() || merge.second.empty()) {
+                continue;
+            }
+
+            const llama_token left  = vocab.text_to_token(merge.first);
+            const llama_token right = vocab.text_to_token(merge.second);
+
+            if (left == LLAMA_TOKEN_NULL || right == LLAMA_TOKEN_NULL) {
+                // symbols that are not tokens have to be merged through the text of the pair
+                merges_by_text = true;
+                continue;
+            }
+
+            merge_table.insert(left, right, i, vocab.text_to_token(merge.first + merge.second));
+        }
+
+        for (uint32_t cpt = 0; cpt < char_tokens.size(); ++cpt) {
+            char_tokens[cpt] = vocab.text_to_token(unicode_cpt_to_utf8(cpt));
+        }
+    }
+
+    // token of the UTF-8 character [text, text + n)
+    llama_token char_to_token(const llama_vocab & vocab, const char * text, size_t n) const {
+        if (n == 1 && (uint8_t) text[0] < 0x80) {
+            return char_tokens[(uint8_t) text[0]];
+        }
+        if (n == 2 && (text[1] & 0xC0) == 0x80) {
+            const uint32_t cpt = ((text[0] & 0x1F) << 6) | (text[1] & 0x3F);
+            if (cpt >= 0x80) {
+                return char_tokens[cpt];
+            }
+        }
+        return vocab.text_to_token(std::string(text, n));
     }
 
     std::vector<std::string> regex_exprs;
+
+    llm_bpe_merge_table merge_table;
+
+    // true if some merges have a side that is not a token
+    bool merges_by_text = false;
+
+    // tokens of the 1- and 2-byte UTF-8 characters (all bytes of the byte-level BPE vocabs)
+    std::array<llama_token, 0x800> char_tokens;
+
+    // tokens of the frequent words, shared by all sessions
+    static constexpr size_t word_cache_max = 65536;
+
+    mutable std::mutex word_cache_mutex;
+    mutable std::unordered_map<std::string, std::vector<llama_token>> word_cache;
 };
 
 struct llm_tokenizer_bpe_session {
+    // minimum number of pre-tokenized words per thread before the tokenization of a text is parallelized
+    static constexpr size_t n_words_per_thread_min = 4096;
+
     llm_tokenizer_bpe_session(const llama_vocab & vocab, const llm_tokenizer_bpe & tokenizer) : vocab(vocab), tokenizer(tokenizer) {}
 
     static void append(const llama_token token_id, std::vector<llama_token> & output)  {
@@ -456,133 +592,235 @@ struct llm_tokenizer_bpe_session {
     }
 
     void tokenize(const std::string & text, std::vector<llama_token> & output) {
-        int final_prev_index = -1;
         const auto word_collection = unicode_regex_split(text, tokenizer.regex_exprs);
 
-        symbols_final.clear();
+        // merges never cross word boundaries, so long inputs are split into contiguous ranges of words that are
+        // tokenized in parallel - the concatenated result is identical to the serial tokenization
+        const size_t n_words = word_collection.size();
+        const size_t n_chunks = std::min<size_t>(vocab.get_n_threads(), n_words/n_words_per_thread_min);
 
-        for (const auto & word : word_collection) {
-            work_queue = llm_bigram_bpe::queue();
-            symbols.clear();
+        if (n_chunks <= 1) {
+            tokenize_words(word_collection, 0, n_words, output);
+            return;
+        }
 
-            int index = 0;
-            size_t offset = 0;
+        std::vector<std::vector<llama_token>> outputs(n_chunks - 1);
+        std::vector<std::exception_ptr>       errors (n_chunks - 1);
 
-            //if (vocab.tokenizer_ignore_merges && vocab.token_to_id.find(word) != vocab.token_to_id.end()) {
-            if (vocab.get_ignore_merges() && vocab.text_to_token(word) != LLAMA_TOKEN_NULL) {
-                symbols.emplace_back(llm_symbol{-1, -1, word.c_str(), word.size()});
-                offset = word.size();
-            }
+        // the workers are joined on every exit path, including when the calling thread throws
+        struct workers_guard {
+            std::vector<std::thread> workers;
 
-            while (offset < word.size()) {
-                llm_symbol sym;
-                size_t char_len = std::min(word.size() - offset, (size_t) unicode_len_utf8(word[offset]));
-                sym.text = word.c_str() + offset;
-                sym.n = char_len;
-                offset += sym.n;
-                sym.prev = index - 1;
-                sym.next = offset == word.size() ? -1 : index + 1;
-                index++;
-                symbols.emplace_back(sym);
+            ~workers_guard() {
+                for (auto & worker : workers) {
+                    if (worker.joinable()) {
+                        worker.join();
+                    }
+                }
             }
-            for (int i = 1; i < (int) symbols.size(); ++i) {
-                add_new_bigram(i - 1, i);
+        } guard;
+
+        guard.workers.reserve(n_chunks - 1);
+
+        for (size_t i = 1; i < n_chunks; ++i) {
+            guard.workers.emplace_back([&, i]() {
+                try {
+                    llm_tokenizer_bpe_session session(vocab, tokenizer);
+                    session.tokenize_words(word_collection, (i*n_words)/n_chunks, ((i + 1)*n_words)/n_chunks, outputs[i - 1]);
+                } catch (...) {
+                    errors[i - 1] = std::current_exception();
+                }
+            });
+        }
+
+        tokenize_words(word_collection, 0, n_words/n_chunks, output);
+
+        for (auto & worker : guard.workers) {
+            worker.join();
+        }
+
+        for (const auto & error : errors) {
+            if (error) {
+                std::rethrow_exception(error);
             }
+        }
 
-            // build token(s)
-            while (!work_queue.empty()) {
-                auto bigram = work_queue.pop_move();
+        for (const auto & out : outputs) {
+            output.insert(output.end(), out.begin(), out.end());
+        }
+    }
 
-                auto & left_symbol = symbols[bigram.left];
-                auto & right_symbol = symbols[bigram.right];
+    // tokenize the pre-tokenized words [i0, i1)
+    void tokenize_words(const std::vector<std::string> & word_collection, size_t i0, size_t i1, std::vector<llama_token> & output) {
+        for (size_t i_word = i0; i_word < i1; ++i_word) {
+            const auto & word = word_collection[i_word];
+
+            if (word.size() > word_memo_len_max) {
+                tokenize_word(word, output);
+                continue;
+            }
 
-                if (left_symbol.n == 0 || right_symbol.n == 0) {
+            // words repeat a lot - reuse the tokens of the words seen before
+            {
+                const auto it = word_memo.find(word);
+                if (it != word_memo.end()) {
+                    output.insert(output.end(), word_memo_tokens.begin() + it->second.first, word_memo_tokens.begin() + it->second.second);
                     continue;
                 }
-                std::string left_token = std::string(left_symbol.text, left_symbol.n);
-                std::string right_token = std::string(right_symbol.text, right_symbol.n);
-                if (left_token + right_token != bigram.text) {
-                    continue;  // Skip this bigram if it's outdated
-                }
+            }
 
-                // merge the right sym into the left one
-                left_symbol.n += right_symbol.n;
-                right_symbol.n = 0;
+            const size_t n_memo = word_memo_tokens.size();
 
-                // remove the right sym from the chain
-                left_symbol.next = right_symbol.next;
-                if (right_symbol.next >= 0) {
-                    symbols[right_symbol.next].prev = bigram.left;
+            bool found = false;
+            {
+                std::lock_guard<std::mutex> lock(tokenizer.word_cache_mutex);
+                const auto it = tokenizer.word_cache.find(word);
+                if (it != tokenizer.word_cache.end()) {
+                    word_memo_tokens.insert(word_memo_tokens.end(), it->second.begin(), it->second.end());
+                    found = true;
                 }
+            }
 
-                add_new_bigram(left_symbol.prev, bigram.left);  // left side of current symbol
-                add_new_bigram(bigram.left, left_symbol.next);  // right side of current symbol
+            if (!found) {
+                tokenize_word(word, word_memo_tokens);
+                word_memo_new.push_back(word);
             }
 
-            // add the finished tokens to the final list keeping correct order for next and prev
-            for (auto & sym : symbols) {
-                if (sym.n > 0) {
-                    sym.prev = final_prev_index;
-                    sym.next = -1;
-                    if (final_prev_index != -1) {
-                        symbols_final[final_prev_index].next = symbols_final.size();
-                    }
-                    symbols_final.emplace_back(sym);
-                    final_prev_index = symbols_final.size() - 1;
-                }
+            word_memo.emplace(word, std::make_pair(n_memo, word_memo_tokens.size()));
+            output.insert(output.end(), word_memo_tokens.begin() + n_memo, word_memo_tokens.end());
+        }
+
+        // publish the newly tokenized words to the other sessions
+        if (!word_memo_new.empty()) {
+            std::lock_guard<std::mutex> lock(tokenizer.word_cache_mutex);
+            if (tokenizer.word_cache.size() + word_memo_new.size() > llm_tokenizer_bpe::word_cache_max) {
+                tokenizer.word_cache.clear();
+            }
+            for (const auto & word : word_memo_new) {
+                const auto & range = word_memo.at(word);
+                tokenizer.word_cache.emplace(word, std::vector<llama_token>(word_memo_tokens.begin() + range.first, word_memo_tokens.begin() + range.second));
             }
+            word_memo_new.clear();
         }
+    }
 
-        symbols = symbols_final;
+private:
+    // longer words are rare, they are not memoized
+    static constexpr size_t word_memo_len_max = 64;
 
-        if (!symbols.empty()) {
-            for (int i = 0; i != -1; i = symbols[i].next) {
-                auto & symbol = symbols[i];
-                if (symbol.n == 0) {
-                    continue;
-                }
+    void tokenize_word(const std::string & word, std::vector<llama_token> & output) {
+        if (vocab.get_ignore_merges()) {
+            const llama_token token = vocab.text_to_token(word);
+            if (token != LLAMA_TOKEN_NULL) {
+                output.push_back(token);
+                return;
+            }
+        }
 
-                const std::string str = std::string(symbol.text, symbol.n);
-                const auto token = vocab.text_to_token(str);
+        symbols.clear();
+        work_queue.clear();
 
-                if (token == LLAMA_TOKEN_NULL) {
-                    for (auto j = str.begin(); j != str.end(); ++j) {
-                        std::string byte_str(1, *j);
-                        auto token_multibyte = vocab.text_to_token(byte_str);
-                        if (token_multibyte != LLAMA_TOKEN_NULL) {
-                            output.push_back(token_multibyte);
-                        }
-                    }
-                } else {
-                    output.push_back(token);
+        int index = 0;
+        size_t offset = 0;
+
+        while (offset < word.size()) {
+            llm_symbol_bpe sym;
+            size_t char_len = std::min(word.size() - offset, (size_t) unicode_len_utf8(word[offset]));
+            sym.text = word.c_str() + offset;
+            sym.n = char_len;
+            sym.id = tokenizer.char_to_token(vocab, sym.text, sym.n);
+            offset += sym.n;
+            sym.prev = index - 1;
+            sym.next = offset == word.size() ? -1 : index + 1;
+            index++;
+            symbols.emplace_back(sym);
+        }
+        for (int i = 1; i < (int) symbols.size(); ++i) {
+            add_new_bigram(i - 1, i);
+        }
+
+        // build token(s)
+        while (!work_queue.empty()) {
+            const auto bigram = work_queue.pop_move();
+
+            auto & left_symbol = symbols[bigram.left];
+            auto & right_symbol = symbols[bigram.right];
+
+            // symbols only grow, so the bigram is outdated if either of its symbols has changed since it was added
+            if (left_symbol.n == 0 || right_symbol.n == 0 || left_symbol.n + right_symbol.n != bigram.size) {
+                continue;
+            }
+
+            // merge the right sym into the left one
+            left_symbol.n += right_symbol.n;
+            left_symbol.id = bigram.id;
+            right_symbol.n = 0;
+
+            // remove the right sym from the chain
+            left_symbol.next = right_symbol.next;
+            if (right_symbol.next >= 0) {
+                symbols[right_symbol.next].prev = bigram.left;
+            }
+
+            add_new_bigram(left_symbol.prev, bigram.left);  // left side of current symbol
+            add_new_bigram(bigram.left, left_symbol.next);  // right side of current symbol
+        }
+
+        if (symbols.empty()) {
+            return;
+        }
+
+        for (int i = 0; i != -1; i = symbols[i].next) {
+            const auto & symbol = symbols[i];
+
+            if (symbol.id != LLAMA_TOKEN_NULL) {
+                output.push_back(symbol.id);
+                continue;
+            }
+
+            for (size_t j = 0; j < symbol.n; ++j) {
+                const std::string byte_str(1, symbol.text[j]);
+                const llama_token token_multibyte = vocab.text_to_token(byte_str);
+                if (token_multibyte != LLAMA_TOKEN_NULL) {
+                    output.push_back(token_multibyte);
                 }
             }
         }
     }
 
-private:
     void add_new_bigram(int left, int right) {
         if (left == -1 || right == -1) {
             return;
         }
-        std::string left_token  = std::string(symbols[left].text,  symbols[left].n);
-        std::string right_token = std::string(symbols[right].text, symbols[right].n);
 
-        int rank_found = -1;
+        const auto & left_symbol  = symbols[left];
+        const auto & right_symbol = symbols[right];
 
-        rank_found = vocab.find_bpe_rank(left_token, right_token);
+        llm_bigram_bpe bigram;
+
+        if (left_symbol.id != LLAMA_TOKEN_NULL && right_symbol.id != LLAMA_TOKEN_NULL) {
+            const auto * merge = tokenizer.merge_table.find(left_symbol.id, right_symbol.id);
+            if (merge == nullptr) {
+                return;
+            }
+            bigram.rank = merge->rank;
+            bigram.id   = merge->id;
+        } else if (tokenizer.merges_by_text) {
+            const std::string left_token  = std::string(left_symbol.text,  left_symbol.n);
+            const std::string right_token = std::string(right_symbol.text, right_symbol.n);
 
-        if (rank_found < 0) {
+            bigram.rank = vocab.find_bpe_rank(left_token, right_token);
+            if (bigram.rank < 0) {
+                return;
+            }
+            bigram.id = vocab.text_to_token(left_token + right_token);
+        } else {
             return;
         }
 
-        llm_bigram_bpe bigram;
-
         bigram.left  = left;
         bigram.right = right;
-        bigram.text  = left_token + right_token;
-        bigram.size  = left_token.size() + right_token.size();
-        bigram.rank  = rank_found;
+        bigram.size  = left_symbol.n + right_symbol.n;
 
         work_queue.push(bigram);
     }
@@ -590,9 +828,13 @@ private:
     const llama_vocab & vocab;
     const llm_tokenizer_bpe & tokenizer;
 
-    std::vector<llm_symbol> symbols;
-    std::vector<llm_symbol> symbols_final;
+    std::vector<llm_symbol_bpe> symbols;
     llm_bigram_bpe::queue work_queue;
+
+    // tokens of the words tokenized by this session: word -> [begin, end) in word_memo_tokens
+    std::unordered_map<std::string, std::pair<size_t, size_t>> word_memo;
+    std::vector<llama_token> word_memo_tokens;
+    std::vector<std::string> word_memo_new;
 };
 
 //
@@ -1266,6 +1508,9 @@ struct llama_vocab::impl {
 
     std::unique_ptr<llm_tokenizer> tokenizer;
 
+    // max number of threads of the tokenization of long texts
+    std::atomic<int32_t> n_threads_tokenize { 1 };
+
     std::vector<char> precompiled_charsmap;
 
     impl(const llama_vocab & vocab) : vocab(vocab) {
@@ -2948,6 +3193,17 @@ int llama_vocab::max_token_len() const {
     return pimpl->max_token_len;
 }
 
+void llama_vocab::set_n_threads(int32_t n_threads) {
+    // more threads do not help, each thread needs at least a few thousand words
+    const int32_t n_threads_max = 64;
+
+    pimpl->n_threads_tokenize = std::min(std::max(1, n_threads), n_threads_max);
+}
+
+int32_t llama_vocab::get_n_threads() const {
+    return pimpl->n_threads_tokenize;
+}
+
 int llama_vocab::find_bpe_rank(const std::string & token_left, const std::string & token_right) const {
     GGML_ASSERT(token_left.find(' ')   == std::string::npos);
     GGML_ASSERT(token_left.find('\n')  == std::string::npos);
@@ -2962,6 +3218,21 @@ int llama_vocab::find_bpe_rank(const std::string & token_left, const std::string
     return it->second;
 }
 
+std::vector<std::pair<std::string, std::string>> llama_vocab::get_bpe_merges() const {
+    int n_merges = 0;
+    for (const auto & it : pimpl->bpe_ranks) {
+        n_merges = std::max(n_merges, it.second + 1);
+    }
+
+    // duplicated merges leave empty entries
+    std::vector<std::pair<std::string, std::string>> result(n_merges);
+    for (const auto & it : pimpl->bpe_ranks) {
+        result[it.second] = it.first;
+    }
+
+    return result;
+}
+
 int32_t llama_vocab::tokenize(
                   const char * text,
                      int32_t   text_len,
@@ -79,8 +79,15 @@ struct llama_vocab {
 
     int max_token_len() const;
 
+    // max number of threads of the tokenization of long texts, the tokenizer state is not part of the model
+    void    set_n_threads(int32_t n_threads);
+    int32_t get_n_threads() const;
+
     int find_bpe_rank(const std::string & token_left, const std::string & token_right) const;
 
+    // the merges indexed by rank
+    std::vector<std::pair<std::string, std::string>> get_bpe_merges() const;
+
     int32_t tokenize(
                    const char * text,
                       int32_t   text_len,
@@ -12,6 +12,7 @@
 #include <cstdint>
 #include <locale>
 #include <map>
+#include <memory>
 #include <regex>
 #include <stdexcept>
 #include <string>
@@ -552,6 +553,804 @@ static std::vector<size_t> unicode_regex_split_stl(const std::string & text, con
     return bpe_offsets;
 }
 
+//
+// minimal linear-time regex engine
+//
+// supports the subset of ECMAScript used by the pre-tokenizer regexes: literals, bracket classes with ranges,
+// class escapes (\s \S \d \D \w \W), groups (capturing groups are treated as (?:...)), alternation, greedy
+// quantifiers (? * + {n} {n,} {n,m}), the ^ and $ anchors and single-codepoint lookaheads (?=X) / (?!X)
+//
+// the pattern is compiled into a Pike VM program, which is executed by a lazily built DFA (see unicode_regex_dfa)
+// matching never backtracks and runs in linear time. the match semantics are leftmost-first, same as std::regex
+//
+// patterns outside of this subset fail to compile and unicode_regex_split() falls back to std::regex
+//
+
+struct unicode_regex_class {
+    uint64_t bits[4] = { 0, 0, 0, 0 };                  // codepoints < 256
+    std::vector<std::pair<uint32_t, uint32_t>> ranges;  // codepoints >= 256, sorted and disjoint after finalize()
+    bool negated = false;
+
+    void add(uint32_t first, uint32_t last) {
+        for (; first <= last && first < 256; ++first) {
+            bits[first >> 6] |= 1ull << (first & 63);
+        }
+        if (first <= last) {
+            ranges.emplace_back(first, last);
+        }
+    }
+
+    void add(const unicode_regex_class & other) {
+        for (int i = 0; i < 4; ++i) {
+            bits[i] |= other.bits[i];
+        }
+        ranges.insert(ranges.end(), other.ranges.begin(), other.ranges.end());
+    }
+
+    void finalize() {
+        std::sort(ranges.begin(), ranges.end());
+        std::vector<std::pair<uint32_t, uint32_t>> merged;
+        for (const auto & range : ranges) {
+            if (!merged.empty() && range.first <= merged.back().second + 1) {
+                merged.back().second = std::max(merged.back().second, range.second);
+            } else {
+                merged.push_back(range);
+            }
+        }
+        ranges = std::move(merged);
+    }
+
+    bool matches(uint32_t cpt) const {
+        bool res;
+        if (cpt < 256) {
+            res = (bits[cpt >> 6] >> (cpt & 63)) & 1;
+        } else {
+            auto it = std::upper_bound(ranges.begin(), ranges.end(), cpt,
+                [](const uint32_t value, const std::pair<uint32_t, uint32_t> & range) {
+                    return value < range.first;
+                });
+            res = it != ranges.begin() && cpt <= (it - 1)->second;
+        }
+        return res != negated;
+    }
+};
+
+struct unicode_regex_program {
+    enum op_type {
+        OP_CLASS,  // consume one codepoint that matches classes[arg]
+        OP_SPLIT,  // continue at x (preferred) and at y
+        OP_JMP,    // continue at x
+        OP_PEEK,   // (?=X): the next codepoint matches classes[arg]
+        OP_NPEEK,  // (?!X): the next codepoint does not match classes[arg], or there is none
+        OP_BOL,    // ^
+        OP_EOL,    // $
+        OP_MATCH,
+    };
+
+    struct inst {
+        op_type op;
+        int x;
+        int y;
+        int arg;
+    };
+
+    std::vector<inst> insts;
+    std::vector<unicode_regex_class> classes;
+};
+
+// recursive-descent parser that emits the program while parsing
+// quantified atoms are parsed once to find their extent and then re-emitted as many times as needed
+struct unicode_regex_compiler {
+    using program = unicode_regex_program;
+
+    const std::vector<uint32_t> & pat;
+    program & prog;
+
+    size_t pos = 0;
+
+    unicode_regex_compiler(const std::vector<uint32_t> & pat, program & prog) : pat(pat), prog(prog) {}
+
+    [[noreturn]] static void unsupported() {
+        throw std::invalid_argument("unsupported regex");
+    }
+
+    bool eof() const {
+        return pos >= pat.size();
+    }
+
+    uint32_t peek() const {
+        return eof() ? 0 : pat[pos];
+    }
+
+    int pc() const {
+        return (int) prog.insts.size();
+    }
+
+    int emit(program::op_type op, int x = 0, int y = 0, int arg = 0) {
+        prog.insts.push_back({ op, x, y, arg });
+        return pc() - 1;
+    }
+
+    int add_class(unicode_regex_class cls) {
+        cls.finalize();
+        prog.classes.push_back(std::move(cls));
+        return (int) prog.classes.size() - 1;
+    }
+
+    // ECMAScript class escapes in the classic "C" locale
+    static bool class_escape(uint32_t c, unicode_regex_class & cls) {
+        switch (c) {
+            case 's': case 'S':
+                cls.add(' ', ' ');
+                cls.add('\t', '\r');
+                break;
+            case 'd': case 'D':
+                cls.add('0', '9');
+                break;
+            case 'w': case 'W':
+                cls.add('0', '9');
+                cls.add('A', 'Z');
+                cls.add('a', 'z');
+                cls.add('_', '_');
+                break;
+            default:
+                return false;
+        }
+        cls.negated = (c == 'S' || c == 'D' || c == 'W');
+        return true;
+    }
+
+    // single character escape, pos points right after the backslash
+    uint32_t char_escape() {
+        if (eof()) {
+            unsupported();
+        }
+        const uint32_t c = pat[pos++];
+        switch (c) {
+            case 'n': return '\n';
+            case 'r': return '\r';
+            case 't': return '\t';
+            case 'f': return '\f';
+            case 'v': return '\v';
+            case '0': return '\0';
+            case 'x':
+            case 'u':
+                {
+                    uint32_t res = 0;
+                    for (int i = 0; i < (c == 'x' ? 2 : 4); ++i) {
+                        const uint32_t h = peek();
+                        if      (h >= '0' && h <= '9') { res = res*16 + (h - '0');      }
+                        else if (h >= 'a' && h <= 'f') { res = res*16 + (h - 'a' + 10); }
+                        else if (h >= 'A' && h <= 'F') { res = res*16 + (h - 'A' + 10); }
+                        else { unsupported(); }
+                        ++pos;
+                    }
+                    return res;
+                }
+            case 'b': case 'B': case 'c': case 'k': case 'p': case 'P':
+                unsupported(); // word boundaries, control escapes, named back-references and unicode properties
+            default:
+                if (c >= '1' && c <= '9') {
+                    unsupported(); // back-references
+                }
+                return c; // identity escape
+        }
+    }
+
+    // parses an escape that denotes a single class member, i.e. a class escape or a character escape
+    void escape(unicode_regex_class & cls) {
+        if (eof()) {
+            unsupported();
+        }
+        if (class_escape(peek(), cls)) {
+            ++pos;
+            return;
+        }
+        const uint32_t c = char_escape();
+        cls.add(c, c);
+    }
+
+    // [...], pos points right after the opening bracket
+    unicode_regex_class bracket() {
+        unicode_regex_class cls;
+        if (peek() == '^') {
+            cls.negated = true;
+            ++pos;
+        }
+        while (true) {
+            if (eof()) {
+                unsupported();
+            }
+            if (peek() == ']') {
+                ++pos;
+                break;
+            }
+
+            uint32_t lo = pat[pos++];
+            if (lo == '[' && (peek() == ':' || peek() == '=' || peek() == '.')) {
+                unsupported(); // POSIX classes
+            }
+            if (lo == '\\') {
+                unicode_regex_class esc;
+                if (class_escape(peek(), esc)) {
+                    if (esc.negated) {
+                        unsupported();
+                    }
+                    ++pos;
+                    cls.add(esc);
+                    continue;
+                }
+                lo = char_escape();
+            }
+
+            uint32_t hi = lo;
+            if (peek() == '-' && pos + 1 < pat.size() && pat[pos + 1] != ']') {
+                ++pos;
+                hi = pat[pos++];
+                if (hi == '\\') {
+                    unicode_regex_class esc;
+                    if (class_escape(peek(), esc)) {
+                        unsupported();
+                    }
+                    hi = char_escape();
+                }
+                if (hi < lo) {
+                    unsupported();
+                }
+            }
+            cls.add(lo, hi);
+        }
+        return cls;
+    }
+
+    // emits a single atom, returns true if it can match the empty string
+    // zero-width assertions set is_assert, they cannot be quantified
+    bool atom(bool & is_assert) {
+        is_assert = false;
+
+        unicode_regex_class cls;
+
+        const uint32_t c = pat[pos++];
+        switch (c) {
+            case '(':
+                {
+                    program::op_type peek_op = program::OP_JMP;
+                    if (peek() == '?') {
+                        switch (pos + 1 < pat.size() ? pat[pos + 1] : 0) {
+                            case ':': break;
+                            case '=': peek_op = program::OP_PEEK;  break;
+                            case '!': peek_op = program::OP_NPEEK; break;
+                            default: unsupported(); // (?i:...), lookbehinds, ...
+                        }
+                        pos += 2;
+                    }
+                    if (peek_op != program::OP_JMP) {
+                        // lookaheads must consist of a single class, escape or literal
+                        const uint32_t l = eof() ? 0 : pat[pos++];
+                        switch (l) {
+                            case '[':  cls = bracket(); break;
+                            case '\\': escape(cls);     break;
+                            case 0: case '(': case ')': case '|': case '.': case '^': case '$':
+                            case '*': case '+': case '?': case '{':
+                                unsupported();
+                            default:
+                                cls.add(l, l);
+                        }
+                        if (peek() != ')') {
+                            unsupported();
+                        }
+                        ++pos;
+                        emit(peek_op, 0, 0, add_class(std::move(cls)));
+                        is_assert = true;
+                        return true;
+                    }
+                    const bool nullable = alternation();
+                    if (peek() != ')') {
+                        unsupported();
+                    }
+                    ++pos;
+                    return nullable;
+                }
+            case '[':
+                cls = bracket();
+                break;
+            case '.':
+                cls.add('\n', '\n');
+                cls.add('\r', '\r');
+                cls.add(0x2028, 0x2029);
+                cls.negated = true;
+                break;
+            case '^':
+                emit(program::OP_BOL);
+                is_assert = true;
+                return true;
+            case '$':
+                emit(program::OP_EOL);
+                is_assert = true;
+                return true;
+            case '\\':
+                escape(cls);
+                break;
+            case ')': case '|': case '*': case '+': case '?': case '{': case '}': case ']':
+                unsupported();
+            default:
+                cls.add(c, c);
+                break;
+        }
+        emit(program::OP_CLASS, 0, 0, add_class(std::move(cls)));
+        return false;
+    }
+
+    // parses an optional quantifier, returns false if there is none
+    bool quantifier(int & n_min, int & n_max) {
+        switch (peek()) {
+            case '?': n_min = 0; n_max =  1; break;
+            case '*': n_min = 0; n_max = -1; break;
+            case '+': n_min = 1; n_max = -1; break;
+            case '{':
+                {
+                    auto number = [&]() {
+                        int res = 0;
+                        if (peek() < '0' || peek() > '9') {
+                            unsupported();
+                        }
+                        while (peek() >= '0' && peek() <= '9') {
+                            res = res*10 + (pat[pos++] - '0');
+                            if (res > 64) {
+                                unsupported();
+                            }
+                        }
+                        return res;
+                    };
+                    ++pos;
+                    n_min = number();
+                    n_max = n_min;
+                    if (peek() == ',') {
+                        ++pos;
+                        n_max = peek() == '}' ? -1 : number();
+                    }
+                    if (peek() != '}' || (n_max >= 0 && n_max < n_min)) {
+                        unsupported();
+                    }
+                    break;
+                }
+            default:
+                return false;
+        }
+        ++pos;
+        if (peek() == '?') {
+            unsupported(); // lazy quantifiers
+        }
+        return true;
+    }
+
+    // atom followed by an optional quantifier, returns true if it can match the empty string
+    bool repeat() {
+        const size_t pos_atom = pos;
+        const int    pc_atom  = pc();
+        const size_t n_cls    = prog.classes.size();
+
+        bool is_assert;
+        const bool nullable = atom(is_assert);
+
+        int n_min;
+        int n_max;
+        if (!quantifier(n_min, n_max)) {
+            return nullable;
+        }
+        if (is_assert || (nullable && n_max != 1)) {
+            unsupported(); // loops over empty matches follow special rules in ECMAScript
+        }
+
+        const size_t pos_end = pos;
+
+        // discard the code of the atom and re-emit it once per repetition
+        auto reemit = [&]() {
+            pos = pos_atom;
+            atom(is_assert);
+        };
+        prog.insts.resize(pc_atom);
+        prog.classes.resize(n_cls);
+
+        for (int i = 0; i < n_min; ++i) {
+            reemit();
+        }
+
+        if (n_max < 0) {
+            // L0: split L1, L2; L1: atom; jmp L0; L2:
+            const int split = emit(program::OP_SPLIT);
+            reemit();
+            emit(program::OP_JMP, split);
+            prog.insts[split].x = split + 1;
+            prog.insts[split].y = pc();
+        } else {
+            // split L1, Lend; L1: atom; split L2, Lend; L2: atom; ... Lend:
+            std::vector<int> splits;
+            for (int i = n_min; i < n_max; ++i) {
+                splits.push_back(emit(program::OP_SPLIT));
+                prog.insts[splits.back()].x = pc();
+                reemit();
+            }
+            for (int split : splits) {
+                prog.insts[split].y = pc();
+            }
+        }
+
+        pos = pos_end;
+
+        return nullable || n_min == 0;
+    }
+
+    // sequence of repeats, returns true if it can match the empty string
+    bool concatenation() {
+        bool nullable = true;
+        while (!eof() && peek() != '|' && peek() != ')') {
+            nullable = repeat() && nullable;
+        }
+        return nullable;
+    }
+
+    // a|b|..., returns true if it can match the empty string
+    bool alternation() {
+        // split L1, L2; L1: a; jmp Lend; L2: split L3, L4; L3: b; jmp Lend; L4: ...
+        std::vector<int> jmps;
+        bool nullable = false;
+        while (true) {
+            const int split = emit(program::OP_SPLIT);
+            prog.insts[split].x = split + 1;
+            nullable = concatenation() || nullable;
+            if (peek() != '|') {
+                // the last alternative does not need the split
+                prog.insts.erase(prog.insts.begin() + split);
+                for (int i = split; i < pc(); ++i) {
+                    auto & inst = prog.insts[i];
+                    if (inst.op == program::OP_SPLIT || inst.op == program::OP_JMP) {
+                        inst.x -= inst.x > split;
+                        inst.y -= inst.y > split;
+                    }
+                }
+                break;
+            }
+            ++pos;
+            jmps.push_back(emit(program::OP_JMP));
+            prog.insts[split].y = pc();
+        }
+        for (int jmp : jmps) {
+            prog.insts[jmp].x = pc();
+        }
+        return nullable;
+    }
+
+    void compile() {
+        const bool nullable = alternation();
+        if (!eof() || nullable) {
+            unsupported(); // unbalanced parentheses, or a pattern that matches the empty string
+        }
+        emit(program::OP_MATCH);
+    }
+};
+
+static bool unicode_regex_compile(const std::vector<uint32_t> & pattern, unicode_regex_program & prog) {
+    try {
+        unicode_regex_compiler(pattern, prog).compile();
+    } catch (const std::invalid_argument & /*ex*/) {
+        return false;
+    }
+    return true;
+}
+
+// lazily built DFA over the Pike VM: a state is the priority-ordered list of threads of the VM, and a transition
+// also records which thread each new thread comes from, so that the start of the match can be tracked per thread
+// (a tagged DFA). the lookaheads depend on the codepoint after the consumed one, so the transitions are keyed on
+// both codepoints. codepoints are mapped to equivalence classes that no class of the program can tell apart
+struct unicode_regex_dfa {
+    using program = unicode_regex_program;
+
+    // the states and the transitions are flushed past this size - the cache is per thread, so this bounds the memory
+    // of each regex in each thread that tokenizes
+    static constexpr size_t MAX_CACHE_SIZE = 1024*1024;
+
+    struct state {
+        std::vector<int> pcs;     // OP_CLASS and OP_MATCH instructions, in priority order
+        bool matched;             // a match has been found, no new threads are started
+        int  match_idx;           // index of the first OP_MATCH in pcs, or -1
+        std::vector<int> next;    // transition index per (eq class of the codepoint, eq class of the next one), -1 if not computed yet
+    };
+
+    struct transition {
+        int              state;
+        std::vector<int> src;     // thread of the previous state each thread comes from, -1 for a new thread
+    };
+
+    const program prog;
+
+    // codepoint equivalence classes
+    uint16_t              eq_byte[256];
+    std::vector<uint32_t> eq_bounds;  // codepoints >= 256: [eq_bounds[i], eq_bounds[i+1]) maps to eq_ids[i]
+    std::vector<uint16_t> eq_ids;
+    std::vector<uint32_t> eq_repr;    // one codepoint of each class
+    int                   n_eq = 0;   // the eq class n_eq denotes the end of the text
+
+    std::vector<state>      states;
+    std::vector<transition> transitions;
+    std::map<std::pair<std::vector<int>, bool>, int> state_ids;
+    std::vector<int> init_ids;        // initial state per (eq class of the first codepoint, start of the text)
+    size_t           cache_size = 0;  // approximate size of the states and the transitions in bytes
+
+    // scratch buffers
+    std::vector<uint32_t> mark;
+    uint32_t              gen = 0;
+    std::vector<int>      pcs;
+    std::vector<int>      src;
+    std::vector<size_t>   starts;
+    std::vector<size_t>   starts_next;
+
+    explicit unicode_regex_dfa(program && p) : prog(std::move(p)) {
+        std::map<std::vector<bool>, uint16_t> sig_ids;
+        auto sig_id = [&](uint32_t cpt) {
+            std::vector<bool> sig(prog.classes.size());
+            for (size_t i = 0; i < prog.classes.size(); ++i) {
+                sig[i] = prog.classes[i].matches(cpt);
+            }
+            auto res = sig_ids.emplace(std::move(sig), (uint16_t) eq_repr.size());
+            if (res.second) {
+                eq_repr.push_back(cpt);
+            }
+            return res.first->second;
+        };
+
+        for (uint32_t cpt = 0; cpt < 256; ++cpt) {
+            eq_byte[cpt] = sig_id(cpt);
+        }
+
+        eq_bounds.push_back(256);
+        for (const auto & cls : prog.classes) {
+            for (const auto & range : cls.ranges) {
+                eq_bounds.push_back(range.first);
+                eq_bounds.push_back(range.second + 1);
+            }
+        }
+        std::sort(eq_bounds.begin(), eq_bounds.end());
+        eq_bounds.erase(std::unique(eq_bounds.begin(), eq_bounds.end()), eq_bounds.end());
+        for (uint32_t bound : eq_bounds) {
+            eq_ids.push_back(sig_id(bound));
+        }
+
+        n_eq = (int) eq_repr.size();
+
+        mark.assign(prog.insts.size(), 0);
+        init_ids.assign(2*(n_eq + 1), -1);
+    }
+
+    int eq(uint32_t cpt) const {
+        if (cpt < 256) {
+            return eq_byte[cpt];
+        }
+        return eq_ids[std::upper_bound(eq_bounds.begin(), eq_bounds.end(), cpt) - eq_bounds.begin() - 1];
+    }
+
+    void flush() {
+        states.clear();
+        transitions.clear();
+        state_ids.clear();
+        std::fill(init_ids.begin(), init_ids.end(), -1);
+        cache_size = 0;
+    }
+
+    // follow the epsilon transitions of pc, ctx is the eq class of the next codepoint
+    void add(int pc, int source, int ctx, bool bol) {
+        if (mark[pc] == gen) {
+            return;
+        }
+        mark[pc] = gen;
+
+        const auto & inst = prog.insts[pc];
+        switch (inst.op) {
+            case program::OP_SPLIT:
+                add(inst.x, source, ctx, bol);
+                add(inst.y, source, ctx, bol);
+                break;
+            case program::OP_JMP:
+                add(inst.x, source, ctx, bol);
+                break;
+            case program::OP_PEEK:
+                if (ctx < n_eq && prog.classes[inst.arg].matches(eq_repr[ctx])) {
+                    add(pc + 1, source, ctx, bol);
+                }
+                break;
+            case program::OP_NPEEK:
+                if (!(ctx < n_eq && prog.classes[inst.arg].matches(eq_repr[ctx]))) {
+                    add(pc + 1, source, ctx, bol);
+                }
+                break;
+            case program::OP_BOL:
+                if (bol) {
+                    add(pc + 1, source, ctx, bol);
+                }
+                break;
+            case program::OP_EOL:
+                if (ctx == n_eq) {
+                    add(pc + 1, source, ctx, bol);
+                }
+                break;
+            case program::OP_CLASS:
+            case program::OP_MATCH:
+                pcs.push_back(pc);
+                src.push_back(source);
+                break;
+        }
+    }
+
+    void begin_closure() {
+        pcs.clear();
+        src.clear();
+        if (++gen == 0) {
+            std::fill(mark.begin(), mark.end(), 0);
+            gen = 1;
+        }
+    }
+
+    int intern(bool matched) {
+        auto res = state_ids.emplace(std::make_pair(pcs, matched), (int) states.size());
+        if (res.second) {
+            int match_idx = -1;
+            for (size_t i = 0; i < pcs.size(); ++i) {
+                if (prog.insts[pcs[i]].op == program::OP_MATCH) {
+                    match_idx = (int) i;
+                    break;
+                }
+            }
+            states.push_back({ pcs, matched, match_idx, std::vector<int>(n_eq*(n_eq + 1), -1) });
+            cache_size += sizeof(state) + (2*pcs.size() + n_eq*(n_eq + 1))*sizeof(int); // the pcs are also in state_ids
+        }
+        return res.first->second;
+    }
+
+    int init_state(int ctx, bool bol) {
+        int & id = init_ids[2*ctx + bol];
+        if (id < 0) {
+            begin_closure();
+            add(0, -1, ctx, bol);
+            id = intern(false);
+        }
+        return id;
+    }
+
+    const transition & step(int s, int cur, int ctx) {
+        const int key = cur*(n_eq + 1) + ctx;
+        if (states[s].next[key] < 0) {
+            const state & st = states[s];
+            const uint32_t cpt = eq_repr[cur];
+            const int n = st.match_idx >= 0 ? st.match_idx : (int) st.pcs.size();
+
+            begin_closure();
+            for (int i = 0; i < n; ++i) {
+                const auto & inst = prog.insts[st.pcs[i]];
+                if (inst.op == program::OP_CLASS && prog.classes[inst.arg].matches(cpt)) {
+                    add(st.pcs[i] + 1, i, ctx, false);
+                }
+            }
+            const bool matched = st.matched || st.match_idx >= 0;
+            if (!matched) {
+                // a new thread for a match starting at the next codepoint has the lowest priority
+                add(0, -1, ctx, false);
+            }
+            const int next = intern(matched); // note: invalidates st
+            transitions.push_back({ next, src });
+            cache_size += sizeof(transition) + src.size()*sizeof(int);
+            states[s].next[key] = (int) transitions.size() - 1;
+        }
+        return transitions[states[s].next[key]];
+    }
+
+    // leftmost-first search in text[pos, end), beg is the start of the text, returns false if there is no match
+    bool search(const uint32_t * text, size_t beg, size_t pos, size_t end, size_t & match_start, size_t & match_end) {
+        if (cache_size > MAX_CACHE_SIZE) {
+            flush();
+        }
+
+        bool matched = false;
+
+        int s = init_state(pos < end ? eq(text[pos]) : n_eq, pos == beg);
+        starts.assign(states[s].pcs.size(), pos);
+
+        for (size_t p = pos; ; ++p) {
+            {
+                const state & st = states[s];
+                if (st.match_idx >= 0) {
+                    matched     = true;
+                    match_start = starts[st.match_idx];
+                    match_end   = p;
+                }
+                if (p >= end || (st.matched && st.pcs.empty())) {
+                    break;
+                }
+            }
+
+            const transition & t = step(s, eq(text[p]), p + 1 < end ? eq(text[p + 1]) : n_eq);
+
+            starts_next.resize(t.src.size());
+            for (size_t i = 0; i < t.src.size(); ++i) {
+                starts_next[i] = t.src[i] < 0 ? p + 1 : starts[t.src[i]];
+            }
+            std::swap(starts, starts_next);
+            s = t.state;
+        }
+
+        return matched;
+    }
+};
+
+// the pre-tokenizer regexes are fixed, so the compiled regexes are cached per thread
+// collapsed regexes are parsed byte by byte, the others as UTF-8
+// returns nullptr if the regex is to be matched with std::regex
+static unicode_regex_dfa * unicode_regex_get_dfa(const std::string & regex_expr, bool collapsed, unicode_regex_engine engine) {
+    thread_local std::map<std::pair<std::string, bool>, std::unique_ptr<unicode_regex_dfa>> cache;
+
+    if (engine == UNICODE_REGEX_ENGINE_STL) {
+        return nullptr;
+    }
+
+    const auto key = std::make_pair(regex_expr, collapsed);
+
+    auto it = cache.find(key);
+    if (it == cache.end()) {
+        std::vector<uint32_t> pattern;
+        if (collapsed) {
+            pattern.reserve(regex_expr.size());
+            for (const char c : regex_expr) {
+                pattern.push_back((uint8_t) c);
+            }
+        } else {
+            pattern = unicode_cpts_from_utf8(regex_expr);
+        }
+
+        std::unique_ptr<unicode_regex_dfa> dfa;
+
+        unicode_regex_program prog;
+        if (unicode_regex_compile(pattern, prog)) {
+            dfa.reset(new unicode_regex_dfa(std::move(prog)));
+        }
+
+        it = cache.emplace(key, std::move(dfa)).first;
+    }
+
+    auto * res = it->second.get();
+    if (res == nullptr && engine == UNICODE_REGEX_ENGINE_DFA) {
+        throw std::runtime_error("regex not supported by the built-in regex engine: " + regex_expr);
+    }
+
+    return res;
+}
+
+// same as unicode_regex_split_stl, but using the minimal regex engine
+static std::vector<size_t> unicode_regex_split_dfa(const std::vector<uint32_t> & text, unicode_regex_dfa & dfa, const std::vector<size_t> & offsets) {
+    std::vector<size_t> bpe_offsets; // store the offset of each word
+    bpe_offsets.reserve(offsets.size()); // Reserve memory for the approximate size
+    size_t start = 0;
+    for (auto offset : offsets) {
+        const size_t end = start + offset;
+
+        size_t pos = start;
+        size_t match_start;
+        size_t match_end;
+        while (pos < end && dfa.search(text.data(), start, pos, end, match_start, match_end)) {
+            if (match_start > pos) {
+                bpe_offsets.emplace_back(match_start - pos);
+            }
+            bpe_offsets.emplace_back(match_end - match_start);
+            pos = match_end;
+        }
+
+        if (pos < end) {
+            bpe_offsets.emplace_back(end - pos);
+        }
+        start = end;
+    }
+
+    return bpe_offsets;
+}
+
 static std::vector<size_t> unicode_regex_split_custom(const std::string & text, const std::string & regex_expr, const std::vector<size_t> & offsets) {
     std::vector<size_t> bpe_offsets;
 
@@ -667,7 +1466,7 @@ uint32_t unicode_tolower(uint32_t cpt) {
     return cpt;  // Return the original code point if no lowercase mapping is found
 }
 
-std::vector<std::string> unicode_regex_split(const std::string & text, const std::vector<std::string> & regex_exprs) {
+std::vector<std::string> unicode_regex_split(const std::string & text, const std::vector<std::string> & regex_exprs, unicode_regex_engine engine) {
     // unicode categories
     static const std::map<std::string, int> k_ucat_enum = {
         { "\\p{N}", unicode_cpt_flags::NUMBER },
@@ -739,7 +1538,7 @@ std::vector<std::string> unicode_regex_split(const std::string & text, const std
 
     for (const auto & regex_expr : regex_exprs) {
         // first, see if we have an efficient custom regex implementation
-        auto tmp = unicode_regex_split_custom(text, regex_expr, bpe_offsets);
+        auto tmp = engine == UNICODE_REGEX_ENGINE_AUTO ? unicode_regex_split_custom(text, regex_expr, bpe_offsets) : std::vector<size_t>();
 
         if (!tmp.empty()) {
             bpe_offsets = std::move(tmp);
@@ -809,22 +1608,38 @@ std::vector<std::string> unicode_regex_split(const std::string & text, const std
 
                 //printf("text_collapsed: %s\n", text_collapsed.c_str());
                 //printf("regex_expr_collapsed: %s\n", regex_expr_collapsed.c_str());
-                bpe_offsets = unicode_regex_split_stl(text_collapsed, regex_expr_collapsed, bpe_offsets);
+                auto * dfa = unicode_regex_get_dfa(regex_expr_collapsed, true, engine);
+                if (dfa) {
+                    // the collapsed regex is made of bytes, not of UTF-8 sequences
+                    std::vector<uint32_t> cpts_collapsed(text_collapsed.size());
+                    for (size_t i = 0; i < text_collapsed.size(); ++i) {
+                        cpts_collapsed[i] = (uint8_t) text_collapsed[i];
+                    }
+                    bpe_offsets = unicode_regex_split_dfa(cpts_collapsed, *dfa, bpe_offsets);
+                } else {
+                    bpe_offsets = unicode_regex_split_stl(text_collapsed, regex_expr_collapsed, bpe_offsets);
+                }
             } else {
                 // no unicode category used, we can use std::wregex directly
-                const std::wstring wregex_expr = unicode_wstring_from_utf8(regex_expr);
 
                 // std::wregex \s does not mach non-ASCII whitespaces, using 0x0B as fallback
-                std::wstring wtext(cpts.begin(), cpts.end());
-                for (size_t i = 0; i < wtext.size(); ++i) {
-                    if (wtext[i] > 0x7F && unicode_cpt_flags_from_cpt(wtext[i]).is_whitespace) {
-                        wtext[i] = 0x0B;
+                std::vector<uint32_t> cpts_ws(cpts);
+                for (size_t i = 0; i < cpts_ws.size(); ++i) {
+                    if (cpts_ws[i] > 0x7F && unicode_cpt_flags_from_cpt(cpts_ws[i]).is_whitespace) {
+                        cpts_ws[i] = 0x0B;
                     }
                 }
 
                 //printf("text: %s\n", text.c_str());
                 //printf("regex_expr: %s\n", regex_expr.c_str());
-                bpe_offsets = unicode_regex_split_stl(wtext, wregex_expr, bpe_offsets);
+                auto * dfa = unicode_regex_get_dfa(regex_expr, false, engine);
+                if (dfa) {
+                    bpe_offsets = unicode_regex_split_dfa(cpts_ws, *dfa, bpe_offsets);
+                } else {
+                    const std::wstring wregex_expr = unicode_wstring_from_utf8(regex_expr);
+                    const std::wstring wtext(cpts_ws.begin(), cpts_ws.end());
+                    bpe_offsets = unicode_regex_split_stl(wtext, wregex_expr, bpe_offsets);
+                }
             }
         } catch (std::regex_error & e) {
             fprintf(stderr, "Failed to process regex: '%s'\n", regex_expr.c_str());
@@ -63,4 +63,13 @@ uint8_t     unicode_utf8_to_byte(const std::string & utf8);
 
 uint32_t unicode_tolower(uint32_t cpt);
 
-std::vector<std::string> unicode_regex_split(const std::string & text, const std::vector<std::string> & regex_exprs);
+// a regex is matched by its hand-written splitter if there is one, else by the built-in regex engine if it supports the regex,
+// else by std::regex - the other engines are used to test the splitters against each other
+enum unicode_regex_engine {
+    UNICODE_REGEX_ENGINE_AUTO,
+    UNICODE_REGEX_ENGINE_DFA, // the built-in regex engine only, throws if it does not support the regex
+    UNICODE_REGEX_ENGINE_STL, // std::regex only
+};
+
+std::vector<std::string> unicode_regex_split(const std::string & text, const std::vector<std::string> & regex_exprs,
+                                             unicode_regex_engine engine = UNICODE_REGEX_ENGINE_AUTO);
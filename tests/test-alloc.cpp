@@ -0,0 +1,188 @@
+// the graph allocator must not place tensors that are alive at the same time in overlapping memory
+
+#include "ggml.h"
+#include "ggml-alloc.h"
+#include "ggml-backend.h"
+#include "ggml-cpu.h"
+
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <random>
+#include <vector>
+
+// one of the most recent tensors, so that most of them are used and freed soon after they are allocated
+static ggml_tensor * pick(const std::vector<ggml_tensor *> & tensors, std::mt19937 & rng) {
+    return tensors[tensors.size() - 1 - std::uniform_int_distribution<size_t>(0, std::min<size_t>(tensors.size(), 6) - 1)(rng)];
+}
+
+// random graph of ops that can and cannot run inplace, with views, mixing small and large tensors
+static ggml_cgraph * build_graph(ggml_context * ctx, int n_nodes, std::mt19937 & rng) {
+    static const int64_t dims[] = { 8, 16, 64, 256 };
+
+    auto dim = [&]() {
+        return dims[std::uniform_int_distribution<int>(0, 3)(rng)];
+    };
+
+    std::vector<ggml_tensor *> tensors;
+    for (int i = 0; i < 8; ++i) {
+        ggml_tensor * t = ggml_new_tensor_2d(ctx, GGML_TYPE_F32, dim(), dim());
+        ggml_set_input(t);
+        tensors.push_back(t);
+    }
+
+    ggml_cgraph * gf = ggml_new_graph_custom(ctx, 4*n_nodes, false);
+
+    for (int i = 0; i < n_nodes; ++i) {
+        ggml_tensor * a = pick(tensors, rng);
+        ggml_tensor * cur = nullptr;
+
+        switch (std::uniform_int_distribution<int>(0, 6)(rng)) {
+            case 0: cur = ggml_silu(ctx, a); break;
+            case 1: cur = ggml_scale(ctx, a, 0.5f); break;
+            case 2:
+                {
+                    ggml_tensor * b = pick(tensors, rng);
+                    cur = ggml_are_same_shape(a, b) ? ggml_add(ctx, a, b) : ggml_add(ctx, a, a);
+                } break;
+            case 3:
+                {
+                    ggml_tensor * b = ggml_new_tensor_2d(ctx, GGML_TYPE_F32, a->ne[0], dim());
+                    ggml_set_input(b);
+                    cur = ggml_mul_mat(ctx, b, a);
+                } break;
+            case 4: cur = ggml_cont(ctx, ggml_transpose(ctx, a)); break;
+            case 5: cur = ggml_scale(ctx, ggml_view_2d(ctx, a, a->ne[0], (a->ne[1] + 1)/2, a->nb[1], 0), 2.0f); break;
+            case 6: cur = ggml_concat(ctx, a, a, 1); break;
+        }
+
+        tensors.push_back(cur);
+
+        if (std::uniform_int_distribution<int>(0, 15)(rng) == 0) {
+            ggml_set_output(cur);
+            ggml_build_forward_expand(gf, cur);
+        }
+    }
+
+    ggml_build_forward_expand(gf, tensors.back());
+
+    return gf;
+}
+
+// the lifetimes follow the rules of ggml-alloc.c: a tensor is allocated at its node (inputs and leafs before all the
+// nodes) and freed after its last use - or its last use through a view; outputs and tensors that are not used are
+// never freed. a node may reuse the memory of a parent that is freed at this node
+static bool check_graph(ggml_cgraph * gf) {
+    struct lifetime {
+        int first;
+        int last;
+    };
+
+    std::map<ggml_tensor *, lifetime> lifetimes;
+
+    auto root = [](ggml_tensor * t) {
+        return t->view_src ? t->view_src : t;
+    };
+
+    for (int i = 0; i < ggml_graph_n_nodes(gf); ++i) {
+        ggml_tensor * node = ggml_graph_node(gf, i);
+        if (node->view_src == nullptr) {
+            lifetimes[node] = { i, i };
+        }
+    }
+    // the leafs
+    for (int i = 0; i < ggml_graph_n_nodes(gf); ++i) {
+        ggml_tensor * node = ggml_graph_node(gf, i);
+        for (int j = 0; j < GGML_MAX_SRC; ++j) {
+            ggml_tensor * src = node->src[j];
+            if (src && src->view_src == nullptr && lifetimes.find(src) == lifetimes.end()) {
+                lifetimes[src] = { -1, -1 };
+            }
+        }
+    }
+
+    // uses of the tensors, and of the views that are never used
+    std::map<ggml_tensor *, int> n_uses;
+    for (int i = 0; i < ggml_graph_n_nodes(gf); ++i) {
+        ggml_tensor * node = ggml_graph_node(gf, i);
+        for (int j = 0; j < GGML_MAX_SRC; ++j) {
+            if (node->src[j]) {
+                auto & lt = lifetimes[root(node->src[j])];
+                lt.last = std::max(lt.last, i);
+                n_uses[node->src[j]]++;
+            }
+        }
+    }
+    for (int i = 0; i < ggml_graph_n_nodes(gf); ++i) {
+        ggml_tensor * node = ggml_graph_node(gf, i);
+        if ((node->flags & GGML_TENSOR_FLAG_OUTPUT) || n_uses[node] == 0) {
+            lifetimes[root(node)].last = INT_MAX;
+        }
+    }
+
+    std::vector<std::pair<ggml_tensor *, lifetime>> owners(lifetimes.begin(), lifetimes.end());
+
+    for (size_t i = 0; i < owners.size(); ++i) {
+        for (size_t j = i + 1; j < owners.size(); ++j) {
+            ggml_tensor * a = owners[i].first;
+            ggml_tensor * b = owners[j].first;
+
+            const lifetime la = owners[i].second;
+            const lifetime lb = owners[j].second;
+
+            if (la.last < lb.first || lb.last < la.first) {
+                continue;
+            }
+            // reused inplace
+            if ((la.last == lb.first || lb.last == la.first) && a->data == b->data) {
+                continue;
+            }
+
+            const uintptr_t a0 = (uintptr_t) a->data;
+            const uintptr_t b0 = (uintptr_t) b->data;
+            if (a0 < b0 + ggml_nbytes(b) && b0 < a0 + ggml_nbytes(a)) {
+                fprintf(stderr, "%s: failed: '%s' [%d, %d] and '%s' [%d, %d] overlap\n", __func__,
+                        ggml_op_desc(a), la.first, la.last, ggml_op_desc(b), lb.first, lb.last);
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+int main() {
+    std::mt19937 rng(42);
+
+    ggml_gallocr_t galloc = ggml_gallocr_new(ggml_backend_cpu_buffer_type());
+
+    bool success = true;
+
+    for (int i = 0; i < 100 && success; ++i) {
+        ggml_init_params params = {
+            /* .mem_size   = */ 16*1024*1024,
+            /* .mem_buffer = */ NULL,
+            /* .no_alloc   = */ true,
+        };
+        ggml_context * ctx = ggml_init(params);
+
+        ggml_cgraph * gf = build_graph(ctx, std::uniform_int_distribution<int>(10, 400)(rng), rng);
+
+        if (!ggml_gallocr_alloc_graph(galloc, gf)) {
+            fprintf(stderr, "%s: failed to allocate the graph\n", __func__);
+            success = false;
+        } else {
+            success = check_graph(gf);
+        }
+
+        ggml_free(ctx);
+    }
+
+    ggml_gallocr_free(galloc);
+
+    fprintf(stderr, "%s: %s\n", __func__, success ? "passed" : "failed");
+
+    return success ? 0 : 1;
+}
@@ -0,0 +1,168 @@
+// the non-flash attention computed in chunks of queries must give the same output as in a single chunk
+
+#include "llama-graph.h"
+#include "llama-batch.h"
+#include "llama-cparams.h"
+#include "llama-hparams.h"
+
+#include "ggml.h"
+#include "ggml-cpu.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+
+struct test_case {
+    bool  mask;
+    bool  kq_b;
+    float max_bias;
+    bool  softcap;
+};
+
+static void set_random(ggml_tensor * t, std::mt19937 & rng) {
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+
+    float * data = (float *) t->data;
+    for (int64_t i = 0; i < ggml_nelements(t); ++i) {
+        data[i] = dist(rng);
+    }
+}
+
+// the attention output of the inputs with a KQ matrix of at most kq_chunk_size bytes per chunk
+static std::vector<float> attn(const test_case & tc, size_t kq_chunk_size, int64_t n_tokens, int64_t n_kv, int64_t n_head, int64_t n_head_kv, int64_t n_embd_head) {
+    ggml_init_params params = {
+        /* .mem_size   = */ 256*1024*1024,
+        /* .mem_buffer = */ NULL,
+        /* .no_alloc   = */ false,
+    };
+    ggml_context * ctx = ggml_init(params);
+
+    llama_hparams hparams = {};
+    hparams.n_layer                  = 1;
+    hparams.n_head_arr[0]            = n_head;
+    hparams.n_head_kv_arr[0]         = n_head_kv;
+    hparams.f_max_alibi_bias         = tc.max_bias;
+    hparams.attn_soft_cap            = tc.softcap;
+    hparams.f_attn_logit_softcapping = 20.0f;
+
+    llama_cparams cparams = {};
+    cparams.n_seq_max     = 1;
+    cparams.offload_kqv   = true;
+    cparams.flash_attn    = false;
+    cparams.kq_chunk_size = kq_chunk_size;
+
+    llama_ubatch ubatch = {};
+
+    const llm_graph_cb cb = [](const llama_ubatch &, ggml_tensor *, const char *, int) {};
+
+    const llm_graph_params gparams = {
+        /*.ctx         =*/ ctx,
+        /*.arch        =*/ LLM_ARCH_LLAMA,
+        /*.hparams     =*/ hparams,
+        /*.cparams     =*/ cparams,
+        /*.ubatch      =*/ ubatch,
+        /*.sched       =*/ nullptr,
+        /*.backend_cpu =*/ nullptr,
+        /*.cvec        =*/ nullptr,
+        /*.loras       =*/ nullptr,
+        /*.memory      =*/ nullptr,
+        /*.cross       =*/ nullptr,
+        /*.n_outputs   =*/ (int32_t) n_tokens,
+        /*.cb          =*/ cb,
+    };
+
+    llm_graph_context gctx(gparams);
+
+    // the same inputs for all the calls
+    std::mt19937 rng(42);
+
+    ggml_tensor * q = ggml_new_tensor_3d(ctx, GGML_TYPE_F32, n_embd_head, n_tokens, n_head);
+    ggml_tensor * k = ggml_new_tensor_3d(ctx, GGML_TYPE_F32, n_embd_head, n_kv,     n_head_kv);
+    ggml_tensor * v = ggml_new_tensor_3d(ctx, GGML_TYPE_F32, n_embd_head, n_kv,     n_head_kv);
+    set_random(q, rng);
+    set_random(k, rng);
+    set_random(v, rng);
+
+    ggml_tensor * kq_mask = nullptr;
+    if (tc.mask) {
+        kq_mask = ggml_new_tensor_2d(ctx, GGML_TYPE_F32, n_kv, GGML_PAD(n_tokens, GGML_KQ_MASK_PAD));
+
+        // causal, with the queries at the end of the KV
+        float * data = (float *) kq_mask->data;
+        for (int64_t i1 = 0; i1 < kq_mask->ne[1]; ++i1) {
+            for (int64_t i0 = 0; i0 < n_kv; ++i0) {
+                data[i1*n_kv + i0] = i0 <= n_kv - n_tokens + i1 ? 0.0f : -INFINITY;
+            }
+        }
+    }
+
+    ggml_tensor * kq_b = nullptr;
+    if (tc.kq_b) {
+        kq_b = ggml_new_tensor_3d(ctx, GGML_TYPE_F32, n_kv, n_tokens, n_head);
+        set_random(kq_b, rng);
+    }
+
+    ggml_cgraph * gf = ggml_new_graph(ctx);
+
+    ggml_tensor * cur = gctx.build_attn_mha(gf, q, k, v, kq_b, kq_mask, false, 1.0f/sqrtf(float(n_embd_head)));
+
+    ggml_graph_compute_with_ctx(ctx, gf, 2);
+
+    std::vector<float> res(ggml_nelements(cur));
+    memcpy(res.data(), cur->data, ggml_nbytes(cur));
+
+    ggml_free(ctx);
+
+    return res;
+}
+
+int main() {
+    const int64_t n_tokens    = 37;
+    const int64_t n_kv        = 64;
+    const int64_t n_head      = 8;
+    const int64_t n_head_kv   = 2;
+    const int64_t n_embd_head = 32;
+
+    // about 5 tokens per chunk, the last chunk is smaller than the others
+    const size_t kq_row_size   = n_kv*n_head*sizeof(float);
+    const size_t kq_chunk_size = 5*kq_row_size;
+
+    if (llm_graph_attn_n_chunks(n_tokens, n_kv, n_head, kq_chunk_size) < 2 ||
+        llm_graph_attn_n_chunks(n_tokens, n_kv, n_head, LLAMA_ATTN_KQ_CHUNK_SIZE) != 1) {
+        fprintf(stderr, "%s: failed: unexpected number of chunks\n", __func__);
+        return 1;
+    }
+
+    const test_case cases[] = {
+        { false, false, 0.0f, false },
+        { true,  false, 0.0f, false },
+        { true,  true,  0.0f, false },
+        { true,  true,  8.0f, false },
+        { true,  false, 0.0f, true  },
+    };
+
+    bool success = true;
+
+    for (const auto & tc : cases) {
+        const std::vector<float> ref = attn(tc, LLAMA_ATTN_KQ_CHUNK_SIZE, n_tokens, n_kv, n_head, n_head_kv, n_embd_head);
+        const std::vector<float> res = attn(tc, kq_chunk_size,            n_tokens, n_kv, n_head, n_head_kv, n_embd_head);
+
+        float max_diff = 0.0f;
+        for (size_t i = 0; i < ref.size(); ++i) {
+            max_diff = std::max(max_diff, std::fabs(res[i] - ref[i]));
+        }
+
+        if (res.size() != ref.size() || !(max_diff <= 1e-6f)) {
+            fprintf(stderr, "%s: failed: mask = %d, kq_b = %d, max_bias = %.1f, softcap = %d: max diff %g\n",
+                    __func__, tc.mask, tc.kq_b, tc.max_bias, tc.softcap, max_diff);
+            success = false;
+        }
+    }
+
+    fprintf(stderr, "%s: %s\n", __func__, success ? "passed" : "failed");
+
+    return success ? 0 : 1;
+}
@@ -4403,6 +4403,17 @@ static std::vector<std::unique_ptr<test_case>> make_test_cases_eval() {
         }
     }
 
+    // decoding with GQA over a long KV: the KV is split across threads, the K/V rows are shared by the q heads of a group
+    for (int nr : { 4, 8, }) {
+        for (int kv : { 2048, 4096, }) {
+            for (int nb : { 1, 2, }) {
+                for (ggml_type type_KV : {GGML_TYPE_F16, GGML_TYPE_Q8_0}) {
+                    test_cases.emplace_back(new test_flash_attn_ext(128, 4, nr, kv, nb, true, 0.0f, 0.0f, GGML_PREC_F32, type_KV));
+                }
+            }
+        }
+    }
+
     test_cases.emplace_back(new test_cross_entropy_loss     (GGML_TYPE_F32, {   10, 5, 4, 3}));
     test_cases.emplace_back(new test_cross_entropy_loss     (GGML_TYPE_F32, {30000, 1, 1, 1}));
     test_cases.emplace_back(new test_cross_entropy_loss_back(GGML_TYPE_F32, {   10, 5, 4, 3}));
@@ -0,0 +1,74 @@
+// the LRU cache of the image embeddings of clip must not mix up images with the same hash
+
+#include "../examples/llava/clip-embd-cache.h"
+
+#undef NDEBUG
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+int main() {
+    // 8x1 RGB images, 3 words of FNV-1a
+    const int nx = 8;
+    const int ny = 1;
+    const size_t n = 3*nx*ny;
+
+    std::vector<uint8_t> a(n);
+    for (size_t i = 0; i < n; ++i) {
+        a[i] = (uint8_t) (17*i + 3);
+    }
+
+    // change the first word of the pixels and cancel it out in the second word:
+    // the state of the hash after the first word is the hash of the first 8 bytes
+    std::vector<uint8_t> b = a;
+    b[0] ^= 1;
+
+    const uint64_t ha = clip_embd_cache::hash(nx, ny, a.data(), 8);
+    const uint64_t hb = clip_embd_cache::hash(nx, ny, b.data(), 8);
+
+    uint64_t w;
+    memcpy(&w, b.data() + 8, sizeof(w));
+    w ^= ha ^ hb;
+    memcpy(b.data() + 8, &w, sizeof(w));
+
+    assert(a != b);
+    assert(clip_embd_cache::hash(nx, ny, a.data(), n) == clip_embd_cache::hash(nx, ny, b.data(), n));
+
+    const std::vector<float> embd_a = { 1.0f, 2.0f, 3.0f, 4.0f };
+    const std::vector<float> embd_b = { 5.0f, 6.0f, 7.0f, 8.0f };
+
+    clip_embd_cache cache;
+
+    cache.put(nx, ny, a.data(), n, embd_a.data(), embd_a.size(), 2);
+
+    // same hash, other pixels
+    assert(cache.get(nx, ny, b.data(), n) == nullptr);
+
+    cache.put(nx, ny, b.data(), n, embd_b.data(), embd_b.size(), 2);
+    assert(cache.entries.size() == 2);
+
+    const auto * entry_a = cache.get(nx, ny, a.data(), n);
+    assert(entry_a != nullptr && entry_a->embd == embd_a);
+
+    const auto * entry_b = cache.get(nx, ny, b.data(), n);
+    assert(entry_b != nullptr && entry_b->embd == embd_b);
+
+    // same pixels, other size
+    assert(cache.get(ny, nx, a.data(), n) == nullptr);
+
+    // the pixels count towards the size, the least recently used entry is evicted
+    assert(cache.size == 2*(n + embd_a.size()*sizeof(float)));
+
+    cache.get(nx, ny, a.data(), n);
+    cache.set_max_size(cache.size - 1);
+
+    assert(cache.entries.size() == 1);
+    assert(cache.get(nx, ny, b.data(), n) == nullptr);
+    assert(cache.get(nx, ny, a.data(), n) != nullptr);
+
+    fprintf(stderr, "%s: passed\n", __func__);
+
+    return 0;
+}
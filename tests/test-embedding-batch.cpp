@@ -0,0 +1,175 @@
+// the embeddings of several sequences packed in one batch must be the same as with one sequence per batch
+
+#include "common.h"
+#include "llama.h"
+#include "get-model.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// the embeddings of the sequences, one vector per sequence - or per token without pooling
+static std::vector<std::vector<float>> embed(llama_context * ctx, const std::vector<llama_tokens> & prompts, bool packed, bool interleaved) {
+    const llama_model * model = llama_get_model(ctx);
+
+    const int n_embd = llama_model_n_embd(model);
+
+    const bool pooled = llama_pooling_type(ctx) != LLAMA_POOLING_TYPE_NONE;
+
+    std::vector<std::vector<float>> res;
+
+    llama_batch batch = llama_batch_init(llama_n_batch(ctx), 0, 1);
+
+    bool ok = true;
+
+    auto encode = [&](const std::vector<llama_seq_id> & seq_ids) {
+        llama_kv_self_clear(ctx);
+
+        const int ret = llama_model_has_encoder(model) ? llama_encode(ctx, batch) : llama_decode(ctx, batch);
+        if (ret != 0) {
+            ok = false;
+            return;
+        }
+
+        for (const llama_seq_id seq_id : seq_ids) {
+            if (pooled) {
+                const float * embd = llama_get_embeddings_seq(ctx, seq_id);
+                res.emplace_back(embd, embd + n_embd);
+            }
+        }
+
+        if (!pooled) {
+            // the tokens of the batch, in the order of the sequences
+            for (const llama_seq_id seq_id : seq_ids) {
+                for (int i = 0; i < batch.n_tokens; ++i) {
+                    if (batch.seq_id[i][0] == seq_id) {
+                        const float * embd = llama_get_embeddings_ith(ctx, i);
+                        res.emplace_back(embd, embd + n_embd);
+                    }
+                }
+            }
+        }
+
+        common_batch_clear(batch);
+    };
+
+    if (!packed) {
+        for (const auto & prompt : prompts) {
+            for (size_t i = 0; i < prompt.size(); ++i) {
+                common_batch_add(batch, prompt[i], i, { 0 }, true);
+            }
+            encode({ 0 });
+        }
+    } else if (!interleaved) {
+        std::vector<llama_seq_id> seq_ids;
+        for (size_t s = 0; s < prompts.size(); ++s) {
+            for (size_t i = 0; i < prompts[s].size(); ++i) {
+                common_batch_add(batch, prompts[s][i], i, { (llama_seq_id) s }, true);
+            }
+            seq_ids.push_back(s);
+        }
+        encode(seq_ids);
+    } else {
+        // the tokens of the sequences alternate, so that the attention needs a mask over the full batch
+        std::vector<llama_seq_id> seq_ids;
+        for (size_t i = 0; seq_ids.size() < prompts.size(); ++i) {
+            for (size_t s = 0; s < prompts.size(); ++s) {
+                if (i < prompts[s].size()) {
+                    common_batch_add(batch, prompts[s][i], i, { (llama_seq_id) s }, true);
+                } else if (i == prompts[s].size()) {
+                    seq_ids.push_back(s);
+                }
+            }
+        }
+        std::sort(seq_ids.begin(), seq_ids.end());
+        encode(seq_ids);
+    }
+
+    llama_batch_free(batch);
+
+    return ok ? res : std::vector<std::vector<float>>();
+}
+
+int main(int argc, char ** argv) {
+    auto * model_path = get_model_or_exit(argc, argv);
+
+    llama_backend_init();
+
+    auto * model = llama_model_load_from_file(model_path, llama_model_default_params());
+    if (model == nullptr) {
+        fprintf(stderr, "%s: error: failed to load model '%s'\n", __func__, model_path);
+        return 1;
+    }
+
+    if (llama_model_is_causal(model)) {
+        // the per-sequence attention of packed batches is only used without a KV cache
+        fprintf(stderr, "%s: skipped: the model uses causal attention\n", __func__);
+        llama_model_free(model);
+        return 0;
+    }
+
+    const std::vector<std::string> texts = {
+        "Hello world",
+        "The quick brown fox jumps over the lazy dog",
+        "a",
+        "Packed batches of several sequences must give the same embeddings as one sequence at a time, whatever the length of the other sequences in the batch.",
+        "1 2 3 4 5",
+    };
+
+    bool success = true;
+
+    for (const auto pooling_type : { LLAMA_POOLING_TYPE_MEAN, LLAMA_POOLING_TYPE_CLS, LLAMA_POOLING_TYPE_NONE }) {
+        for (const bool flash_attn : { false, true }) {
+            auto cparams = llama_context_default_params();
+            cparams.n_ctx        = 512;
+            cparams.n_batch      = 512;
+            cparams.n_ubatch     = 512;
+            cparams.n_seq_max    = texts.size();
+            cparams.embeddings   = true;
+            cparams.pooling_type = pooling_type;
+            cparams.flash_attn   = flash_attn;
+
+            llama_context * ctx = llama_init_from_model(model, cparams);
+
+            std::vector<llama_tokens> prompts;
+            for (const auto & text : texts) {
+                prompts.push_back(common_tokenize(ctx, text, true));
+            }
+
+            const auto ref = embed(ctx, prompts, false, false);
+
+            for (const bool interleaved : { false, true }) {
+                const auto res = embed(ctx, prompts, true, interleaved);
+
+                // normalized mean squared error, the order of the sums differs with the shape of the batch
+                double mse   = ref.empty() || res.size() != ref.size() ? INFINITY : 0.0;
+                double b_sum = 0.0;
+                for (size_t i = 0; i < res.size() && i < ref.size(); ++i) {
+                    for (size_t j = 0; j < ref[i].size(); ++j) {
+                        mse   += (res[i][j] - ref[i][j])*(res[i][j] - ref[i][j]);
+                        b_sum += ref[i][j]*ref[i][j];
+                    }
+                }
+
+                const double err = mse/b_sum;
+                if (!(err <= 1e-8)) {
+                    fprintf(stderr, "%s: failed: pooling_type = %d, flash_attn = %d, interleaved = %d: nmse = %g\n",
+                            __func__, pooling_type, flash_attn, interleaved, err);
+                    success = false;
+                }
+            }
+
+            llama_free(ctx);
+        }
+    }
+
+    llama_model_free(model);
+
+    llama_backend_free();
+
+    fprintf(stderr, "%s: %s\n", __func__, success ? "passed" : "failed");
+
+    return success ? 0 : 1;
+}
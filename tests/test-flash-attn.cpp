@@ -0,0 +1,148 @@
+// the CPU flash attention that groups the q heads of a KV head (GQA) and splits the KV sequence across threads must
+// match the plain path, with one q head per KV head and a single chunk of the KV sequence
+
+#include "ggml.h"
+#include "ggml-cpu.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+
+struct test_case {
+    ggml_type type_KV;
+    int64_t   nr;       // q heads per KV head
+    int64_t   kv;
+    int64_t   nb;       // q rows
+    float     max_bias;
+};
+
+static void set_random(ggml_tensor * t, std::mt19937 & rng) {
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+
+    std::vector<float> data(ggml_nelements(t));
+    for (auto & x : data) {
+        x = dist(rng);
+    }
+
+    if (t->type == GGML_TYPE_F32) {
+        memcpy(t->data, data.data(), ggml_nbytes(t));
+    } else {
+        ggml_quantize_chunk(t->type, data.data(), t->data, 0, ggml_nrows(t), t->ne[0], nullptr);
+    }
+}
+
+// the output of the flash attention with the given number of threads
+// with expand, each KV head is repeated for its q heads, so that no q heads are grouped
+static std::vector<float> attn(const test_case & tc, int n_threads, bool expand) {
+    const int64_t D  = 128;
+    const int64_t nh = 4; // KV heads
+
+    ggml_init_params params = {
+        /* .mem_size   = */ 256*1024*1024,
+        /* .mem_buffer = */ NULL,
+        /* .no_alloc   = */ false,
+    };
+    ggml_context * ctx = ggml_init(params);
+
+    // the same inputs for all the calls
+    std::mt19937 rng(42);
+
+    ggml_tensor * q = ggml_new_tensor_3d(ctx, GGML_TYPE_F32, D, tc.nb, nh*tc.nr);
+    ggml_tensor * k = ggml_new_tensor_3d(ctx, tc.type_KV,    D, tc.kv, nh);
+    ggml_tensor * v = ggml_new_tensor_3d(ctx, tc.type_KV,    D, tc.kv, nh);
+    set_random(q, rng);
+    set_random(k, rng);
+    set_random(v, rng);
+
+    // random mask, with the first 600 KV values masked so that the first chunk of the split is fully masked
+    ggml_tensor * mask = ggml_new_tensor_2d(ctx, GGML_TYPE_F16, tc.kv, GGML_PAD(tc.nb, GGML_KQ_MASK_PAD));
+    {
+        std::uniform_int_distribution<int> dist(0, 3);
+
+        ggml_fp16_t * data = (ggml_fp16_t *) mask->data;
+        for (int64_t i = 0; i < ggml_nelements(mask); ++i) {
+            const bool masked = i%tc.kv < 600 || dist(rng) == 0;
+            data[i] = ggml_fp32_to_fp16(masked ? -INFINITY : 0.0f);
+        }
+    }
+
+    if (expand) {
+        // q head h uses KV head h/nr
+        ggml_tensor * k_exp = ggml_new_tensor_3d(ctx, tc.type_KV, D, tc.kv, nh*tc.nr);
+        ggml_tensor * v_exp = ggml_new_tensor_3d(ctx, tc.type_KV, D, tc.kv, nh*tc.nr);
+        for (int64_t h = 0; h < nh*tc.nr; ++h) {
+            memcpy((char *) k_exp->data + h*k_exp->nb[2], (char *) k->data + (h/tc.nr)*k->nb[2], k->nb[2]);
+            memcpy((char *) v_exp->data + h*v_exp->nb[2], (char *) v->data + (h/tc.nr)*v->nb[2], v->nb[2]);
+        }
+        k = k_exp;
+        v = v_exp;
+    }
+
+    ggml_tensor * out = ggml_flash_attn_ext(ctx, q, k, v, mask, 1.0f/sqrtf(float(D)), tc.max_bias, 0.0f);
+    ggml_flash_attn_ext_set_prec(out, GGML_PREC_F32);
+
+    ggml_cgraph * gf = ggml_new_graph(ctx);
+    ggml_build_forward_expand(gf, out);
+
+    ggml_graph_compute_with_ctx(ctx, gf, n_threads);
+
+    std::vector<float> res(ggml_nelements(out));
+    memcpy(res.data(), out->data, ggml_nbytes(out));
+
+    ggml_free(ctx);
+
+    return res;
+}
+
+// normalized mean squared error, as in test-backend-ops
+static double nmse(const std::vector<float> & a, const std::vector<float> & b) {
+    double mse   = 0.0;
+    double b_sum = 0.0;
+
+    for (size_t i = 0; i < a.size(); ++i) {
+        mse   += (a[i] - b[i])*(a[i] - b[i]);
+        b_sum += b[i]*b[i];
+    }
+
+    return mse/b_sum;
+}
+
+int main() {
+    const double max_nmse = 5e-4;
+
+    bool success = true;
+
+    for (ggml_type type_KV : { GGML_TYPE_F16, GGML_TYPE_Q8_0 }) {
+        for (int64_t nr : { 1, 4, 8 }) {
+            for (int64_t kv : { 1000, 2048 }) {
+                for (int64_t nb : { 1, 2 }) {
+                    for (float max_bias : { 0.0f, 8.0f }) {
+                        const test_case tc = { type_KV, nr, kv, nb, max_bias };
+
+                        // one q head per KV head, a single thread: no grouping and a single chunk
+                        const std::vector<float> ref = attn(tc, 1, true);
+
+                        // grouped, then grouped and split across threads - with 3 threads and 1000 KV values the chunks
+                        // are not all of the same size
+                        for (int n_threads : { 1, 3, 4 }) {
+                            const std::vector<float> res = attn(tc, n_threads, false);
+
+                            const double err = nmse(res, ref);
+                            if (!(err <= max_nmse)) {
+                                fprintf(stderr, "%s: failed: type_KV = %s, nr = %d, kv = %d, nb = %d, max_bias = %.1f, n_threads = %d: nmse = %g\n",
+                                        __func__, ggml_type_name(type_KV), (int) nr, (int) kv, (int) nb, max_bias, n_threads, err);
+                                success = false;
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    fprintf(stderr, "%s: %s\n", __func__, success ? "passed" : "failed");
+
+    return success ? 0 : 1;
+}
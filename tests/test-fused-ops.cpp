@@ -0,0 +1,211 @@
+// the chains of ops that the CPU backend fuses ([ADD ->] RMS_NORM -> MUL, SILU -> MUL, ROPE -> CPY) must give the same
+// results as the same graph evaluated one node at a time
+
+#include "ggml.h"
+#include "ggml-cpu.h"
+#include "../ggml/src/ggml-impl.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <random>
+#include <string>
+#include <vector>
+
+struct test_case {
+    std::string name;
+
+    // builds the graph from random inputs
+    std::function<void(ggml_context *, ggml_cgraph *)> build;
+};
+
+static ggml_tensor * new_random(ggml_context * ctx, int64_t ne0, int64_t ne1, int64_t ne2, std::mt19937 & rng) {
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+
+    ggml_tensor * t = ggml_new_tensor_3d(ctx, GGML_TYPE_F32, ne0, ne1, ne2);
+
+    float * data = (float *) t->data;
+    for (int64_t i = 0; i < ggml_nelements(t); ++i) {
+        data[i] = dist(rng);
+    }
+
+    return t;
+}
+
+// the values of all the nodes of the graph, with the graph evaluated at once or one node at a time
+static std::vector<float> eval(const test_case & tc, int n_threads, bool fused) {
+    ggml_init_params params = {
+        /* .mem_size   = */ 64*1024*1024,
+        /* .mem_buffer = */ NULL,
+        /* .no_alloc   = */ false,
+    };
+    ggml_context * ctx = ggml_init(params);
+
+    ggml_cgraph * gf = ggml_new_graph(ctx);
+
+    tc.build(ctx, gf);
+
+    if (fused) {
+        ggml_graph_compute_with_ctx(ctx, gf, n_threads);
+    } else {
+        // a chain of ops cannot be fused across graphs
+        for (int i = 0; i < ggml_graph_n_nodes(gf); ++i) {
+            ggml_cgraph gv = ggml_graph_view(gf, i, i + 1);
+            ggml_graph_compute_with_ctx(ctx, &gv, n_threads);
+        }
+    }
+
+    std::vector<float> res;
+
+    for (int i = 0; i < ggml_graph_n_nodes(gf); ++i) {
+        const ggml_tensor * node = ggml_graph_node(gf, i);
+
+        // the destination of the copies
+        const ggml_tensor * t = node->op == GGML_OP_CPY ? node->src[1] : node;
+
+        for (int64_t j = 0; j < ggml_nelements(t); ++j) {
+            switch (t->type) {
+                case GGML_TYPE_F32:  res.push_back(((const float *) t->data)[j]); break;
+                case GGML_TYPE_F16:  res.push_back(ggml_fp16_to_fp32(((const ggml_fp16_t *) t->data)[j])); break;
+                case GGML_TYPE_BF16: res.push_back(ggml_bf16_to_fp32(((const ggml_bf16_t *) t->data)[j])); break;
+                default: GGML_ABORT("unexpected type");
+            }
+        }
+    }
+
+    ggml_free(ctx);
+
+    return res;
+}
+
+int main() {
+    const int64_t n_embd   = 256;
+    const int64_t n_tokens = 7;
+    const int64_t n_seqs   = 3;
+
+    const int64_t n_embd_head = 64;
+    const int64_t n_head      = n_embd/n_embd_head;
+
+    std::vector<test_case> cases;
+
+    // RMS_NORM -> MUL, with the weights broadcast or not, and in-place
+    for (const bool broadcast : { true, false }) {
+        for (const bool inplace : { false, true }) {
+            cases.push_back({ "rms_norm_mul, broadcast = " + std::to_string(broadcast) + ", inplace = " + std::to_string(inplace),
+                [=](ggml_context * ctx, ggml_cgraph * gf) {
+                    std::mt19937 rng(42);
+
+                    ggml_tensor * x = new_random(ctx, n_embd, n_tokens, n_seqs, rng);
+                    ggml_tensor * w = new_random(ctx, n_embd, broadcast ? 1 : n_tokens, broadcast ? 1 : n_seqs, rng);
+
+                    ggml_tensor * cur = ggml_rms_norm(ctx, x, 1e-5f);
+                    cur = inplace ? ggml_mul_inplace(ctx, cur, w) : ggml_mul(ctx, cur, w);
+
+                    ggml_build_forward_expand(gf, cur);
+                } });
+        }
+    }
+
+    // ADD -> RMS_NORM -> MUL, as for the residual of a layer followed by the norm of the next one
+    for (const bool broadcast : { true, false }) {
+        cases.push_back({ "add_rms_norm_mul, broadcast = " + std::to_string(broadcast),
+            [=](ggml_context * ctx, ggml_cgraph * gf) {
+                std::mt19937 rng(42);
+
+                ggml_tensor * x = new_random(ctx, n_embd, n_tokens, n_seqs, rng);
+                ggml_tensor * y = new_random(ctx, n_embd, broadcast ? 1 : n_tokens, 1, rng);
+                ggml_tensor * w = new_random(ctx, n_embd, 1, 1, rng);
+
+                ggml_tensor * inp = ggml_add(ctx, x, y);
+
+                ggml_tensor * cur = ggml_rms_norm(ctx, inp, 1e-5f);
+                cur = ggml_mul(ctx, cur, w);
+
+                // the sum is used again after the norm
+                cur = ggml_add(ctx, cur, inp);
+
+                ggml_build_forward_expand(gf, cur);
+            } });
+    }
+
+    // SILU -> MUL, with the result of the SILU as either operand, and with the input of the SILU as the other one
+    for (int other : { 0, 1, 2 }) {
+        cases.push_back({ "silu_mul, other = " + std::to_string(other),
+            [=](ggml_context * ctx, ggml_cgraph * gf) {
+                std::mt19937 rng(42);
+
+                ggml_tensor * gate = new_random(ctx, 4*n_embd, n_tokens, n_seqs, rng);
+                ggml_tensor * up   = new_random(ctx, 4*n_embd, n_tokens, n_seqs, rng);
+
+                ggml_tensor * cur = ggml_silu(ctx, gate);
+                switch (other) {
+                    case 0: cur = ggml_mul(ctx, cur, up);   break;
+                    case 1: cur = ggml_mul(ctx, up,  cur);  break;
+                    case 2: cur = ggml_mul(ctx, cur, gate); break;
+                }
+
+                ggml_build_forward_expand(gf, cur);
+            } });
+    }
+
+    // ROPE -> CPY into a view of a cache, right after the ROPE or with other nodes in between
+    for (ggml_type type : { GGML_TYPE_F32, GGML_TYPE_F16, GGML_TYPE_BF16 }) {
+        for (int mode : { 0, GGML_ROPE_TYPE_NEOX }) {
+            for (const bool between : { false, true }) {
+                cases.push_back({ std::string("rope_cpy, type = ") + ggml_type_name(type) + ", mode = " + std::to_string(mode) + ", between = " + std::to_string(between),
+                    [=](ggml_context * ctx, ggml_cgraph * gf) {
+                        std::mt19937 rng(42);
+
+                        ggml_tensor * k = new_random(ctx, n_embd_head, n_head, n_tokens, rng);
+                        ggml_tensor * v = new_random(ctx, n_embd, n_tokens, 1, rng);
+
+                        ggml_tensor * pos = ggml_new_tensor_1d(ctx, GGML_TYPE_I32, n_tokens);
+                        for (int64_t i = 0; i < n_tokens; ++i) {
+                            ((int32_t *) pos->data)[i] = 100 + 3*i;
+                        }
+
+                        // the cache holds more tokens than the batch, the batch is copied after the first 5
+                        ggml_tensor * cache = ggml_new_tensor_1d(ctx, type, n_embd*(n_tokens + 8));
+                        memset(cache->data, 0, ggml_nbytes(cache));
+
+                        ggml_tensor * k_rope = ggml_rope_ext(ctx, k, pos, nullptr, n_embd_head, mode, 4096, 10000.0f, 1.0f, 0.0f, 1.0f, 0.0f, 0.0f);
+                        ggml_build_forward_expand(gf, k_rope);
+
+                        if (between) {
+                            ggml_build_forward_expand(gf, ggml_scale(ctx, v, 2.0f));
+                            ggml_build_forward_expand(gf, ggml_scale(ctx, k_rope, 0.5f));
+                        }
+
+                        ggml_tensor * k_view = ggml_view_1d(ctx, cache, n_embd*n_tokens, ggml_row_size(type, 5*n_embd));
+                        ggml_build_forward_expand(gf, ggml_cpy(ctx, k_rope, k_view));
+                    } });
+            }
+        }
+    }
+
+    bool success = true;
+
+    for (const auto & tc : cases) {
+        const std::vector<float> ref = eval(tc, 1, false);
+
+        for (int n_threads : { 1, 3, 4 }) {
+            const std::vector<float> res = eval(tc, n_threads, true);
+
+            float max_diff = res.size() == ref.size() ? 0.0f : INFINITY;
+            for (size_t i = 0; i < res.size() && i < ref.size(); ++i) {
+                max_diff = std::max(max_diff, std::fabs(res[i] - ref[i]));
+            }
+
+            if (!(max_diff <= 1e-5f)) {
+                fprintf(stderr, "%s: failed: %s, n_threads = %d: max diff %g\n", __func__, tc.name.c_str(), n_threads, max_diff);
+                success = false;
+            }
+        }
+    }
+
+    fprintf(stderr, "%s: %s\n", __func__, success ? "passed" : "failed");
+
+    return success ? 0 : 1;
+}
@@ -0,0 +1,187 @@
+// the matrix multiplications with the weights repacked in the CPU_AARCH64 buffer must match the ones with the weights
+// in a plain CPU buffer
+
+#include "ggml.h"
+#include "ggml-alloc.h"
+#include "ggml-backend.h"
+#include "ggml-cpu.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+
+struct test_case {
+    ggml_type type;
+    int64_t   n;        // rows of the weights
+    int64_t   m;        // rows of the activations
+    int64_t   n_expert; // 0 for MUL_MAT, else MUL_MAT_ID with 2 experts per row
+};
+
+static ggml_backend_buffer_type_t get_repack_buft() {
+    ggml_backend_dev_t dev = ggml_backend_dev_by_type(GGML_BACKEND_DEVICE_TYPE_CPU);
+    ggml_backend_reg_t reg = ggml_backend_dev_backend_reg(dev);
+
+    auto get_extra_bufts = (ggml_backend_dev_get_extra_bufts_t) ggml_backend_reg_get_proc_address(reg, "ggml_backend_dev_get_extra_bufts");
+    if (get_extra_bufts) {
+        for (ggml_backend_buffer_type_t * buft = get_extra_bufts(dev); buft && *buft; ++buft) {
+            if (strcmp(ggml_backend_buft_name(*buft), "CPU_AARCH64") == 0) {
+                return *buft;
+            }
+        }
+    }
+
+    return nullptr;
+}
+
+// the output of the multiplication with the weights in the given buffer type, empty if they are not repacked
+static std::vector<float> mul_mat(const test_case & tc, ggml_backend_t backend, ggml_backend_buffer_type_t buft, bool repack) {
+    const int64_t k = 512;
+
+    ggml_init_params params = {
+        /* .mem_size   = */ 16*ggml_tensor_overhead() + ggml_graph_overhead(),
+        /* .mem_buffer = */ NULL,
+        /* .no_alloc   = */ true,
+    };
+    ggml_context * ctx_w = ggml_init(params);
+    ggml_context * ctx   = ggml_init(params);
+
+    ggml_tensor * w = tc.n_expert == 0 ?
+        ggml_new_tensor_2d(ctx_w, tc.type, k, tc.n) :
+        ggml_new_tensor_3d(ctx_w, tc.type, k, tc.n, tc.n_expert);
+
+    ggml_backend_buffer_t buf_w = ggml_backend_alloc_ctx_tensors_from_buft(ctx_w, buft);
+
+    std::vector<float> res;
+
+    // the weights that the CPU cannot repack are not supported by the buffer type
+    if (!repack || w->extra != nullptr) {
+        // the same inputs for all the calls
+        std::mt19937 rng(42);
+        std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+
+        std::vector<float> data(ggml_nelements(w));
+        for (auto & x : data) {
+            x = dist(rng);
+        }
+
+        std::vector<uint8_t> data_q(ggml_nbytes(w));
+        ggml_quantize_chunk(tc.type, data.data(), data_q.data(), 0, ggml_nrows(w), k, nullptr);
+        ggml_backend_tensor_set(w, data_q.data(), 0, data_q.size());
+
+        ggml_tensor * out = nullptr;
+        ggml_tensor * x   = nullptr;
+        ggml_tensor * ids = nullptr;
+
+        if (tc.n_expert == 0) {
+            x   = ggml_new_tensor_2d(ctx, GGML_TYPE_F32, k, tc.m);
+            out = ggml_mul_mat(ctx, w, x);
+        } else {
+            x   = ggml_new_tensor_3d(ctx, GGML_TYPE_F32, k, 2, tc.m);
+            ids = ggml_new_tensor_2d(ctx, GGML_TYPE_I32, 2, tc.m);
+            out = ggml_mul_mat_id(ctx, w, x, ids);
+        }
+
+        ggml_cgraph * gf = ggml_new_graph(ctx);
+        ggml_build_forward_expand(gf, out);
+
+        ggml_backend_buffer_t buf = ggml_backend_alloc_ctx_tensors(ctx, backend);
+
+        data.resize(ggml_nelements(x));
+        for (auto & v : data) {
+            v = dist(rng);
+        }
+        ggml_backend_tensor_set(x, data.data(), 0, ggml_nbytes(x));
+
+        if (ids) {
+            // two different experts per row
+            std::vector<int32_t> data_ids(ggml_nelements(ids));
+            for (int64_t i = 0; i < tc.m; ++i) {
+                data_ids[2*i + 0] = std::uniform_int_distribution<int32_t>(0, tc.n_expert - 1)(rng);
+                data_ids[2*i + 1] = (data_ids[2*i + 0] + 1 + std::uniform_int_distribution<int32_t>(0, tc.n_expert - 2)(rng)) % tc.n_expert;
+            }
+            ggml_backend_tensor_set(ids, data_ids.data(), 0, ggml_nbytes(ids));
+        }
+
+        ggml_backend_graph_compute(backend, gf);
+
+        res.resize(ggml_nelements(out));
+        ggml_backend_tensor_get(out, res.data(), 0, ggml_nbytes(out));
+
+        ggml_backend_buffer_free(buf);
+    }
+
+    ggml_backend_buffer_free(buf_w);
+
+    ggml_free(ctx);
+    ggml_free(ctx_w);
+
+    return res;
+}
+
+// normalized mean squared error, as in test-backend-ops
+static double nmse(const std::vector<float> & a, const std::vector<float> & b) {
+    double mse   = 0.0;
+    double b_sum = 0.0;
+
+    for (size_t i = 0; i < a.size(); ++i) {
+        mse   += (a[i] - b[i])*(a[i] - b[i]);
+        b_sum += b[i]*b[i];
+    }
+
+    return mse/b_sum;
+}
+
+int main() {
+    const double max_nmse = 1e-6;
+
+    ggml_backend_buffer_type_t buft_repack = get_repack_buft();
+    if (buft_repack == nullptr) {
+        fprintf(stderr, "%s: skipped: no repack buffer type\n", __func__);
+        return 0;
+    }
+
+    ggml_backend_t backend = ggml_backend_cpu_init();
+
+    bool success = true;
+    int  n_tested = 0;
+
+    for (ggml_type type : { GGML_TYPE_Q4_0, GGML_TYPE_Q4_K, GGML_TYPE_Q5_K, GGML_TYPE_Q6_K, GGML_TYPE_Q8_0, GGML_TYPE_IQ4_NL, GGML_TYPE_IQ4_XS }) {
+        // 24 rows only fit the kernels that interleave 8 rows, 32 rows also fit the ones that interleave 16
+        for (int64_t n : { 24, 32 }) {
+            // the rows of the activations that are left after the blocks of 4 use the gemv kernel
+            for (int64_t m : { 1, 4, 7, 16 }) {
+                for (int64_t n_expert : { 0, 4 }) {
+                    for (int n_threads : { 1, 3 }) {
+                        const test_case tc = { type, n, m, n_expert };
+
+                        ggml_backend_cpu_set_n_threads(backend, n_threads);
+
+                        const std::vector<float> res = mul_mat(tc, backend, buft_repack, true);
+                        if (res.empty()) {
+                            continue;
+                        }
+
+                        const std::vector<float> ref = mul_mat(tc, backend, ggml_backend_cpu_buffer_type(), false);
+
+                        const double err = nmse(res, ref);
+                        if (!(err <= max_nmse)) {
+                            fprintf(stderr, "%s: failed: type = %s, n = %d, m = %d, n_expert = %d, n_threads = %d: nmse = %g\n",
+                                    __func__, ggml_type_name(type), (int) n, (int) m, (int) n_expert, n_threads, err);
+                            success = false;
+                        }
+
+                        n_tested++;
+                    }
+                }
+            }
+        }
+    }
+
+    ggml_backend_free(backend);
+
+    fprintf(stderr, "%s: %s, %d cases with repacked weights\n", __func__, success ? "passed" : "failed", n_tested);
+
+    return success ? 0 : 1;
+}
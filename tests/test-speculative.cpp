@@ -0,0 +1,80 @@
+// the tree draft with a single branch per token must be the same as the linear draft
+
+#include "common.h"
+#include "speculative.h"
+#include "llama.h"
+#include "get-model.h"
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+int main(int argc, char ** argv) {
+    auto * model_path = get_model_or_exit(argc, argv);
+
+    llama_backend_init();
+
+    auto * model = llama_model_load_from_file(model_path, llama_model_default_params());
+    if (model == nullptr) {
+        fprintf(stderr, "%s: error: failed to load model '%s'\n", __func__, model_path);
+        return 1;
+    }
+
+    auto cparams = llama_context_default_params();
+    cparams.n_ctx     = 512;
+    cparams.n_batch   = 512;
+    cparams.n_seq_max = 4;
+
+    // the tree draft needs a draft context of its own
+    llama_context * ctx_linear = llama_init_from_model(model, cparams);
+    llama_context * ctx_tree   = llama_init_from_model(model, cparams);
+
+    const llama_tokens prompt = common_tokenize(ctx_linear, "Once upon a time, there was a little girl who", true);
+
+    bool success = true;
+
+    for (const float p_min : { 0.0f, 0.1f, 0.3f, 0.5f, 0.9f }) {
+        for (size_t n_prompt = 2; n_prompt < prompt.size(); n_prompt += 3) {
+            const llama_tokens prompt_cur(prompt.begin(), prompt.begin() + n_prompt - 1);
+            const llama_token  id_last = prompt[n_prompt - 1];
+
+            common_speculative_params params;
+            params.n_draft  = 12;
+            params.n_branch = 1;
+            params.p_min    = p_min;
+
+            llama_kv_self_clear(ctx_linear);
+            llama_kv_self_clear(ctx_tree);
+
+            auto * spec_linear = common_speculative_init(ctx_linear);
+            auto * spec_tree   = common_speculative_init(ctx_tree);
+
+            const llama_tokens            draft = common_speculative_gen_draft     (spec_linear, params, prompt_cur, id_last);
+            const common_speculative_tree tree  = common_speculative_gen_draft_tree(spec_tree,   params, prompt_cur, id_last);
+
+            bool is_chain = true;
+            for (size_t i = 0; i < tree.size(); ++i) {
+                is_chain = is_chain && tree.parents[i] == (int) i - 1;
+            }
+
+            if (!is_chain || tree.tokens != draft) {
+                fprintf(stderr, "%s: failed: p_min = %.2f, n_prompt = %zu: linear draft of %zu tokens, tree of %zu nodes%s\n",
+                        __func__, p_min, n_prompt, draft.size(), tree.size(), is_chain ? "" : " (not a chain)");
+                success = false;
+            }
+
+            common_speculative_free(spec_linear);
+            common_speculative_free(spec_tree);
+        }
+    }
+
+    llama_free(ctx_linear);
+    llama_free(ctx_tree);
+    llama_model_free(model);
+
+    llama_backend_free();
+
+    fprintf(stderr, "%s: %s\n", __func__, success ? "passed" : "failed");
+
+    return success ? 0 : 1;
+}
@@ -252,6 +252,31 @@ int main(int argc, char **argv) {
         threads[i].join();
     }
 
+    // long texts are tokenized in parallel ranges of words - the result must be identical to the serial tokenization
+    if (!k_tests.empty()) {
+        std::string text;
+        while (text.size() < 1024*1024) {
+            for (const auto & test_kv : k_tests) {
+                text += test_kv.first;
+                text += " ";
+            }
+        }
+
+        llama_model_set_n_threads_tokenize(model, 1);
+        const std::vector<llama_token> res_serial = common_tokenize(ctx, text, add_special, false);
+
+        llama_model_set_n_threads_tokenize(model, 4);
+        const std::vector<llama_token> res_parallel = common_tokenize(ctx, text, add_special, false);
+
+        llama_model_set_n_threads_tokenize(model, 1);
+
+        if (res_serial != res_parallel) {
+            fprintf(stderr, "%s : failed test: parallel tokenization of %zu bytes differs from the serial tokenization (%zu vs %zu tokens)\n",
+                __func__, text.size(), res_parallel.size(), res_serial.size());
+            success = false;
+        }
+    }
+
     // single threaded tokenization
     if (!fname_text.empty()) {
         fprintf(stderr, "%s : tokenizing: '%s'\n", __func__, fname_text.c_str());
@@ -0,0 +1,108 @@
+// the built-in regex engine must split the text like std::regex and like the hand-written splitters
+
+#include "unicode.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <exception>
+#include <random>
+#include <string>
+#include <vector>
+
+// the pre-tokenizer regexes of llama-vocab.cpp
+static const std::vector<std::string> k_regex_exprs = {
+    "(?:'[sS]|'[tT]|'[rR][eE]|'[vV][eE]|'[mM]|'[lL][lL]|'[dD])|[^\\r\\n\\p{L}\\p{N}]?\\p{L}+|\\p{N}{1,3}| ?[^\\s\\p{L}\\p{N}]+[\\r\\n]*|\\s*[\\r\\n]+|\\s+(?!\\S)|\\s+",
+    "(?:'[sS]|'[tT]|'[rR][eE]|'[vV][eE]|'[mM]|'[lL][lL]|'[dD])|[^\\r\\n\\p{L}\\p{N}]?\\p{L}+|\\p{N}| ?[^\\s\\p{L}\\p{N}]+[\\r\\n]*|\\s*[\\r\\n]+|\\s+(?!\\S)|\\s+",
+    "'s|'t|'re|'ve|'m|'ll|'d| ?\\p{L}+| ?\\p{N}+| ?[^\\s\\p{L}\\p{N}]+|\\s+(?!\\S)",
+    "[^\\r\\n\\p{L}\\p{N}]?((?=[\\p{L}])([^a-z]))*((?=[\\p{L}])([^A-Z]))+|[^\\r\\n\\p{L}\\p{N}]?((?=[\\p{L}])([^a-z]))+((?=[\\p{L}])([^A-Z]))*|\\p{N}| ?[^\\s\\p{L}\\p{N}]+[\\r\\n/]*|\\s*[\\r\\n]+|\\s+(?!\\S)|\\s+",
+    "[^\\r\\n\\p{L}\\p{N}]?((?=[\\p{L}])([^a-z]))*((?=[\\p{L}])([^A-Z]))+(?:'[sS]|'[tT]|'[rR][eE]|'[vV][eE]|'[mM]|'[lL][lL]|'[dD])?|[^\\r\\n\\p{L}\\p{N}]?((?=[\\p{L}])([^a-z]))+((?=[\\p{L}])([^A-Z]))*(?:'[sS]|'[tT]|'[rR][eE]|'[vV][eE]|'[mM]|'[lL][lL]|'[dD])?|\\p{N}{1,3}| ?[^\\s\\p{L}\\p{N}]+[\\r\\n/]*|\\s*[\\r\\n]+|\\s+(?!\\S)|\\s+",
+    "[!\"#$%&'()*+,\\-./:;<=>?@\\[\\\\\\]^_`{|}~][A-Za-z]+|[^\r\n\\p{L}\\p{P}\\p{S}]?[\\p{L}\\p{M}]+| ?[\\p{P}\\p{S}]+[\r\n]*|\\s*[\r\n]+|\\s+(?!\\S)|\\s+",
+    "\\s?[A-Za-zµÀ-ÖØ-öø-ƺƼ-ƿǄ-ʓʕ-ʯͰ-ͳͶͷͻ-ͽͿΆΈ-ΊΌΎ-ΡΣ-ϵϷ-ҁҊ-ԯԱ-ՖႠ-ჅᎠ-Ᏽᏸ-ᏽᲐ-ᲺᲽ-Ჿᴀ-ᴫᵫ-ᵷᵹ-ᶚḀ-ἕἘ-Ἕἠ-ὅὈ-Ὅὐ-ὗὙὛὝὟ-ώᾀ-ᾴᾶ-ᾼιῂ-ῄῆ-ῌῐ-ΐῖ-Ίῠ-Ῥῲ-ῴῶ-ῼℂℇℊ-ℓℕℙ-ℝℤΩℨK-ℭℯ-ℴℹℼ-ℿⅅ-ⅉⅎↃↄⰀ-ⱻⱾ-ⳤⳫ-ⳮⳲⳳꙀ-ꙭꚀ-ꚛꜢ-ꝯꝱ-ꞇꞋ-ꞎꭰ-ꮿﬀ-ﬆﬓ-ﬗＡ-Ｚａ-ｚ𐐀-𐑏𐒰-𐓓𐓘-𐓻𐲀-𐲲𐳀-𐳲𑢠-𑣟𞤀-𞥃]+",
+    "\\s?[!-/:-~！-／：-～‘-‟　-。]+",
+    "\\s+$",
+    "\\s?\\p{L}+",
+    "\\s?\\p{P}+",
+    " ?[^(\\s|.,!?…。，、।۔،)]+",
+    "[一-龥ࠀ-一가-퟿]+",
+    "[一-龥぀-ゟ゠-ヿ]+",
+    "[\r\n]",
+    "\\p{N}",
+    "\\p{N}+",
+    "\\p{N}{1,3}",
+    "[0-9][0-9][0-9]",
+    "[\\p{P}\\$\\+<=>\\^~\\|`]+",
+    "[\\p{P}\\$\\+<=>\\^~\\|]+",
+    "[\\p{P}!-/:-@\\[-`{-~]",
+    "<sentinel:[0-9]+>",
+    "(IMGIMG)((A|B|C|D|E|F|G|H|I){1,4})Z",
+    "([\\t\\n]|    |  )",
+};
+
+// texts made of pieces that exercise the classes, the contractions and the whitespace rules of the regexes
+static std::string random_text(std::mt19937 & rng) {
+    static const std::vector<std::string> pieces = {
+        "a", "Z", "hello", "World", "HTTPServer", "camelCase", "'s", "'T", "'re", "'LL", "'d", "'x",
+        "0", "7", "42", "12345", " ", "  ", "    ", "\t", "\n", "\r\n", "\n\n", "\u00a0", "\u3000", "\u2009",
+        ".", ",", "!", "?", "...", "$", "+", "<=>", "^", "`", "|", "~", "/", "(", ")", "[", "]", "\\", "\"",
+        "é", "Ünïcödé", "Привет", "Ωμέγα", "你好", "世界", "こんにちは", "カタカナ", "한국어", "१२३", "٣", "…", "。", "，",
+        "\u0301", "🦙", "🙂", "€", "©", "<sentinel:", ">", "IMGIMG", "ABZ", "IZ",
+    };
+
+    std::uniform_int_distribution<size_t> dist_piece(0, pieces.size() - 1);
+    std::uniform_int_distribution<int>    dist_len(0, 40);
+
+    std::string res;
+    for (int i = dist_len(rng); i > 0; --i) {
+        res += pieces[dist_piece(rng)];
+    }
+
+    return res;
+}
+
+static bool check(const std::string & regex_expr, const std::string & text, unicode_regex_engine engine, unicode_regex_engine engine_ref) {
+    const std::vector<std::string> res     = unicode_regex_split(text, { regex_expr }, engine);
+    const std::vector<std::string> res_ref = unicode_regex_split(text, { regex_expr }, engine_ref);
+
+    if (res != res_ref) {
+        fprintf(stderr, "%s: failed: regex '%s', text '%s': %zu words vs %zu\n", __func__, regex_expr.c_str(), text.c_str(), res.size(), res_ref.size());
+        return false;
+    }
+
+    return true;
+}
+
+int main() {
+    std::mt19937 rng(42);
+
+    std::vector<std::string> texts = {
+        "",
+        " ",
+        "Hello world",
+        " Hello World!\n\nI'm   fine,  thanks -- and you?  ",
+        "3333333 33 1.5 1,000,000\t\t\r\n",
+        "<sentinel:0><sentinel:123> IMGIMGABCDZ IMGIMGAAAAAZ",
+    };
+    for (int i = 0; i < 200; ++i) {
+        texts.push_back(random_text(rng));
+    }
+
+    bool success = true;
+
+    try {
+        for (const auto & regex_expr : k_regex_exprs) {
+            for (const auto & text : texts) {
+                // the same text and the same regex as std::regex
+                success = check(regex_expr, text, UNICODE_REGEX_ENGINE_DFA, UNICODE_REGEX_ENGINE_STL) && success;
+                // the same splits as the hand-written splitters, if any
+                success = check(regex_expr, text, UNICODE_REGEX_ENGINE_DFA, UNICODE_REGEX_ENGINE_AUTO) && success;
+            }
+        }
+    } catch (const std::exception & e) {
+        fprintf(stderr, "%s: failed: %s\n", __func__, e.what());
+        success = false;
+    }
+
+    fprintf(stderr, "%s: %s\n", __func__, success ? "passed" : "failed");
+
+    return success ? 0 : 1;
+}
@@ -0,0 +1,189 @@
+// build, search, save and load the vector index, and reject corrupted files
+
+#include "vector-index.h"
+
+#undef NDEBUG
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+
+static std::vector<float> random_vecs(int64_t n, int32_t n_embd, std::mt19937 & rng) {
+    std::normal_distribution<float> dist;
+
+    std::vector<float> res(n*n_embd);
+    for (int64_t i = 0; i < n; ++i) {
+        float sum = 0.0f;
+        for (int32_t j = 0; j < n_embd; ++j) {
+            res[i*n_embd + j] = dist(rng);
+            sum += res[i*n_embd + j]*res[i*n_embd + j];
+        }
+        for (int32_t j = 0; j < n_embd; ++j) {
+            res[i*n_embd + j] /= std::sqrt(sum);
+        }
+    }
+
+    return res;
+}
+
+// fraction of the exact top-k that is found by the approximate search
+static float recall(const std::vector<std::vector<common_vindex_match>> & exact, const std::vector<std::vector<common_vindex_match>> & approx) {
+    int64_t n_found = 0;
+    int64_t n_total = 0;
+
+    for (size_t q = 0; q < exact.size(); ++q) {
+        for (const auto & m : exact[q]) {
+            for (const auto & a : approx[q]) {
+                if (a.id == m.id) {
+                    n_found++;
+                    break;
+                }
+            }
+        }
+        n_total += exact[q].size();
+    }
+
+    return (float) n_found/n_total;
+}
+
+static bool same_matches(const std::vector<std::vector<common_vindex_match>> & a, const std::vector<std::vector<common_vindex_match>> & b) {
+    if (a.size() != b.size()) {
+        return false;
+    }
+
+    for (size_t q = 0; q < a.size(); ++q) {
+        if (a[q].size() != b[q].size()) {
+            return false;
+        }
+        for (size_t i = 0; i < a[q].size(); ++i) {
+            if (a[q][i].id != b[q][i].id || a[q][i].score != b[q][i].score) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+int main() {
+    const int64_t n_vec     = 2000;
+    const int32_t n_embd    = 32;
+    const int32_t n_queries = 100;
+    const int32_t k         = 10;
+
+    std::mt19937 rng(42);
+
+    const auto data    = random_vecs(n_vec,     n_embd, rng);
+    const auto queries = random_vecs(n_queries, n_embd, rng);
+
+    common_vindex_params params;
+    params.n_threads = 2;
+
+    // exact search
+    params.type = COMMON_VINDEX_TYPE_FLAT;
+
+    common_vindex * flat = common_vindex_init(data.data(), n_vec, n_embd, params);
+    assert(flat != nullptr);
+
+    const auto res_flat = common_vindex_search(flat, queries.data(), n_queries, k);
+
+    for (int32_t q = 0; q < n_queries; ++q) {
+        assert((int32_t) res_flat[q].size() == k);
+        for (int32_t i = 1; i < k; ++i) {
+            assert(res_flat[q][i - 1].score >= res_flat[q][i].score);
+        }
+    }
+
+    // approximate search
+    params.type = COMMON_VINDEX_TYPE_HNSW;
+    params.tag  = 1234;
+
+    common_vindex * hnsw = common_vindex_init(data.data(), n_vec, n_embd, params);
+    assert(hnsw != nullptr);
+
+    const auto res_hnsw = common_vindex_search(hnsw, queries.data(), n_queries, k);
+
+    const float r = recall(res_flat, res_hnsw);
+    fprintf(stderr, "%s: recall@%d = %.3f\n", __func__, k, r);
+    assert(r >= 0.9f);
+
+    // save and load
+    const std::string fname = "test-vector-index.tmp";
+
+    assert(common_vindex_save(hnsw, fname));
+
+    common_vindex * loaded = common_vindex_load(fname, params);
+    assert(loaded != nullptr);
+    assert(common_vindex_n_vec (loaded) == n_vec);
+    assert(common_vindex_n_embd(loaded) == n_embd);
+    assert(common_vindex_get_params(loaded).tag == params.tag);
+
+    assert(same_matches(res_hnsw, common_vindex_search(loaded, queries.data(), n_queries, k)));
+
+    common_vindex_free(loaded);
+
+    // corrupted graphs must be rejected
+    {
+        std::vector<char> buf;
+        {
+            std::ifstream f(fname, std::ios::binary);
+            buf.assign(std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>());
+        }
+
+        // see the layout of the file in common/vector-index.cpp
+        auto pad = [](size_t n) { return (n + 63)/64*64; };
+
+        const size_t off_M      = 24;
+        const size_t off_entry  = 32;
+        const size_t off_links0 = pad(56) + pad(sizeof(float)*n_vec*n_embd) + pad(sizeof(int32_t)*n_vec) + pad(sizeof(int64_t)*n_vec);
+
+        const int32_t M0 = 2*params.M;
+
+        // the links of node 0 on the bottom layer: the number of links followed by their ids
+        int32_t links[2];
+        memcpy(links, buf.data() + off_links0, sizeof(links));
+        assert(links[0] > 0);
+
+        const std::vector<std::pair<size_t, int32_t>> corruptions = {
+            { off_M,                              M0 + 1          }, // more links on the upper layers than on the bottom one
+            { off_entry,                          (int32_t) n_vec }, // entry point out of range
+            { off_links0,                         M0 + 1          }, // too many links
+            { off_links0 + sizeof(int32_t),       (int32_t) n_vec }, // link out of range
+            { off_links0 + sizeof(int32_t),       -1              }, // negative link
+        };
+
+        for (const auto & c : corruptions) {
+            std::vector<char> cur = buf;
+            memcpy(cur.data() + c.first, &c.second, sizeof(int32_t));
+
+            {
+                std::ofstream f(fname, std::ios::binary);
+                f.write(cur.data(), cur.size());
+            }
+
+            assert(common_vindex_load(fname, params) == nullptr);
+        }
+
+        // truncated file
+        {
+            std::ofstream f(fname, std::ios::binary);
+            f.write(buf.data(), buf.size()/2);
+        }
+
+        assert(common_vindex_load(fname, params) == nullptr);
+    }
+
+    std::remove(fname.c_str());
+
+    common_vindex_free(hnsw);
+    common_vindex_free(flat);
+
+    fprintf(stderr, "%s: passed\n", __func__);
+
+    return 0;
+}